@@ -0,0 +1,432 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: memory access pattern analyzer                 */
+/*                                                             */
+/***************************************************************/
+
+/* Fed by the loads and stores of scalar runs (trace_data), it keeps
+ *
+ *   per PC      the last address and stride, and how often the
+ *               stride repeated
+ *   per line    the logical time of its last reference. A Fenwick
+ *               tree marks the times that are still some line's
+ *               latest, so the reuse distance (distinct lines since
+ *               the previous reference) is one prefix sum:
+ *               O(log N) per reference. When the time runs past the
+ *               tree the live marks are renumbered 1..lines.
+ *   per window  the distinct lines touched in each window of
+ *               region-of-interest instructions: the working set
+ *               over time */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+
+#define ACCESS_TREE_MIN (1 << 16)
+
+typedef struct
+{
+  uint64_t line;   /* line + 1, 0 = empty slot */
+  uint64_t time;   /* of the latest reference */
+  uint64_t window; /* last window touched + 1 */
+} line_t;
+
+typedef struct
+{
+  uint64_t pc; /* 0 = empty slot */
+  uint64_t last_address;
+  int64_t stride;
+  armsim_access_site_t site;
+} pc_t;
+
+struct access_model
+{
+  armsim_access_config_t config;
+  int line_shift;
+  line_t *lines;
+  uint64_t line_mask, nlines;
+  pc_t *pcs;
+  uint64_t pc_mask, npcs;
+  uint32_t *tree; /* Fenwick tree over times 1..capacity */
+  uint64_t capacity, clock;
+  uint64_t window, window_lines; /* current window and its distinct lines */
+  uint64_t *windows;             /* finished windows */
+  uint64_t nwindows, windows_size;
+  armsim_access_stats_t stats;
+};
+
+static inline uint64_t hash(uint64_t key)
+{
+  return key * 0x9e3779b97f4a7c15ULL >> 20;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : line_lookup / pc_lookup                         */
+/*                                                             */
+/* Purpose   : Find or insert a table slot, growing the table  */
+/*             at half load. NULL if out of memory.            */
+/*                                                             */
+/***************************************************************/
+line_t *line_lookup(struct access_model *a, uint64_t line)
+{
+  uint64_t key = line + 1, i;
+
+  if (2 * (a->nlines + 1) > a->line_mask + 1)
+  {
+    uint64_t size = 2 * (a->line_mask + 1), k;
+    line_t *lines = calloc(size, sizeof(*lines));
+    if (lines == NULL)
+      return NULL;
+    for (k = 0; k <= a->line_mask; k++)
+    {
+      if (a->lines[k].line == 0)
+        continue;
+      for (i = hash(a->lines[k].line) & (size - 1); lines[i].line != 0; i = (i + 1) & (size - 1))
+        ;
+      lines[i] = a->lines[k];
+    }
+    free(a->lines);
+    a->lines = lines;
+    a->line_mask = size - 1;
+  }
+
+  for (i = hash(key) & a->line_mask; a->lines[i].line != 0; i = (i + 1) & a->line_mask)
+    if (a->lines[i].line == key)
+      return &a->lines[i];
+  a->lines[i].line = key;
+  a->nlines++;
+  return &a->lines[i];
+}
+
+pc_t *pc_lookup(struct access_model *a, uint64_t pc)
+{
+  uint64_t i;
+
+  if (2 * (a->npcs + 1) > a->pc_mask + 1)
+  {
+    uint64_t size = 2 * (a->pc_mask + 1), k;
+    pc_t *pcs = calloc(size, sizeof(*pcs));
+    if (pcs == NULL)
+      return NULL;
+    for (k = 0; k <= a->pc_mask; k++)
+    {
+      if (a->pcs[k].pc == 0)
+        continue;
+      for (i = hash(a->pcs[k].pc) & (size - 1); pcs[i].pc != 0; i = (i + 1) & (size - 1))
+        ;
+      pcs[i] = a->pcs[k];
+    }
+    free(a->pcs);
+    a->pcs = pcs;
+    a->pc_mask = size - 1;
+  }
+
+  for (i = hash(pc) & a->pc_mask; a->pcs[i].pc != 0; i = (i + 1) & a->pc_mask)
+    if (a->pcs[i].pc == pc)
+      return &a->pcs[i];
+  a->pcs[i].pc = pc;
+  a->pcs[i].site.pc = pc;
+  a->npcs++;
+  return &a->pcs[i];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : tree_add / tree_prefix                          */
+/*                                                             */
+/***************************************************************/
+static inline void tree_add(struct access_model *a, uint64_t time, int delta)
+{
+  for (; time <= a->capacity; time += time & -time)
+    a->tree[time] += delta;
+}
+
+static inline uint64_t tree_prefix(struct access_model *a, uint64_t time)
+{
+  uint64_t sum = 0;
+  for (; time > 0; time -= time & -time)
+    sum += a->tree[time];
+  return sum;
+}
+
+int compare_times(const void *x, const void *y)
+{
+  uint64_t a = (*(line_t *const *)x)->time, b = (*(line_t *const *)y)->time;
+  return a < b ? -1 : a > b;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : tree_compact                                    */
+/*                                                             */
+/* Purpose   : Renumber the live times 1..nlines in order and  */
+/*             rebuild the tree, doubling it when more than    */
+/*             half full. FALSE if out of memory.              */
+/*                                                             */
+/***************************************************************/
+int tree_compact(struct access_model *a)
+{
+  line_t **live = malloc((a->nlines + 1) * sizeof(*live));
+  uint64_t n = 0, k, capacity = a->capacity;
+
+  if (live == NULL)
+    return FALSE;
+  for (k = 0; k <= a->line_mask; k++)
+    if (a->lines[k].line != 0)
+      live[n++] = &a->lines[k];
+  qsort(live, n, sizeof(*live), compare_times);
+  for (k = 0; k < n; k++)
+    live[k]->time = k + 1;
+  free(live);
+
+  if (2 * n > capacity)
+  {
+    uint32_t *tree = realloc(a->tree, (2 * capacity + 1) * sizeof(*tree));
+    if (tree == NULL)
+      return FALSE;
+    a->tree = tree;
+    a->capacity = capacity = 2 * capacity;
+  }
+  /* every time 1..n is live: build the tree of ones in O(capacity) */
+  memset(a->tree, 0, (capacity + 1) * sizeof(*a->tree));
+  for (k = 1; k <= capacity; k++)
+  {
+    a->tree[k] += k <= n;
+    if (k + (k & -k) <= capacity)
+      a->tree[k + (k & -k)] += a->tree[k];
+  }
+  a->clock = n;
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : line_reference                                  */
+/*                                                             */
+/* Purpose   : One reference to a line: reuse distance and     */
+/*             working-set bookkeeping                         */
+/*                                                             */
+/***************************************************************/
+void line_reference(struct access_model *a, uint64_t line, uint64_t window)
+{
+  line_t *l;
+  uint64_t now;
+
+  if (a->clock == a->capacity && !tree_compact(a))
+    return;
+  if ((l = line_lookup(a, line)) == NULL)
+    return;
+  now = ++a->clock;
+
+  if (l->time == 0)
+  {
+    a->stats.cold++;
+  }
+  else
+  {
+    /* live marks after l->time = lines referenced since */
+    uint64_t distance = a->nlines - tree_prefix(a, l->time);
+    int bucket = distance ? 64 - __builtin_clzll(distance) : 0;
+    a->stats.reuse[bucket < ARMSIM_REUSE_BUCKETS ? bucket : ARMSIM_REUSE_BUCKETS - 1]++;
+    tree_add(a, l->time, -1);
+  }
+  tree_add(a, now, 1);
+  l->time = now;
+
+  if (l->window != window + 1)
+  {
+    l->window = window + 1;
+    a->window_lines++;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : window_close                                    */
+/*                                                             */
+/* Purpose   : Record the working set of every window before   */
+/*             `window`                                        */
+/*                                                             */
+/***************************************************************/
+void window_close(struct access_model *a, uint64_t window)
+{
+  while (a->window < window)
+  {
+    if (a->nwindows == a->windows_size)
+    {
+      uint64_t size = a->windows_size ? 2 * a->windows_size : 64;
+      uint64_t *windows = realloc(a->windows, size * sizeof(*windows));
+      if (windows == NULL)
+        break;
+      a->windows = windows;
+      a->windows_size = size;
+    }
+    a->windows[a->nwindows++] = a->window_lines;
+    a->window_lines = 0;
+    a->window++;
+  }
+  a->window = window;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : access_data                                     */
+/*                                                             */
+/* Purpose   : Data tap: one load or store of the instruction  */
+/*             at NEXT_STATE.PC                                */
+/*                                                             */
+/***************************************************************/
+void access_data(uint64_t address, int size, int write)
+{
+  struct access_model *a = ARMSIM->access;
+  uint64_t window = roi_instructions() / a->config.window;
+  uint64_t line = address >> a->line_shift, last = (address + size - 1) >> a->line_shift;
+  pc_t *p;
+
+  if (window != a->window)
+    window_close(a, window);
+
+  if ((p = pc_lookup(a, NEXT_STATE.PC)) != NULL)
+  {
+    int64_t stride = address - p->last_address;
+    if (p->site.accesses > 0)
+    {
+      if (stride == p->stride)
+      {
+        p->site.stride_hits++;
+        p->site.stride = stride;
+      }
+      p->stride = stride;
+    }
+    p->last_address = address;
+    p->site.accesses++;
+    p->site.writes += write;
+  }
+
+  a->stats.accesses++;
+  for (; line <= last; line++)
+    line_reference(a, line, window);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : access_flush                                    */
+/*                                                             */
+/* Purpose   : Forget every line and PC, clear the statistics  */
+/*                                                             */
+/***************************************************************/
+void access_flush()
+{
+  struct access_model *a = ARMSIM->access;
+
+  if (a == NULL)
+    return;
+  memset(a->lines, 0, (a->line_mask + 1) * sizeof(*a->lines));
+  memset(a->pcs, 0, (a->pc_mask + 1) * sizeof(*a->pcs));
+  memset(a->tree, 0, (a->capacity + 1) * sizeof(*a->tree));
+  a->nlines = a->npcs = a->clock = 0;
+  a->window = a->window_lines = a->nwindows = 0;
+  memset(&a->stats, 0, sizeof(a->stats));
+}
+
+void access_free()
+{
+  struct access_model *a = ARMSIM->access;
+
+  if (a != NULL)
+  {
+    free(a->lines);
+    free(a->pcs);
+    free(a->tree);
+    free(a->windows);
+    free(a);
+  }
+  ARMSIM->access = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_access_configure(armsim_t *sim, const armsim_access_config_t *config)
+{
+  struct access_model *a;
+
+  if (sim == NULL ||
+      (config != NULL && (config->line == 0 || (config->line & (config->line - 1)) ||
+                          config->window == 0)))
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  access_free();
+  if (config == NULL)
+    return 0;
+
+  if ((a = calloc(1, sizeof(*a))) == NULL)
+    return ARMSIM_E_NOMEM;
+  a->config = *config;
+  a->line_shift = __builtin_ctz(config->line);
+  a->capacity = ACCESS_TREE_MIN;
+  a->line_mask = a->pc_mask = 255;
+  a->lines = calloc(a->line_mask + 1, sizeof(*a->lines));
+  a->pcs = calloc(a->pc_mask + 1, sizeof(*a->pcs));
+  a->tree = calloc(a->capacity + 1, sizeof(*a->tree));
+  if (a->lines == NULL || a->pcs == NULL || a->tree == NULL)
+  {
+    free(a->lines);
+    free(a->pcs);
+    free(a->tree);
+    free(a);
+    return ARMSIM_E_NOMEM;
+  }
+  a->window = INSTRUCTION_COUNT / config->window;
+  sim->access = a;
+  trace_update();
+  return 0;
+}
+
+int armsim_access_stats(armsim_t *sim, armsim_access_stats_t *stats)
+{
+  if (sim == NULL || stats == NULL || sim->access == NULL)
+    return ARMSIM_E_INVAL;
+  *stats = sim->access->stats;
+  stats->lines = sim->access->nlines;
+  stats->windows = sim->access->nwindows + 1;
+  return 0;
+}
+
+int armsim_access_sites(armsim_t *sim, armsim_access_site_t *sites, size_t max)
+{
+  struct access_model *a;
+  size_t n = 0;
+  uint64_t i;
+
+  if (sim == NULL || (sites == NULL && max > 0) || (a = sim->access) == NULL)
+    return ARMSIM_E_INVAL;
+  for (i = 0; i <= a->pc_mask; i++)
+  {
+    if (a->pcs[i].pc == 0)
+      continue;
+    if (n < max)
+      sites[n] = a->pcs[i].site;
+    n++;
+  }
+  return n;
+}
+
+int armsim_access_windows(armsim_t *sim, uint64_t *lines, size_t max)
+{
+  struct access_model *a;
+  size_t n;
+
+  if (sim == NULL || (lines == NULL && max > 0) || (a = sim->access) == NULL)
+    return ARMSIM_E_INVAL;
+  for (n = 0; n < a->nwindows && n < max; n++)
+    lines[n] = a->windows[n];
+  if (n < max)
+    lines[n] = a->window_lines; /* the current window, so far */
+  return a->nwindows + 1;
+}
@@ -0,0 +1,1289 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: memory, execution engine and C API             */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shell.h"
+#include "timing.h"
+
+__thread struct armsim *ARMSIM __attribute__((tls_model("initial-exec")));
+
+/* per-instance watchdog aliases, in the style of shell.h */
+#define BUDGET_AT (ARMSIM->budget_at)
+#define CLOCK_AT (ARMSIM->clock_at)
+#define PROBE_AT (ARMSIM->probe_at)
+#define PROBE (ARMSIM->probe)
+#define BREAKPOINTS (ARMSIM->breakpoints)
+#define NUM_BREAKPOINTS (ARMSIM->num_breakpoints)
+#define WATCHPOINTS (ARMSIM->watchpoints)
+#define NUM_WATCHPOINTS (ARMSIM->num_watchpoints)
+#define UNPROTECTED_PAGES (ARMSIM->unprotected_pages)
+#define NUM_UNPROTECTED (ARMSIM->num_unprotected)
+
+/* SIGSEGV as it was before the first watchpoint, see watch_fault */
+static struct sigaction SEGV_PREVIOUS;
+static volatile sig_atomic_t SEGV_INSTALLED = FALSE;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_read_32                                      */
+/*                                                             */
+/* Purpose: Read a 32-bit word from memory                     */
+/*                                                             */
+/***************************************************************/
+uint32_t mem_read_32(uint64_t address)
+{
+  uint32_t word = 0;
+  int i;
+  HOST_PROFILE(host_enter());
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    if (address >= MEM_REGIONS[i].start &&
+        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size))
+    {
+      uint32_t offset = address - MEM_REGIONS[i].start;
+
+      word = (MEM_REGIONS[i].mem[offset + 3] << 24) |
+             (MEM_REGIONS[i].mem[offset + 2] << 16) |
+             (MEM_REGIONS[i].mem[offset + 1] << 8) |
+             (MEM_REGIONS[i].mem[offset + 0] << 0);
+      break;
+    }
+  }
+  HOST_PROFILE(host_leave(HOST_MEMORY));
+
+  return word;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_write_32                                     */
+/*                                                             */
+/* Purpose: Write a 32-bit word to memory                      */
+/*                                                             */
+/***************************************************************/
+void mem_write_32(uint64_t address, uint32_t value)
+{
+  int i;
+  HOST_PROFILE(host_enter());
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    if (address >= MEM_REGIONS[i].start &&
+        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size))
+    {
+      uint32_t offset = address - MEM_REGIONS[i].start;
+
+      if (ARMSIM->hash != NULL)
+      {
+        uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+        hash_store(address, MEM_REGIONS[i].mem + offset, bytes, 4);
+      }
+      mark_dirty(i, offset, 4);
+      MEM_REGIONS[i].mem[offset + 3] = (value >> 24) & 0xFF;
+      MEM_REGIONS[i].mem[offset + 2] = (value >> 16) & 0xFF;
+      MEM_REGIONS[i].mem[offset + 1] = (value >> 8) & 0xFF;
+      MEM_REGIONS[i].mem[offset + 0] = (value >> 0) & 0xFF;
+      MEM_WRITES++;
+      if (i == 0)
+      {
+        predecode_invalidate(address);
+        if (ARMSIM->plugins != NULL)
+          plugin_invalidate();
+      }
+      break;
+    }
+  }
+  HOST_PROFILE(host_leave(HOST_MEMORY));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : host_address                                    */
+/*                                                             */
+/* Purpose   : Host byte backing a guest address, or NULL.     */
+/*             *avail is set to the bytes left in the region.  */
+/*                                                             */
+/***************************************************************/
+uint8_t *host_address(uint64_t address, uint64_t *avail)
+{
+  int i;
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    if (address >= MEM_REGIONS[i].start &&
+        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size))
+    {
+      if (avail != NULL)
+        *avail = MEM_REGIONS[i].start + MEM_REGIONS[i].size - address;
+      return MEM_REGIONS[i].mem + (address - MEM_REGIONS[i].start);
+    }
+  }
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_update                                    */
+/*                                                             */
+/* Purpose   : Recompute whether any timing model is attached  */
+/*             and inside the region of interest; the trace    */
+/*             recorder sees the whole run                     */
+/*                                                             */
+/***************************************************************/
+void trace_update()
+{
+  ARMSIM->tracing = ARMSIM->roi_active &&
+                    (ARMSIM->cache != NULL || ARMSIM->sweep != NULL || ARMSIM->bpred != NULL ||
+                     ARMSIM->access != NULL || ARMSIM->plugin_memory ||
+                     ARMSIM->pc_counts != NULL);
+  ARMSIM->recording = (ARMSIM->roi_active && (ARMSIM->pipeline != NULL || ARMSIM->ooo != NULL ||
+                                              ARMSIM->dataflow != NULL)) ||
+                      ARMSIM->recorder != NULL;
+}
+
+void trace_fetch_models(uint64_t pc)
+{
+  if (ARMSIM->cache != NULL)
+    cache_fetch(pc);
+  if (ARMSIM->sweep != NULL)
+    sweep_fetch(pc);
+  if (ARMSIM->bpred != NULL)
+    bpred_fetch(pc);
+  if (ARMSIM->pc_counts != NULL)
+    pcprof_fetch(pc);
+}
+
+#ifndef ARMSIM_NO_TIMING
+void trace_retire_models(Instruction inst)
+{
+  insn_record_t record;
+
+  record_instruction(&record, inst);
+  if (ARMSIM->roi_active && inst != MAGIC)
+  {
+    if (ARMSIM->pipeline != NULL)
+      pipeline_retire(&record);
+    if (ARMSIM->ooo != NULL)
+      ooo_retire(&record);
+    if (ARMSIM->dataflow != NULL)
+      dataflow_retire(&record);
+  }
+  if (ARMSIM->recorder != NULL)
+    recorder_retire(&record);
+}
+#endif
+
+void trace_data_models(uint64_t address, int size, int write)
+{
+  if (ARMSIM->cache != NULL)
+    cache_data(address, size, write);
+  if (ARMSIM->sweep != NULL)
+    sweep_data(address, size, write);
+  if (ARMSIM->access != NULL)
+    access_data(address, size, write);
+  if (ARMSIM->plugin_memory)
+    plugin_data(address, size, write);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cycle                                           */
+/*                                                             */
+/* Purpose   : Execute a cycle                                 */
+/*                                                             */
+/***************************************************************/
+void cycle()
+{
+  uint32_t word;
+
+  HOST_PROFILE(host_begin());
+  word = process_instruction();
+  /* flight recorder: a single store per instruction, see history.c */
+  ARMSIM->history[INSTRUCTION_COUNT & ARMSIM->history_mask] =
+      (history_t){CURRENT_STATE.PC, NEXT_STATE.REGS[word & (ARM_REGS - 1)], word};
+  CURRENT_STATE = NEXT_STATE;
+  INSTRUCTION_COUNT++;
+  HOST_PROFILE(host_end());
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : watch_fault                                     */
+/*                                                             */
+/* Purpose   : SIGSEGV handler for writes to watched pages.    */
+/*             Unprotects the page so the store can complete   */
+/*             and stops the run after the current cycle, when */
+/*             simulate() checks the watched bytes. Faults     */
+/*             elsewhere go to the handler it replaced.        */
+/*                                                             */
+/***************************************************************/
+void watch_fault(int sig, siginfo_t *info, void *context)
+{
+  int i;
+  uintptr_t page_size;
+  uint8_t *host = info->si_addr;
+
+  if (ARMSIM == NULL || NUM_WATCHPOINTS == 0)
+    i = MEM_NREGIONS;
+  else
+    for (i = 0; i < MEM_NREGIONS; i++)
+    {
+      uint8_t *mem = MEM_REGIONS[i].mem;
+      if (host >= mem && host < mem + MEM_REGIONS[i].size + 3)
+        break;
+    }
+  if (i == MEM_NREGIONS || NUM_UNPROTECTED == MAX_UNPROTECTED)
+  {
+    /* not ours: chain, or put the old action back and fault again */
+    if (SEGV_PREVIOUS.sa_flags & SA_SIGINFO)
+      SEGV_PREVIOUS.sa_sigaction(sig, info, context);
+    else if (SEGV_PREVIOUS.sa_handler != SIG_DFL && SEGV_PREVIOUS.sa_handler != SIG_IGN)
+      SEGV_PREVIOUS.sa_handler(sig);
+    else
+    {
+      sigaction(SIGSEGV, &SEGV_PREVIOUS, NULL);
+      SEGV_INSTALLED = FALSE;
+    }
+    return;
+  }
+
+  page_size = ARMSIM->page_size;
+  uint8_t *page = (uint8_t *)((uintptr_t)host & ~(page_size - 1));
+  mprotect(page, page_size, PROT_READ | PROT_WRITE);
+  UNPROTECTED_PAGES[NUM_UNPROTECTED++] = page;
+
+  ARMSIM->watch_hit_pc = NEXT_STATE.PC;
+  STOP_REASON = STOP_WATCH_PENDING;
+  RUN_BIT = FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : protect_watchpoints                             */
+/*                                                             */
+/* Purpose   : Snapshot the watched bytes and write-protect    */
+/*             (or release) every watched page                 */
+/*                                                             */
+/***************************************************************/
+void protect_watchpoints(int enable)
+{
+  int k;
+  uint64_t address;
+  uintptr_t page_size = ARMSIM->page_size;
+  int prot = enable ? PROT_READ : PROT_READ | PROT_WRITE;
+
+  for (k = 0; k < NUM_WATCHPOINTS; k++)
+  {
+    if (enable)
+      memcpy(WATCHPOINTS[k].shadow, host_address(WATCHPOINTS[k].start, NULL),
+             WATCHPOINTS[k].end - WATCHPOINTS[k].start);
+    for (address = WATCHPOINTS[k].start; address < WATCHPOINTS[k].end;
+         address = (address | (page_size - 1)) + 1)
+    {
+      uintptr_t page = (uintptr_t)host_address(address, NULL) & ~(page_size - 1);
+      mprotect((void *)page, page_size, prot);
+    }
+  }
+  NUM_UNPROTECTED = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : watch_changed                                   */
+/*                                                             */
+/* Purpose   : After a write to a watched page, find the first */
+/*             watched byte whose value changed                */
+/*                                                             */
+/***************************************************************/
+int watch_changed(uint64_t *changed)
+{
+  int k;
+  uint64_t offset;
+  for (k = 0; k < NUM_WATCHPOINTS; k++)
+  {
+    uint8_t *mem = host_address(WATCHPOINTS[k].start, NULL);
+    for (offset = 0; offset < WATCHPOINTS[k].end - WATCHPOINTS[k].start; offset++)
+    {
+      if (mem[offset] != WATCHPOINTS[k].shadow[offset])
+      {
+        *changed = WATCHPOINTS[k].start + offset;
+        return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : has_breakpoint                                  */
+/*                                                             */
+/***************************************************************/
+int has_breakpoint(uint64_t pc)
+{
+  int k;
+  for (k = 0; k < NUM_BREAKPOINTS; k++)
+    if (BREAKPOINTS[k] == pc)
+      return TRUE;
+  return FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : schedule_checks                                 */
+/*                                                             */
+/* Purpose   : Point CHECK_AT at the earliest pending check    */
+/*                                                             */
+/***************************************************************/
+void schedule_checks()
+{
+  CHECK_AT = BUDGET_AT;
+  if (CLOCK_AT < CHECK_AT)
+    CHECK_AT = CLOCK_AT;
+  if (PROBE_AT < CHECK_AT)
+    CHECK_AT = PROBE_AT;
+  if (ARMSIM->monitor_at < CHECK_AT)
+    CHECK_AT = ARMSIM->monitor_at;
+  if (ARMSIM->timeline_at < CHECK_AT)
+    CHECK_AT = ARMSIM->timeline_at;
+  if (PROBE.boundaries_left > 0 || (ARMSIM->plugin_blocks && ARMSIM->roi_active))
+    CHECK_AT = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : boundary_checks                                 */
+/*                                                             */
+/* Purpose   : Watchdog and plugin work at a block boundary,   */
+/*             only reached when INSTRUCTION_COUNT passes      */
+/*             CHECK_AT                                        */
+/*                                                             */
+/***************************************************************/
+void boundary_checks(uint64_t target)
+{
+  if (ARMSIM->plugin_blocks && ARMSIM->roi_active)
+    plugin_block(target);
+
+  if (INSTRUCTION_COUNT >= BUDGET_AT)
+  {
+    RUN_BIT = FALSE;
+    STOP_REASON = STOP_BUDGET;
+  }
+
+  if (INSTRUCTION_COUNT >= CLOCK_AT)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > ARMSIM->deadline.tv_sec ||
+        (now.tv_sec == ARMSIM->deadline.tv_sec && now.tv_nsec >= ARMSIM->deadline.tv_nsec))
+    {
+      RUN_BIT = FALSE;
+      STOP_REASON = STOP_TIMEOUT;
+    }
+    CLOCK_AT = INSTRUCTION_COUNT + CLOCK_CHECK_INTERVAL;
+  }
+
+  if (PROBE.boundaries_left > 0)
+  {
+    /* same block, same registers and flags, no stores: it loops forever */
+    if (target == PROBE.target)
+    {
+      if (MEM_WRITES == PROBE.mem_writes &&
+          memcmp(NEXT_STATE.REGS, PROBE.state.REGS, sizeof(NEXT_STATE.REGS)) == 0 &&
+          NEXT_STATE.FLAG_N == PROBE.state.FLAG_N &&
+          NEXT_STATE.FLAG_Z == PROBE.state.FLAG_Z &&
+          NEXT_STATE.FLAG_V == PROBE.state.FLAG_V &&
+          NEXT_STATE.FLAG_C == PROBE.state.FLAG_C)
+      {
+        RUN_BIT = FALSE;
+        STOP_REASON = STOP_IDLE_LOOP;
+      }
+      PROBE.boundaries_left = 0;
+    }
+    else
+    {
+      PROBE.boundaries_left--;
+    }
+  }
+  else if (INSTRUCTION_COUNT >= PROBE_AT)
+  {
+    PROBE.target = target;
+    PROBE.mem_writes = MEM_WRITES;
+    PROBE.state = NEXT_STATE;
+    PROBE.boundaries_left = PROBE_BOUNDARIES;
+    PROBE_AT = INSTRUCTION_COUNT + PROBE_INTERVAL;
+  }
+
+  if (INSTRUCTION_COUNT >= ARMSIM->monitor_at)
+    monitor_tick(target);
+  if (INSTRUCTION_COUNT >= ARMSIM->timeline_at)
+    timeline_tick(target);
+
+  schedule_checks();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : roi_restart                                     */
+/*                                                             */
+/* Purpose   : Start a program inside or outside the region of */
+/*             interest, with an ROI count of 0                */
+/*                                                             */
+/***************************************************************/
+void roi_restart(int active)
+{
+  ARMSIM->roi_active = active;
+  ARMSIM->roi_offset = INSTRUCTION_COUNT;
+  ARMSIM->roi_count = 0;
+  trace_update();
+  schedule_checks();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : roi_marker                                      */
+/*                                                             */
+/* Purpose   : Retire the ROI marker at the PC. Markers belong */
+/*             to no region: they reach the trace recorder but */
+/*             no model, and the ROI count skips them.         */
+/*                                                             */
+/***************************************************************/
+void roi_marker(uint32_t instruction)
+{
+  int marker = extract_bits(instruction, 5, 20);
+  uint64_t after = INSTRUCTION_COUNT + 1; /* the instruction after the marker */
+
+  NEXT_STATE.PC += 4;
+  trace_retire(MAGIC);
+  if (ARMSIM->plugins != NULL)
+    plugin_roi(marker);
+  if (ARMSIM->timeline != NULL)
+    timeline_roi(marker);
+
+  switch (marker)
+  {
+  case ARMSIM_ROI_RESET:
+    /* statistics only: caches and predictors stay warm */
+    cache_clear_stats();
+    bpred_clear_stats();
+    access_flush();
+    pipeline_flush();
+    ooo_flush();
+    dataflow_flush();
+    host_flush();
+    pcprof_flush();
+    if (ARMSIM->roi_active)
+      ARMSIM->roi_offset = after;
+    else
+      ARMSIM->roi_count = 0;
+    break;
+  case ARMSIM_ROI_BEGIN:
+    if (ARMSIM->roi_active)
+      break;
+    ARMSIM->roi_active = TRUE;
+    ARMSIM->roi_offset = after - ARMSIM->roi_count;
+    break;
+  case ARMSIM_ROI_END:
+    if (!ARMSIM->roi_active)
+      break;
+    ARMSIM->roi_count = INSTRUCTION_COUNT - ARMSIM->roi_offset;
+    ARMSIM->roi_active = FALSE;
+    break;
+  case ARMSIM_ROI_CHECKPOINT:
+    RUN_BIT = FALSE;
+    STOP_REASON = STOP_CHECKPOINT;
+    break;
+  }
+
+  trace_update();
+  schedule_checks();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : arm_watchdog                                    */
+/*                                                             */
+/* Purpose   : Start the budget and clock for one run          */
+/*                                                             */
+/***************************************************************/
+void arm_watchdog()
+{
+  double limit = ARMSIM->time_limit;
+
+  BUDGET_AT = ARMSIM->instruction_limit ? INSTRUCTION_COUNT + ARMSIM->instruction_limit
+                                        : UINT64_MAX;
+  CLOCK_AT = UINT64_MAX;
+  if (limit > 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &ARMSIM->deadline);
+    ARMSIM->deadline.tv_sec += (time_t)limit;
+    ARMSIM->deadline.tv_nsec += (long)((limit - (time_t)limit) * 1e9);
+    if (ARMSIM->deadline.tv_nsec >= 1000000000)
+    {
+      ARMSIM->deadline.tv_sec++;
+      ARMSIM->deadline.tv_nsec -= 1000000000;
+    }
+    CLOCK_AT = INSTRUCTION_COUNT + CLOCK_CHECK_INTERVAL;
+  }
+  PROBE_AT = INSTRUCTION_COUNT + PROBE_INTERVAL;
+  PROBE.boundaries_left = 0;
+  schedule_checks();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : disarm_watchdog                                 */
+/*                                                             */
+/***************************************************************/
+void disarm_watchdog()
+{
+  BUDGET_AT = CLOCK_AT = PROBE_AT = UINT64_MAX;
+  PROBE.boundaries_left = 0;
+  schedule_checks();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : simulate                                        */
+/*                                                             */
+/* Purpose   : Run up to max_cycles cycles, stopping early on  */
+/*             HLT, a breakpoint or a watchpoint. With nothing */
+/*             armed this is the plain cycle() loop.           */
+/*                                                             */
+/***************************************************************/
+int simulate(uint64_t max_cycles)
+{
+  uint64_t i = 0;
+
+  if (RUN_BIT == FALSE)
+    return ARMSIM_E_HALTED;
+
+  STOP_REASON = STOP_NONE;
+  if (ARMSIM->recorder != NULL)
+    recorder_sync();
+  if (ARMSIM->plugins != NULL)
+    plugin_run_start();
+  if (ARMSIM->monitor != NULL)
+    monitor_run(TRUE);
+  if (ARMSIM->timeline != NULL)
+    timeline_run(TRUE);
+  if (ARMSIM->pcprof != NULL)
+    pcprof_run(TRUE);
+  if (has_breakpoint(CURRENT_STATE.PC))
+    BREAK_SKIP_PC = CURRENT_STATE.PC;
+
+  if (NUM_WATCHPOINTS > 0)
+    protect_watchpoints(TRUE);
+
+  for (;;)
+  {
+    while (RUN_BIT && i < max_cycles)
+    {
+      /* stop exactly at the next state hash */
+      uint64_t end = ARMSIM->hash_at - INSTRUCTION_COUNT < max_cycles - i
+                         ? i + (ARMSIM->hash_at - INSTRUCTION_COUNT)
+                         : max_cycles;
+      while (RUN_BIT && i < end)
+      {
+        cycle();
+        i++;
+      }
+      /* a trap at the hash point retires nothing: hash after it */
+      if (INSTRUCTION_COUNT == ARMSIM->hash_at &&
+          (RUN_BIT || (STOP_REASON != STOP_BREAKPOINT && STOP_REASON != STOP_INVALID)))
+        hash_emit();
+    }
+    if (STOP_REASON != STOP_WATCH_PENDING)
+      break;
+    if (watch_changed(&ARMSIM->watch_hit_addr))
+    {
+      STOP_REASON = STOP_WATCHPOINT;
+      break;
+    }
+    /* the write missed the watched bytes or left them unchanged */
+    protect_watchpoints(TRUE);
+    STOP_REASON = STOP_NONE;
+    RUN_BIT = TRUE;
+  }
+
+  if (NUM_WATCHPOINTS > 0)
+    protect_watchpoints(FALSE);
+  if (ARMSIM->recorder != NULL)
+    recorder_publish();
+
+  switch (STOP_REASON)
+  {
+  case STOP_BREAKPOINT:
+  case STOP_INVALID:
+    /* the trap itself retires nothing */
+    INSTRUCTION_COUNT--;
+    break;
+  default:
+    break;
+  }
+
+  if (ARMSIM->plugins != NULL)
+    plugin_run_end();
+  if (ARMSIM->hash != NULL &&
+      (STOP_REASON == STOP_HALT || STOP_REASON == STOP_INVALID || STOP_REASON == STOP_IDLE_LOOP))
+    hash_emit();
+
+  /* only HLT, an invalid instruction or an idle loop are final;
+   * a checkpoint resumes after its marker */
+  if (STOP_REASON != STOP_HALT && STOP_REASON != STOP_INVALID &&
+      STOP_REASON != STOP_IDLE_LOOP)
+    RUN_BIT = TRUE;
+  if (ARMSIM->pcprof != NULL)
+    pcprof_run(FALSE);
+  if (ARMSIM->timeline != NULL)
+    timeline_run(FALSE);
+  if (ARMSIM->monitor != NULL)
+    monitor_run(FALSE);
+
+  return STOP_REASON;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : init_memory                                     */
+/*                                                             */
+/* Purpose   : Allocate and zero memory                        */
+/*                                                             */
+/***************************************************************/
+static const mem_region_t MEM_LAYOUT[MEM_NREGIONS] = {
+    {MEM_TEXT_START, MEM_TEXT_SIZE, NULL, MEM_TEXT_SIZE, FALSE},
+    {MEM_DATA_START, MEM_DATA_SIZE, NULL, MEM_DATA_LIMIT, FALSE},
+    {MEM_STACK_START, MEM_STACK_SIZE, NULL, MEM_STACK_SIZE, FALSE},
+};
+
+int init_memory()
+{
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    MEM_REGIONS[i] = MEM_LAYOUT[i];
+    // Extra 3 bytes to prevent buffer overflow on unaligned access.
+    // Whole zeroed pages so watchpoints can write-protect them; the
+    // data segment reserves room to grow, paid for only when touched.
+    MEM_REGIONS[i].mem = mmap(NULL, MEM_REGIONS[i].limit + 3,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MEM_REGIONS[i].mem == MAP_FAILED)
+    {
+      MEM_REGIONS[i].mem = NULL;
+      return ARMSIM_E_NOMEM;
+    }
+    if ((ARMSIM->dirty[i] = calloc(DIRTY_WORDS(MEM_REGIONS[i].limit), sizeof(uint64_t))) == NULL)
+      return ARMSIM_E_NOMEM;
+  }
+  predecode_reset();
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : free_memory                                     */
+/*                                                             */
+/***************************************************************/
+void free_memory()
+{
+  int i;
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    if (MEM_REGIONS[i].mem != NULL)
+      munmap(MEM_REGIONS[i].mem, MEM_REGIONS[i].limit + 3);
+    MEM_REGIONS[i].mem = NULL;
+    free(ARMSIM->dirty[i]);
+    ARMSIM->dirty[i] = NULL;
+  }
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+armsim_t *armsim_create(void)
+{
+  armsim_t *sim = calloc(1, sizeof(*sim));
+  if (sim == NULL)
+    return NULL;
+
+  ARMSIM = sim;
+  sim->monitor_at = UINT64_MAX;
+  sim->timeline_at = UINT64_MAX;
+  sim->page_size = sysconf(_SC_PAGESIZE);
+  if (init_memory() != 0 || history_init(HISTORY_ENTRIES) != 0)
+  {
+    free_memory();
+    free(sim->history);
+    free(sim);
+    return NULL;
+  }
+  disarm_watchdog();
+  roi_restart(TRUE);
+  hash_schedule();
+  return sim;
+}
+
+void armsim_destroy(armsim_t *sim)
+{
+  int k;
+  if (sim == NULL)
+    return;
+  ARMSIM = sim;
+  free_memory();
+  free(sim->history);
+  cache_free();
+  sweep_free();
+  bpred_free();
+  access_free();
+  pipeline_free();
+  ooo_free();
+  dataflow_free();
+  recorder_free();
+  plugin_free();
+  hash_free();
+  snapshot_free();
+  monitor_free();
+  host_free();
+  timeline_free();
+  pcprof_free();
+  for (k = 0; k < NUM_WATCHPOINTS; k++)
+    free(WATCHPOINTS[k].shadow);
+  free(sim);
+  ARMSIM = NULL;
+}
+
+int armsim_reset(armsim_t *sim)
+{
+  int i, k;
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+
+  /* keep the mappings, just hand back zeroed pages; pages of a host
+   * file would come back with its contents, so those are replaced */
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    mem_region_t *region = &MEM_REGIONS[i];
+    if (region->file_backed &&
+        mmap(region->mem, region->limit + 3, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+      memset(region->mem, 0, region->size + 3);
+    else if (!region->file_backed)
+      madvise(region->mem, region->size + 3, MADV_DONTNEED);
+    memset(sim->dirty[i], 0, DIRTY_WORDS(region->size) * sizeof(uint64_t));
+    region->size = MEM_LAYOUT[i].size;
+    region->file_backed = FALSE;
+  }
+  for (k = 0; k < NUM_WATCHPOINTS; k++)
+    free(WATCHPOINTS[k].shadow);
+
+  memset(&sim->current, 0, sizeof(sim->current));
+  memset(&sim->next, 0, sizeof(sim->next));
+  sim->run_bit = FALSE;
+  sim->stop_reason = STOP_NONE;
+  sim->instruction_count = 0;
+  sim->mem_writes = 0;
+  sim->history_start = 0;
+  sim->num_breakpoints = 0;
+  sim->break_skip_pc = 0;
+  sim->num_watchpoints = 0;
+  sim->num_unprotected = 0;
+  predecode_reset();
+  roi_restart(TRUE);
+  cache_flush();
+  bpred_flush();
+  access_flush();
+  pipeline_flush();
+  ooo_flush();
+  dataflow_flush();
+  plugin_flush();
+  hash_flush();
+  snapshot_clear();
+  host_flush();
+  pcprof_flush();
+  disarm_watchdog();
+  return 0;
+}
+
+int armsim_load_image(armsim_t *sim, const uint32_t *words, size_t count)
+{
+  size_t ii;
+  int roi = TRUE;
+  if (sim == NULL || (words == NULL && count > 0) || count > ARMSIM_TEXT_WORDS)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+
+  if (ARMSIM->timeline != NULL)
+    timeline_span("load", TRUE);
+  for (ii = 0; ii < count; ii++)
+  {
+    mem_write_32(MEM_TEXT_START + 4 * ii, words[ii]);
+    roi &= words[ii] != HLT_WORD(ARMSIM_ROI_BEGIN);
+  }
+  roi_restart(roi);
+  if (ARMSIM->timeline != NULL)
+    timeline_span("load", FALSE);
+
+  CURRENT_STATE.PC = MEM_TEXT_START;
+  NEXT_STATE = CURRENT_STATE;
+  RUN_BIT = TRUE;
+  return 0;
+}
+
+int armsim_load_file(armsim_t *sim, const char *path, size_t *words_read)
+{
+  FILE *prog;
+  int bytes_read = EOF;
+  unsigned int word;
+  uint64_t ii = 0;
+  int roi = TRUE;
+
+  if (sim == NULL || path == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+
+  /* Open program file. */
+  prog = fopen(path, "r");
+  if (prog == NULL)
+    return ARMSIM_E_IO;
+  if (ARMSIM->timeline != NULL)
+    timeline_span("load", TRUE);
+
+  /* Read in the program. */
+  while ((bytes_read = fscanf(prog, "%x\n", &word)) > 0)
+  {
+    /* a program that does not fit the text segment is refused */
+    if (ii == MEM_TEXT_SIZE)
+    {
+      bytes_read = 0;
+      break;
+    }
+    mem_write_32(MEM_TEXT_START + ii, word);
+    roi &= word != HLT_WORD(ARMSIM_ROI_BEGIN);
+    ii += 4;
+  }
+  fclose(prog);
+  if (ARMSIM->timeline != NULL)
+    timeline_span("load", FALSE);
+  if (bytes_read == 0)
+    return ARMSIM_E_FORMAT;
+  roi_restart(roi);
+
+  CURRENT_STATE.PC = MEM_TEXT_START;
+  NEXT_STATE = CURRENT_STATE;
+  RUN_BIT = TRUE;
+  if (words_read != NULL)
+    *words_read = ii / 4;
+  return 0;
+}
+
+int armsim_step(armsim_t *sim, uint64_t count)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  return simulate(count);
+}
+
+int armsim_run(armsim_t *sim)
+{
+  int result;
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  arm_watchdog();
+  result = simulate(UINT64_MAX);
+  disarm_watchdog();
+  return result;
+}
+
+int armsim_set_limits(armsim_t *sim, uint64_t max_instructions, double seconds)
+{
+  if (sim == NULL || seconds < 0)
+    return ARMSIM_E_INVAL;
+  sim->instruction_limit = max_instructions;
+  sim->time_limit = seconds;
+  return 0;
+}
+
+int armsim_is_halted(armsim_t *sim)
+{
+  return sim == NULL || !sim->run_bit;
+}
+
+uint64_t armsim_get_reg(armsim_t *sim, int reg)
+{
+  if (sim == NULL || reg < 0 || reg >= ARM_REGS)
+    return 0;
+  return sim->current.REGS[reg];
+}
+
+int armsim_set_reg(armsim_t *sim, int reg, uint64_t value)
+{
+  if (sim == NULL || reg < 0 || reg >= ARM_REGS)
+    return ARMSIM_E_INVAL;
+  sim->current.REGS[reg] = value;
+  sim->next.REGS[reg] = value;
+  return 0;
+}
+
+uint64_t armsim_get_pc(armsim_t *sim)
+{
+  return sim == NULL ? 0 : sim->current.PC;
+}
+
+int armsim_set_pc(armsim_t *sim, uint64_t pc)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  sim->current.PC = pc;
+  sim->next.PC = pc;
+  return 0;
+}
+
+int armsim_get_flags(armsim_t *sim)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  return (sim->current.FLAG_N ? ARMSIM_FLAG_N : 0) |
+         (sim->current.FLAG_Z ? ARMSIM_FLAG_Z : 0) |
+         (sim->current.FLAG_C ? ARMSIM_FLAG_C : 0) |
+         (sim->current.FLAG_V ? ARMSIM_FLAG_V : 0);
+}
+
+int armsim_set_flags(armsim_t *sim, int nzcv)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  sim->current.FLAG_N = sim->next.FLAG_N = (nzcv & ARMSIM_FLAG_N) != 0;
+  sim->current.FLAG_Z = sim->next.FLAG_Z = (nzcv & ARMSIM_FLAG_Z) != 0;
+  sim->current.FLAG_C = sim->next.FLAG_C = (nzcv & ARMSIM_FLAG_C) != 0;
+  sim->current.FLAG_V = sim->next.FLAG_V = (nzcv & ARMSIM_FLAG_V) != 0;
+  return 0;
+}
+
+int armsim_read_mem(armsim_t *sim, uint64_t address, void *buf, size_t len)
+{
+  uint8_t *out = buf;
+  if (sim == NULL || (buf == NULL && len > 0))
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+
+  while (len > 0)
+  {
+    uint64_t avail;
+    uint8_t *host = host_address(address, &avail);
+    if (host == NULL)
+      return ARMSIM_E_FAULT;
+    if (avail > len)
+      avail = len;
+    memcpy(out, host, avail);
+    out += avail;
+    address += avail;
+    len -= avail;
+  }
+  return 0;
+}
+
+int armsim_write_mem(armsim_t *sim, uint64_t address, const void *buf, size_t len)
+{
+  const uint8_t *in = buf;
+  int i;
+  if (sim == NULL || (buf == NULL && len > 0))
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+
+  while (len > 0)
+  {
+    uint64_t avail, a;
+    uint8_t *host = host_address(address, &avail);
+    if (host == NULL)
+      return ARMSIM_E_FAULT;
+    if (avail > len)
+      avail = len;
+    if (sim->hash != NULL)
+      hash_store(address, host, in, avail);
+    for (i = 0; host < MEM_REGIONS[i].mem || host >= MEM_REGIONS[i].mem + MEM_REGIONS[i].size; i++)
+      ;
+    mark_dirty(i, host - MEM_REGIONS[i].mem, avail);
+    memcpy(host, in, avail);
+    /* counted and invalidated as the same words through mem_write_32 */
+    MEM_WRITES += (avail + 3) / 4;
+    if (i == 0)
+    {
+      for (a = address & ~3ULL; a < address + avail; a += 4)
+        predecode_invalidate(a);
+      if (ARMSIM->plugins != NULL)
+        plugin_invalidate();
+    }
+    in += avail;
+    address += avail;
+    len -= avail;
+  }
+  return 0;
+}
+
+int armsim_load_data(armsim_t *sim, const char *path, uint64_t address, uint64_t *bytes)
+{
+  mem_region_t *data;
+  struct stat st;
+  uint64_t offset, len, end;
+  long page = sysconf(_SC_PAGESIZE);
+  int fd, result = 0;
+
+  if (sim == NULL || path == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  data = &MEM_REGIONS[1];
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return ARMSIM_E_IO;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return ARMSIM_E_IO;
+  }
+  offset = address - data->start;
+  len = st.st_size;
+  if (address < data->start || offset > data->limit || len > data->limit - offset)
+  {
+    close(fd);
+    return ARMSIM_E_FAULT;
+  }
+  if (ARMSIM->timeline != NULL)
+    timeline_span("load", TRUE);
+
+  /* grow the data segment over the file, whole pages at a time */
+  end = offset + len;
+  if (end > data->size)
+  {
+    /* bytes unaligned stores left past the old end become memory */
+    mark_dirty(1, data->size, 3);
+    memset(data->mem + data->size, 0, 3);
+    data->size = (end + MEM_PAGE - 1) / MEM_PAGE * MEM_PAGE;
+    if (data->size > data->limit)
+      data->size = data->limit;
+  }
+
+  /* page-aligned files are mapped copy-on-write, read on first touch */
+  if (len > 0 && offset % page == 0 &&
+      mmap(data->mem + offset, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) !=
+          MAP_FAILED)
+  {
+    data->file_backed = TRUE;
+  }
+  else
+  {
+    uint64_t done = 0;
+    while (done < len)
+    {
+      ssize_t n = pread(fd, data->mem + offset + done, len - done, done);
+      if (n <= 0)
+      {
+        result = ARMSIM_E_IO;
+        break;
+      }
+      done += n;
+    }
+  }
+  close(fd);
+
+  if (len > 0)
+    mark_dirty(1, offset, len);
+  hash_rescan();
+  if (ARMSIM->timeline != NULL)
+    timeline_span("load", FALSE);
+  if (bytes != NULL)
+    *bytes = len;
+  return result;
+}
+
+int armsim_save_data(armsim_t *sim, uint64_t address, uint64_t len, const char *path)
+{
+  uint64_t avail = 0;
+  uint8_t *host;
+  int fd, result = 0;
+
+  if (sim == NULL || path == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  host = host_address(address, &avail);
+  if (len > 0 && (host == NULL || avail < len))
+    return ARMSIM_E_FAULT;
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return ARMSIM_E_IO;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, host, len);
+    if (n <= 0)
+    {
+      result = ARMSIM_E_IO;
+      break;
+    }
+    host += n;
+    len -= n;
+  }
+  if (close(fd) != 0)
+    result = ARMSIM_E_IO;
+  return result;
+}
+
+int armsim_get_counters(armsim_t *sim, armsim_counters_t *counters)
+{
+  if (sim == NULL || counters == NULL)
+    return ARMSIM_E_INVAL;
+  counters->instructions = sim->instruction_count;
+  counters->stores = sim->mem_writes;
+  counters->roi_instructions = sim->roi_active ? sim->instruction_count - sim->roi_offset
+                                               : sim->roi_count;
+  return 0;
+}
+
+int armsim_break_add(armsim_t *sim, uint64_t pc)
+{
+  if (sim == NULL || pc < MEM_TEXT_START || pc >= MEM_TEXT_START + MEM_TEXT_SIZE || (pc & 3))
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (has_breakpoint(pc))
+    return 0;
+  if (NUM_BREAKPOINTS == MAX_BREAKPOINTS)
+    return ARMSIM_E_FULL;
+  BREAKPOINTS[NUM_BREAKPOINTS++] = pc;
+  predecode_set_breakpoint(pc, TRUE);
+  return 0;
+}
+
+int armsim_break_delete(armsim_t *sim, uint64_t pc)
+{
+  int k;
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  for (k = 0; k < NUM_BREAKPOINTS; k++)
+  {
+    if (BREAKPOINTS[k] == pc)
+    {
+      BREAKPOINTS[k] = BREAKPOINTS[--NUM_BREAKPOINTS];
+      predecode_set_breakpoint(pc, FALSE);
+      return 0;
+    }
+  }
+  return ARMSIM_E_INVAL;
+}
+
+int armsim_watch_add(armsim_t *sim, uint64_t address, uint64_t len)
+{
+  uint64_t avail;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  /* the whole range in one region, as the shadow copy is taken */
+  if (len == 0 || host_address(address, &avail) == NULL || avail < len)
+    return ARMSIM_E_FAULT;
+  if (NUM_WATCHPOINTS == MAX_WATCHPOINTS)
+    return ARMSIM_E_FULL;
+  if (!SEGV_INSTALLED)
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = watch_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &SEGV_PREVIOUS);
+    SEGV_INSTALLED = TRUE;
+  }
+  WATCHPOINTS[NUM_WATCHPOINTS].shadow = malloc(len);
+  if (WATCHPOINTS[NUM_WATCHPOINTS].shadow == NULL)
+    return ARMSIM_E_NOMEM;
+  WATCHPOINTS[NUM_WATCHPOINTS].start = address;
+  WATCHPOINTS[NUM_WATCHPOINTS].end = address + len;
+  NUM_WATCHPOINTS++;
+  return 0;
+}
+
+int armsim_watch_delete(armsim_t *sim, uint64_t address)
+{
+  int k;
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  for (k = 0; k < NUM_WATCHPOINTS; k++)
+  {
+    if (WATCHPOINTS[k].start == address)
+    {
+      free(WATCHPOINTS[k].shadow);
+      WATCHPOINTS[k] = WATCHPOINTS[--NUM_WATCHPOINTS];
+      return 0;
+    }
+  }
+  return ARMSIM_E_INVAL;
+}
+
+int armsim_watch_hit(armsim_t *sim, uint64_t *address, uint64_t *pc)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  if (address != NULL)
+    *address = sim->watch_hit_addr;
+  if (pc != NULL)
+    *pc = sim->watch_hit_pc;
+  return 0;
+}
+
+const char *armsim_strerror(int result)
+{
+  switch (result)
+  {
+  case ARMSIM_RUNNING:
+    return "running";
+  case ARMSIM_HALTED:
+    return "halted";
+  case ARMSIM_BREAKPOINT:
+    return "breakpoint";
+  case ARMSIM_WATCHPOINT:
+    return "watchpoint";
+  case ARMSIM_BUDGET:
+    return "instruction budget exhausted";
+  case ARMSIM_TIMEOUT:
+    return "time limit exceeded";
+  case ARMSIM_IDLE_LOOP:
+    return "idle loop";
+  case ARMSIM_INVALID:
+    return "invalid instruction";
+  case ARMSIM_CHECKPOINT:
+    return "checkpoint";
+  case ARMSIM_INTERRUPTED:
+    return "interrupted";
+  case ARMSIM_E_INVAL:
+    return "invalid argument";
+  case ARMSIM_E_NOMEM:
+    return "out of memory";
+  case ARMSIM_E_FAULT:
+    return "address outside guest memory";
+  case ARMSIM_E_HALTED:
+    return "simulator is halted";
+  case ARMSIM_E_IO:
+    return "can't open file";
+  case ARMSIM_E_FORMAT:
+    return "malformed program or trace file";
+  case ARMSIM_E_FULL:
+    return "too many breakpoints or watchpoints";
+  case ARMSIM_E_NOSYS:
+    return "not compiled into this build";
+  default:
+    return "unknown error";
+  }
+}
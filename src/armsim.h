@@ -0,0 +1,635 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: embeddable simulator instances                 */
+/*                                                             */
+/***************************************************************/
+
+/* The library never writes to stdout and never exits; every
+ * failure is reported through a negative ARMSIM_E* return value.
+ * An instance may only be driven by one thread at a time, but
+ * different instances can run concurrently on different threads. */
+
+#ifndef _ARMSIM_H_
+#define _ARMSIM_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ARMSIM_REGS 32
+
+#ifndef ARMSIM_API
+#define ARMSIM_API __attribute__((visibility("default")))
+#endif
+
+typedef struct armsim armsim_t;
+
+/* Why a step or run returned (non-negative results) */
+typedef enum
+{
+  ARMSIM_RUNNING = 0,    /* executed the requested number of steps */
+  ARMSIM_HALTED,         /* HLT; the instance stays halted */
+  ARMSIM_BREAKPOINT,     /* stopped before a breakpoint */
+  ARMSIM_WATCHPOINT,     /* a write changed a watched byte */
+  ARMSIM_BUDGET,         /* instruction budget exhausted */
+  ARMSIM_TIMEOUT,        /* wall-clock limit exceeded */
+  ARMSIM_IDLE_LOOP,      /* guest spins without changing state */
+  ARMSIM_INVALID,        /* undecodable instruction at the PC */
+  ARMSIM_CHECKPOINT,     /* after a checkpoint marker, see below */
+  ARMSIM_INTERRUPTED     /* armsim_interrupt, see below */
+} armsim_status_t;
+
+/* Errors (negative results) */
+#define ARMSIM_E_INVAL -1  /* bad argument */
+#define ARMSIM_E_NOMEM -2  /* allocation failed */
+#define ARMSIM_E_FAULT -3  /* address outside guest memory */
+#define ARMSIM_E_HALTED -4 /* can't simulate, instance is halted */
+#define ARMSIM_E_IO -5     /* can't open or read a file */
+#define ARMSIM_E_FORMAT -6 /* malformed program or trace file */
+#define ARMSIM_E_FULL -7   /* no free breakpoint/watchpoint slot */
+#define ARMSIM_E_NOSYS -8  /* feature compiled out of this build */
+
+/* NZCV bits as returned by armsim_get_flags */
+#define ARMSIM_FLAG_N 0x8
+#define ARMSIM_FLAG_Z 0x4
+#define ARMSIM_FLAG_C 0x2
+#define ARMSIM_FLAG_V 0x1
+
+typedef struct
+{
+  uint64_t instructions;     /* retired since load */
+  uint64_t stores;           /* 32-bit guest memory writes */
+  uint64_t roi_instructions; /* retired inside the region of interest */
+} armsim_counters_t;
+
+/* Region of interest: HLT #imm with one of these immediates is a
+ * marker, not a halt. Markers retire like NOPs, never reach a timing
+ * model or plugin exec, and
+ *   RESET       zeroes the statistics of every model, keeping caches
+ *               and predictors warm, and restarts the ROI count;
+ *   BEGIN, END  bracket the region: caches, predictors, pipelines,
+ *               plugins and the ROI count only see what runs inside;
+ *   CHECKPOINT  stops the run with ARMSIM_CHECKPOINT, resumable.
+ * A program containing a BEGIN marker starts outside the region;
+ * any other program is a region from start to end. */
+#define ARMSIM_ROI_RESET 0x100      /* HLT #0x100 */
+#define ARMSIM_ROI_BEGIN 0x101      /* HLT #0x101 */
+#define ARMSIM_ROI_END 0x102        /* HLT #0x102 */
+#define ARMSIM_ROI_CHECKPOINT 0x103 /* HLT #0x103 */
+
+/* Instances */
+ARMSIM_API armsim_t *armsim_create(void);
+ARMSIM_API void armsim_destroy(armsim_t *sim);
+ARMSIM_API int armsim_reset(armsim_t *sim);
+
+/* Loading: words go to the start of the text segment and the PC is
+ * pointed at it. armsim_load_file reads the hexdump (.x) format; a
+ * file with more words than the segment holds is ARMSIM_E_FORMAT. */
+#define ARMSIM_TEXT_WORDS (0x00100000 / 4) /* text segment capacity */
+ARMSIM_API int armsim_load_image(armsim_t *sim, const uint32_t *words, size_t count);
+ARMSIM_API int armsim_load_file(armsim_t *sim, const char *path, size_t *words_read);
+
+/* Execution: both return an armsim_status_t or a negative error.
+ * armsim_run applies the instruction and time limits. */
+ARMSIM_API int armsim_step(armsim_t *sim, uint64_t count);
+ARMSIM_API int armsim_run(armsim_t *sim);
+ARMSIM_API int armsim_set_limits(armsim_t *sim, uint64_t max_instructions, double seconds);
+ARMSIM_API int armsim_is_halted(armsim_t *sim);
+
+/* Architectural state */
+ARMSIM_API uint64_t armsim_get_reg(armsim_t *sim, int reg);
+ARMSIM_API int armsim_set_reg(armsim_t *sim, int reg, uint64_t value);
+ARMSIM_API uint64_t armsim_get_pc(armsim_t *sim);
+ARMSIM_API int armsim_set_pc(armsim_t *sim, uint64_t pc);
+ARMSIM_API int armsim_get_flags(armsim_t *sim);
+ARMSIM_API int armsim_set_flags(armsim_t *sim, int nzcv);
+ARMSIM_API int armsim_read_mem(armsim_t *sim, uint64_t address, void *buf, size_t len);
+ARMSIM_API int armsim_write_mem(armsim_t *sim, uint64_t address, const void *buf, size_t len);
+ARMSIM_API int armsim_get_counters(armsim_t *sim, armsim_counters_t *counters);
+
+/* Bulk data: armsim_load_data puts the contents of a host file at
+ * address in the data segment, which grows to hold it (up to 2 GiB
+ * from its start); *bytes gets the file size. At page-aligned
+ * addresses the file is mapped copy-on-write, so nothing is read
+ * before the guest touches it and guest stores never reach the file.
+ * armsim_save_data writes len bytes, all in one region, to path with
+ * one write. armsim_reset shrinks the data segment back. */
+ARMSIM_API int armsim_load_data(armsim_t *sim, const char *path, uint64_t address,
+                                uint64_t *bytes);
+ARMSIM_API int armsim_save_data(armsim_t *sim, uint64_t address, uint64_t len, const char *path);
+
+/* Flight recorder: every instance keeps the pc, word and written
+ * register of the last instructions it retired in a power-of-two ring
+ * (256 by default), one store per instruction. armsim_history copies
+ * out the last max of them, oldest first, and returns how many; with
+ * entries NULL it returns how many there are. Lanes running in
+ * lockstep are not recorded. */
+typedef struct
+{
+  uint64_t pc;
+  uint32_t word;
+  const char *name; /* mnemonic */
+  int dest;         /* register written, -1 if none */
+  uint64_t value;   /* its new value */
+} armsim_history_entry_t;
+
+ARMSIM_API int armsim_history_configure(armsim_t *sim, size_t entries);
+ARMSIM_API int armsim_history(armsim_t *sim, armsim_history_entry_t *entries, size_t max);
+
+/* Live monitoring, for a run on another thread: after
+ * armsim_monitor_start the engine publishes a sample of its state
+ * every 65536 instructions at a block boundary, and whenever a step
+ * or run starts or returns. armsim_sample copies the latest one out
+ * from any thread without stopping or slowing the run; its fields
+ * always belong to the same instruction boundary. armsim_interrupt,
+ * callable from any thread or a signal handler, makes the run return
+ * ARMSIM_INTERRUPTED at the next sampled boundary; the run can be
+ * resumed. An interrupt arriving when no run is in progress is
+ * dropped when the next one returns. */
+typedef struct
+{
+  uint64_t instructions;     /* retired so far */
+  uint64_t roi_instructions; /* retired inside the region of interest */
+  uint64_t stores;           /* 32-bit guest memory writes */
+  uint64_t pc;
+  uint64_t regs[ARMSIM_REGS];
+  uint32_t nzcv;             /* ARMSIM_FLAG_* bits */
+  int running;               /* inside armsim_step or armsim_run */
+} armsim_sample_t;
+
+ARMSIM_API int armsim_monitor_start(armsim_t *sim);
+ARMSIM_API int armsim_monitor_stop(armsim_t *sim);
+ARMSIM_API int armsim_sample(armsim_t *sim, armsim_sample_t *sample);
+ARMSIM_API int armsim_interrupt(armsim_t *sim);
+
+/* Flat per-PC profile of the region of interest, see pcprof.c.
+ * ARMSIM_PROFILE_EXACT counts every instruction through the fetch
+ * tap. ARMSIM_PROFILE_SAMPLED counts SIGPROF samples of the PC being
+ * executed, hz per second of process CPU time (0: 1000), at no cost
+ * to the engine; one instance per process, and it owns SIGPROF and
+ * ITIMER_PROF until armsim_profile_stop. armsim_profile_sites
+ * copies out up to max text words that were counted, in PC order,
+ * and returns how many there are. */
+enum
+{
+  ARMSIM_PROFILE_EXACT,
+  ARMSIM_PROFILE_SAMPLED
+};
+
+/* What the engine was doing when a sample landed */
+enum
+{
+  ARMSIM_TIER_IDLE,   /* not running: loading, dumping, the shell */
+  ARMSIM_TIER_SCALAR, /* cycle() loop, nothing attached */
+  ARMSIM_TIER_MODELS, /* cycle() loop feeding models, traces or plugins */
+  ARMSIM_TIER_LANES,  /* lanes in lockstep */
+  ARMSIM_TIERS
+};
+
+typedef struct
+{
+  uint64_t pc;
+  uint64_t count; /* instructions, or samples */
+  const char *name;
+} armsim_profile_site_t;
+
+typedef struct
+{
+  int mode;
+  unsigned hz;                  /* sampled only */
+  uint64_t total;               /* instructions, or samples, in the ROI */
+  uint64_t other;               /* ... of those outside the text segment */
+  uint64_t outside;             /* samples outside the ROI */
+  uint64_t tiers[ARMSIM_TIERS]; /* every sample, by tier */
+} armsim_profile_stats_t;
+
+ARMSIM_API int armsim_profile_start(armsim_t *sim, int mode, unsigned hz);
+ARMSIM_API int armsim_profile_stop(armsim_t *sim);
+ARMSIM_API int armsim_profile_stats(armsim_t *sim, armsim_profile_stats_t *stats);
+ARMSIM_API int armsim_profile_sites(armsim_t *sim, armsim_profile_site_t *sites, size_t max);
+
+/* Timeline: Chrome trace-event JSON (chrome://tracing, Perfetto) of
+ * loads, runs, ROI regions, stop reasons and the hottest block of
+ * every sample window, written by a background thread; see
+ * timeline.c. interval is instructions per hot block sample, 0 for
+ * the default. armsim_timeline_span marks the caller's own phases
+ * (begin TRUE, then FALSE) and may be called from any thread; the
+ * others belong to the thread driving the instance. */
+typedef struct
+{
+  uint64_t events;  /* queued for the writer */
+  uint64_t dropped; /* lost to a full queue */
+  uint64_t bytes;
+} armsim_timeline_stats_t;
+
+ARMSIM_API int armsim_timeline_start(armsim_t *sim, const char *path, uint64_t interval);
+ARMSIM_API int armsim_timeline_span(armsim_t *sim, const char *name, int begin);
+ARMSIM_API int armsim_timeline_stop(armsim_t *sim, armsim_timeline_stats_t *stats);
+
+/* Host cost profile, in builds made with make PROFILE=1 (otherwise
+ * ARMSIM_E_NOSYS): the host ticks (TSC cycles on x86) every
+ * Instruction spends in each phase of cycle(), and inside
+ * AddWithCarry and the guest memory lookups, with the probes' own
+ * cost, measured by armsim_host_profile_start, taken off. See
+ * hostprof.c for where the phases start and end. armsim_host_profile
+ * copies out up to max rows, one per Instruction that retired, and
+ * returns how many there are. */
+#define ARMSIM_HOST_PHASES 3 /* fetch, execute, commit */
+#define ARMSIM_HOST_BUCKETS 16
+
+typedef struct
+{
+  const char *name; /* Instruction, or "other" for traps and markers */
+  uint64_t count;
+  uint64_t ticks[ARMSIM_HOST_PHASES];
+  uint64_t flags_ticks;                      /* in AddWithCarry, part of execute */
+  uint64_t memory_ticks[ARMSIM_HOST_PHASES]; /* in guest memory lookups, per phase */
+  uint64_t histogram[ARMSIM_HOST_BUCKETS];   /* [k]: totals of 2^k to 2^(k+1)-1 ticks,
+                                                the last bucket open-ended */
+} armsim_host_cost_t;
+
+typedef struct
+{
+  uint64_t phase[ARMSIM_HOST_PHASES]; /* ticks subtracted from each phase */
+  uint64_t nested;                    /* ... from each nested timer */
+  uint64_t nested_cost;               /* ... from its phase, per nested timer */
+} armsim_host_bias_t;
+
+ARMSIM_API int armsim_host_profile_start(armsim_t *sim);
+ARMSIM_API int armsim_host_profile(armsim_t *sim, armsim_host_cost_t *rows, size_t max,
+                                   armsim_host_bias_t *bias);
+
+/* Cache model: an optional L1I/L1D/L2 hierarchy fed by instruction
+ * fetch and by the loads and stores of scalar runs. Lines are
+ * allocated on read misses, and on write misses when write-back. */
+typedef enum
+{
+  ARMSIM_CACHE_L1I = 0,
+  ARMSIM_CACHE_L1D,
+  ARMSIM_CACHE_L2,
+  ARMSIM_CACHE_LEVELS
+} armsim_cache_level_t;
+
+#define ARMSIM_REPLACE_LRU 0
+#define ARMSIM_REPLACE_PLRU 1 /* tree pseudo-LRU, ways a power of two */
+
+typedef struct
+{
+  uint32_t size;   /* bytes; 0 = level not present */
+  uint32_t ways;   /* 1..64 */
+  uint32_t line;   /* bytes, a power of two; size / (ways * line) sets, a power of two */
+  int replacement; /* ARMSIM_REPLACE_* */
+  int write_back;  /* else write-through without write allocation */
+} armsim_cache_config_t;
+
+/* Statistics are kept per guest region of the accessed line */
+typedef enum
+{
+  ARMSIM_REGION_TEXT = 0,
+  ARMSIM_REGION_DATA,
+  ARMSIM_REGION_STACK,
+  ARMSIM_REGION_NONE, /* outside guest memory */
+  ARMSIM_REGIONS
+} armsim_region_t;
+
+typedef struct
+{
+  uint64_t hits, misses;
+  uint64_t evictions;  /* valid lines replaced */
+  uint64_t writebacks; /* dirty lines written to the next level */
+} armsim_cache_counts_t;
+
+typedef struct
+{
+  armsim_cache_counts_t total;
+  armsim_cache_counts_t region[ARMSIM_REGIONS];
+} armsim_cache_stats_t;
+
+/* config holds ARMSIM_CACHE_LEVELS entries, NULL removes the model.
+ * Configuring or resetting the instance starts with empty caches. */
+ARMSIM_API int armsim_cache_configure(armsim_t *sim, const armsim_cache_config_t *config);
+ARMSIM_API int armsim_cache_stats(armsim_t *sim, int level, armsim_cache_stats_t *stats);
+
+/* Single-pass design-space sweep: every run after armsim_sweep_start
+ * feeds its references (ARMSIM_SWEEP_* streams) to all nconfigs
+ * single-level caches at once, spread over `threads` worker threads.
+ * armsim_sweep_finish stops the sweep and stores each configuration's
+ * hits and misses in results[nconfigs]; evictions and writebacks are
+ * only counted for configurations that are not write-back LRU. */
+#define ARMSIM_SWEEP_FETCH 0x1
+#define ARMSIM_SWEEP_DATA 0x2
+
+ARMSIM_API int armsim_sweep_start(armsim_t *sim, int streams, const armsim_cache_config_t *configs,
+                                  size_t nconfigs, int threads);
+ARMSIM_API int armsim_sweep_finish(armsim_t *sim, armsim_cache_counts_t *results);
+
+/* Branch predictors: any number (up to 8) can be attached side by side
+ * and each one sees every B.cond, CBZ, CBNZ and BR of scalar runs.
+ * Direction predictors count conditional branches, the BTB counts
+ * taken branches and the RAS counts BR X30; the ISA has no BL, so the
+ * RAS pushes X30 whenever it was written since the previous branch. */
+typedef enum
+{
+  ARMSIM_BPRED_BIMODAL = 0,
+  ARMSIM_BPRED_GSHARE,
+  ARMSIM_BPRED_TAGE, /* TAGE-lite: bimodal base plus 4 tagged tables */
+  ARMSIM_BPRED_BTB,
+  ARMSIM_BPRED_RAS
+} armsim_bpred_kind_t;
+
+typedef struct
+{
+  int kind;         /* armsim_bpred_kind_t */
+  uint32_t entries; /* table entries, a power of two; RAS depth */
+  uint32_t history; /* gshare history bits, TAGE longest history (<= 64) */
+} armsim_bpred_config_t;
+
+typedef struct
+{
+  uint64_t lookups, mispredicts;
+  uint64_t instructions; /* retired in the ROI since the first predictor was added */
+} armsim_bpred_stats_t;
+
+typedef struct
+{
+  uint64_t pc;
+  uint64_t executed, taken;
+  uint64_t mispredicts; /* by the requested predictor */
+} armsim_branch_site_t;
+
+/* armsim_bpred_add returns the predictor's index. armsim_bpred_sites
+ * fills up to max static branches and returns how many there are. */
+ARMSIM_API int armsim_bpred_add(armsim_t *sim, const armsim_bpred_config_t *config);
+ARMSIM_API int armsim_bpred_clear(armsim_t *sim);
+ARMSIM_API int armsim_bpred_stats(armsim_t *sim, int predictor, armsim_bpred_stats_t *stats);
+ARMSIM_API int armsim_bpred_sites(armsim_t *sim, int predictor, armsim_branch_site_t *sites,
+                                  size_t max);
+
+/* In-order pipeline: a classic IF/ID/EX/MEM/WB timing model driven
+ * by every instruction scalar runs retire. Branches are predicted not
+ * taken. Builds made with ARMSIM_NO_TIMING return ARMSIM_E_NOSYS. */
+typedef struct
+{
+  int forwarding;   /* EX/MEM bypasses; else operands are read after WB */
+  int branch_in_ex; /* resolve branches in EX (2-cycle penalty), not ID (1) */
+} armsim_pipeline_config_t;
+
+typedef enum
+{
+  ARMSIM_STALL_DATA = 0, /* waiting on an ALU result */
+  ARMSIM_STALL_LOAD_USE, /* waiting on an LDUR* result */
+  ARMSIM_STALL_FLAGS,    /* B.cond or ADCS waiting on NZCV */
+  ARMSIM_STALL_BRANCH,   /* bubbles after taken branches */
+  ARMSIM_STALL_CAUSES
+} armsim_stall_t;
+
+typedef struct
+{
+  uint64_t instructions, cycles;
+  uint64_t stalls[ARMSIM_STALL_CAUSES]; /* cycles lost, by cause */
+  uint64_t taken_branches;
+} armsim_pipeline_stats_t;
+
+/* config NULL removes the model; resetting the instance drains it */
+ARMSIM_API int armsim_pipeline_configure(armsim_t *sim, const armsim_pipeline_config_t *config);
+ARMSIM_API int armsim_pipeline_stats(armsim_t *sim, armsim_pipeline_stats_t *stats);
+
+/* Out-of-order core: a trace-driven model of a superscalar core fed
+ * by the same instruction stream, for what-if studies on wider cores.
+ * Zero fields in the configuration take the default in brackets. */
+typedef struct
+{
+  uint32_t fetch_width;    /* fetch and dispatch per cycle [4] */
+  uint32_t issue_width;    /* [4] */
+  uint32_t commit_width;   /* [4] */
+  uint32_t rob_size;       /* [128] */
+  uint32_t lsq_size;       /* loads and stores in flight [32] */
+  uint32_t frontend_depth; /* fetch to dispatch, in cycles [5] */
+  uint32_t alu_latency;    /* [1] */
+  uint32_t mul_latency;    /* [3] */
+  uint32_t load_latency;   /* [3] */
+  uint32_t alu_units;      /* each unit takes one instruction a cycle [4] */
+  uint32_t mul_units;      /* [1] */
+  uint32_t mem_units;      /* [2] */
+} armsim_ooo_config_t;
+
+typedef enum
+{
+  ARMSIM_OOO_ROB_FULL = 0, /* dispatch waiting for a ROB entry */
+  ARMSIM_OOO_LSQ_FULL,     /* dispatch waiting for an LSQ entry */
+  ARMSIM_OOO_ISSUE_WIDTH,  /* ready, but all issue ports taken */
+  ARMSIM_OOO_UNIT_BUSY,    /* ready, but its functional units taken */
+  ARMSIM_OOO_MISPREDICT,   /* fetch waiting for a mispredicted branch */
+  ARMSIM_OOO_STALLS
+} armsim_ooo_stall_t;
+
+typedef struct
+{
+  uint64_t instructions, cycles;
+  uint64_t mispredicts;
+  uint64_t stalls[ARMSIM_OOO_STALLS]; /* instruction-cycles delayed, by cause */
+} armsim_ooo_stats_t;
+
+/* config NULL removes the model; resetting the instance drains it */
+ARMSIM_API int armsim_ooo_configure(armsim_t *sim, const armsim_ooo_config_t *config);
+ARMSIM_API int armsim_ooo_stats(armsim_t *sim, armsim_ooo_stats_t *stats);
+
+/* Dataflow limit study: schedules every retired instruction on an
+ * ideal machine (unlimited resources, perfect prediction, one cycle
+ * per instruction) that only waits for its register, NZCV and memory
+ * inputs. Dependency distances, in dynamic instructions from producer
+ * to consumer, are histogrammed in powers of two: bucket k counts
+ * distances in [2^k, 2^(k+1)), the last one everything longer. */
+#define ARMSIM_DATAFLOW_BUCKETS 24
+
+typedef struct
+{
+  uint64_t instructions;
+  uint64_t critical_path; /* cycles; ideal IPC = instructions / critical_path */
+  uint64_t memory_words;  /* distinct 32-bit words stored to */
+  uint64_t distances[ARMSIM_DATAFLOW_BUCKETS];
+} armsim_dataflow_stats_t;
+
+ARMSIM_API int armsim_dataflow_enable(armsim_t *sim, int enable);
+ARMSIM_API int armsim_dataflow_stats(armsim_t *sim, armsim_dataflow_stats_t *stats);
+
+/* Memory access analyzer, fed by the loads and stores of scalar runs:
+ * per-PC strides, reuse distances (distinct lines referenced between
+ * two references to a line; reuse[0] counts distance 0, reuse[k]
+ * distances in [2^(k-1), 2^k), the last bucket everything longer) and
+ * the working set, in distinct lines, of each window of instructions. */
+#define ARMSIM_REUSE_BUCKETS 32
+
+typedef struct
+{
+  uint32_t line;   /* bytes, a power of two */
+  uint64_t window; /* instructions per working-set window */
+} armsim_access_config_t;
+
+typedef struct
+{
+  uint64_t accesses; /* loads and stores */
+  uint64_t lines;    /* distinct lines referenced */
+  uint64_t cold;     /* first references */
+  uint64_t reuse[ARMSIM_REUSE_BUCKETS];
+  uint64_t windows;  /* including the current one */
+} armsim_access_stats_t;
+
+typedef struct
+{
+  uint64_t pc;
+  uint64_t accesses, writes;
+  int64_t stride;       /* latest stride that repeated, in bytes */
+  uint64_t stride_hits; /* accesses that repeated the previous stride */
+} armsim_access_site_t;
+
+/* config NULL removes the analyzer. armsim_access_sites and
+ * armsim_access_windows fill up to max entries and return how many
+ * there are. */
+ARMSIM_API int armsim_access_configure(armsim_t *sim, const armsim_access_config_t *config);
+ARMSIM_API int armsim_access_stats(armsim_t *sim, armsim_access_stats_t *stats);
+ARMSIM_API int armsim_access_sites(armsim_t *sim, armsim_access_site_t *sites, size_t max);
+ARMSIM_API int armsim_access_windows(armsim_t *sim, uint64_t *lines, size_t max);
+
+/* Execution traces: while started, every instruction scalar runs
+ * retire is written to a compressed trace file by a background
+ * thread. Recording needs the record tap, so builds made with
+ * ARMSIM_NO_TIMING return ARMSIM_E_NOSYS; reading works everywhere. */
+typedef struct
+{
+  uint64_t instructions;
+  uint64_t bytes; /* file size */
+} armsim_trace_stats_t;
+
+/* armsim_trace_stop flushes and closes the file; stats may be NULL */
+ARMSIM_API int armsim_trace_start(armsim_t *sim, const char *path);
+ARMSIM_API int armsim_trace_stop(armsim_t *sim, armsim_trace_stats_t *stats);
+
+#define ARMSIM_TRACE_LOAD 1
+#define ARMSIM_TRACE_STORE 2
+
+typedef struct
+{
+  uint64_t pc;
+  uint32_t word;    /* raw encoding */
+  uint32_t nzcv;    /* ARMSIM_FLAG_* bits after the instruction */
+  const char *name; /* mnemonic */
+  int dest;         /* register written, -1 if none */
+  uint64_t value;   /* its new value */
+  int access;       /* 0 or ARMSIM_TRACE_LOAD/STORE */
+  int size;         /* bytes of guest memory accessed */
+  uint64_t address, data;
+} armsim_trace_entry_t;
+
+typedef struct armsim_trace armsim_trace_t;
+
+/* armsim_trace_next returns 1 per instruction, 0 at the end */
+ARMSIM_API int armsim_trace_open(const char *path, armsim_trace_t **trace);
+ARMSIM_API int armsim_trace_next(armsim_trace_t *trace, armsim_trace_entry_t *entry);
+ARMSIM_API void armsim_trace_close(armsim_trace_t *trace);
+
+/* State hashing: a 64-bit hash of the registers, PC, NZCV and guest
+ * memory. armsim_hash computes it now; armsim_hash_start writes a
+ * text line "<instructions> 0x<pc> <hash>" to path every interval
+ * instructions past from, and once more when a run ends for good,
+ * until armsim_hash_stop. The memory term is kept up to date store
+ * by store, so records cost the same however large memory is. */
+ARMSIM_API int armsim_hash(armsim_t *sim, uint64_t *hash);
+ARMSIM_API int armsim_hash_start(armsim_t *sim, const char *path, uint64_t interval,
+                                 uint64_t from);
+ARMSIM_API int armsim_hash_stop(armsim_t *sim);
+
+/* Snapshots for repeated runs: armsim_snapshot remembers the
+ * registers, PC, flags, counters, region of interest and guest
+ * memory; armsim_restore returns to that state, copying back only the
+ * 4 KB pages written since, so one loaded image can be rerun with new
+ * inputs (armsim_set_reg) at almost no setup cost. Both copy only
+ * what changed since the last snapshot, restore or reset. Breakpoints,
+ * watchpoints and attached models are left as they are; armsim_reset
+ * drops the snapshot. */
+ARMSIM_API int armsim_snapshot(armsim_t *sim);
+ARMSIM_API int armsim_restore(armsim_t *sim);
+
+/* Plugins: callbacks on the events of scalar runs, batched per block.
+ * A block is the straight-line run of instructions from a branch
+ * target (or the run start) to the next taken branch (or the run
+ * end). translate sees every static basic block (up to and including
+ * its first branch) before the first exec that covers it; exec then
+ * reports each block executed. memory gets the loads and stores in
+ * batches, delivered at block ends or when a batch fills; a block's
+ * batches come before its exec. halt is called when HLT or an invalid
+ * instruction ends a run, unload by armsim_destroy. Outside the region
+ * of interest no block or memory events arrive; roi reports every
+ * marker. NULL callbacks are not subscribed, and events nobody
+ * subscribes to cost nothing. */
+#define ARMSIM_MAX_PLUGINS 8
+
+typedef struct
+{
+  uint64_t pc, address;
+  uint32_t size; /* bytes of guest memory accessed */
+  uint32_t write;
+} armsim_mem_access_t;
+
+typedef struct
+{
+  void (*translate)(void *ctx, uint64_t pc, const uint32_t *words, size_t count);
+  void (*exec)(void *ctx, uint64_t pc, uint64_t count);
+  void (*memory)(void *ctx, const armsim_mem_access_t *accesses, size_t count);
+  void (*halt)(void *ctx, int status); /* armsim_status_t */
+  void (*unload)(void *ctx);
+  void (*roi)(void *ctx, int marker); /* ARMSIM_ROI_*, as it retires */
+} armsim_plugin_t;
+
+/* A plugin .so exports
+ *   int armsim_plugin_init(armsim_t *sim, const char *args);
+ * which calls armsim_plugin_register and returns 0 or an ARMSIM_E*
+ * code; on an error the callbacks it registered are dropped, without
+ * unload, and the .so is closed. Programs loading plugins must export
+ * the armsim_* symbols (link with -rdynamic); plugins do not link
+ * libarmsim themselves. */
+ARMSIM_API int armsim_plugin_register(armsim_t *sim, const armsim_plugin_t *plugin, void *ctx);
+ARMSIM_API int armsim_plugin_load(armsim_t *sim, const char *path, const char *args);
+
+/* Lane-parallel runs: executes one program from nlanes initial
+ * register files (lane k starts from init_regs[k]) in lockstep, as
+ * armsim_run would on `image` for each lane. The image instance only
+ * supplies the program, memory, PC, flags and limits; it is not
+ * modified. Lanes whose control flow diverges finish on the scalar
+ * engine. Lanes keep no state hash streams and check no
+ * watchpoints, so an image with armsim_hash_start attached or any
+ * armsim_watch_add range is refused with ARMSIM_E_INVAL. */
+typedef struct
+{
+  int status;        /* armsim_status_t or ARMSIM_E* */
+  uint32_t nzcv;     /* ARMSIM_FLAG_* bits */
+  uint64_t instructions;
+  uint64_t pc;
+  uint64_t regs[ARMSIM_REGS];
+  int lockstep;      /* finished without leaving the SIMD path */
+} armsim_lane_result_t;
+
+ARMSIM_API int armsim_run_lanes(armsim_t *image, size_t nlanes,
+                                const uint64_t (*init_regs)[ARMSIM_REGS],
+                                armsim_lane_result_t *results);
+
+/* Debugging */
+ARMSIM_API int armsim_break_add(armsim_t *sim, uint64_t pc);
+ARMSIM_API int armsim_break_delete(armsim_t *sim, uint64_t pc);
+ARMSIM_API int armsim_watch_add(armsim_t *sim, uint64_t address, uint64_t len);
+ARMSIM_API int armsim_watch_delete(armsim_t *sim, uint64_t address);
+ARMSIM_API int armsim_watch_hit(armsim_t *sim, uint64_t *address, uint64_t *pc);
+
+ARMSIM_API const char *armsim_strerror(int result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,639 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: branch predictor models                        */
+/*                                                             */
+/***************************************************************/
+
+/* Every B, B.cond, CBZ, CBNZ and BR the engine executes is offered to
+ * each attached predictor, which predicts, compares with the real
+ * outcome and trains in one call. Direction predictors (bimodal,
+ * gshare, TAGE-lite) see the conditional branches, the BTB sees
+ * every taken branch, and the return-address stack sees BR X30.
+ *
+ * The subset has no BL, so a "call" is recognised the way guest code
+ * has to write one: X30 is loaded with the return address before the
+ * branch. The fetch tap notes instructions whose destination is X30,
+ * the next branch pushes its value on the RAS and BR X30 pops. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "sim.h"
+
+#define MAX_PREDICTORS 8
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 9
+#define TAGE_RESET_PERIOD (1 << 18) /* branches between useful-bit decays */
+
+typedef struct predictor predictor_t;
+
+typedef struct
+{
+  uint64_t pc, next_pc;
+  int taken, kind; /* BRANCH_* */
+  int call;        /* X30 was written since the previous branch */
+} branch_t;
+
+/* Returns TRUE on a misprediction, -1 when the branch is not one the
+ * predictor handles */
+typedef int (*predict_fn)(predictor_t *p, const branch_t *b);
+
+typedef struct
+{
+  uint16_t tag;
+  int8_t counter; /* -4..3, taken when >= 0 */
+  uint8_t useful; /* 0..3 */
+} tage_entry_t;
+
+struct predictor
+{
+  armsim_bpred_config_t config;
+  predict_fn predict;
+  uint64_t mask; /* entries - 1 */
+  uint64_t history;
+  uint8_t *counters; /* 2-bit, bimodal/gshare/TAGE base */
+  /* TAGE-lite */
+  tage_entry_t *tagged[TAGE_TABLES];
+  unsigned lengths[TAGE_TABLES];
+  unsigned tagged_bits;
+  uint64_t branches;
+  /* BTB: pc + 1 and target per entry; RAS: a circular stack */
+  uint64_t *tags, *targets;
+  uint64_t top, depth;
+  armsim_bpred_stats_t stats;
+};
+
+typedef struct
+{
+  uint64_t pc; /* 0 = empty slot */
+  uint64_t executed, taken;
+  uint64_t mispredicts[MAX_PREDICTORS];
+} site_t;
+
+struct bpred_model
+{
+  predictor_t predictors[MAX_PREDICTORS];
+  int npredictors;
+  int ras;              /* a RAS is attached: watch for X30 writes */
+  int x30_written;
+  uint64_t start_count; /* roi_instructions() when attached */
+  site_t *sites;        /* open addressing on the branch PC */
+  uint64_t site_mask, nsites;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : counter_update                                  */
+/*                                                             */
+/* Purpose   : Saturating 2-bit counter, taken when >= 2       */
+/*                                                             */
+/***************************************************************/
+static inline void counter_update(uint8_t *counter, int taken)
+{
+  if (taken && *counter < 3)
+    (*counter)++;
+  else if (!taken && *counter > 0)
+    (*counter)--;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predict_bimodal / predict_gshare                */
+/*                                                             */
+/***************************************************************/
+int predict_bimodal(predictor_t *p, const branch_t *b)
+{
+  uint8_t *counter = &p->counters[(b->pc >> 2) & p->mask];
+  int wrong;
+
+  if (b->kind != BRANCH_CONDITIONAL)
+    return -1;
+  wrong = (*counter >= 2) != b->taken;
+  counter_update(counter, b->taken);
+  return wrong;
+}
+
+int predict_gshare(predictor_t *p, const branch_t *b)
+{
+  uint64_t history = p->config.history >= 64 ? p->history
+                                              : p->history & ((1ULL << p->config.history) - 1);
+  uint8_t *counter = &p->counters[((b->pc >> 2) ^ history) & p->mask];
+  int wrong;
+
+  if (b->kind != BRANCH_CONDITIONAL)
+    return -1;
+  wrong = (*counter >= 2) != b->taken;
+  counter_update(counter, b->taken);
+  p->history = p->history << 1 | b->taken;
+  return wrong;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fold                                            */
+/*                                                             */
+/* Purpose   : XOR the low `length` history bits into `bits`   */
+/*                                                             */
+/***************************************************************/
+static inline uint64_t fold(uint64_t history, unsigned length, unsigned bits)
+{
+  uint64_t folded = 0;
+  if (length < 64)
+    history &= (1ULL << length) - 1;
+  for (; length > 0; length = length > bits ? length - bits : 0)
+  {
+    folded ^= history & ((1ULL << bits) - 1);
+    history >>= bits;
+  }
+  return folded;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predict_tage                                    */
+/*                                                             */
+/* Purpose   : TAGE-lite: a bimodal base and TAGE_TABLES tagged */
+/*             tables over geometric history lengths; the      */
+/*             longest hit provides, a misprediction allocates */
+/*             in a longer table                               */
+/*                                                             */
+/***************************************************************/
+int predict_tage(predictor_t *p, const branch_t *b)
+{
+  tage_entry_t *hits[TAGE_TABLES];
+  uint64_t line = b->pc >> 2;
+  uint64_t index[TAGE_TABLES];
+  uint16_t tag[TAGE_TABLES];
+  uint8_t *base = &p->counters[line & p->mask];
+  int provider = -1, alt = -1, t, prediction, alt_prediction, wrong;
+
+  if (b->kind != BRANCH_CONDITIONAL)
+    return -1;
+
+  for (t = 0; t < TAGE_TABLES; t++)
+  {
+    index[t] = (line ^ fold(p->history, p->lengths[t], p->tagged_bits)) &
+               ((1ULL << p->tagged_bits) - 1);
+    tag[t] = (line ^ (fold(p->history, p->lengths[t], TAGE_TAG_BITS) << 1)) &
+             ((1 << TAGE_TAG_BITS) - 1);
+    hits[t] = &p->tagged[t][index[t]];
+    if (hits[t]->tag == tag[t])
+    {
+      alt = provider;
+      provider = t;
+    }
+  }
+
+  alt_prediction = alt >= 0 ? hits[alt]->counter >= 0 : *base >= 2;
+  prediction = provider >= 0 ? hits[provider]->counter >= 0 : *base >= 2;
+  wrong = prediction != b->taken;
+
+  if (provider >= 0)
+  {
+    tage_entry_t *e = hits[provider];
+    if (b->taken && e->counter < 3)
+      e->counter++;
+    else if (!b->taken && e->counter > -4)
+      e->counter--;
+    if (prediction != alt_prediction)
+    {
+      if (!wrong && e->useful < 3)
+        e->useful++;
+      else if (wrong && e->useful > 0)
+        e->useful--;
+    }
+  }
+  else
+  {
+    counter_update(base, b->taken);
+  }
+
+  if (wrong && provider < TAGE_TABLES - 1)
+  {
+    /* claim the first free entry among the longer tables */
+    for (t = provider + 1; t < TAGE_TABLES; t++)
+    {
+      if (hits[t]->useful == 0)
+      {
+        hits[t]->tag = tag[t];
+        hits[t]->counter = b->taken ? 0 : -1;
+        break;
+      }
+    }
+    if (t == TAGE_TABLES)
+      for (t = provider + 1; t < TAGE_TABLES; t++)
+        hits[t]->useful--;
+  }
+
+  if (++p->branches % TAGE_RESET_PERIOD == 0)
+  {
+    int i;
+    for (t = 0; t < TAGE_TABLES; t++)
+      for (i = 0; i < 1 << p->tagged_bits; i++)
+        p->tagged[t][i].useful >>= 1;
+  }
+
+  p->history = p->history << 1 | b->taken;
+  return wrong;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predict_btb                                     */
+/*                                                             */
+/* Purpose   : Direct-mapped target buffer, looked up by every */
+/*             taken branch                                    */
+/*                                                             */
+/***************************************************************/
+int predict_btb(predictor_t *p, const branch_t *b)
+{
+  uint64_t slot = (b->pc >> 2) & p->mask;
+  int wrong;
+
+  if (!b->taken)
+    return -1;
+  wrong = p->tags[slot] != b->pc + 1 || p->targets[slot] != b->next_pc;
+  p->tags[slot] = b->pc + 1;
+  p->targets[slot] = b->next_pc;
+  return wrong;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predict_ras                                     */
+/*                                                             */
+/* Purpose   : Return-address stack, see the top of this file  */
+/*                                                             */
+/***************************************************************/
+int predict_ras(predictor_t *p, const branch_t *b)
+{
+  if (b->call)
+  {
+    /* circular: a deep call chain overwrites the oldest entry */
+    p->targets[p->top++ % p->config.entries] = NEXT_STATE.REGS[30];
+    if (p->depth < p->config.entries)
+      p->depth++;
+  }
+  if (b->kind != BRANCH_RETURN)
+    return -1;
+  if (p->depth == 0)
+    return TRUE;
+  p->depth--;
+  return p->targets[--p->top % p->config.entries] != b->next_pc;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : site_lookup                                     */
+/*                                                             */
+/* Purpose   : The per-PC record of a static branch, grown at  */
+/*             half load. NULL if out of memory.               */
+/*                                                             */
+/***************************************************************/
+site_t *site_lookup(struct bpred_model *model, uint64_t pc)
+{
+  uint64_t i;
+
+  if (2 * (model->nsites + 1) > model->site_mask + 1)
+  {
+    uint64_t size = 2 * (model->site_mask + 1), k;
+    site_t *sites = calloc(size, sizeof(*sites));
+    if (sites == NULL)
+      return NULL;
+    for (k = 0; k <= model->site_mask; k++)
+    {
+      if (model->sites[k].pc == 0)
+        continue;
+      for (i = (model->sites[k].pc >> 2) & (size - 1); sites[i].pc != 0; i = (i + 1) & (size - 1))
+        ;
+      sites[i] = model->sites[k];
+    }
+    free(model->sites);
+    model->sites = sites;
+    model->site_mask = size - 1;
+  }
+
+  for (i = (pc >> 2) & model->site_mask; model->sites[i].pc != 0; i = (i + 1) & model->site_mask)
+    if (model->sites[i].pc == pc)
+      return &model->sites[i];
+  model->sites[i].pc = pc;
+  model->nsites++;
+  return &model->sites[i];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_fetch                                     */
+/*                                                             */
+/* Purpose   : Fetch tap: note writes of X30 for the RAS       */
+/*                                                             */
+/***************************************************************/
+void bpred_fetch(uint64_t pc)
+{
+  struct bpred_model *model = ARMSIM->bpred;
+  Instruction inst;
+  uint32_t word;
+
+  if (!model->ras)
+    return;
+  inst = fetch_decoded(pc, &word);
+  if ((word & 0x1f) != 30)
+    return;
+  if (inst == BRK)
+    inst = decode(word);
+  switch (inst)
+  {
+  case ADDSer:
+  case ADDSim:
+  case SUBSer:
+  case SUBSim:
+  case ANDS:
+  case EOR:
+  case ORR:
+  case LSL:
+  case LSR:
+  case LDUR:
+  case LDURB:
+  case LDURH:
+  case MOVZ:
+  case ADDim:
+  case ADDer:
+  case MUL:
+  case ADCS:
+  case MRS:
+    model->x30_written = TRUE;
+    break;
+  default:
+    break;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_branch                                    */
+/*                                                             */
+/* Purpose   : Branch tap: offer one executed branch to every  */
+/*             attached predictor                              */
+/*                                                             */
+/***************************************************************/
+void bpred_branch(uint64_t pc, uint64_t next_pc, int taken, int kind)
+{
+  struct bpred_model *model = ARMSIM->bpred;
+  site_t *site = site_lookup(model, pc);
+  branch_t b = {pc, next_pc, taken, kind, model->x30_written};
+  int k;
+
+  model->x30_written = FALSE;
+  if (site != NULL)
+  {
+    site->executed++;
+    site->taken += taken;
+  }
+  for (k = 0; k < model->npredictors; k++)
+  {
+    predictor_t *p = &model->predictors[k];
+    int wrong = p->predict(p, &b);
+    if (wrong < 0)
+      continue;
+    p->stats.lookups++;
+    p->stats.mispredicts += wrong;
+    if (site != NULL)
+      site->mispredicts[k] += wrong;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predictor_init                                  */
+/*                                                             */
+/***************************************************************/
+int predictor_init(predictor_t *p, const armsim_bpred_config_t *config)
+{
+  uint64_t entries = config->entries;
+  int t;
+
+  memset(p, 0, sizeof(*p));
+  p->config = *config;
+  p->mask = entries - 1;
+  switch (config->kind)
+  {
+  case ARMSIM_BPRED_BIMODAL:
+  case ARMSIM_BPRED_GSHARE:
+    p->predict = config->kind == ARMSIM_BPRED_BIMODAL ? predict_bimodal : predict_gshare;
+    if ((p->counters = malloc(entries)) == NULL)
+      return ARMSIM_E_NOMEM;
+    memset(p->counters, 1, entries); /* weakly not taken */
+    break;
+  case ARMSIM_BPRED_TAGE:
+    p->predict = predict_tage;
+    p->tagged_bits = __builtin_ctzll(entries) > 2 ? __builtin_ctzll(entries) - 2 : 1;
+    if ((p->counters = malloc(entries)) == NULL)
+      return ARMSIM_E_NOMEM;
+    memset(p->counters, 1, entries);
+    for (t = 0; t < TAGE_TABLES; t++)
+    {
+      /* geometric lengths ending at the configured history */
+      p->lengths[t] = config->history >> (TAGE_TABLES - 1 - t);
+      if (p->lengths[t] < 2)
+        p->lengths[t] = 2;
+      p->tagged[t] = calloc(1ULL << p->tagged_bits, sizeof(tage_entry_t));
+      if (p->tagged[t] == NULL)
+        return ARMSIM_E_NOMEM;
+      for (uint64_t i = 0; i < 1ULL << p->tagged_bits; i++)
+        p->tagged[t][i].tag = 0xffff; /* never matches a TAGE_TAG_BITS tag */
+    }
+    break;
+  case ARMSIM_BPRED_BTB:
+    p->predict = predict_btb;
+    p->tags = calloc(entries, sizeof(*p->tags));
+    p->targets = calloc(entries, sizeof(*p->targets));
+    if (p->tags == NULL || p->targets == NULL)
+      return ARMSIM_E_NOMEM;
+    break;
+  case ARMSIM_BPRED_RAS:
+    p->predict = predict_ras;
+    if ((p->targets = calloc(entries, sizeof(*p->targets))) == NULL)
+      return ARMSIM_E_NOMEM;
+    break;
+  }
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predictor_release                               */
+/*                                                             */
+/***************************************************************/
+void predictor_release(predictor_t *p)
+{
+  int t;
+
+  free(p->counters);
+  free(p->tags);
+  free(p->targets);
+  for (t = 0; t < TAGE_TABLES; t++)
+    free(p->tagged[t]);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_flush                                     */
+/*                                                             */
+/* Purpose   : Start every predictor over untrained, with clear */
+/*             statistics. Predictors that can't be rebuilt    */
+/*             are dropped.                                    */
+/*                                                             */
+/***************************************************************/
+void bpred_flush()
+{
+  struct bpred_model *model = ARMSIM->bpred;
+  int k, n = 0;
+
+  if (model == NULL)
+    return;
+  for (k = 0; k < model->npredictors; k++)
+  {
+    armsim_bpred_config_t config = model->predictors[k].config;
+    predictor_release(&model->predictors[k]);
+    if (predictor_init(&model->predictors[n], &config) == 0)
+      n++;
+    else
+      predictor_release(&model->predictors[n]);
+  }
+  model->npredictors = n;
+  memset(model->sites, 0, (model->site_mask + 1) * sizeof(*model->sites));
+  model->nsites = 0;
+  model->x30_written = FALSE;
+  model->start_count = roi_instructions();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_clear_stats                               */
+/*                                                             */
+/* Purpose   : Clear the statistics and branch sites, keeping  */
+/*             every predictor trained                         */
+/*                                                             */
+/***************************************************************/
+void bpred_clear_stats()
+{
+  struct bpred_model *model = ARMSIM->bpred;
+  int k;
+
+  if (model == NULL)
+    return;
+  for (k = 0; k < model->npredictors; k++)
+    memset(&model->predictors[k].stats, 0, sizeof(model->predictors[k].stats));
+  memset(model->sites, 0, (model->site_mask + 1) * sizeof(*model->sites));
+  model->nsites = 0;
+  model->start_count = roi_instructions();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_free                                      */
+/*                                                             */
+/***************************************************************/
+void bpred_free()
+{
+  struct bpred_model *model = ARMSIM->bpred;
+  int k;
+
+  if (model == NULL)
+    return;
+  for (k = 0; k < model->npredictors; k++)
+    predictor_release(&model->predictors[k]);
+  free(model->sites);
+  free(model);
+  ARMSIM->bpred = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_bpred_add(armsim_t *sim, const armsim_bpred_config_t *config)
+{
+  struct bpred_model *model;
+  predictor_t *p;
+  int result;
+
+  if (sim == NULL || config == NULL || config->entries == 0 || config->kind < 0 ||
+      config->kind > ARMSIM_BPRED_RAS || config->history > 64 ||
+      (config->kind != ARMSIM_BPRED_RAS && (config->entries & (config->entries - 1))))
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+
+  if ((model = sim->bpred) == NULL)
+  {
+    if ((model = calloc(1, sizeof(*model))) == NULL ||
+        (model->sites = calloc(64, sizeof(*model->sites))) == NULL)
+    {
+      free(model);
+      return ARMSIM_E_NOMEM;
+    }
+    model->site_mask = 63;
+    model->start_count = roi_instructions();
+    sim->bpred = model;
+    trace_update();
+  }
+  if (model->npredictors == MAX_PREDICTORS)
+    return ARMSIM_E_FULL;
+
+  p = &model->predictors[model->npredictors];
+  if ((result = predictor_init(p, config)) != 0)
+  {
+    predictor_release(p);
+    return result;
+  }
+  model->ras |= config->kind == ARMSIM_BPRED_RAS;
+  return model->npredictors++;
+}
+
+int armsim_bpred_clear(armsim_t *sim)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  bpred_free();
+  return 0;
+}
+
+int armsim_bpred_stats(armsim_t *sim, int predictor, armsim_bpred_stats_t *stats)
+{
+  if (sim == NULL || stats == NULL || sim->bpred == NULL || predictor < 0 ||
+      predictor >= sim->bpred->npredictors)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  *stats = sim->bpred->predictors[predictor].stats;
+  stats->instructions = roi_instructions() - sim->bpred->start_count;
+  return 0;
+}
+
+int armsim_bpred_sites(armsim_t *sim, int predictor, armsim_branch_site_t *sites, size_t max)
+{
+  struct bpred_model *model;
+  size_t n = 0;
+  uint64_t i;
+
+  if (sim == NULL || (sites == NULL && max > 0) || (model = sim->bpred) == NULL ||
+      predictor < 0 || predictor >= model->npredictors)
+    return ARMSIM_E_INVAL;
+  for (i = 0; i <= model->site_mask; i++)
+  {
+    if (model->sites[i].pc == 0)
+      continue;
+    if (n < max)
+    {
+      sites[n].pc = model->sites[i].pc;
+      sites[n].executed = model->sites[i].executed;
+      sites[n].taken = model->sites[i].taken;
+      sites[n].mispredicts = model->sites[i].mispredicts[predictor];
+    }
+    n++;
+  }
+  return n;
+}
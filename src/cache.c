@@ -0,0 +1,451 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: set-associative cache hierarchy model          */
+/*                                                             */
+/***************************************************************/
+
+/* Each level keeps its tags in one packed array, a set being `ways`
+ * consecutive 64-bit entries, so a lookup touches one or two host
+ * cache lines. An entry is (line number + 1) << 1 | dirty, 0 when
+ * empty. LRU sets are kept in most-recently-used-first order;
+ * pseudo-LRU sets keep their positions and a tree of direction bits.
+ * Instruction fetch is the hot path: a fetch from the line fetched
+ * last is a hit that cannot change any replacement state. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "cache.h"
+
+struct cache_model
+{
+  cache_level_t level[ARMSIM_CACHE_LEVELS];
+  uint64_t last_fetch; /* L1I entry of the previous fetch, 0 = none */
+  int last_region;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : region_of                                       */
+/*                                                             */
+/***************************************************************/
+int region_of(uint64_t address)
+{
+  int i;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    if (address - MEM_REGIONS[i].start < MEM_REGIONS[i].size)
+      return i;
+  return ARMSIM_REGION_NONE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : plru_touch / plru_victim                        */
+/*                                                             */
+/* Purpose   : Tree pseudo-LRU. Node k has children 2k+1 and   */
+/*             2k+2; a set bit means "the victim is right".    */
+/*                                                             */
+/***************************************************************/
+void plru_touch(uint64_t *tree, uint32_t ways, uint32_t way)
+{
+  uint32_t node = 0, low = 0, span = ways;
+  while (span > 1)
+  {
+    span >>= 1;
+    if (way < low + span)
+    {
+      *tree |= 1ULL << node; /* used left, evict right next */
+      node = 2 * node + 1;
+    }
+    else
+    {
+      *tree &= ~(1ULL << node);
+      node = 2 * node + 2;
+      low += span;
+    }
+  }
+}
+
+uint32_t plru_victim(uint64_t tree, uint32_t ways)
+{
+  uint32_t node = 0, low = 0, span = ways;
+  while (span > 1)
+  {
+    span >>= 1;
+    if (tree & (1ULL << node))
+    {
+      node = 2 * node + 2;
+      low += span;
+    }
+    else
+    {
+      node = 2 * node + 1;
+    }
+  }
+  return low;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : level_valid                                     */
+/*                                                             */
+/* Purpose   : Check a level's geometry and policy             */
+/*                                                             */
+/***************************************************************/
+int level_valid(const armsim_cache_config_t *config)
+{
+  uint64_t sets;
+
+  if (config->line < 4 || (config->line & (config->line - 1)) || config->ways < 1 ||
+      config->ways > 64 || config->size % ((uint64_t)config->ways * config->line) != 0)
+    return FALSE;
+  sets = config->size / ((uint64_t)config->ways * config->line);
+  return (sets & (sets - 1)) == 0 &&
+         (config->replacement == ARMSIM_REPLACE_LRU ||
+          (config->replacement == ARMSIM_REPLACE_PLRU && (config->ways & (config->ways - 1)) == 0));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : level_init / level_free                         */
+/*                                                             */
+/***************************************************************/
+int level_init(cache_level_t *c, const armsim_cache_config_t *config)
+{
+  uint64_t sets = config->size / ((uint64_t)config->ways * config->line);
+
+  memset(c, 0, sizeof(*c));
+  c->config = *config;
+  c->present = TRUE;
+  c->ways = config->ways;
+  c->set_mask = sets - 1;
+  c->line_shift = __builtin_ctz(config->line);
+  c->tags = calloc(sets * c->ways, sizeof(*c->tags));
+  c->trees = calloc(sets, sizeof(*c->trees));
+  if (c->tags == NULL || c->trees == NULL)
+    return ARMSIM_E_NOMEM;
+  return 0;
+}
+
+void level_free(cache_level_t *c)
+{
+  free(c->tags);
+  free(c->trees);
+  c->tags = c->trees = NULL;
+  c->present = FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : level_access                                    */
+/*                                                             */
+/* Purpose   : Look a line up in one level, allocating it on a */
+/*             miss when `allocate`. Returns TRUE on a hit;    */
+/*             *victim gets the dirty line pushed out, or 0.   */
+/*             *slot points at the line's entry when present.  */
+/*                                                             */
+/***************************************************************/
+int level_access(cache_level_t *c, uint64_t line, int region, int allocate,
+                 uint64_t *victim, uint64_t **slot)
+{
+  uint64_t set = line & c->set_mask;
+  uint64_t *tags = c->tags + set * c->ways;
+  uint64_t want = ENTRY(line);
+  uint32_t way, ways = c->ways;
+
+  *victim = 0;
+  *slot = NULL;
+  for (way = 0; way < ways; way++)
+    if ((tags[way] & ~(uint64_t)DIRTY) == want)
+      break;
+
+  if (way < ways)
+  {
+    uint64_t entry = tags[way];
+    c->counts[region].hits++;
+    if (c->config.replacement == ARMSIM_REPLACE_PLRU)
+    {
+      plru_touch(&c->trees[set], ways, way);
+      *slot = &tags[way];
+    }
+    else
+    {
+      memmove(tags + 1, tags, way * sizeof(*tags));
+      tags[0] = entry;
+      *slot = &tags[0];
+    }
+    return TRUE;
+  }
+
+  c->counts[region].misses++;
+  if (!allocate)
+    return FALSE;
+
+  if (c->config.replacement == ARMSIM_REPLACE_PLRU)
+  {
+    /* fill an empty way before evicting */
+    for (way = 0; way < ways && tags[way] != 0; way++)
+      ;
+    if (way == ways)
+      way = plru_victim(c->trees[set], ways);
+    plru_touch(&c->trees[set], ways, way);
+  }
+  else
+  {
+    way = ways - 1;
+  }
+
+  if (tags[way] != 0)
+  {
+    int victim_region = region_of(ENTRY_LINE(tags[way]) << c->line_shift);
+    c->counts[victim_region].evictions++;
+    if (tags[way] & DIRTY)
+    {
+      c->counts[victim_region].writebacks++;
+      *victim = tags[way];
+    }
+  }
+
+  if (c->config.replacement == ARMSIM_REPLACE_PLRU)
+  {
+    tags[way] = want;
+    *slot = &tags[way];
+  }
+  else
+  {
+    memmove(tags + 1, tags, (ways - 1) * sizeof(*tags));
+    tags[0] = want;
+    *slot = &tags[0];
+  }
+  return FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : l2_access                                       */
+/*                                                             */
+/* Purpose   : A read fill or a write from an L1               */
+/*                                                             */
+/***************************************************************/
+void l2_access(struct cache_model *model, uint64_t address, int write)
+{
+  cache_level_t *c = &model->level[ARMSIM_CACHE_L2];
+  uint64_t victim, *slot;
+
+  if (!c->present)
+    return;
+  level_access(c, address >> c->line_shift, region_of(address),
+               !write || c->config.write_back, &victim, &slot);
+  if (write && slot != NULL && c->config.write_back)
+    *slot |= DIRTY;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : l1_access                                       */
+/*                                                             */
+/* Purpose   : One line-sized access to an L1, then to L2 on a */
+/*             miss, a write-through or a dirty eviction       */
+/*                                                             */
+/***************************************************************/
+void l1_access(struct cache_model *model, int level, uint64_t address, int region, int write)
+{
+  cache_level_t *c = &model->level[level];
+  uint64_t victim, *slot;
+  int hit;
+
+  if (!c->present)
+  {
+    l2_access(model, address, write);
+    return;
+  }
+
+  hit = level_access(c, address >> c->line_shift, region,
+                     !write || c->config.write_back, &victim, &slot);
+  if (victim != 0)
+    l2_access(model, ENTRY_LINE(victim) << c->line_shift, TRUE);
+  if (write && !c->config.write_back)
+    l2_access(model, address, TRUE);
+  else if (!hit)
+    l2_access(model, address, FALSE);
+  if (write && slot != NULL && c->config.write_back)
+    *slot |= DIRTY;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_fetch                                     */
+/*                                                             */
+/* Purpose   : Instruction fetch at pc                         */
+/*                                                             */
+/***************************************************************/
+void cache_fetch(uint64_t pc)
+{
+  struct cache_model *model = ARMSIM->cache;
+  cache_level_t *c = &model->level[ARMSIM_CACHE_L1I];
+
+  if (c->present && ENTRY(pc >> c->line_shift) == model->last_fetch)
+  {
+    /* still the MRU line of its set: nothing to update */
+    c->counts[model->last_region].hits++;
+    return;
+  }
+
+  model->last_region = region_of(pc);
+  l1_access(model, ARMSIM_CACHE_L1I, pc, model->last_region, FALSE);
+  if (c->present)
+    model->last_fetch = ENTRY(pc >> c->line_shift);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_data                                      */
+/*                                                             */
+/* Purpose   : A load or store of size bytes at address,       */
+/*             split at line boundaries                        */
+/*                                                             */
+/***************************************************************/
+void cache_data(uint64_t address, int size, int write)
+{
+  struct cache_model *model = ARMSIM->cache;
+  cache_level_t *c = &model->level[ARMSIM_CACHE_L1D];
+  unsigned shift = c->present ? c->line_shift : model->level[ARMSIM_CACHE_L2].line_shift;
+  uint64_t line, last = (address + size - 1) >> shift;
+
+  if (!c->present && !model->level[ARMSIM_CACHE_L2].present)
+    return;
+  for (line = address >> shift; line <= last; line++)
+  {
+    uint64_t at = line == address >> shift ? address : line << shift;
+    l1_access(model, ARMSIM_CACHE_L1D, at, region_of(at), write);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_flush                                     */
+/*                                                             */
+/* Purpose   : Empty every level and clear the statistics      */
+/*                                                             */
+/***************************************************************/
+void cache_flush()
+{
+  struct cache_model *model = ARMSIM->cache;
+  int i;
+
+  if (model == NULL)
+    return;
+  for (i = 0; i < ARMSIM_CACHE_LEVELS; i++)
+  {
+    cache_level_t *c = &model->level[i];
+    if (!c->present)
+      continue;
+    memset(c->tags, 0, (c->set_mask + 1) * c->ways * sizeof(*c->tags));
+    memset(c->trees, 0, (c->set_mask + 1) * sizeof(*c->trees));
+    memset(c->counts, 0, sizeof(c->counts));
+  }
+  model->last_fetch = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_clear_stats                               */
+/*                                                             */
+/* Purpose   : Clear the statistics, keeping every level warm  */
+/*                                                             */
+/***************************************************************/
+void cache_clear_stats()
+{
+  struct cache_model *model = ARMSIM->cache;
+  int i;
+
+  if (model == NULL)
+    return;
+  for (i = 0; i < ARMSIM_CACHE_LEVELS; i++)
+    memset(model->level[i].counts, 0, sizeof(model->level[i].counts));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_free                                      */
+/*                                                             */
+/***************************************************************/
+void cache_free()
+{
+  struct cache_model *model = ARMSIM->cache;
+  int i;
+
+  if (model == NULL)
+    return;
+  for (i = 0; i < ARMSIM_CACHE_LEVELS; i++)
+    level_free(&model->level[i]);
+  free(model);
+  ARMSIM->cache = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_cache_configure(armsim_t *sim, const armsim_cache_config_t *config)
+{
+  struct cache_model *model;
+  int i;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (config == NULL)
+  {
+    cache_free();
+    return 0;
+  }
+
+  for (i = 0; i < ARMSIM_CACHE_LEVELS; i++)
+    if (config[i].size != 0 && !level_valid(&config[i]))
+      return ARMSIM_E_INVAL;
+
+  if ((model = calloc(1, sizeof(*model))) == NULL)
+    return ARMSIM_E_NOMEM;
+  for (i = 0; i < ARMSIM_CACHE_LEVELS; i++)
+  {
+    if (config[i].size != 0 && level_init(&model->level[i], &config[i]) != 0)
+    {
+      /* the current model stays attached */
+      for (i = 0; i < ARMSIM_CACHE_LEVELS; i++)
+        level_free(&model->level[i]);
+      free(model);
+      return ARMSIM_E_NOMEM;
+    }
+  }
+
+  cache_free();
+  ARMSIM->cache = model;
+  trace_update();
+  return 0;
+}
+
+int armsim_cache_stats(armsim_t *sim, int level, armsim_cache_stats_t *stats)
+{
+  int i;
+
+  if (sim == NULL || stats == NULL || level < 0 || level >= ARMSIM_CACHE_LEVELS)
+    return ARMSIM_E_INVAL;
+  memset(stats, 0, sizeof(*stats));
+  if (sim->cache == NULL || !sim->cache->level[level].present)
+    return ARMSIM_E_INVAL;
+
+  for (i = 0; i < ARMSIM_REGIONS; i++)
+  {
+    const armsim_cache_counts_t *counts = &sim->cache->level[level].counts[i];
+    stats->region[i] = *counts;
+    stats->total.hits += counts->hits;
+    stats->total.misses += counts->misses;
+    stats->total.evictions += counts->evictions;
+    stats->total.writebacks += counts->writebacks;
+  }
+  return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <inttypes.h>
+#include "armsim.h"
+
+/* One cache level (cache.c); also driven directly by sweep.c */
+
+typedef struct
+{
+  armsim_cache_config_t config;
+  int present;
+  unsigned line_shift;
+  uint64_t set_mask;
+  uint32_t ways;
+  uint64_t *tags;  /* sets * ways entries */
+  uint64_t *trees; /* pseudo-LRU direction bits, one word per set */
+  armsim_cache_counts_t counts[ARMSIM_REGIONS];
+} cache_level_t;
+
+/* A tag entry is (line number + 1) << 1 | dirty, 0 when empty */
+#define ENTRY(line) (((line) + 1) << 1)
+#define ENTRY_LINE(entry) (((entry) >> 1) - 1)
+#define DIRTY 1
+
+int level_valid(const armsim_cache_config_t *config);
+int level_init(cache_level_t *c, const armsim_cache_config_t *config);
+void level_free(cache_level_t *c);
+int level_access(cache_level_t *c, uint64_t line, int region, int allocate,
+                 uint64_t *victim, uint64_t **slot);
+int region_of(uint64_t address);
+
+#endif
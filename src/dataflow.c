@@ -0,0 +1,253 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: dataflow limit study                           */
+/*                                                             */
+/***************************************************************/
+
+/* The ideal machine: unlimited resources, perfect branch prediction
+ * and one cycle per instruction, so an instruction executes as soon
+ * as its inputs exist. Every register, NZCV and every 32-bit memory
+ * word remembers the cycle its value became available and the
+ * sequence number of the instruction that produced it. Memory words
+ * live in an open-addressing hash keyed by address, so only the
+ * footprint the program touches costs anything. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+
+#ifndef ARMSIM_NO_TIMING
+
+typedef struct
+{
+  uint64_t cycle;    /* value available at the end of this cycle */
+  uint64_t sequence; /* producer's sequence number + 1, 0 = initial */
+} value_t;
+
+typedef struct
+{
+  uint64_t word; /* address / 4 + 1, 0 = empty slot */
+  value_t value;
+} word_t;
+
+struct dataflow
+{
+  value_t regs[REG_FLAGS + 1];
+  word_t *words;
+  uint64_t word_mask, nwords;
+  uint64_t sequence;
+  armsim_dataflow_stats_t stats;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : word_lookup                                     */
+/*                                                             */
+/* Purpose   : The slot of a memory word, inserted when create */
+/*             is set (NULL if out of memory) and grown at     */
+/*             half load                                       */
+/*                                                             */
+/***************************************************************/
+value_t *word_lookup(struct dataflow *d, uint64_t address, int create)
+{
+  uint64_t word = (address >> 2) + 1, i;
+
+  if (create && 2 * (d->nwords + 1) > d->word_mask + 1)
+  {
+    uint64_t size = 2 * (d->word_mask + 1), k;
+    word_t *words = calloc(size, sizeof(*words));
+    if (words == NULL)
+      return NULL;
+    for (k = 0; k <= d->word_mask; k++)
+    {
+      if (d->words[k].word == 0)
+        continue;
+      for (i = (d->words[k].word * 0x9e3779b97f4a7c15ULL >> 20) & (size - 1); words[i].word != 0;
+           i = (i + 1) & (size - 1))
+        ;
+      words[i] = d->words[k];
+    }
+    free(d->words);
+    d->words = words;
+    d->word_mask = size - 1;
+  }
+
+  for (i = (word * 0x9e3779b97f4a7c15ULL >> 20) & d->word_mask; d->words[i].word != 0;
+       i = (i + 1) & d->word_mask)
+    if (d->words[i].word == word)
+      return &d->words[i].value;
+  if (!create)
+    return NULL;
+  d->words[i].word = word;
+  d->nwords++;
+  return &d->words[i].value;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : depend                                          */
+/*                                                             */
+/* Purpose   : Account for one input: histogram its dependency */
+/*             distance and return when it is available        */
+/*                                                             */
+/***************************************************************/
+static inline uint64_t depend(struct dataflow *d, const value_t *value)
+{
+  if (value->sequence != 0)
+  {
+    uint64_t distance = d->sequence + 1 - value->sequence;
+    int bucket = 63 - __builtin_clzll(distance);
+    d->stats.distances[bucket < ARMSIM_DATAFLOW_BUCKETS ? bucket : ARMSIM_DATAFLOW_BUCKETS - 1]++;
+  }
+  return value->cycle;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : dataflow_retire                                 */
+/*                                                             */
+/* Purpose   : Schedule one retired instruction on the ideal   */
+/*             machine                                         */
+/*                                                             */
+/***************************************************************/
+void dataflow_retire(const insn_record_t *r)
+{
+  struct dataflow *d = ARMSIM->dataflow;
+  int words = (r->inst == LDUR || r->inst == STUR) ? 2 : 1;
+  uint64_t start = 0, cycle;
+  value_t produced;
+  int k;
+
+  for (k = 0; k < 3; k++)
+  {
+    if (r->src[k] == REG_NONE)
+      continue;
+    cycle = depend(d, &d->regs[r->src[k]]);
+    if (cycle > start)
+      start = cycle;
+  }
+  if (r->flags & RECORD_LOAD)
+  {
+    for (k = 0; k < words; k++)
+    {
+      value_t *value = word_lookup(d, r->address + 4 * k, FALSE);
+      if (value != NULL && (cycle = depend(d, value)) > start)
+        start = cycle;
+    }
+  }
+
+  produced.cycle = start + 1;
+  produced.sequence = ++d->sequence;
+  if (r->dest != REG_NONE)
+    d->regs[r->dest] = produced;
+  if (r->flags & RECORD_SETS_FLAGS)
+    d->regs[REG_FLAGS] = produced;
+  if (r->flags & RECORD_STORE)
+  {
+    for (k = 0; k < words; k++)
+    {
+      value_t *value = word_lookup(d, r->address + 4 * k, TRUE);
+      if (value != NULL)
+        *value = produced;
+    }
+  }
+
+  if (produced.cycle > d->stats.critical_path)
+    d->stats.critical_path = produced.cycle;
+  d->stats.instructions++;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : dataflow_flush                                  */
+/*                                                             */
+/* Purpose   : Forget every value and clear the statistics     */
+/*                                                             */
+/***************************************************************/
+void dataflow_flush()
+{
+  struct dataflow *d = ARMSIM->dataflow;
+
+  if (d == NULL)
+    return;
+  memset(d->regs, 0, sizeof(d->regs));
+  memset(d->words, 0, (d->word_mask + 1) * sizeof(*d->words));
+  d->nwords = 0;
+  d->sequence = 0;
+  memset(&d->stats, 0, sizeof(d->stats));
+}
+
+void dataflow_free()
+{
+  if (ARMSIM->dataflow != NULL)
+    free(ARMSIM->dataflow->words);
+  free(ARMSIM->dataflow);
+  ARMSIM->dataflow = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_dataflow_enable(armsim_t *sim, int enable)
+{
+  struct dataflow *d;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (!enable)
+  {
+    dataflow_free();
+    return 0;
+  }
+  if (sim->dataflow != NULL)
+    return 0;
+  if ((d = calloc(1, sizeof(*d))) == NULL || (d->words = calloc(1024, sizeof(*d->words))) == NULL)
+  {
+    free(d);
+    return ARMSIM_E_NOMEM;
+  }
+  d->word_mask = 1023;
+  sim->dataflow = d;
+  trace_update();
+  return 0;
+}
+
+int armsim_dataflow_stats(armsim_t *sim, armsim_dataflow_stats_t *stats)
+{
+  if (sim == NULL || stats == NULL || sim->dataflow == NULL)
+    return ARMSIM_E_INVAL;
+  *stats = sim->dataflow->stats;
+  stats->memory_words = sim->dataflow->nwords;
+  return 0;
+}
+
+#else
+
+void dataflow_retire(const insn_record_t *record)
+{
+}
+
+void dataflow_flush()
+{
+}
+
+void dataflow_free()
+{
+}
+
+int armsim_dataflow_enable(armsim_t *sim, int enable)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+int armsim_dataflow_stats(armsim_t *sim, armsim_dataflow_stats_t *stats)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+#endif
@@ -0,0 +1,221 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: periodic state hashing                         */
+/*                                                             */
+/***************************************************************/
+
+/* A state hash folds the registers, PC, NZCV and guest memory into
+ * 64 bits. Memory contributes the XOR of byte_hash(address, byte)
+ * over every non-zero byte, so zeroed memory hashes to 0 and a store
+ * only has to XOR out the bytes it replaces and XOR in the new ones:
+ * while hashing is on, mem_write_32() and armsim_write_mem() keep the
+ * memory term current through hash_store() and nothing is rescanned.
+ *
+ * The file gets one text line per record,
+ *
+ *   <instructions> 0x<pc> <hash>
+ *
+ * every `interval` instructions past `from`, plus one when a run ends
+ * for good (HLT, invalid instruction, idle loop). simulate() runs in
+ * chunks that end exactly at HASH_AT, so records land on the same
+ * instruction counts in every engine and build, and cost nothing
+ * between them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "shell.h"
+
+struct state_hash
+{
+  FILE *out;
+  uint64_t interval, from;
+  uint64_t last;   /* instruction count of the last record */
+  uint64_t memory; /* XOR of byte_hash over non-zero guest bytes */
+};
+
+static inline uint64_t mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static inline uint64_t byte_hash(uint64_t address, uint8_t byte)
+{
+  return byte == 0 ? 0 : mix(address << 8 | byte);
+}
+
+/* The memory term from scratch */
+static uint64_t memory_hash()
+{
+  uint64_t hash = 0, k;
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    const uint8_t *mem = MEM_REGIONS[i].mem;
+    for (k = 0; k < MEM_REGIONS[i].size; k += 8)
+    {
+      uint64_t word;
+      int b;
+      memcpy(&word, mem + k, 8);
+      if (word == 0)
+        continue;
+      for (b = 0; b < 8; b++)
+        hash ^= byte_hash(MEM_REGIONS[i].start + k + b, mem[k + b]);
+    }
+    /* the 3 bytes past the end that unaligned stores can reach */
+    for (k = MEM_REGIONS[i].size; k < MEM_REGIONS[i].size + 3; k++)
+      hash ^= byte_hash(MEM_REGIONS[i].start + k, mem[k]);
+  }
+  return hash;
+}
+
+static uint64_t state_hash(uint64_t memory)
+{
+  uint64_t hash = mix(memory ^ CURRENT_STATE.PC);
+  int k;
+
+  for (k = 0; k < ARM_REGS; k++)
+    hash = mix(hash ^ CURRENT_STATE.REGS[k]);
+  return mix(hash ^ (CURRENT_STATE.FLAG_N << 3 | CURRENT_STATE.FLAG_Z << 2 |
+                     CURRENT_STATE.FLAG_C << 1 | CURRENT_STATE.FLAG_V));
+}
+
+/* len bytes at guest address, now old, are about to become new */
+void hash_store(uint64_t address, const uint8_t *old, const uint8_t *new, size_t len)
+{
+  struct state_hash *h = ARMSIM->hash;
+  size_t k;
+
+  for (k = 0; k < len; k++)
+    if (old[k] != new[k])
+      h->memory ^= byte_hash(address + k, old[k]) ^ byte_hash(address + k, new[k]);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : hash_schedule                                   */
+/*                                                             */
+/* Purpose   : Point HASH_AT at the next record after the      */
+/*             current instruction count                       */
+/*                                                             */
+/***************************************************************/
+void hash_schedule()
+{
+  struct state_hash *h = ARMSIM->hash;
+
+  if (h == NULL)
+    ARMSIM->hash_at = UINT64_MAX;
+  else if (INSTRUCTION_COUNT < h->from)
+    ARMSIM->hash_at = h->from + h->interval;
+  else
+    ARMSIM->hash_at = h->from + ((INSTRUCTION_COUNT - h->from) / h->interval + 1) * h->interval;
+}
+
+/* From simulate(), at HASH_AT or when a run ends for good */
+void hash_emit()
+{
+  struct state_hash *h = ARMSIM->hash;
+
+  if (INSTRUCTION_COUNT != h->last)
+    fprintf(h->out, "%" PRIu64 " 0x%" PRIx64 " %016" PRIx64 "\n", INSTRUCTION_COUNT,
+            CURRENT_STATE.PC, state_hash(h->memory));
+  h->last = INSTRUCTION_COUNT;
+  hash_schedule();
+}
+
+/* The state went back in time: records may repeat counts */
+void hash_rewind()
+{
+  if (ARMSIM->hash == NULL)
+    return;
+  ARMSIM->hash->last = UINT64_MAX;
+  hash_schedule();
+}
+
+/* Guest memory changed behind the store paths */
+void hash_rescan()
+{
+  if (ARMSIM->hash != NULL)
+    ARMSIM->hash->memory = memory_hash();
+}
+
+/* Guest memory was zeroed */
+void hash_flush()
+{
+  if (ARMSIM->hash == NULL)
+    return;
+  ARMSIM->hash->memory = 0;
+  ARMSIM->hash->last = UINT64_MAX;
+  hash_schedule();
+}
+
+void hash_free()
+{
+  struct state_hash *h = ARMSIM->hash;
+
+  if (h == NULL)
+    return;
+  fclose(h->out);
+  free(h);
+  ARMSIM->hash = NULL;
+  hash_schedule();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_hash(armsim_t *sim, uint64_t *hash)
+{
+  if (sim == NULL || hash == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  *hash = state_hash(sim->hash != NULL ? sim->hash->memory : memory_hash());
+  return 0;
+}
+
+int armsim_hash_start(armsim_t *sim, const char *path, uint64_t interval, uint64_t from)
+{
+  struct state_hash *h;
+
+  if (sim == NULL || path == NULL || interval == 0)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  hash_free();
+  if ((h = calloc(1, sizeof(*h))) == NULL)
+    return ARMSIM_E_NOMEM;
+  if ((h->out = fopen(path, "w")) == NULL)
+  {
+    free(h);
+    return ARMSIM_E_IO;
+  }
+  h->interval = interval;
+  h->from = from;
+  h->last = UINT64_MAX;
+  h->memory = memory_hash();
+  sim->hash = h;
+  hash_schedule();
+  return 0;
+}
+
+int armsim_hash_stop(armsim_t *sim)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (sim->hash != NULL && fflush(sim->hash->out) != 0)
+  {
+    hash_free();
+    return ARMSIM_E_IO;
+  }
+  hash_free();
+  return 0;
+}
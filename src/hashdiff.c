@@ -0,0 +1,343 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   hashdiff: find where two simulator runs diverge           */
+/*                                                             */
+/***************************************************************/
+
+/* hashdiff a.hash b.hash
+ *   compares two state hash files written by sim -K and reports the
+ *   first interval where they disagree.
+ *
+ * hashdiff [-k interval] [-f fine] [-n max_insns] [-c commands] simA simB program
+ *   runs the program under both simulator binaries, hashing every
+ *   interval (1000000) instructions. When the hashes disagree it runs
+ *   both again up to the end of the divergent interval, hashing only
+ *   inside it and 64 times more often, until the interval is at most
+ *   fine (1) instructions wide; then it prints the registers that
+ *   differ at its end. The shell commands in the -c file (e.g. input)
+ *   run before go. */
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#define REFINE 64 /* records per divergent interval when re-running */
+
+typedef struct
+{
+  uint64_t count, pc, hash;
+} record_t;
+
+typedef struct
+{
+  record_t *records;
+  size_t n;
+} stream_t;
+
+int read_stream(const char *path, stream_t *s)
+{
+  FILE *in = fopen(path, "r");
+  record_t r;
+  size_t size = 0;
+
+  s->records = NULL;
+  s->n = 0;
+  if (in == NULL)
+    return 0;
+  while (fscanf(in, "%" SCNu64 " %" SCNx64 " %" SCNx64, &r.count, &r.pc, &r.hash) == 3)
+  {
+    if (s->n == size)
+    {
+      size = size ? 2 * size : 1024;
+      if ((s->records = realloc(s->records, size * sizeof(r))) == NULL)
+      {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+      }
+    }
+    s->records[s->n++] = r;
+  }
+  fclose(in);
+  return 1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : compare                                         */
+/*                                                             */
+/* Purpose   : Index of the first record where a and b differ, */
+/*             -1 if they agree throughout. *agreed is the     */
+/*             instruction count both last agreed at.          */
+/*                                                             */
+/***************************************************************/
+long compare(const stream_t *a, const stream_t *b, uint64_t *agreed)
+{
+  size_t k;
+
+  for (k = 0; k < a->n && k < b->n; k++)
+  {
+    const record_t *x = &a->records[k], *y = &b->records[k];
+    if (x->count != y->count || x->pc != y->pc || x->hash != y->hash)
+      return k;
+    *agreed = x->count;
+  }
+  return a->n == b->n ? -1 : (long)k;
+}
+
+void print_record(const char *name, const stream_t *s, long k)
+{
+  if ((size_t)k < s->n)
+    printf("  %s: %" PRIu64 " instructions, PC 0x%" PRIx64 ", hash %016" PRIx64 "\n", name,
+           s->records[k].count, s->records[k].pc, s->records[k].hash);
+  else
+    printf("  %s: no record (the run ended)\n", name);
+}
+
+/* First instruction count past `agreed` that the streams reach */
+uint64_t divergent_end(const stream_t *a, const stream_t *b, long k)
+{
+  uint64_t end = UINT64_MAX;
+
+  if ((size_t)k < a->n)
+    end = a->records[k].count;
+  if ((size_t)k < b->n && b->records[k].count < end)
+    end = b->records[k].count;
+  return end;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run                                             */
+/*                                                             */
+/* Purpose   : Run program under sim with the commands in      */
+/*             input, hashing into hashes; 0 if it can't start */
+/*                                                             */
+/***************************************************************/
+int run(const char *sim, const char *program, const char *input, const char *hashes,
+        uint64_t interval, uint64_t from, uint64_t limit, const char *output)
+{
+  char command[4096];
+  char budget[64] = "";
+
+  if (limit > 0)
+    snprintf(budget, sizeof(budget), "-n %" PRIu64, limit);
+  if (hashes != NULL)
+    snprintf(command, sizeof(command),
+             "'%s' %s -K '%s:%" PRIu64 ":%" PRIu64 "' '%s' < '%s' > '%s' 2>&1", sim, budget,
+             hashes, interval, from, program, input, output);
+  else
+    snprintf(command, sizeof(command), "'%s' %s '%s' < '%s' > '%s' 2>&1", sim, budget, program,
+             input, output);
+  return system(command) == 0;
+}
+
+/* A temporary file holding the -c commands followed by tail */
+char *make_input(const char *commands, const char *tail)
+{
+  char *path = strdup("/tmp/hashdiffXXXXXX");
+  FILE *out, *in;
+  int fd, c;
+
+  if (path == NULL || (fd = mkstemp(path)) < 0 || (out = fdopen(fd, "w")) == NULL)
+  {
+    fprintf(stderr, "Error: Can't create a temporary file\n");
+    exit(1);
+  }
+  if (commands != NULL)
+  {
+    if ((in = fopen(commands, "r")) == NULL)
+    {
+      fprintf(stderr, "Error: Can't open %s\n", commands);
+      exit(1);
+    }
+    while ((c = getc(in)) != EOF)
+      putc(c, out);
+    fclose(in);
+    putc('\n', out);
+  }
+  fputs(tail, out);
+  fclose(out);
+  return path;
+}
+
+char *make_temp()
+{
+  return make_input(NULL, "");
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : show_registers                                  */
+/*                                                             */
+/* Purpose   : Print the rdump lines that differ after count   */
+/*             instructions                                    */
+/*                                                             */
+/***************************************************************/
+void show_registers(char *sims[2], const char *program, const char *commands, uint64_t count)
+{
+  char tail[128], line[2][256];
+  char *input, *output[2];
+  FILE *in[2];
+  int k, differ = 0;
+
+  if (count > INT_MAX)
+    return;
+  snprintf(tail, sizeof(tail), "run %" PRIu64 "\nrdump\nquit\n", count);
+  input = make_input(commands, tail);
+  for (k = 0; k < 2; k++)
+  {
+    output[k] = make_temp();
+    run(sims[k], program, input, NULL, 0, 0, 0, output[k]);
+    in[k] = fopen(output[k], "r");
+  }
+
+  if (in[0] != NULL && in[1] != NULL)
+  {
+    printf("\nState after %" PRIu64 " instructions:\n", count);
+    while (fgets(line[0], sizeof(line[0]), in[0]) != NULL &&
+           fgets(line[1], sizeof(line[1]), in[1]) != NULL)
+    {
+      if (strcmp(line[0], line[1]) == 0 ||
+          (line[0][0] != 'X' && strncmp(line[0], "PC", 2) != 0 && strncmp(line[0], "FLAG", 4) != 0))
+        continue;
+      line[0][strcspn(line[0], "\n")] = '\0';
+      printf("  A %-30s B %s", line[0], line[1]);
+      differ = 1;
+    }
+    if (!differ)
+      printf("  registers, PC and flags agree: the difference is in memory\n");
+  }
+  for (k = 0; k < 2; k++)
+  {
+    if (in[k] != NULL)
+      fclose(in[k]);
+    unlink(output[k]);
+    free(output[k]);
+  }
+  unlink(input);
+  free(input);
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s a.hash b.hash\n"
+          "       %s [-k interval] [-f fine] [-n max_insns] [-c commands] simA simB program\n",
+          name, name);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t interval = 1000000, fine = 1, limit = 0, from = 0, agreed = 0;
+  char *commands = NULL, *input, *hashes[2], *output;
+  char *sims[2];
+  const char *program;
+  stream_t streams[2];
+  long k;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "k:f:n:c:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'k':
+      interval = strtoull(optarg, NULL, 0);
+      break;
+    case 'f':
+      fine = strtoull(optarg, NULL, 0);
+      break;
+    case 'n':
+      limit = strtoull(optarg, NULL, 0);
+      break;
+    case 'c':
+      commands = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (interval == 0 || fine == 0)
+    usage(argv[0]);
+
+  if (argc - optind == 2)
+  {
+    for (i = 0; i < 2; i++)
+      if (!read_stream(argv[optind + i], &streams[i]))
+      {
+        fprintf(stderr, "Error: Can't open %s\n", argv[optind + i]);
+        exit(1);
+      }
+    if ((k = compare(&streams[0], &streams[1], &agreed)) < 0)
+    {
+      printf("The hash streams agree (%zu records)\n", streams[0].n);
+      return 0;
+    }
+    printf("Diverged after %" PRIu64 " instructions, at record %ld:\n", agreed, k);
+    print_record("A", &streams[0], k);
+    print_record("B", &streams[1], k);
+    return 2;
+  }
+  if (argc - optind != 3)
+    usage(argv[0]);
+
+  sims[0] = argv[optind];
+  sims[1] = argv[optind + 1];
+  program = argv[optind + 2];
+  input = make_input(commands, "go\nquit\n");
+  output = make_temp();
+  hashes[0] = make_temp();
+  hashes[1] = make_temp();
+
+  for (;;)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      if (!run(sims[i], program, input, hashes[i], interval, from, limit, output) ||
+          !read_stream(hashes[i], &streams[i]))
+      {
+        fprintf(stderr, "Error: %s did not run %s\n", sims[i], program);
+        exit(1);
+      }
+    }
+    agreed = from;
+    if ((k = compare(&streams[0], &streams[1], &agreed)) < 0)
+    {
+      if (from == 0)
+        printf("The runs agree (%zu records every %" PRIu64 " instructions)\n", streams[0].n,
+               interval);
+      else
+        printf("The runs agree on a re-run: the divergence is not reproducible\n");
+      break;
+    }
+
+    uint64_t end = divergent_end(&streams[0], &streams[1], k);
+    printf("Diverged between %" PRIu64 " and %" PRIu64 " instructions\n", agreed, end);
+    if (end - agreed <= fine || interval <= fine)
+    {
+      print_record("A", &streams[0], k);
+      print_record("B", &streams[1], k);
+      show_registers(sims, program, commands, end);
+      break;
+    }
+
+    /* hash only the divergent interval, more finely, and stop after it */
+    from = agreed;
+    interval = (end - agreed) / REFINE > fine ? (end - agreed) / REFINE : fine;
+    limit = end;
+    for (i = 0; i < 2; i++)
+      free(streams[i].records);
+  }
+
+  unlink(input);
+  unlink(output);
+  unlink(hashes[0]);
+  unlink(hashes[1]);
+  return k < 0 ? 0 : 2;
+}
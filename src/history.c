@@ -0,0 +1,77 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: flight recorder of the last instructions       */
+/*                                                             */
+/***************************************************************/
+
+/* cycle() stores one history_t per retired instruction at
+ * INSTRUCTION_COUNT & history_mask: the pc, the word and whatever the
+ * Rd/Rt field names after the instruction. Nothing else is decided
+ * per instruction; whether that register was written is worked out
+ * from the word when the ring is read. A trapping instruction (a
+ * breakpoint or an invalid word) stores too, but INSTRUCTION_COUNT
+ * does not advance past it, so it is never read back and the next
+ * instruction overwrites it. */
+
+#include <stdlib.h>
+#include "shell.h"
+#include "sim.h"
+
+/* Allocate an empty ring of entries (a power of two) */
+int history_init(size_t entries)
+{
+  history_t *history = calloc(entries, sizeof(*history));
+
+  if (history == NULL)
+    return ARMSIM_E_NOMEM;
+  free(ARMSIM->history);
+  ARMSIM->history = history;
+  ARMSIM->history_mask = entries - 1;
+  ARMSIM->history_start = INSTRUCTION_COUNT;
+  return 0;
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_history_configure(armsim_t *sim, size_t entries)
+{
+  if (sim == NULL || entries == 0 || (entries & (entries - 1)))
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  return history_init(entries);
+}
+
+int armsim_history(armsim_t *sim, armsim_history_entry_t *entries, size_t max)
+{
+  uint64_t count, i;
+  size_t n = 0;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  count = sim->instruction_count - sim->history_start;
+  if (count > sim->history_mask + 1)
+    count = sim->history_mask + 1;
+  if (entries == NULL)
+    return count;
+  if (count > max)
+    count = max;
+
+  for (i = sim->instruction_count - count; i < sim->instruction_count; i++)
+  {
+    const history_t *h = &sim->history[i & sim->history_mask];
+    Instruction inst = decode(h->word);
+    armsim_history_entry_t *e = &entries[n++];
+
+    e->pc = h->pc;
+    e->word = h->word;
+    e->name = inst >= 0 ? instruction_names[inst] : "INVALID";
+    e->dest = writes_register(inst) ? (int)(h->word & (ARM_REGS - 1)) : -1;
+    e->value = e->dest >= 0 ? h->value : 0;
+  }
+  return n;
+}
@@ -0,0 +1,325 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: host cost of each instruction, per phase       */
+/*                                                             */
+/***************************************************************/
+
+/* Built with make PROFILE=1 (-DARMSIM_HOST_PROFILE), cycle() reads
+ * the host timestamp counter (rdtsc on x86, CNTVCT_EL0 on AArch64)
+ * at four points of every instruction and charges the intervals to
+ * its Instruction, as host ticks:
+ *
+ *   fetch    the pre-decoded slot (decoding it on a miss) and the
+ *            fetch taps of the timing models
+ *   execute  the handler in process_instruction()'s switch
+ *   commit   the PC update, the retire tap, the flight recorder
+ *            and the state copy at the end of cycle()
+ *
+ * AddWithCarry() and the guest memory lookups of mem_read_32() and
+ * mem_write_32(), which every handler goes through to re-read its
+ * own word, are timed again inside whatever phase calls them. Each
+ * instruction's total also lands in a log2 histogram.
+ *
+ * The probes cost ticks of their own. armsim_host_profile_start()
+ * times them with nothing between them and subtracts that bias (the
+ * median of many runs) from every interval, and from the enclosing
+ * phase the cost of every nested timer. The counter is not
+ * serializing, so single intervals are fuzzy by a few tens of ticks;
+ * the sums over millions of instructions are what to read. Without
+ * PROFILE=1 the hooks compile to nothing and the API returns
+ * ARMSIM_E_NOSYS. Like the timing models it counts only the region
+ * of interest, and lanes running in lockstep are not profiled. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "sim.h"
+
+#ifdef ARMSIM_HOST_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define HOST_ROWS (MAGIC + 2) /* every Instruction, then "other" */
+#define HOST_OTHER (MAGIC + 1)
+#define CALIBRATION_RUNS 4001
+
+struct host_profile
+{
+  uint64_t bias[HOST_PHASES]; /* ticks an empty phase measures */
+  uint64_t nested_bias;       /* ticks an empty nested timer measures */
+  uint64_t nested_cost;       /* ticks it adds to its phase */
+
+  uint64_t last;    /* timestamp the current phase started at */
+  uint64_t pending; /* nested timer cost inside the current phase */
+  uint64_t total;   /* this instruction so far */
+  uint64_t stack[4];
+  int depth;
+  int row, phase; /* row -1: outside the region of interest */
+  int calibrating;
+
+  armsim_host_cost_t rows[HOST_ROWS];
+};
+
+static inline uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t t;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Close the current phase at now */
+static inline void charge(struct host_profile *p, uint64_t now)
+{
+  uint64_t delta = now - p->last, cost = p->bias[p->phase] + p->pending;
+
+  delta = delta > cost ? delta - cost : 0;
+  p->rows[p->row].ticks[p->phase] += delta;
+  p->total += delta;
+  p->pending = 0;
+  p->last = now;
+}
+
+/* From cycle(), before process_instruction() */
+void host_begin()
+{
+  struct host_profile *p = ARMSIM->host_profile;
+
+  p->row = ARMSIM->roi_active || p->calibrating ? HOST_OTHER : -1;
+  p->phase = HOST_FETCH;
+  p->total = p->pending = 0;
+  p->depth = 0;
+  p->last = ticks();
+}
+
+/* From process_instruction(): the phase inst was in is over */
+void host_mark(int inst)
+{
+  struct host_profile *p = ARMSIM->host_profile;
+  uint64_t now = ticks();
+
+  if (p->row < 0)
+    return;
+  p->row = inst >= 0 && inst <= MAGIC ? inst : HOST_OTHER;
+  charge(p, now);
+  if (p->phase < HOST_COMMIT)
+    p->phase++;
+}
+
+/* From cycle(), once the instruction has retired (or trapped) */
+void host_end()
+{
+  struct host_profile *p = ARMSIM->host_profile;
+  armsim_host_cost_t *row;
+  int bucket;
+
+  if (p->row < 0)
+    return;
+  charge(p, ticks());
+  row = &p->rows[p->row];
+  row->count++;
+  bucket = p->total < 2 ? 0 : 63 - __builtin_clzll(p->total);
+  row->histogram[bucket < ARMSIM_HOST_BUCKETS ? bucket : ARMSIM_HOST_BUCKETS - 1]++;
+  /* loads and shell reads between instructions are nobody's */
+  p->row = -1;
+}
+
+/* Around AddWithCarry() and the guest memory lookups */
+void host_enter()
+{
+  struct host_profile *p = ARMSIM->host_profile;
+
+  if (p->depth < 4)
+    p->stack[p->depth] = ticks();
+  p->depth++;
+}
+
+void host_leave(int what)
+{
+  struct host_profile *p = ARMSIM->host_profile;
+  uint64_t delta;
+
+  if (--p->depth >= 4 || p->row < 0)
+    return;
+  delta = ticks() - p->stack[p->depth];
+  delta = delta > p->nested_bias ? delta - p->nested_bias : 0;
+  if (what == HOST_FLAGS)
+    p->rows[p->row].flags_ticks += delta;
+  else
+    p->rows[p->row].memory_ticks[p->phase] += delta;
+  p->pending += p->nested_cost;
+}
+
+/* HLT #0x100 and reset start the profile over */
+void host_flush()
+{
+  struct host_profile *p = ARMSIM->host_profile;
+
+  if (p != NULL)
+    memset(p->rows, 0, sizeof(p->rows));
+}
+
+void host_free()
+{
+  free(ARMSIM->host_profile);
+  ARMSIM->host_profile = NULL;
+}
+
+static int by_value(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint64_t median(uint64_t *samples)
+{
+  qsort(samples, CALIBRATION_RUNS, sizeof(uint64_t), by_value);
+  return samples[CALIBRATION_RUNS / 2];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : calibrate                                       */
+/*                                                             */
+/* Purpose   : Measure what the probes alone read: empty       */
+/*             phases, then an empty nested timer in execute.  */
+/*             Returns 0 or ARMSIM_E_NOMEM                     */
+/*                                                             */
+/***************************************************************/
+static int calibrate(struct host_profile *p)
+{
+  uint64_t(*samples)[CALIBRATION_RUNS];
+  armsim_host_cost_t *row = &p->rows[HOST_OTHER];
+  uint64_t before[HOST_PHASES], nested;
+  int k, phase;
+
+  if ((samples = malloc((HOST_PHASES + 2) * sizeof(*samples))) == NULL)
+    return ARMSIM_E_NOMEM;
+  p->calibrating = TRUE;
+  for (k = 0; k < CALIBRATION_RUNS; k++)
+  {
+    memcpy(before, row->ticks, sizeof(before));
+    host_begin();
+    host_mark(-1);
+    host_mark(-1);
+    host_end();
+    for (phase = 0; phase < HOST_PHASES; phase++)
+      samples[phase][k] = row->ticks[phase] - before[phase];
+  }
+  for (phase = 0; phase < HOST_PHASES; phase++)
+    p->bias[phase] = median(samples[phase]);
+
+  for (k = 0; k < CALIBRATION_RUNS; k++)
+  {
+    before[HOST_EXECUTE] = row->ticks[HOST_EXECUTE];
+    nested = row->flags_ticks;
+    host_begin();
+    host_mark(-1);
+    host_enter();
+    host_leave(HOST_FLAGS);
+    host_mark(-1);
+    host_end();
+    samples[HOST_PHASES][k] = row->ticks[HOST_EXECUTE] - before[HOST_EXECUTE];
+    samples[HOST_PHASES + 1][k] = row->flags_ticks - nested;
+  }
+  /* execute already had its own bias taken off */
+  p->nested_cost = median(samples[HOST_PHASES]);
+  p->nested_bias = median(samples[HOST_PHASES + 1]);
+  p->calibrating = FALSE;
+  host_flush();
+  free(samples);
+  return 0;
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_host_profile_start(armsim_t *sim)
+{
+  struct host_profile *p;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if ((p = calloc(1, sizeof(*p))) == NULL)
+    return ARMSIM_E_NOMEM;
+  host_free();
+  sim->host_profile = p;
+  if (calibrate(p) != 0)
+  {
+    host_free();
+    return ARMSIM_E_NOMEM;
+  }
+  return 0;
+}
+
+int armsim_host_profile(armsim_t *sim, armsim_host_cost_t *rows, size_t max,
+                        armsim_host_bias_t *bias)
+{
+  struct host_profile *p;
+  size_t n = 0;
+  int k;
+
+  if (sim == NULL || (rows == NULL && max > 0))
+    return ARMSIM_E_INVAL;
+  if ((p = sim->host_profile) == NULL)
+    return ARMSIM_E_INVAL;
+  for (k = 0; k < HOST_ROWS; k++)
+  {
+    if (p->rows[k].count == 0)
+      continue;
+    if (n < max)
+    {
+      rows[n] = p->rows[k];
+      rows[n].name = k == HOST_OTHER ? "other" : instruction_names[k];
+    }
+    n++;
+  }
+  if (bias != NULL)
+  {
+    memcpy(bias->phase, p->bias, sizeof(bias->phase));
+    bias->nested = p->nested_bias;
+    bias->nested_cost = p->nested_cost;
+  }
+  return n;
+}
+
+#else
+
+void host_flush()
+{
+}
+
+void host_free()
+{
+}
+
+int armsim_host_profile_start(armsim_t *sim)
+{
+  (void)sim;
+  return ARMSIM_E_NOSYS;
+}
+
+int armsim_host_profile(armsim_t *sim, armsim_host_cost_t *rows, size_t max,
+                        armsim_host_bias_t *bias)
+{
+  (void)sim;
+  (void)rows;
+  (void)max;
+  (void)bias;
+  return ARMSIM_E_NOSYS;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   hotblocks.so: example plugin, the hottest basic blocks    */
+/*                                                             */
+/***************************************************************/
+
+/* sim -L ./hotblocks.so[:N] counts the instructions each block
+ * retires and the loads and stores it makes, and prints the N (10)
+ * hottest blocks every time the program halts. Everything arrives
+ * in per-block batches, so the plugin never runs per instruction.
+ * Only the region of interest is counted. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "armsim.h"
+
+typedef struct
+{
+  uint64_t pc; /* + 1, 0 = empty slot */
+  uint64_t executions, instructions;
+  uint64_t loads, stores;
+} hot_t;
+
+typedef struct
+{
+  hot_t *blocks;
+  uint64_t mask, count;
+  uint64_t pending[2]; /* loads and stores of the block executing */
+  int top;
+} hotblocks_t;
+
+static hot_t *lookup(hotblocks_t *h, uint64_t pc)
+{
+  uint64_t key = pc + 1, i;
+
+  if (2 * (h->count + 1) > h->mask + 1)
+  {
+    uint64_t size = 2 * (h->mask + 1), k;
+    hot_t *blocks = calloc(size, sizeof(*blocks));
+    if (blocks == NULL)
+      return NULL;
+    for (k = 0; k <= h->mask; k++)
+    {
+      if (h->blocks[k].pc == 0)
+        continue;
+      for (i = (h->blocks[k].pc * 0x9e3779b97f4a7c15ULL >> 20) & (size - 1); blocks[i].pc != 0;
+           i = (i + 1) & (size - 1))
+        ;
+      blocks[i] = h->blocks[k];
+    }
+    free(h->blocks);
+    h->blocks = blocks;
+    h->mask = size - 1;
+  }
+  for (i = (key * 0x9e3779b97f4a7c15ULL >> 20) & h->mask; h->blocks[i].pc != 0;
+       i = (i + 1) & h->mask)
+    if (h->blocks[i].pc == key)
+      return &h->blocks[i];
+  h->blocks[i].pc = key;
+  h->count++;
+  return &h->blocks[i];
+}
+
+/* A block's memory batches always arrive before its exec */
+static void memory(void *ctx, const armsim_mem_access_t *accesses, size_t count)
+{
+  hotblocks_t *h = ctx;
+  size_t k;
+
+  for (k = 0; k < count; k++)
+    h->pending[accesses[k].write != 0]++;
+}
+
+static void exec(void *ctx, uint64_t pc, uint64_t count)
+{
+  hotblocks_t *h = ctx;
+  hot_t *block = lookup(h, pc);
+
+  if (block != NULL)
+  {
+    block->executions++;
+    block->instructions += count;
+    block->loads += h->pending[0];
+    block->stores += h->pending[1];
+  }
+  h->pending[0] = h->pending[1] = 0;
+}
+
+static int by_instructions(const void *a, const void *b)
+{
+  const hot_t *x = a, *y = b;
+  return x->instructions < y->instructions ? 1 : x->instructions > y->instructions ? -1 : 0;
+}
+
+static void halt(void *ctx, int status)
+{
+  hotblocks_t *h = ctx;
+  hot_t *sorted = malloc(h->count * sizeof(*sorted));
+  uint64_t k, n = 0, total = 0;
+
+  if (sorted == NULL)
+    return;
+  for (k = 0; k <= h->mask; k++)
+    if (h->blocks[k].pc != 0)
+    {
+      sorted[n++] = h->blocks[k];
+      total += h->blocks[k].instructions;
+    }
+  qsort(sorted, n, sizeof(*sorted), by_instructions);
+
+  printf("Hot blocks (%" PRIu64 " blocks, %" PRIu64 " instructions)\n", n, total);
+  printf("%-18s %12s %14s %7s %12s %12s\n", "Block", "Executions", "Instructions", "Share",
+         "Loads", "Stores");
+  for (k = 0; k < n && k < (uint64_t)h->top; k++)
+    printf("0x%016" PRIx64 " %12" PRIu64 " %14" PRIu64 " %6.2f%% %12" PRIu64 " %12" PRIu64 "\n",
+           sorted[k].pc - 1, sorted[k].executions, sorted[k].instructions,
+           total ? 100.0 * sorted[k].instructions / total : 0.0, sorted[k].loads,
+           sorted[k].stores);
+  printf("\n");
+  free(sorted);
+}
+
+/* HLT #0x100 starts the counts over */
+static void roi(void *ctx, int marker)
+{
+  hotblocks_t *h = ctx;
+
+  if (marker != ARMSIM_ROI_RESET)
+    return;
+  memset(h->blocks, 0, (h->mask + 1) * sizeof(hot_t));
+  h->count = 0;
+  h->pending[0] = h->pending[1] = 0;
+}
+
+static void unload(void *ctx)
+{
+  hotblocks_t *h = ctx;
+  free(h->blocks);
+  free(h);
+}
+
+ARMSIM_API int armsim_plugin_init(armsim_t *sim, const char *args)
+{
+  static const armsim_plugin_t callbacks = {NULL, exec, memory, halt, unload, roi};
+  hotblocks_t *h = calloc(1, sizeof(*h));
+  int result;
+
+  if (h == NULL || (h->blocks = calloc(1024, sizeof(hot_t))) == NULL)
+  {
+    free(h);
+    return ARMSIM_E_NOMEM;
+  }
+  h->mask = 1023;
+  h->top = *args ? atoi(args) : 10;
+  if ((result = armsim_plugin_register(sim, &callbacks, h)) < 0)
+    unload(h);
+  return result;
+}
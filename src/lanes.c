@@ -0,0 +1,913 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: lane-parallel lockstep execution               */
+/*                                                             */
+/***************************************************************/
+
+/* Many initial register files, one program. Lanes share the PC and
+ * the decoded instruction, so every ALU instruction becomes a loop
+ * over a structure-of-arrays register file that the compiler turns
+ * into vector code. Whenever the lanes would stop agreeing -- a
+ * divergent branch, a store into the text segment, a watchdog event
+ * that needs per-lane handling -- the lanes concerned are handed to
+ * the scalar engine at that instruction, so every lane ends exactly
+ * as armsim_run would have left it.
+ *
+ * A lane that stores, or leaves, gets an instance of its own with a
+ * copy of the image's memory. Lanes that leave run to the end one
+ * after another, so once a lane is done its instance goes back to a
+ * pool and the next lane takes it over, after copying back only the
+ * pages it stored to: a run pays for as many instances as lanes hold
+ * at once, not one per lane. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "sim.h"
+
+#define LANE_GROUP 256 /* lanes run in lockstep at a time */
+#define LANE_CHUNK 4096 /* granularity of the image page copy */
+
+typedef struct
+{
+  uint64_t check_at, budget_at, clock_at, probe_at;
+  uint64_t probe_target;
+  int boundaries_left;
+} lane_watchdog_t;
+
+typedef struct
+{
+  /* lane state, one column per lane */
+  int64_t regs[ARM_REGS][LANE_GROUP];
+  int64_t flag_n[LANE_GROUP], flag_z[LANE_GROUP];
+  int64_t flag_v[LANE_GROUP], flag_c[LANE_GROUP];
+  /* loop probe snapshot, see boundary_checks() */
+  int64_t probe_regs[ARM_REGS][LANE_GROUP];
+  int64_t probe_n[LANE_GROUP], probe_z[LANE_GROUP];
+  int64_t probe_v[LANE_GROUP], probe_c[LANE_GROUP];
+  uint64_t probe_writes[LANE_GROUP];
+  /* operand scratch */
+  int64_t operand[LANE_GROUP], carry[LANE_GROUP];
+  uint8_t live[LANE_GROUP];
+  armsim_t *memory[LANE_GROUP]; /* private copy once the lane stores */
+  armsim_t *pool[LANE_GROUP];   /* spare copies, memory as in the image */
+  int npool;
+
+  int width, nlive;
+  uint64_t pc, count, skip_pc;
+  lane_watchdog_t watchdog;
+  struct timespec deadline;
+
+  armsim_t *image;
+  uint32_t *chunks; /* non-zero image chunks: region << 24 | index */
+  int nchunks;
+  armsim_lane_result_t *results;
+} lanes_t;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : image_chunks                                    */
+/*                                                             */
+/* Purpose   : List the image chunks a lane copy must carry    */
+/*                                                             */
+/***************************************************************/
+static int image_chunks(lanes_t *L)
+{
+  static const uint8_t zero[LANE_CHUNK];
+  armsim_t *image = L->image;
+  int i, max = 0;
+  uint64_t k;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+    max += (image->regions[i].size + 3 + LANE_CHUNK - 1) / LANE_CHUNK;
+  L->chunks = malloc(max * sizeof(uint32_t));
+  if (L->chunks == NULL)
+    return ARMSIM_E_NOMEM;
+
+  L->nchunks = 0;
+  for (i = 0; i < MEM_NREGIONS; i++)
+  {
+    uint64_t size = image->regions[i].size + 3;
+    for (k = 0; k * LANE_CHUNK < size; k++)
+    {
+      uint64_t len = size - k * LANE_CHUNK < LANE_CHUNK ? size - k * LANE_CHUNK : LANE_CHUNK;
+      if (memcmp(image->regions[i].mem + k * LANE_CHUNK, zero, len) != 0)
+        L->chunks[L->nchunks++] = (uint32_t)i << 24 | k;
+    }
+  }
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane_instance                                   */
+/*                                                             */
+/* Purpose   : A new instance with the image's memory and      */
+/*             breakpoints. NULL on failure.                   */
+/*                                                             */
+/***************************************************************/
+static armsim_t *lane_instance(lanes_t *L)
+{
+  armsim_t *image = L->image;
+  armsim_t *sim;
+  int i, k;
+
+  if ((sim = armsim_create()) == NULL)
+    return NULL;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+    sim->regions[i].size = image->regions[i].size;
+
+  for (k = 0; k < L->nchunks; k++)
+  {
+    uint64_t offset = (uint64_t)(L->chunks[k] & 0xffffff) * LANE_CHUNK;
+    mem_region_t *from = &image->regions[L->chunks[k] >> 24];
+    uint64_t len = from->size + 3 - offset;
+    if (len > LANE_CHUNK)
+      len = LANE_CHUNK;
+    memcpy(sim->regions[L->chunks[k] >> 24].mem + offset, from->mem + offset, len);
+  }
+  for (i = 0; i < image->num_breakpoints; i++)
+    armsim_break_add(sim, image->breakpoints[i]);
+  return sim;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane_memory                                     */
+/*                                                             */
+/* Purpose   : The instance holding lane l's memory, taken     */
+/*             from the pool or copied from the image on first */
+/*             use. NULL on failure.                           */
+/*                                                             */
+/***************************************************************/
+static armsim_t *lane_memory(lanes_t *L, int l)
+{
+  armsim_t *image = L->image;
+  armsim_t *sim = L->memory[l];
+
+  if (sim != NULL)
+    return sim;
+  if (L->npool > 0)
+    sim = L->pool[--L->npool];
+  else if ((sim = lane_instance(L)) == NULL)
+    return NULL;
+
+  sim->break_skip_pc = 0;
+  sim->mem_writes = image->mem_writes;
+  /* no ROI marker runs in lockstep, so the region is still the image's */
+  sim->roi_active = image->roi_active;
+  sim->roi_offset = image->roi_offset;
+  sim->roi_count = image->roi_count;
+  sim->instruction_limit = image->instruction_limit;
+  sim->time_limit = image->time_limit;
+  L->memory[l] = sim;
+  return sim;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane_release                                    */
+/*                                                             */
+/* Purpose   : Return lane l's instance, if it has one, to the  */
+/*             pool. Only the pages it stored to differ from   */
+/*             the image, and its dirty bits say which.        */
+/*                                                             */
+/***************************************************************/
+static void lane_release(lanes_t *L, int l)
+{
+  armsim_t *image = L->image;
+  armsim_t *sim = L->memory[l], *current = ARMSIM;
+  uint64_t w, offset, len, a;
+  int i;
+
+  if (sim == NULL)
+    return;
+  ARMSIM = sim;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    for (w = 0; w < DIRTY_WORDS(MEM_REGIONS[i].size); w++)
+      for (; sim->dirty[i][w] != 0; sim->dirty[i][w] &= sim->dirty[i][w] - 1)
+      {
+        offset = (64 * w + __builtin_ctzll(sim->dirty[i][w])) * MEM_PAGE;
+        len = MEM_REGIONS[i].size + 3 - offset;
+        if (len > MEM_PAGE)
+          len = MEM_PAGE;
+        memcpy(MEM_REGIONS[i].mem + offset, image->regions[i].mem + offset, len);
+        if (i == 0)
+          for (a = 0; a < len; a += 4)
+            predecode_invalidate(MEM_REGIONS[i].start + offset + a);
+      }
+  L->pool[L->npool++] = sim;
+  L->memory[l] = NULL;
+  ARMSIM = current;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane_writes                                     */
+/*                                                             */
+/***************************************************************/
+static uint64_t lane_writes(lanes_t *L, int l)
+{
+  return L->memory[l] != NULL ? L->memory[l]->mem_writes : L->image->mem_writes;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane_finish                                     */
+/*                                                             */
+/* Purpose   : Report a lane that ends in lockstep             */
+/*                                                             */
+/***************************************************************/
+static void lane_finish(lanes_t *L, int l, int status, uint64_t pc, uint64_t count)
+{
+  armsim_lane_result_t *result = &L->results[l];
+  int k;
+
+  result->status = status;
+  result->nzcv = (L->flag_n[l] ? ARMSIM_FLAG_N : 0) | (L->flag_z[l] ? ARMSIM_FLAG_Z : 0) |
+                 (L->flag_c[l] ? ARMSIM_FLAG_C : 0) | (L->flag_v[l] ? ARMSIM_FLAG_V : 0);
+  result->instructions = count;
+  result->pc = pc;
+  for (k = 0; k < ARM_REGS; k++)
+    result->regs[k] = L->regs[k][l];
+  result->lockstep = TRUE;
+  L->live[l] = FALSE;
+  L->nlive--;
+  lane_release(L, l);
+}
+
+static void lanes_finish(lanes_t *L, int status, uint64_t pc, uint64_t count)
+{
+  int l;
+  for (l = 0; l < L->width; l++)
+    if (L->live[l])
+      lane_finish(L, l, status, pc, count);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane_leave                                      */
+/*                                                             */
+/* Purpose   : Hand lane l, about to execute the instruction   */
+/*             at the shared PC, to the scalar engine and run  */
+/*             it to the end with watchdog state `watchdog`    */
+/*                                                             */
+/***************************************************************/
+static void lane_leave(lanes_t *L, int l, const lane_watchdog_t *watchdog)
+{
+  armsim_lane_result_t *result = &L->results[l];
+  armsim_t *sim = lane_memory(L, l);
+  int k;
+
+  memset(result, 0, sizeof(*result));
+  L->live[l] = FALSE;
+  L->nlive--;
+  if (sim == NULL)
+  {
+    result->status = ARMSIM_E_NOMEM;
+    return;
+  }
+
+  ARMSIM = sim;
+  CURRENT_STATE.PC = L->pc;
+  for (k = 0; k < ARM_REGS; k++)
+  {
+    CURRENT_STATE.REGS[k] = L->regs[k][l];
+    sim->probe.state.REGS[k] = L->probe_regs[k][l];
+  }
+  CURRENT_STATE.FLAG_N = L->flag_n[l];
+  CURRENT_STATE.FLAG_Z = L->flag_z[l];
+  CURRENT_STATE.FLAG_V = L->flag_v[l];
+  CURRENT_STATE.FLAG_C = L->flag_c[l];
+  NEXT_STATE = CURRENT_STATE;
+  RUN_BIT = TRUE;
+  INSTRUCTION_COUNT = L->count;
+
+  sim->budget_at = watchdog->budget_at;
+  sim->clock_at = watchdog->clock_at;
+  sim->probe_at = watchdog->probe_at;
+  sim->deadline = L->deadline;
+  sim->probe.target = watchdog->probe_target;
+  sim->probe.boundaries_left = watchdog->boundaries_left;
+  sim->probe.mem_writes = L->probe_writes[l];
+  sim->probe.state.FLAG_N = L->probe_n[l];
+  sim->probe.state.FLAG_Z = L->probe_z[l];
+  sim->probe.state.FLAG_V = L->probe_v[l];
+  sim->probe.state.FLAG_C = L->probe_c[l];
+  schedule_checks();
+
+  pcprof_source(L->image, &sim->current.PC, ARMSIM_TIER_SCALAR);
+  result->status = simulate(UINT64_MAX);
+  pcprof_source(L->image, &L->pc, ARMSIM_TIER_LANES);
+  disarm_watchdog();
+
+  result->nzcv = armsim_get_flags(sim);
+  result->instructions = sim->instruction_count;
+  result->pc = sim->current.PC;
+  for (k = 0; k < ARM_REGS; k++)
+    result->regs[k] = sim->current.REGS[k];
+  result->lockstep = FALSE;
+  lane_release(L, l);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_schedule                                  */
+/*                                                             */
+/* Purpose   : schedule_checks() for the lockstep watchdog     */
+/*                                                             */
+/***************************************************************/
+static void lanes_schedule(lane_watchdog_t *watchdog)
+{
+  watchdog->check_at = watchdog->budget_at;
+  if (watchdog->clock_at < watchdog->check_at)
+    watchdog->check_at = watchdog->clock_at;
+  if (watchdog->probe_at < watchdog->check_at)
+    watchdog->check_at = watchdog->probe_at;
+  if (watchdog->boundaries_left > 0)
+    watchdog->check_at = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_boundary                                  */
+/*                                                             */
+/* Purpose   : block_boundary() for a branch every live lane   */
+/*             takes. Lanes that stop here leave lockstep.     */
+/*                                                             */
+/***************************************************************/
+static void lanes_boundary(lanes_t *L, uint64_t target)
+{
+  lane_watchdog_t *watchdog = &L->watchdog;
+  lane_watchdog_t before = *watchdog;
+  int l, k;
+
+  if (target == L->pc)
+  {
+    /* a branch to itself never changes state again */
+    lanes_finish(L, ARMSIM_IDLE_LOOP, target, L->count + 1);
+    return;
+  }
+  if (L->count < watchdog->check_at)
+    return;
+
+  if (L->count >= watchdog->budget_at)
+  {
+    for (l = 0; l < L->width; l++)
+      if (L->live[l])
+        lane_leave(L, l, &before);
+    return;
+  }
+
+  if (L->count >= watchdog->clock_at)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > L->deadline.tv_sec ||
+        (now.tv_sec == L->deadline.tv_sec && now.tv_nsec >= L->deadline.tv_nsec))
+    {
+      for (l = 0; l < L->width; l++)
+        if (L->live[l])
+          lane_leave(L, l, &before);
+      return;
+    }
+    watchdog->clock_at = L->count + CLOCK_CHECK_INTERVAL;
+  }
+
+  if (watchdog->boundaries_left > 0)
+  {
+    if (target == watchdog->probe_target)
+    {
+      /* lanes back in their probed state loop forever */
+      for (l = 0; l < L->width; l++)
+      {
+        if (!L->live[l] || lane_writes(L, l) != L->probe_writes[l] ||
+            L->flag_n[l] != L->probe_n[l] || L->flag_z[l] != L->probe_z[l] ||
+            L->flag_v[l] != L->probe_v[l] || L->flag_c[l] != L->probe_c[l])
+          continue;
+        for (k = 0; k < ARM_REGS && L->regs[k][l] == L->probe_regs[k][l]; k++)
+          ;
+        if (k == ARM_REGS)
+          lane_finish(L, l, ARMSIM_IDLE_LOOP, target, L->count + 1);
+      }
+      watchdog->boundaries_left = 0;
+    }
+    else
+    {
+      watchdog->boundaries_left--;
+    }
+  }
+  else if (L->count >= watchdog->probe_at)
+  {
+    memcpy(L->probe_regs, L->regs, sizeof(L->regs));
+    memcpy(L->probe_n, L->flag_n, sizeof(L->flag_n));
+    memcpy(L->probe_z, L->flag_z, sizeof(L->flag_z));
+    memcpy(L->probe_v, L->flag_v, sizeof(L->flag_v));
+    memcpy(L->probe_c, L->flag_c, sizeof(L->flag_c));
+    for (l = 0; l < L->width; l++)
+      L->probe_writes[l] = lane_writes(L, l);
+    watchdog->probe_target = target;
+    watchdog->boundaries_left = PROBE_BOUNDARIES;
+    watchdog->probe_at = L->count + PROBE_INTERVAL;
+  }
+
+  lanes_schedule(watchdog);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_split                                     */
+/*                                                             */
+/* Purpose   : Keep the majority side of a conditional branch  */
+/*             in lockstep; the other lanes leave before it.   */
+/*             Returns whether the remaining lanes take it.    */
+/*                                                             */
+/***************************************************************/
+static int lanes_split(lanes_t *L, const uint8_t *taken)
+{
+  int l, ntaken = 0, keep;
+
+  for (l = 0; l < L->width; l++)
+    if (L->live[l])
+      ntaken += taken[l];
+  keep = 2 * ntaken >= L->nlive;
+  if (ntaken != 0 && ntaken != L->nlive)
+    for (l = 0; l < L->width; l++)
+      if (L->live[l] && taken[l] != keep)
+        lane_leave(L, l, &L->watchdog);
+  return keep;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_add                                       */
+/*                                                             */
+/* Purpose   : AddWithCarry over every lane; nflags is 0 (no   */
+/*             flags), 2 (N and Z) or 4 (NZCV)                 */
+/*                                                             */
+/***************************************************************/
+static void lanes_add(lanes_t *L, int d, int n, const int64_t *y, const int64_t *carry,
+                      int write, int nflags)
+{
+  int l;
+  int64_t *rd = L->regs[d];
+  const int64_t *rn = L->regs[n];
+
+  for (l = 0; l < LANE_GROUP; l++)
+  {
+    uint64_t a = rn[l], b = y[l];
+    uint64_t sum = a + b + carry[l];
+    int64_t sa = a, sb = b, ss = sum;
+
+    if (nflags >= 2)
+    {
+      L->flag_n[l] = sum >> 63;
+      L->flag_z[l] = sum == 0;
+    }
+    if (nflags == 4)
+    {
+      L->flag_c[l] = (sum < a) | (sum < b) | (carry[l] & (sum == UINT64_MAX));
+      L->flag_v[l] = ((sa >= 0) & (sb >= 0) & (ss < 0)) | ((sa < 0) & (sb < 0) & (ss >= 0));
+    }
+    if (write)
+      rd[l] = sum;
+  }
+}
+
+static void lanes_fill(int64_t *column, int64_t value)
+{
+  int l;
+  for (l = 0; l < LANE_GROUP; l++)
+    column[l] = value;
+}
+
+static void lanes_not(int64_t *column, const int64_t *from)
+{
+  int l;
+  for (l = 0; l < LANE_GROUP; l++)
+    column[l] = ~from[l];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_store                                     */
+/*                                                             */
+/* Purpose   : Per-lane store of the given width (8 = STUR,    */
+/*             otherwise one 32-bit write of data & mask)      */
+/*                                                             */
+/***************************************************************/
+static void lanes_store(lanes_t *L, int n, int t, int64_t offset, int wide, uint32_t mask)
+{
+  int l;
+
+  for (l = 0; l < L->width; l++)
+  {
+    if (!L->live[l])
+      continue;
+    uint64_t address = L->regs[n][l] + offset;
+    uint64_t data = L->regs[t][l];
+
+    /* self-modifying lanes run a different program from here */
+    if (address + 4 - MEM_TEXT_START < MEM_TEXT_SIZE + 4)
+    {
+      lane_leave(L, l, &L->watchdog);
+      continue;
+    }
+    if ((ARMSIM = lane_memory(L, l)) == NULL)
+    {
+      memset(&L->results[l], 0, sizeof(L->results[l]));
+      L->results[l].status = ARMSIM_E_NOMEM;
+      L->live[l] = FALSE;
+      L->nlive--;
+      continue;
+    }
+    if (wide)
+    {
+      mem_write_32(address, (uint32_t)data);
+      mem_write_32(address + 4, (uint32_t)(data >> 32));
+      mem_write_32(address, (uint32_t)data);
+    }
+    else
+    {
+      mem_write_32(address, (uint32_t)data & mask);
+    }
+  }
+  ARMSIM = L->image;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_load                                      */
+/*                                                             */
+/***************************************************************/
+static void lanes_load(lanes_t *L, int n, int t, int64_t offset, int wide, uint32_t mask)
+{
+  int l;
+
+  for (l = 0; l < L->width; l++)
+  {
+    if (!L->live[l])
+      continue;
+    uint64_t address = L->regs[n][l] + offset;
+
+    ARMSIM = L->memory[l] != NULL ? L->memory[l] : L->image;
+    if (wide)
+      L->regs[t][l] = (uint64_t)mem_read_32(address + 4) << 32 | mem_read_32(address);
+    else
+      L->regs[t][l] = mem_read_32(address) & mask;
+  }
+  ARMSIM = L->image;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_condition                                 */
+/*                                                             */
+/* Purpose   : ConditionHolds() for every lane                 */
+/*                                                             */
+/***************************************************************/
+static void lanes_condition(lanes_t *L, uint32_t cond, uint8_t *taken)
+{
+  int l;
+
+  for (l = 0; l < LANE_GROUP; l++)
+  {
+    int holds;
+    switch ((cond >> 1) & 0x7)
+    {
+    case 0b000:
+      holds = L->flag_z[l] != 0;
+      break;
+    case 0b101:
+      holds = L->flag_n[l] == 0;
+      break;
+    case 0b110:
+      holds = L->flag_n[l] == 0 && L->flag_z[l] == 0;
+      break;
+    default:
+      holds = 0;
+      break;
+    }
+    if ((cond & 0x1) == 1 && cond != 0b1111)
+      holds = !holds;
+    taken[l] = holds;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_step                                      */
+/*                                                             */
+/* Purpose   : Execute the instruction at the shared PC on     */
+/*             every live lane                                 */
+/*                                                             */
+/***************************************************************/
+static void lanes_step(lanes_t *L)
+{
+  static const int64_t zeros[LANE_GROUP], ones[LANE_GROUP] = {[0 ... LANE_GROUP - 1] = 1};
+  uint8_t taken[LANE_GROUP];
+  uint64_t pc = L->pc;
+  uint32_t word;
+  Instruction inst = fetch_decoded(pc, &word);
+  size_t d = extract_bits(word, 0, 4);
+  size_t n = extract_bits(word, 5, 9);
+  size_t m = extract_bits(word, 16, 20);
+  uint64_t imm12 = extract_bits(word, 10, 21);
+  int64_t offset9 = extract_bits(word, 12, 20);
+  int64_t offset19 = (int64_t)((uint64_t)extract_bits(word, 5, 23) << 45) >> 43;
+  int l;
+
+  if (extract_bits(word, 22, 23) == 0b01)
+    imm12 <<= 12;
+
+  if (inst == BRK)
+  {
+    if (pc != L->skip_pc)
+    {
+      /* the trap itself retires nothing */
+      lanes_finish(L, ARMSIM_BREAKPOINT, pc, L->count);
+      return;
+    }
+    inst = decode(word);
+  }
+  L->skip_pc = 0;
+
+  switch (inst)
+  {
+  case HLT:
+    lanes_finish(L, ARMSIM_HALTED, pc + 4, L->count + 1);
+    return;
+  case MAGIC:
+    /* ROI markers change engine state: the scalar engine runs them */
+    for (l = 0; l < L->width; l++)
+      if (L->live[l])
+        lane_leave(L, l, &L->watchdog);
+    return;
+  case ADDSer:
+    lanes_add(L, d, n, L->regs[m], zeros, TRUE, 4);
+    break;
+  case ADDSim:
+    lanes_fill(L->operand, imm12);
+    lanes_add(L, d, n, L->operand, zeros, TRUE, 4);
+    break;
+  case SUBSer:
+    lanes_not(L->operand, L->regs[m]);
+    lanes_add(L, d, n, L->operand, ones, TRUE, 4);
+    break;
+  case SUBSim:
+    lanes_fill(L->operand, ~imm12);
+    lanes_add(L, d, n, L->operand, ones, TRUE, 4);
+    break;
+  case CMPer:
+    lanes_not(L->operand, L->regs[m]);
+    lanes_add(L, d, n, L->operand, ones, FALSE, 2);
+    break;
+  case CMPim:
+    lanes_fill(L->operand, ~imm12);
+    lanes_add(L, d, n, L->operand, ones, FALSE, 2);
+    break;
+  case ADDim:
+    lanes_fill(L->operand, imm12);
+    lanes_add(L, d, n, L->operand, zeros, TRUE, 0);
+    break;
+  case ADDer:
+    lanes_add(L, d, n, L->regs[m], zeros, TRUE, 0);
+    break;
+  case ADCS:
+    memcpy(L->carry, L->flag_c, sizeof(L->carry));
+    lanes_add(L, d, n, L->regs[m], L->carry, TRUE, 4);
+    break;
+  case ANDS:
+    for (l = 0; l < LANE_GROUP; l++)
+    {
+      uint64_t result = L->regs[n][l] & L->regs[m][l];
+      L->regs[d][l] = result;
+      L->flag_n[l] = result >> 63;
+      L->flag_z[l] = result == 0;
+    }
+    break;
+  case EOR:
+    for (l = 0; l < LANE_GROUP; l++)
+      L->regs[d][l] = L->regs[n][l] ^ L->regs[m][l];
+    break;
+  case ORR:
+    for (l = 0; l < LANE_GROUP; l++)
+      L->regs[d][l] = L->regs[n][l] | L->regs[m][l];
+    break;
+  case LSL:
+  {
+    /* sim.c shifts by 64 - immr; the host masks the count */
+    unsigned shift = (64 - extract_bits(word, 16, 21)) & 63;
+    for (l = 0; l < LANE_GROUP; l++)
+      L->regs[d][l] = (uint64_t)L->regs[n][l] << shift;
+    break;
+  }
+  case LSR:
+  {
+    unsigned shift = extract_bits(word, 16, 21);
+    for (l = 0; l < LANE_GROUP; l++)
+      L->regs[d][l] = L->regs[n][l] >> shift;
+    break;
+  }
+  case MOVZ:
+    lanes_fill(L->regs[d], extract_bits(word, 5, 20));
+    break;
+  case MRS:
+    /* lanes feed no timing model: every counter counts instructions */
+    lanes_fill(L->regs[d], L->image->roi_active ? L->count - L->image->roi_offset
+                                                : L->image->roi_count);
+    break;
+  case MUL:
+    for (l = 0; l < LANE_GROUP; l++)
+      L->regs[d][l] = (uint64_t)L->regs[31][l] + (uint64_t)L->regs[n][l] * L->regs[m][l];
+    break;
+  case STUR:
+    lanes_store(L, n, d, offset9, TRUE, 0);
+    break;
+  case STURB:
+    lanes_store(L, n, d, offset9, FALSE, 0xff);
+    break;
+  case STURH:
+    lanes_store(L, n, d, offset9, FALSE, 0x1ffff);
+    break;
+  case LDUR:
+    lanes_load(L, n, d, offset9, TRUE, 0);
+    break;
+  case LDURB:
+    lanes_load(L, n, d, offset9, FALSE, 0xff);
+    break;
+  case LDURH:
+    lanes_load(L, n, d, offset9, FALSE, 0x1ffff);
+    break;
+  case B:
+  {
+    int64_t offset = (int64_t)((uint64_t)extract_bits(word, 0, 25) << 38) >> 36;
+    lanes_boundary(L, pc + offset);
+    L->pc = pc + offset;
+    L->count++;
+    return;
+  }
+  case BR:
+  {
+    /* lanes jumping elsewhere than the first live lane leave */
+    uint64_t target = 0;
+    int first = TRUE;
+    for (l = 0; l < L->width; l++)
+    {
+      if (!L->live[l])
+        continue;
+      if (first)
+        target = L->regs[n][l];
+      else if ((uint64_t)L->regs[n][l] != target)
+        lane_leave(L, l, &L->watchdog);
+      first = FALSE;
+    }
+    lanes_boundary(L, target);
+    L->pc = target;
+    L->count++;
+    return;
+  }
+  case BEQ:
+  case BNE:
+  case BGT:
+  case BLT:
+  case BGE:
+  case BLE:
+  case CBZ:
+  case CBNZ:
+    if (inst == CBZ || inst == CBNZ)
+      for (l = 0; l < LANE_GROUP; l++)
+        taken[l] = (L->regs[d][l] == 0) == (inst == CBZ);
+    else
+      lanes_condition(L, extract_bits(word, 0, 3), taken);
+    if (lanes_split(L, taken))
+    {
+      lanes_boundary(L, pc + offset19);
+      L->pc = pc + offset19;
+    }
+    else
+    {
+      L->pc = pc + 4;
+    }
+    L->count++;
+    return;
+  default:
+    /* nothing retires and the PC stays on the bad word */
+    lanes_finish(L, ARMSIM_INVALID, pc, L->count);
+    return;
+  }
+  L->pc = pc + 4;
+  L->count++;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lanes_run                                       */
+/*                                                             */
+/* Purpose   : Run one lockstep group to completion            */
+/*                                                             */
+/***************************************************************/
+static void lanes_run(lanes_t *L, const uint64_t (*init_regs)[ARMSIM_REGS])
+{
+  armsim_t *image = L->image;
+  lane_watchdog_t *watchdog = &L->watchdog;
+  int l, k;
+
+  memset(L->regs, 0, sizeof(L->regs));
+  for (l = 0; l < L->width; l++)
+  {
+    for (k = 0; k < ARM_REGS; k++)
+      L->regs[k][l] = init_regs[l][k];
+    L->flag_n[l] = image->current.FLAG_N;
+    L->flag_z[l] = image->current.FLAG_Z;
+    L->flag_v[l] = image->current.FLAG_V;
+    L->flag_c[l] = image->current.FLAG_C;
+    L->live[l] = TRUE;
+    L->memory[l] = NULL;
+  }
+  L->nlive = L->width;
+  L->pc = image->current.PC;
+  L->count = image->instruction_count;
+  L->skip_pc = 0;
+  for (k = 0; k < image->num_breakpoints; k++)
+    if (image->breakpoints[k] == L->pc)
+      L->skip_pc = L->pc;
+
+  /* arm_watchdog() */
+  watchdog->budget_at = image->instruction_limit ? L->count + image->instruction_limit
+                                                 : UINT64_MAX;
+  watchdog->clock_at = UINT64_MAX;
+  if (image->time_limit > 0)
+  {
+    double limit = image->time_limit;
+    clock_gettime(CLOCK_MONOTONIC, &L->deadline);
+    L->deadline.tv_sec += (time_t)limit;
+    L->deadline.tv_nsec += (long)((limit - (time_t)limit) * 1e9);
+    if (L->deadline.tv_nsec >= 1000000000)
+    {
+      L->deadline.tv_sec++;
+      L->deadline.tv_nsec -= 1000000000;
+    }
+    watchdog->clock_at = L->count + CLOCK_CHECK_INTERVAL;
+  }
+  watchdog->probe_at = L->count + PROBE_INTERVAL;
+  watchdog->boundaries_left = 0;
+  lanes_schedule(watchdog);
+
+  while (L->nlive > 0)
+  {
+    ARMSIM = image;
+    lanes_step(L);
+  }
+
+  for (l = 0; l < L->width; l++)
+    lane_release(L, l);
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_run_lanes(armsim_t *image, size_t nlanes,
+                     const uint64_t (*init_regs)[ARMSIM_REGS],
+                     armsim_lane_result_t *results)
+{
+  lanes_t *L;
+  size_t first;
+  int result;
+
+  if (image == NULL || (nlanes > 0 && (init_regs == NULL || results == NULL)) ||
+      image->hash != NULL || image->num_watchpoints > 0)
+    return ARMSIM_E_INVAL;
+  if (!image->run_bit)
+    return ARMSIM_E_HALTED;
+  if ((L = calloc(1, sizeof(*L))) == NULL)
+    return ARMSIM_E_NOMEM;
+
+  L->image = image;
+  ARMSIM = image;
+  if ((result = image_chunks(L)) != 0)
+  {
+    free(L);
+    return result;
+  }
+
+  pcprof_source(image, &L->pc, ARMSIM_TIER_LANES);
+  for (first = 0; first < nlanes; first += LANE_GROUP)
+  {
+    L->width = nlanes - first < LANE_GROUP ? nlanes - first : LANE_GROUP;
+    L->results = results + first;
+    lanes_run(L, init_regs + first);
+  }
+  pcprof_source(image, &image->current.PC, ARMSIM_TIER_IDLE);
+
+  while (L->npool > 0)
+    armsim_destroy(L->pool[--L->npool]);
+  free(L->chunks);
+  free(L);
+  ARMSIM = image;
+  return 0;
+}
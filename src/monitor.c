@@ -0,0 +1,150 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: live sampling of a running instance            */
+/*                                                             */
+/***************************************************************/
+
+/* While monitoring is on, simulate() publishes an armsim_sample_t
+ * when it starts and returns, and boundary_checks() publishes one
+ * every MONITOR_INTERVAL instructions at the block boundary that
+ * passes MONITOR_AT. The sample sits behind a seqlock: the engine
+ * makes the sequence odd, copies the state and makes it even again,
+ * and a reader on another thread copies it out and retries if the
+ * sequence was odd or moved meanwhile. The engine never waits for a
+ * reader, so a run costs the same with or without one.
+ *
+ * armsim_interrupt() only sets a flag, which the same boundary reads;
+ * the run then returns ARMSIM_INTERRUPTED with the branch retired,
+ * and can be resumed. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "shell.h"
+
+struct monitor
+{
+  atomic_uint_fast64_t sequence; /* odd while the engine writes */
+  armsim_sample_t sample;
+  atomic_int interrupt; /* armsim_interrupt() was called */
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : publish                                         */
+/*                                                             */
+/* Purpose   : Store a sample of state, count and pc behind    */
+/*             the seqlock                                     */
+/*                                                             */
+/***************************************************************/
+static void publish(const CPU_State *state, uint64_t count, uint64_t roi, uint64_t pc,
+                    int running)
+{
+  struct monitor *m = ARMSIM->monitor;
+  uint_fast64_t sequence = atomic_load_explicit(&m->sequence, memory_order_relaxed);
+  armsim_sample_t *s = &m->sample;
+
+  atomic_store_explicit(&m->sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  s->instructions = count;
+  s->roi_instructions = roi;
+  s->stores = MEM_WRITES;
+  s->pc = pc;
+  memcpy(s->regs, state->REGS, sizeof(s->regs));
+  s->nzcv = state->FLAG_N << 3 | state->FLAG_Z << 2 | state->FLAG_C << 1 | state->FLAG_V;
+  s->running = running;
+  atomic_store_explicit(&m->sequence, sequence + 2, memory_order_release);
+
+  ARMSIM->monitor_at = INSTRUCTION_COUNT + MONITOR_INTERVAL;
+  schedule_checks();
+}
+
+/* From boundary_checks(), while the branch to target retires */
+void monitor_tick(uint64_t target)
+{
+  struct monitor *m = ARMSIM->monitor;
+
+  /* the state after the branch, as the next cycle() will leave it */
+  publish(&NEXT_STATE, INSTRUCTION_COUNT + 1, roi_instructions() + ARMSIM->roi_active, target,
+          TRUE);
+  if (atomic_exchange_explicit(&m->interrupt, FALSE, memory_order_relaxed))
+  {
+    RUN_BIT = FALSE;
+    STOP_REASON = STOP_INTERRUPT;
+  }
+}
+
+/* From simulate(), as a run starts and once it has settled */
+void monitor_run(int running)
+{
+  /* an interrupt nothing was running for is dropped */
+  if (!running)
+    atomic_store_explicit(&ARMSIM->monitor->interrupt, FALSE, memory_order_relaxed);
+  publish(&CURRENT_STATE, INSTRUCTION_COUNT, roi_instructions(), CURRENT_STATE.PC, running);
+}
+
+void monitor_free()
+{
+  free(ARMSIM->monitor);
+  ARMSIM->monitor = NULL;
+  ARMSIM->monitor_at = UINT64_MAX;
+  schedule_checks();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_monitor_start(armsim_t *sim)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (sim->monitor == NULL)
+  {
+    if ((sim->monitor = calloc(1, sizeof(struct monitor))) == NULL)
+      return ARMSIM_E_NOMEM;
+    atomic_init(&sim->monitor->sequence, 0);
+    atomic_init(&sim->monitor->interrupt, FALSE);
+  }
+  monitor_run(FALSE);
+  return 0;
+}
+
+int armsim_monitor_stop(armsim_t *sim)
+{
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  monitor_free();
+  return 0;
+}
+
+/* Any thread; never touches the engine's state */
+int armsim_sample(armsim_t *sim, armsim_sample_t *sample)
+{
+  struct monitor *m;
+  uint_fast64_t before, after;
+
+  if (sim == NULL || sample == NULL || (m = sim->monitor) == NULL)
+    return ARMSIM_E_INVAL;
+  do
+  {
+    before = atomic_load_explicit(&m->sequence, memory_order_acquire);
+    memcpy(sample, &m->sample, sizeof(*sample));
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&m->sequence, memory_order_relaxed);
+  } while ((before & 1) != 0 || before != after);
+  return 0;
+}
+
+/* Any thread, or a signal handler */
+int armsim_interrupt(armsim_t *sim)
+{
+  if (sim == NULL || sim->monitor == NULL)
+    return ARMSIM_E_INVAL;
+  atomic_store_explicit(&sim->monitor->interrupt, TRUE, memory_order_relaxed);
+  return 0;
+}
@@ -0,0 +1,404 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: out-of-order core timing model                 */
+/*                                                             */
+/***************************************************************/
+
+/* A trace-driven out-of-order core. Instead of stepping cycles it
+ * stamps every retired instruction record with the cycles it is
+ * fetched, dispatched, issued, completed and committed, so the cost is
+ * a few table lookups per instruction:
+ *
+ *   fetch     in order, fetch_width per cycle, a taken branch ends the
+ *             group; waits for mispredicted branches to resolve
+ *   dispatch  frontend_depth cycles later, in order, fetch_width per
+ *             cycle, once the ROB (and the LSQ for memory ops) has room
+ *   issue     out of order once the rd/rn/rm sources (and NZCV, and
+ *             an older store to the same word for loads) are ready,
+ *             issue_width per cycle and one per free functional unit
+ *   commit    in order, commit_width per cycle, after completion
+ *
+ * Conditional branches are predicted by a 4K-entry bimodal table and
+ * BR by a 512-entry target buffer. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+
+#ifndef ARMSIM_NO_TIMING
+
+#define OOO_CYCLES (1 << 14) /* per-cycle issue bookkeeping, a ring */
+#define OOO_STORES 1024      /* in-flight store words, direct-mapped */
+#define OOO_COUNTERS 4096
+#define OOO_TARGETS 512
+
+enum
+{
+  UNIT_ALU = 0,
+  UNIT_MUL,
+  UNIT_MEM,
+  UNIT_CLASSES
+};
+
+typedef struct
+{
+  uint64_t cycle;
+  uint8_t issued;
+  uint8_t busy[UNIT_CLASSES];
+} issue_slot_t;
+
+typedef struct
+{
+  uint64_t in_order; /* cycle of the last instruction through the stage */
+  uint32_t count;    /* instructions that went through in that cycle */
+} stage_t;
+
+struct ooo
+{
+  armsim_ooo_config_t config;
+  uint32_t units[UNIT_CLASSES];
+  uint32_t latency[UNIT_CLASSES];
+  uint64_t *rob, *lsq; /* commit cycles, indexed by sequence number */
+  /* everything below is cleared by ooo_flush */
+  stage_t fetch, dispatch, commit;
+  int group_end;     /* the last fetch was a taken branch */
+  uint64_t redirect; /* fetch resumes after a mispredicted branch */
+  uint64_t ready[REG_FLAGS + 1];
+  uint64_t sequence, memory_ops;
+  issue_slot_t slots[OOO_CYCLES];
+  uint64_t store_word[OOO_STORES], store_ready[OOO_STORES];
+  uint8_t counters[OOO_COUNTERS];
+  uint64_t target_pc[OOO_TARGETS], target[OOO_TARGETS];
+  armsim_ooo_stats_t stats;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : stage_pass                                      */
+/*                                                             */
+/* Purpose   : First cycle >= cycle an in-order stage of the   */
+/*             given width can take one more instruction       */
+/*                                                             */
+/***************************************************************/
+static inline uint64_t stage_pass(stage_t *s, uint64_t cycle, uint32_t width)
+{
+  if (cycle <= s->in_order)
+  {
+    cycle = s->in_order;
+    if (s->count == width)
+    {
+      cycle++;
+      s->count = 0;
+    }
+  }
+  else
+  {
+    s->count = 0;
+  }
+  s->in_order = cycle;
+  s->count++;
+  return cycle;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : issue_slot                                      */
+/*                                                             */
+/* Purpose   : The bookkeeping of a cycle, cleared when the    */
+/*             ring wraps around to it                         */
+/*                                                             */
+/***************************************************************/
+static inline issue_slot_t *issue_slot(struct ooo *o, uint64_t cycle)
+{
+  issue_slot_t *slot = &o->slots[cycle & (OOO_CYCLES - 1)];
+  if (slot->cycle != cycle)
+  {
+    memset(slot, 0, sizeof(*slot));
+    slot->cycle = cycle;
+  }
+  return slot;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ooo_predict                                     */
+/*                                                             */
+/* Purpose   : TRUE if the front end would have fetched the    */
+/*             wrong path after this branch; trains on it      */
+/*                                                             */
+/***************************************************************/
+int ooo_predict(struct ooo *o, const insn_record_t *r, uint64_t next_pc)
+{
+  int taken = (r->flags & RECORD_TAKEN) != 0;
+
+  if (r->inst == B)
+    return FALSE;
+  if (r->inst == BR)
+  {
+    uint64_t slot = (r->pc >> 2) & (OOO_TARGETS - 1);
+    int wrong = o->target_pc[slot] != r->pc + 1 || o->target[slot] != next_pc;
+    o->target_pc[slot] = r->pc + 1;
+    o->target[slot] = next_pc;
+    return wrong;
+  }
+  uint8_t *counter = &o->counters[(r->pc >> 2) & (OOO_COUNTERS - 1)];
+  int wrong = (*counter >= 2) != taken;
+  if (taken && *counter < 3)
+    (*counter)++;
+  else if (!taken && *counter > 0)
+    (*counter)--;
+  return wrong;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ooo_retire                                      */
+/*                                                             */
+/* Purpose   : Time one retired instruction through the core   */
+/*                                                             */
+/***************************************************************/
+void ooo_retire(const insn_record_t *r)
+{
+  struct ooo *o = ARMSIM->ooo;
+  armsim_ooo_config_t *config = &o->config;
+  uint64_t fetch, dispatch, ready, issue, complete, commit, natural;
+  int memory = (r->flags & (RECORD_LOAD | RECORD_STORE)) != 0;
+  int unit = r->inst == MUL ? UNIT_MUL : memory ? UNIT_MEM : UNIT_ALU;
+  int k;
+
+  /* fetch: stays at most frontend_depth cycles ahead of dispatch */
+  natural = o->fetch.in_order + (o->group_end ? 1 : 0);
+  if (o->dispatch.in_order > natural + config->frontend_depth)
+    natural = o->dispatch.in_order - config->frontend_depth;
+  if (o->redirect > natural)
+  {
+    o->stats.stalls[ARMSIM_OOO_MISPREDICT] += o->redirect - natural;
+    natural = o->redirect;
+  }
+  fetch = stage_pass(&o->fetch, natural, config->fetch_width);
+
+  /* dispatch: needs a ROB entry, and an LSQ entry for memory ops */
+  dispatch = fetch + config->frontend_depth;
+  if (o->sequence >= config->rob_size)
+  {
+    uint64_t freed = o->rob[o->sequence % config->rob_size] + 1;
+    if (freed > dispatch)
+    {
+      o->stats.stalls[ARMSIM_OOO_ROB_FULL] += freed - dispatch;
+      dispatch = freed;
+    }
+  }
+  if (memory && o->memory_ops >= config->lsq_size)
+  {
+    uint64_t freed = o->lsq[o->memory_ops % config->lsq_size] + 1;
+    if (freed > dispatch)
+    {
+      o->stats.stalls[ARMSIM_OOO_LSQ_FULL] += freed - dispatch;
+      dispatch = freed;
+    }
+  }
+  dispatch = stage_pass(&o->dispatch, dispatch, config->fetch_width);
+
+  /* issue: operands, then a free issue port and functional unit */
+  ready = dispatch + 1;
+  for (k = 0; k < 3; k++)
+    if (r->src[k] != REG_NONE && o->ready[r->src[k]] > ready)
+      ready = o->ready[r->src[k]];
+  if (r->flags & RECORD_LOAD)
+  {
+    uint64_t word = r->address >> 3, i = word & (OOO_STORES - 1);
+    if (o->store_word[i] == word + 1 && o->store_ready[i] > ready)
+      ready = o->store_ready[i];
+  }
+  for (issue = ready;; issue++)
+  {
+    issue_slot_t *slot = issue_slot(o, issue);
+    if (slot->issued == config->issue_width)
+    {
+      o->stats.stalls[ARMSIM_OOO_ISSUE_WIDTH]++;
+      continue;
+    }
+    if (slot->busy[unit] == o->units[unit])
+    {
+      o->stats.stalls[ARMSIM_OOO_UNIT_BUSY]++;
+      continue;
+    }
+    slot->issued++;
+    slot->busy[unit]++;
+    break;
+  }
+  complete = issue + ((r->flags & RECORD_STORE) ? 1 : o->latency[unit]);
+
+  if (r->dest != REG_NONE)
+    o->ready[r->dest] = complete;
+  if (r->flags & RECORD_SETS_FLAGS)
+    o->ready[REG_FLAGS] = complete;
+  if (r->flags & RECORD_STORE)
+  {
+    uint64_t word = r->address >> 3, i = word & (OOO_STORES - 1);
+    o->store_word[i] = word + 1;
+    o->store_ready[i] = complete;
+  }
+
+  /* branches resolve when they complete */
+  o->group_end = (r->flags & RECORD_TAKEN) != 0;
+  if ((r->flags & RECORD_BRANCH) && ooo_predict(o, r, NEXT_STATE.PC))
+  {
+    o->stats.mispredicts++;
+    o->redirect = complete + 1;
+  }
+
+  commit = stage_pass(&o->commit, complete + 1, config->commit_width);
+  o->rob[o->sequence++ % config->rob_size] = commit;
+  if (memory)
+    o->lsq[o->memory_ops++ % config->lsq_size] = commit;
+  o->stats.instructions++;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ooo_flush                                       */
+/*                                                             */
+/* Purpose   : Empty the core and clear the statistics         */
+/*                                                             */
+/***************************************************************/
+void ooo_flush()
+{
+  struct ooo *o = ARMSIM->ooo;
+  size_t skip = offsetof(struct ooo, fetch);
+
+  if (o == NULL)
+    return;
+  memset((char *)o + skip, 0, sizeof(*o) - skip);
+  memset(o->slots, 0xff, sizeof(o->slots)); /* no cycle matches */
+  memset(o->counters, 1, sizeof(o->counters));
+}
+
+void ooo_free()
+{
+  if (ARMSIM->ooo != NULL)
+  {
+    free(ARMSIM->ooo->rob);
+    free(ARMSIM->ooo->lsq);
+  }
+  free(ARMSIM->ooo);
+  ARMSIM->ooo = NULL;
+  trace_update();
+}
+
+/* Cycles until the last instruction recorded commits */
+uint64_t ooo_cycles()
+{
+  struct ooo *o = ARMSIM->ooo;
+  return o->stats.instructions ? o->commit.in_order + 1 : 0;
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_ooo_configure(armsim_t *sim, const armsim_ooo_config_t *config)
+{
+  static const armsim_ooo_config_t defaults = {4, 4, 4, 128, 32, 5, 1, 3, 3, 4, 1, 2};
+  armsim_ooo_config_t c;
+  struct ooo *o;
+  uint32_t *field, k;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (config == NULL)
+  {
+    ooo_free();
+    return 0;
+  }
+  /* zero fields take the defaults */
+  c = *config;
+  for (k = 0; k < sizeof(c) / sizeof(uint32_t); k++)
+  {
+    field = (uint32_t *)&c + k;
+    if (*field == 0)
+      *field = ((const uint32_t *)&defaults)[k];
+  }
+  /* defaulted unit counts and LSQ size fit the given widths and ROB */
+  if (config->alu_units == 0 && c.alu_units > c.issue_width)
+    c.alu_units = c.issue_width;
+  if (config->mem_units == 0 && c.mem_units > c.issue_width)
+    c.mem_units = c.issue_width;
+  if (config->lsq_size == 0 && c.lsq_size > c.rob_size)
+    c.lsq_size = c.rob_size;
+  if (c.fetch_width > 255 || c.issue_width > 255 || c.commit_width > 255 ||
+      c.alu_units > c.issue_width || c.mul_units > c.issue_width || c.mem_units > c.issue_width ||
+      c.rob_size > (1 << 20) || c.lsq_size > c.rob_size)
+    return ARMSIM_E_INVAL;
+
+  if ((o = calloc(1, sizeof(*o))) == NULL)
+    return ARMSIM_E_NOMEM;
+  o->rob = calloc(c.rob_size, sizeof(*o->rob));
+  o->lsq = calloc(c.lsq_size, sizeof(*o->lsq));
+  if (o->rob == NULL || o->lsq == NULL)
+  {
+    free(o->rob);
+    free(o->lsq);
+    free(o);
+    return ARMSIM_E_NOMEM;
+  }
+  o->config = c;
+  o->units[UNIT_ALU] = c.alu_units;
+  o->units[UNIT_MUL] = c.mul_units;
+  o->units[UNIT_MEM] = c.mem_units;
+  o->latency[UNIT_ALU] = c.alu_latency;
+  o->latency[UNIT_MUL] = c.mul_latency;
+  o->latency[UNIT_MEM] = c.load_latency;
+
+  ooo_free();
+  sim->ooo = o;
+  ooo_flush();
+  trace_update();
+  return 0;
+}
+
+int armsim_ooo_stats(armsim_t *sim, armsim_ooo_stats_t *stats)
+{
+  struct ooo *o;
+
+  if (sim == NULL || stats == NULL || (o = sim->ooo) == NULL)
+    return ARMSIM_E_INVAL;
+  *stats = o->stats;
+  ARMSIM = sim;
+  stats->cycles = ooo_cycles();
+  return 0;
+}
+
+#else
+
+void ooo_retire(const insn_record_t *record)
+{
+}
+
+void ooo_flush()
+{
+}
+
+void ooo_free()
+{
+}
+
+uint64_t ooo_cycles()
+{
+  return 0;
+}
+
+int armsim_ooo_configure(armsim_t *sim, const armsim_ooo_config_t *config)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+int armsim_ooo_stats(armsim_t *sim, armsim_ooo_stats_t *stats)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+#endif
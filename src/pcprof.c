@@ -0,0 +1,272 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: flat per-PC profiles, exact or sampled         */
+/*                                                             */
+/***************************************************************/
+
+/* Both kinds count into one array with a slot per text word.
+ *
+ * An exact profile rides the fetch tap (trace_fetch), so every
+ * instruction the region of interest executes costs an increment,
+ * and attaching it takes the scalar engine off its fast path.
+ *
+ * A sampled profile adds nothing to the engine. setitimer() raises
+ * SIGPROF every 1/hz seconds of process CPU time, and the handler
+ * reads the PC of whatever the engine is executing through a
+ * published pointer, CURRENT_STATE.PC of the running instance or the
+ * shared PC of lanes in lockstep, along with the engine tier. Runs
+ * and lanes repoint it as they start and end, so the engine pays a
+ * couple of stores per run. Samples outside a run count as idle, and
+ * samples outside the region of interest count apart. The itimer is
+ * per process, so only one instance samples at a time. */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "shell.h"
+#include "sim.h"
+
+#define PROFILE_SLOTS (MEM_TEXT_SIZE / 4)
+#define PROFILE_HZ 1000
+
+struct pcprof
+{
+  int mode; /* ARMSIM_PROFILE_* */
+  unsigned hz;
+  uint64_t *counts; /* per text word */
+  uint64_t other;   /* outside the text segment */
+
+  /* sampled only: what the handler reads and writes */
+  struct armsim *sim;
+  const volatile uint64_t *volatile source;
+  volatile sig_atomic_t tier;
+  uint64_t outside; /* outside the region of interest */
+  uint64_t tiers[ARMSIM_TIERS];
+  struct sigaction old_action;
+};
+
+/* The sampling instance, for the handler */
+static struct pcprof *volatile SAMPLING;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sample                                          */
+/*                                                             */
+/* Purpose   : SIGPROF handler: charge one sample to the guest */
+/*             PC being executed, or to the tier that holds    */
+/*             no PC                                           */
+/*                                                             */
+/***************************************************************/
+static void sample(int sig)
+{
+  struct pcprof *p = SAMPLING;
+  uint64_t offset;
+  int tier;
+
+  (void)sig;
+  if (p == NULL)
+    return;
+  tier = p->tier;
+  p->tiers[tier]++;
+  if (tier == ARMSIM_TIER_IDLE)
+    return;
+  if (!*(volatile int *)&p->sim->roi_active)
+  {
+    p->outside++;
+    return;
+  }
+  offset = *p->source - MEM_TEXT_START;
+  if (offset < MEM_TEXT_SIZE)
+    p->counts[offset >> 2]++;
+  else
+    p->other++;
+}
+
+/* From trace_fetch_models(), exact profiles only */
+void pcprof_fetch(uint64_t pc)
+{
+  uint64_t offset = pc - MEM_TEXT_START;
+
+  if (offset < MEM_TEXT_SIZE)
+    ARMSIM->pc_counts[offset >> 2]++;
+  else
+    ARMSIM->pcprof->other++;
+}
+
+/* From simulate(), as a run starts and once it has settled */
+void pcprof_run(int running)
+{
+  struct pcprof *p = ARMSIM->pcprof;
+
+  if (p->mode != ARMSIM_PROFILE_SAMPLED)
+    return;
+  if (!running)
+  {
+    p->tier = ARMSIM_TIER_IDLE;
+    return;
+  }
+  p->source = &CURRENT_STATE.PC;
+  p->tier = ARMSIM->tracing || ARMSIM->recording || ARMSIM->plugins != NULL
+                ? ARMSIM_TIER_MODELS
+                : ARMSIM_TIER_SCALAR;
+}
+
+/* From the lanes engine of owner: sample *pc as tier from now on */
+void pcprof_source(struct armsim *owner, const uint64_t *pc, int tier)
+{
+  struct pcprof *p = owner->pcprof;
+
+  if (p == NULL || p->mode != ARMSIM_PROFILE_SAMPLED)
+    return;
+  p->tier = ARMSIM_TIER_IDLE;
+  p->source = pc;
+  p->tier = tier;
+}
+
+/* HLT #0x100 and reset start the profile over */
+void pcprof_flush()
+{
+  struct pcprof *p = ARMSIM->pcprof;
+
+  if (p == NULL)
+    return;
+  memset(p->counts, 0, PROFILE_SLOTS * sizeof(uint64_t));
+  p->other = p->outside = 0;
+  memset(p->tiers, 0, sizeof(p->tiers));
+}
+
+void pcprof_free()
+{
+  struct pcprof *p = ARMSIM->pcprof;
+  struct itimerval off = {{0, 0}, {0, 0}};
+
+  if (p == NULL)
+    return;
+  if (p->mode == ARMSIM_PROFILE_SAMPLED)
+  {
+    setitimer(ITIMER_PROF, &off, NULL);
+    sigaction(SIGPROF, &p->old_action, NULL);
+    SAMPLING = NULL;
+  }
+  free(p->counts);
+  free(p);
+  ARMSIM->pcprof = NULL;
+  ARMSIM->pc_counts = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_profile_start(armsim_t *sim, int mode, unsigned hz)
+{
+  struct pcprof *p;
+  struct sigaction action;
+  struct itimerval timer;
+
+  if (sim == NULL || (mode != ARMSIM_PROFILE_EXACT && mode != ARMSIM_PROFILE_SAMPLED) ||
+      hz > 1000000)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  pcprof_free();
+  if (mode == ARMSIM_PROFILE_SAMPLED && SAMPLING != NULL)
+    return ARMSIM_E_INVAL;
+  if ((p = calloc(1, sizeof(*p))) == NULL)
+    return ARMSIM_E_NOMEM;
+  if ((p->counts = calloc(PROFILE_SLOTS, sizeof(uint64_t))) == NULL)
+  {
+    free(p);
+    return ARMSIM_E_NOMEM;
+  }
+  p->mode = mode;
+  p->sim = sim;
+  p->source = &sim->current.PC;
+  p->tier = ARMSIM_TIER_IDLE;
+  sim->pcprof = p;
+
+  if (mode == ARMSIM_PROFILE_EXACT)
+  {
+    sim->pc_counts = p->counts;
+    trace_update();
+    return 0;
+  }
+
+  p->hz = hz ? hz : PROFILE_HZ;
+  SAMPLING = p;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / p->hz;
+  timer.it_value = timer.it_interval;
+  if (sigaction(SIGPROF, &action, &p->old_action) != 0 ||
+      setitimer(ITIMER_PROF, &timer, NULL) != 0)
+  {
+    sigaction(SIGPROF, &p->old_action, NULL);
+    SAMPLING = NULL;
+    free(p->counts);
+    free(p);
+    sim->pcprof = NULL;
+    return ARMSIM_E_INVAL;
+  }
+  return 0;
+}
+
+int armsim_profile_stop(armsim_t *sim)
+{
+  if (sim == NULL || sim->pcprof == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  pcprof_free();
+  return 0;
+}
+
+int armsim_profile_stats(armsim_t *sim, armsim_profile_stats_t *stats)
+{
+  struct pcprof *p;
+  uint64_t k;
+
+  if (sim == NULL || stats == NULL || (p = sim->pcprof) == NULL)
+    return ARMSIM_E_INVAL;
+  memset(stats, 0, sizeof(*stats));
+  stats->mode = p->mode;
+  stats->hz = p->hz;
+  for (k = 0; k < PROFILE_SLOTS; k++)
+    stats->total += p->counts[k];
+  stats->total += p->other;
+  stats->other = p->other;
+  stats->outside = p->outside;
+  memcpy(stats->tiers, p->tiers, sizeof(stats->tiers));
+  return 0;
+}
+
+int armsim_profile_sites(armsim_t *sim, armsim_profile_site_t *sites, size_t max)
+{
+  struct pcprof *p;
+  size_t n = 0;
+  uint64_t k;
+
+  if (sim == NULL || (sites == NULL && max > 0) || (p = sim->pcprof) == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  for (k = 0; k < PROFILE_SLOTS; k++)
+  {
+    if (p->counts[k] == 0)
+      continue;
+    if (n < max)
+    {
+      uint64_t pc = MEM_TEXT_START + 4 * k;
+      Instruction inst = decode(mem_read_32(pc));
+      sites[n].pc = pc;
+      sites[n].count = p->counts[k];
+      sites[n].name = inst >= 0 ? instruction_names[inst] : "INVALID";
+    }
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,199 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: in-order 5-stage pipeline timing model         */
+/*                                                             */
+/***************************************************************/
+
+/* A classic IF/ID/EX/MEM/WB pipeline timed from the retired
+ * instruction records. Each register (and NZCV) remembers the first
+ * cycle a consumer may use its latest value; an instruction leaves ID
+ * one cycle after its predecessor unless one of its sources is not
+ * ready by the stage that needs it, or a taken branch left a bubble.
+ *
+ * Relative to the cycle t an instruction spends in ID:
+ *   ALU results forward from the end of EX   -> usable at t + 2
+ *   loads forward from the end of MEM        -> usable at t + 3
+ *   without forwarding, values are read in ID after WB at t + 3
+ * ALU operands are needed at EX (t + 1), store data at MEM (t + 2),
+ * and branch operands and flags at ID or EX, where branches resolve.
+ * Branches are predicted not taken: a taken one costs 1 bubble when
+ * resolved in ID, 2 in EX; B always resolves in ID. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+
+#ifndef ARMSIM_NO_TIMING
+
+struct pipeline
+{
+  armsim_pipeline_config_t config;
+  uint64_t id_cycle; /* when the last instruction was in ID */
+  uint64_t bubbles;  /* owed by the next instruction after a taken branch */
+  uint64_t ready[REG_FLAGS + 1];
+  uint8_t loaded[REG_FLAGS + 1]; /* latest value comes from a load */
+  armsim_pipeline_stats_t stats;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : pipeline_retire                                 */
+/*                                                             */
+/* Purpose   : Advance the pipeline by one retired instruction */
+/*                                                             */
+/***************************************************************/
+void pipeline_retire(const insn_record_t *record)
+{
+  struct pipeline *p = ARMSIM->pipeline;
+  uint64_t t = p->id_cycle + 1 + p->bubbles, earliest = t;
+  int k, cause = ARMSIM_STALL_DATA;
+
+  p->stats.stalls[ARMSIM_STALL_BRANCH] += p->bubbles;
+  p->bubbles = 0;
+
+  for (k = 0; k < 3; k++)
+  {
+    int reg = record->src[k];
+    uint64_t need;
+    if (reg == REG_NONE)
+      continue;
+    if (!p->config.forwarding)
+      need = 0;
+    else if (reg == REG_FLAGS || (record->flags & RECORD_BRANCH))
+      need = p->config.branch_in_ex ? 1 : 0;
+    else if ((record->flags & RECORD_STORE) && k == 1)
+      need = 2;
+    else
+      need = 1;
+    if (p->ready[reg] > earliest + need)
+    {
+      earliest = p->ready[reg] - need;
+      cause = reg == REG_FLAGS ? ARMSIM_STALL_FLAGS
+              : p->loaded[reg] ? ARMSIM_STALL_LOAD_USE
+                               : ARMSIM_STALL_DATA;
+    }
+  }
+  p->stats.stalls[cause] += earliest - t;
+  t = earliest;
+  p->id_cycle = t;
+
+  if (record->dest != REG_NONE)
+  {
+    int load = (record->flags & RECORD_LOAD) != 0;
+    p->ready[record->dest] = t + (!p->config.forwarding || load ? 3 : 2);
+    p->loaded[record->dest] = load;
+  }
+  if (record->flags & RECORD_SETS_FLAGS)
+    p->ready[REG_FLAGS] = t + (p->config.forwarding ? 2 : 3);
+
+  if (record->inst == B)
+    p->bubbles = 1;
+  else if (record->flags & RECORD_TAKEN)
+    p->bubbles = p->config.branch_in_ex ? 2 : 1;
+  p->stats.taken_branches += (record->flags & RECORD_TAKEN) != 0;
+  p->stats.instructions++;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : pipeline_flush                                  */
+/*                                                             */
+/* Purpose   : Drain the pipeline and clear the statistics     */
+/*                                                             */
+/***************************************************************/
+void pipeline_flush()
+{
+  struct pipeline *p = ARMSIM->pipeline;
+  armsim_pipeline_config_t config;
+
+  if (p == NULL)
+    return;
+  config = p->config;
+  memset(p, 0, sizeof(*p));
+  p->config = config;
+}
+
+void pipeline_free()
+{
+  free(ARMSIM->pipeline);
+  ARMSIM->pipeline = NULL;
+  trace_update();
+}
+
+/* Cycles to retire everything recorded so far; the last instruction
+ * still has EX, MEM and WB ahead of it */
+uint64_t pipeline_cycles()
+{
+  struct pipeline *p = ARMSIM->pipeline;
+  return p->stats.instructions ? p->id_cycle + 4 : 0;
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_pipeline_configure(armsim_t *sim, const armsim_pipeline_config_t *config)
+{
+  struct pipeline *p;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (config == NULL)
+  {
+    pipeline_free();
+    return 0;
+  }
+  if ((p = calloc(1, sizeof(*p))) == NULL)
+    return ARMSIM_E_NOMEM;
+  p->config = *config;
+  free(sim->pipeline);
+  sim->pipeline = p;
+  trace_update();
+  return 0;
+}
+
+int armsim_pipeline_stats(armsim_t *sim, armsim_pipeline_stats_t *stats)
+{
+  struct pipeline *p;
+
+  if (sim == NULL || stats == NULL || (p = sim->pipeline) == NULL)
+    return ARMSIM_E_INVAL;
+  *stats = p->stats;
+  ARMSIM = sim;
+  stats->cycles = pipeline_cycles();
+  return 0;
+}
+
+#else
+
+void pipeline_retire(const insn_record_t *record)
+{
+}
+
+void pipeline_flush()
+{
+}
+
+void pipeline_free()
+{
+}
+
+uint64_t pipeline_cycles()
+{
+  return 0;
+}
+
+int armsim_pipeline_configure(armsim_t *sim, const armsim_pipeline_config_t *config)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+int armsim_pipeline_stats(armsim_t *sim, armsim_pipeline_stats_t *stats)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+#endif
@@ -0,0 +1,377 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: instrumentation plugins                        */
+/*                                                             */
+/***************************************************************/
+
+/* Plugins hang off hooks the engine already has, so an event nobody
+ * subscribes to adds no work to process_instruction():
+ *   - block events keep CHECK_AT at 0 (schedule_checks), which sends
+ *     every taken branch through boundary_checks() to plugin_block();
+ *   - memory events set the tracing flag, so trace_data() reaches
+ *     plugin_data(), which only appends to a batch;
+ *   - run ends flush the current block and report halts.
+ * Outside the region of interest tracing and CHECK_AT ignore the
+ * plugins, and ROI markers end the current block before them.
+ * Translated block starts live in an open-addressing hash, emptied
+ * whenever the text segment is written. */
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "sim.h"
+
+#define PLUGIN_BATCH 256      /* memory accesses per callback */
+#define PLUGIN_MAX_BLOCK 1024 /* instructions translated at once */
+
+typedef struct
+{
+  armsim_plugin_t callbacks;
+  void *ctx;
+  void *handle; /* dlopen handle, NULL if registered directly */
+} plugin_t;
+
+typedef struct
+{
+  uint64_t pc; /* block start + 1, 0 = empty slot */
+  uint32_t count;
+} block_t;
+
+struct plugins
+{
+  plugin_t plugin[ARMSIM_MAX_PLUGINS];
+  int count;
+  int translate, exec, memory; /* subscribers */
+
+  /* the block executing now */
+  uint64_t entry_pc, entry_count;
+
+  armsim_mem_access_t accesses[PLUGIN_BATCH];
+  size_t naccesses;
+
+  block_t *blocks;
+  uint64_t block_mask, nblocks;
+  uint32_t words[PLUGIN_MAX_BLOCK];
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : block_lookup                                    */
+/*                                                             */
+/* Purpose   : The slot of a translated block start, inserted  */
+/*             if missing (NULL if out of memory)              */
+/*                                                             */
+/***************************************************************/
+static block_t *block_lookup(struct plugins *p, uint64_t pc)
+{
+  uint64_t key = pc + 1, i;
+
+  if (2 * (p->nblocks + 1) > p->block_mask + 1)
+  {
+    uint64_t size = 2 * (p->block_mask + 1), k;
+    block_t *blocks = calloc(size, sizeof(*blocks));
+    if (blocks == NULL)
+      return NULL;
+    for (k = 0; k <= p->block_mask; k++)
+    {
+      if (p->blocks[k].pc == 0)
+        continue;
+      for (i = (p->blocks[k].pc * 0x9e3779b97f4a7c15ULL >> 20) & (size - 1); blocks[i].pc != 0;
+           i = (i + 1) & (size - 1))
+        ;
+      blocks[i] = p->blocks[k];
+    }
+    free(p->blocks);
+    p->blocks = blocks;
+    p->block_mask = size - 1;
+  }
+
+  for (i = (key * 0x9e3779b97f4a7c15ULL >> 20) & p->block_mask; p->blocks[i].pc != 0;
+       i = (i + 1) & p->block_mask)
+    if (p->blocks[i].pc == key)
+      return &p->blocks[i];
+  p->blocks[i].pc = key;
+  p->blocks[i].count = 0;
+  p->nblocks++;
+  return &p->blocks[i];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : translate                                       */
+/*                                                             */
+/* Purpose   : Length of the basic block at pc, handed to the  */
+/*             translate callbacks the first time; 0 outside   */
+/*             guest memory                                    */
+/*                                                             */
+/***************************************************************/
+static uint32_t translate(struct plugins *p, uint64_t pc)
+{
+  block_t *block = block_lookup(p, pc);
+  uint64_t avail = 0;
+  uint8_t *host;
+  uint32_t count = 0;
+  int k;
+
+  if (block == NULL)
+    return 0;
+  if (block->count != 0)
+    return block->count;
+
+  host = host_address(pc, &avail);
+  while (host != NULL && count < PLUGIN_MAX_BLOCK && 4 * (count + 1) <= avail)
+  {
+    Instruction inst;
+    memcpy(&p->words[count], host + 4 * count, 4);
+    inst = decode(p->words[count++]);
+    /* B, the B.conds and HLT lead the Instruction enum */
+    if (inst <= HLT || inst == BR || inst == CBZ || inst == CBNZ || inst == ISNOT)
+      break;
+  }
+  if (count == 0)
+  {
+    /* leave nothing behind for an address with no code */
+    block->pc = 0;
+    p->nblocks--;
+    return 0;
+  }
+
+  block->count = count;
+  for (k = 0; k < p->count; k++)
+    if (p->plugin[k].callbacks.translate != NULL)
+      p->plugin[k].callbacks.translate(p->plugin[k].ctx, pc, p->words, count);
+  return count;
+}
+
+static void flush_memory(struct plugins *p)
+{
+  int k;
+
+  for (k = 0; k < p->count && p->naccesses > 0; k++)
+    if (p->plugin[k].callbacks.memory != NULL)
+      p->plugin[k].callbacks.memory(p->plugin[k].ctx, p->accesses, p->naccesses);
+  p->naccesses = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : flush_block                                     */
+/*                                                             */
+/* Purpose   : Report the block that started at entry_pc and   */
+/*             ends before instruction number `end`            */
+/*                                                             */
+/***************************************************************/
+static void flush_block(struct plugins *p, uint64_t end)
+{
+  uint64_t count = end - p->entry_count;
+  int k;
+
+  if (p->translate > 0)
+  {
+    /* a block runs through not-taken branches into the next ones */
+    uint64_t pc = p->entry_pc, stop = p->entry_pc + 4 * count;
+    uint32_t length;
+    while (pc < stop && (length = translate(p, pc)) != 0)
+      pc += 4 * (uint64_t)length;
+  }
+  flush_memory(p);
+  if (count == 0)
+    return;
+  for (k = 0; k < p->count; k++)
+    if (p->plugin[k].callbacks.exec != NULL)
+      p->plugin[k].callbacks.exec(p->plugin[k].ctx, p->entry_pc, count);
+}
+
+/* From boundary_checks(), while the branch to target retires */
+void plugin_block(uint64_t target)
+{
+  struct plugins *p = ARMSIM->plugins;
+
+  flush_block(p, INSTRUCTION_COUNT + 1);
+  p->entry_pc = target;
+  p->entry_count = INSTRUCTION_COUNT + 1;
+}
+
+/* From trace_data_models(); NEXT_STATE.PC is still the access's pc */
+void plugin_data(uint64_t address, int size, int write)
+{
+  struct plugins *p = ARMSIM->plugins;
+  armsim_mem_access_t *access = &p->accesses[p->naccesses++];
+
+  access->pc = NEXT_STATE.PC;
+  access->address = address;
+  access->size = size;
+  access->write = write;
+  if (p->naccesses == PLUGIN_BATCH)
+    flush_memory(p);
+}
+
+void plugin_run_start()
+{
+  ARMSIM->plugins->entry_pc = CURRENT_STATE.PC;
+  ARMSIM->plugins->entry_count = INSTRUCTION_COUNT;
+}
+
+/* After simulate() has settled INSTRUCTION_COUNT and the stop reason */
+void plugin_run_end()
+{
+  struct plugins *p = ARMSIM->plugins;
+  int k;
+
+  if (ARMSIM->roi_active)
+    flush_block(p, INSTRUCTION_COUNT);
+  p->entry_pc = CURRENT_STATE.PC;
+  p->entry_count = INSTRUCTION_COUNT;
+  if (STOP_REASON != STOP_HALT && STOP_REASON != STOP_INVALID)
+    return;
+  for (k = 0; k < p->count; k++)
+    if (p->plugin[k].callbacks.halt != NULL)
+      p->plugin[k].callbacks.halt(p->plugin[k].ctx, STOP_REASON);
+}
+
+/* From roi_marker(), before the marker takes effect; the marker
+ * itself belongs to no block */
+void plugin_roi(int marker)
+{
+  struct plugins *p = ARMSIM->plugins;
+  int k;
+
+  if (ARMSIM->roi_active)
+    flush_block(p, INSTRUCTION_COUNT);
+  p->entry_pc = NEXT_STATE.PC;
+  p->entry_count = INSTRUCTION_COUNT + 1;
+  for (k = 0; k < p->count; k++)
+    if (p->plugin[k].callbacks.roi != NULL)
+      p->plugin[k].callbacks.roi(p->plugin[k].ctx, marker);
+}
+
+/* A store to the text segment: translations may be stale */
+void plugin_invalidate()
+{
+  struct plugins *p = ARMSIM->plugins;
+
+  if (p->nblocks == 0)
+    return;
+  memset(p->blocks, 0, (p->block_mask + 1) * sizeof(*p->blocks));
+  p->nblocks = 0;
+}
+
+void plugin_flush()
+{
+  if (ARMSIM->plugins == NULL)
+    return;
+  plugin_invalidate();
+  ARMSIM->plugins->naccesses = 0;
+}
+
+void plugin_free()
+{
+  struct plugins *p = ARMSIM->plugins;
+  int k;
+
+  if (p == NULL)
+    return;
+  for (k = 0; k < p->count; k++)
+  {
+    if (p->plugin[k].callbacks.unload != NULL)
+      p->plugin[k].callbacks.unload(p->plugin[k].ctx);
+    if (p->plugin[k].handle != NULL)
+      dlclose(p->plugin[k].handle);
+  }
+  free(p->blocks);
+  free(p);
+  ARMSIM->plugins = NULL;
+  ARMSIM->plugin_blocks = ARMSIM->plugin_memory = FALSE;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_plugin_register(armsim_t *sim, const armsim_plugin_t *plugin, void *ctx)
+{
+  struct plugins *p;
+
+  if (sim == NULL || plugin == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (sim->plugins == NULL)
+  {
+    if ((p = calloc(1, sizeof(*p))) == NULL || (p->blocks = calloc(1024, sizeof(block_t))) == NULL)
+    {
+      free(p);
+      return ARMSIM_E_NOMEM;
+    }
+    p->block_mask = 1023;
+    sim->plugins = p;
+  }
+  p = sim->plugins;
+  if (p->count == ARMSIM_MAX_PLUGINS)
+    return ARMSIM_E_FULL;
+
+  p->plugin[p->count].callbacks = *plugin;
+  p->plugin[p->count].ctx = ctx;
+  p->plugin[p->count].handle = NULL;
+  p->count++;
+  p->translate += plugin->translate != NULL;
+  p->exec += plugin->exec != NULL;
+  p->memory += plugin->memory != NULL;
+
+  sim->plugin_blocks = p->translate > 0 || p->exec > 0;
+  sim->plugin_memory = p->memory > 0;
+  trace_update();
+  schedule_checks();
+  return p->count - 1;
+}
+
+int armsim_plugin_load(armsim_t *sim, const char *path, const char *args)
+{
+  int (*init)(armsim_t *, const char *);
+  void *handle;
+  int before, after, result;
+
+  if (sim == NULL || path == NULL)
+    return ARMSIM_E_INVAL;
+  if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+    return ARMSIM_E_IO;
+  if ((init = (int (*)(armsim_t *, const char *))dlsym(handle, "armsim_plugin_init")) == NULL)
+  {
+    dlclose(handle);
+    return ARMSIM_E_FORMAT;
+  }
+
+  before = sim->plugins != NULL ? sim->plugins->count : 0;
+  result = init(sim, args != NULL ? args : "");
+  after = sim->plugins != NULL ? sim->plugins->count : 0;
+  if (after == before)
+  {
+    dlclose(handle);
+    return result < 0 ? result : ARMSIM_E_INVAL;
+  }
+  if (result < 0)
+  {
+    /* drop what the failed init registered before unloading its code */
+    struct plugins *p = sim->plugins;
+    while (p->count > before)
+    {
+      const armsim_plugin_t *callbacks = &p->plugin[--p->count].callbacks;
+      p->translate -= callbacks->translate != NULL;
+      p->exec -= callbacks->exec != NULL;
+      p->memory -= callbacks->memory != NULL;
+    }
+    sim->plugin_blocks = p->translate > 0 || p->exec > 0;
+    sim->plugin_memory = p->memory > 0;
+    ARMSIM = sim;
+    trace_update();
+    schedule_checks();
+    dlclose(handle);
+    return result;
+  }
+  /* the code stays loaded while any of its callbacks is registered */
+  sim->plugins->plugin[after - 1].handle = handle;
+  return 0;
+}
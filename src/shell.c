@@ -21,251 +21,1933 @@
 /*          You should only change sim.c!                       */
 /* !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
 
-#include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include <inttypes.h>
-#include "shell.h"
+#include <time.h>
+#include "armsim.h"
+
+#define FALSE 0
+#define TRUE 1
+
+/* The interactive shell is a client of libarmsim; it owns the only
+ * simulator instance and does all of the printing. */
+armsim_t *SIM;
+
+/* the cache sweep started with -s, until the sweep command */
+armsim_cache_config_t *SWEEP_CONFIGS;
+size_t NUM_SWEEP_CONFIGS;
+char SWEEP_STREAM[8];
+
+/* names of the -p branch predictors, by predictor index */
+#define MAX_PREDICTORS 8
+char PREDICTOR_NAMES[MAX_PREDICTORS][32];
+int NUM_PREDICTORS;
+
+/* -o addr:len:file regions, saved at exit */
+#define MAX_DATA_FILES 16
+char *SAVE_SPECS[MAX_DATA_FILES];
+int NUM_SAVE_SPECS;
+
+/* -J timeline_file[:interval], started before the programs load */
+char *TIMELINE_SPEC;
+
+/* the run started by "go &", see go() */
+enum { BG_IDLE, BG_RUNNING, BG_DONE };
+atomic_int BG_STATE = BG_IDLE;
+pthread_t BG_THREAD;
+int BG_RESULT;
+struct timespec BG_START;
+uint64_t BG_START_COUNT; /* instructions when it started */
+
+/* a run is in progress, in either thread: SIGINT interrupts it */
+volatile sig_atomic_t RUNNING;
 
 /***************************************************************/
-/* Main memory.                                                */
+/*                                                             */
+/* Procedure : help                                            */
+/*                                                             */
+/* Purpose   : Print out a list of commands                    */
+/*                                                             */
 /***************************************************************/
+void help()
+{
+  printf("----------------ARM ISIM Help-----------------------\n");
+  printf("go               -  run program to completion         \n");
+  printf("go &             -  run it in the background          \n");
+  printf("status, stats    -  what a background run is doing    \n");
+  printf("stop             -  pause it at the next block boundary\n");
+  printf("run n            -  execute program for n instructions\n");
+  printf("mdump low high   -  dump memory from low to high      \n");
+  printf("load_data file addr - map a host file into data memory\n");
+  printf("save_data addr len file - write guest memory to a file\n");
+  printf("rdump            -  dump the register & bus values    \n");
+  printf("format f [target] - rdump/mdump as text|json|binary,  \n");
+  printf("                    to both|console|file              \n");
+  printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
+  printf("break pc         -  stop before executing pc          \n");
+  printf("delete pc        -  remove the breakpoint at pc       \n");
+  printf("watch addr [len] -  stop when a write changes addr..+len\n");
+  printf("unwatch addr     -  remove the watchpoint at addr     \n");
+  printf("until pc         -  run until pc is reached           \n");
+  printf("limit n [secs]   -  cap each go at n instructions/secs\n");
+  printf("cache            -  dump the cache model statistics   \n");
+  printf("sweep            -  finish the -s sweep, dump its table\n");
+  printf("predict          -  dump the branch predictor statistics\n");
+  printf("timing           -  dump the pipeline cycles and stalls\n");
+  printf("ooo              -  dump the out-of-order core statistics\n");
+  printf("flow             -  dump the dataflow limit study       \n");
+  printf("access           -  dump the memory access patterns     \n");
+  printf("history [n]      -  dump the last n instructions retired\n");
+  printf("host             -  dump the host cost of each instruction\n");
+  printf("profile          -  dump the -Q per-PC profile          \n");
+  printf("?                -  display this help menu            \n");
+  printf("quit             -  exit the program                  \n\n");
+}
 
-#define MEM_DATA_START 0x10000000
-#define MEM_DATA_SIZE 0x00100000
-#define MEM_TEXT_START 0x00400000
-#define MEM_TEXT_SIZE 0x00100000
-#define MEM_STACK_START 0xfffffffc
-#define MEM_STACK_SIZE 0x00100000
+/***************************************************************/
+/*                                                             */
+/* Procedure : read_word                                       */
+/*                                                             */
+/* Purpose   : Read a guest word, 0 outside guest memory       */
+/*                                                             */
+/***************************************************************/
+uint32_t read_word(uint64_t address)
+{
+  uint8_t bytes[4];
+  if (armsim_read_mem(SIM, address, bytes, sizeof(bytes)) != 0)
+    return 0;
+  return (bytes[3] << 24) | (bytes[2] << 16) | (bytes[1] << 8) | bytes[0];
+}
 
-typedef struct
+/***************************************************************/
+/*                                                             */
+/* Procedure : take_sample                                     */
+/*                                                             */
+/* Purpose   : The state rdump, status and stats show: sampled */
+/*             through the monitor while a run is in progress  */
+/*             in the background, read directly otherwise      */
+/*                                                             */
+/***************************************************************/
+void take_sample(armsim_sample_t *s)
+{
+  armsim_counters_t counters;
+  int k;
+
+  if (atomic_load(&BG_STATE) == BG_RUNNING && armsim_sample(SIM, s) == 0)
+    return;
+  armsim_get_counters(SIM, &counters);
+  s->instructions = counters.instructions;
+  s->roi_instructions = counters.roi_instructions;
+  s->stores = counters.stores;
+  s->pc = armsim_get_pc(SIM);
+  for (k = 0; k < ARMSIM_REGS; k++)
+    s->regs[k] = armsim_get_reg(SIM, k);
+  s->nzcv = armsim_get_flags(SIM);
+  s->running = FALSE;
+}
+
+double seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Ctrl-C stops a run at its next sampled block boundary, and quits
+ * when nothing is running */
+void interrupt_handler(int sig)
+{
+  if (RUNNING)
+  {
+    armsim_interrupt(SIM);
+    return;
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : history_dump                                    */
+/*                                                             */
+/* Purpose   : Dump the last max (0: all) instructions from    */
+/*             the flight recorder to the screen and, unless   */
+/*             NULL, to the output file                        */
+/*                                                             */
+/***************************************************************/
+void history_dump(FILE *dumpsim_file, size_t max)
+{
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_history_entry_t *entries;
+  int i, k, n = armsim_history(SIM, NULL, 0);
+
+  if (max > 0 && (size_t)n > max)
+    n = max;
+  if ((entries = calloc(n + 1, sizeof(*entries))) == NULL)
+  {
+    printf("Error: Can't allocate history\n");
+    exit(-1);
+  }
+  n = armsim_history(SIM, entries, n);
+
+  for (i = 0; i < 1 + (dumpsim_file != NULL); i++)
+  {
+    fprintf(out[i], "\nLast %d instructions :\n", n);
+    fprintf(out[i], "-------------------------------------\n");
+    for (k = 0; k < n; k++)
+    {
+      fprintf(out[i], "0x%016" PRIx64 ": %08x  ", entries[k].pc, entries[k].word);
+      if (entries[k].dest >= 0)
+        fprintf(out[i], "%-7s X%d = 0x%" PRIx64 "\n", entries[k].name, entries[k].dest,
+                entries[k].value);
+      else
+        fprintf(out[i], "%s\n", entries[k].name);
+    }
+    fprintf(out[i], "\n");
+  }
+  free(entries);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : report_stop                                     */
+/*                                                             */
+/* Purpose   : Explain why a run returned; a final stop shows  */
+/*             the flight recorder on the screen, so dumpsim   */
+/*             stays comparable with the reference simulators  */
+/*                                                             */
+/***************************************************************/
+void report_stop(int result)
+{
+  uint64_t pc = armsim_get_pc(SIM);
+  uint64_t address, writer;
+
+  switch (result)
+  {
+  case ARMSIM_E_HALTED:
+    printf("Can't simulate, Simulator is halted\n\n");
+    break;
+  case ARMSIM_HALTED:
+    printf("Simulator halted\n\n");
+    break;
+  case ARMSIM_BREAKPOINT:
+    printf("Breakpoint at 0x%" PRIx64 "\n\n", pc);
+    break;
+  case ARMSIM_WATCHPOINT:
+    armsim_watch_hit(SIM, &address, &writer);
+    printf("Watchpoint: write to 0x%" PRIx64 " by PC 0x%" PRIx64 "\n\n",
+           address, writer);
+    break;
+  case ARMSIM_INVALID:
+    printf("Invalid instruction 0x%08x at 0x%" PRIx64 "\n\n", read_word(pc), pc);
+    printf("Simulator halted\n\n");
+    break;
+  case ARMSIM_CHECKPOINT:
+    printf("Checkpoint at 0x%" PRIx64 "\n\n", pc);
+    break;
+  case ARMSIM_IDLE_LOOP:
+    printf("Idle loop at 0x%" PRIx64 ": guest can no longer make progress\n\n", pc);
+    printf("Simulator halted\n\n");
+    break;
+  case ARMSIM_BUDGET:
+    printf("Instruction budget exhausted at 0x%" PRIx64 "\n\n", pc);
+    break;
+  case ARMSIM_TIMEOUT:
+    printf("Time limit exceeded at 0x%" PRIx64 "\n\n", pc);
+    break;
+  case ARMSIM_INTERRUPTED:
+    printf("Stopped at 0x%" PRIx64 "\n\n", pc);
+    break;
+  default:
+    break;
+  }
+  if (result == ARMSIM_HALTED || result == ARMSIM_INVALID || result == ARMSIM_IDLE_LOOP)
+    history_dump(NULL, 0);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run n                                           */
+/*                                                             */
+/* Purpose   : Simulate ARM for n cycles                       */
+/*                                                             */
+/***************************************************************/
+void run(int num_cycles)
 {
-  uint64_t start, size;
-  uint8_t *mem;
-} mem_region_t;
+  int result;
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-    {MEM_TEXT_START, MEM_TEXT_SIZE, NULL},
-    {MEM_DATA_START, MEM_DATA_SIZE, NULL},
-    {MEM_STACK_START, MEM_STACK_SIZE, NULL},
-};
+  if (armsim_is_halted(SIM))
+  {
+    report_stop(ARMSIM_E_HALTED);
+    return;
+  }
 
-#define MEM_NREGIONS (sizeof(MEM_REGIONS) / sizeof(mem_region_t))
+  printf("Simulating for %d cycles...\n\n", num_cycles);
+  RUNNING = TRUE;
+  result = armsim_step(SIM, num_cycles);
+  RUNNING = FALSE;
+  report_stop(result);
+}
 
 /***************************************************************/
-/* CPU State info.                                             */
+/*                                                             */
+/* rdump and mdump build the whole dump in one buffer, in the  */
+/* format and for the targets chosen with -f or the format     */
+/* command, and hand it to each target with one write():       */
+/*                                                             */
+/*   text    the classic listing                               */
+/*   json    one object per dump, on one line                  */
+/*   binary  host-endian records, like simd's wire format:     */
+/*             u32 DUMP_REGS_MAGIC, u32 nzcv,                  */
+/*             u64 instructions, u64 roi_instructions, u64 pc, */
+/*             u64 regs[32]                                    */
+/*           or                                                */
+/*             u32 DUMP_MEM_MAGIC, u32 nwords, u64 start,      */
+/*             u32 word[nwords]                                */
+/*                                                             */
 /***************************************************************/
+#define DUMP_REGS_MAGIC 0x474d5341 /* "ASMG" */
+#define DUMP_MEM_MAGIC 0x4d4d5341  /* "ASMM" */
+
+enum { DUMP_TEXT, DUMP_JSON, DUMP_BINARY };
+enum { DUMP_BOTH, DUMP_CONSOLE, DUMP_FILE };
+const char *DUMP_FORMATS[] = {"text", "json", "binary"};
+const char *DUMP_TARGETS[] = {"both", "console", "file"};
+int DUMP_FORMAT = DUMP_TEXT;
+int DUMP_TARGET = DUMP_BOTH;
+
+typedef struct
+{
+  char *data;
+  size_t len, size;
+} dump_buf_t;
+
+char *buf_reserve(dump_buf_t *b, size_t n)
+{
+  if (b->len + n > b->size)
+  {
+    size_t size = b->size ? b->size : 4096;
+    while (size < b->len + n)
+      size *= 2;
+    if ((b->data = realloc(b->data, size)) == NULL)
+    {
+      printf("Error: Can't allocate the dump\n");
+      exit(-1);
+    }
+    b->size = size;
+  }
+  return b->data + b->len;
+}
+
+void buf_put(dump_buf_t *b, const void *data, size_t len)
+{
+  memcpy(buf_reserve(b, len), data, len);
+  b->len += len;
+}
+
+void buf_printf(dump_buf_t *b, const char *format, ...)
+{
+  va_list args;
+  int n;
+
+  va_start(args, format);
+  n = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  buf_reserve(b, n + 1);
+  va_start(args, format);
+  vsnprintf(b->data + b->len, n + 1, format, args);
+  va_end(args);
+  b->len += n;
+}
+
+/* value in hex, at least digits wide, without printf per word */
+void buf_hex(dump_buf_t *b, uint64_t value, int digits)
+{
+  static const char hex[] = "0123456789abcdef";
+  char *p = buf_reserve(b, 16);
+  int n = 1, k;
+
+  while (n < 16 && value >> 4 * n != 0)
+    n++;
+  if (n < digits)
+    n = digits;
+  for (k = n - 1; k >= 0; k--, value >>= 4)
+    p[k] = hex[value & 0xf];
+  b->len += n;
+}
+
+void buf_dec(dump_buf_t *b, int64_t value)
+{
+  char digits[20], *p = buf_reserve(b, 21);
+  uint64_t v = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  int n = 0;
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_BIT; /* run bit */
-int INSTRUCTION_COUNT;
+  do
+    digits[n++] = '0' + v % 10;
+  while ((v /= 10) != 0);
+  if (value < 0)
+    *p++ = '-', b->len++;
+  while (n > 0)
+    *p++ = digits[--n], b->len++;
+}
 
 /***************************************************************/
 /*                                                             */
-/* Procedure: mem_read_32                                      */
+/* Procedure : dump_flush                                      */
 /*                                                             */
-/* Purpose: Read a 32-bit word from memory                     */
+/* Purpose   : Write the buffer to the screen and/or the       */
+/*             output file, once each, and empty it            */
 /*                                                             */
 /***************************************************************/
-uint32_t mem_read_32(uint64_t address)
+void dump_flush(FILE *dumpsim_file, dump_buf_t *b)
 {
+  FILE *out[2] = {stdout, dumpsim_file};
   int i;
-  for (i = 0; i < MEM_NREGIONS; i++)
+
+  for (i = 0; i < 2; i++)
   {
-    if (address >= MEM_REGIONS[i].start &&
-        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size))
+    size_t done = 0;
+    if (DUMP_TARGET == (i == 0 ? DUMP_FILE : DUMP_CONSOLE))
+      continue;
+    /* whatever stdio still holds goes first */
+    fflush(out[i]);
+    while (done < b->len)
     {
-      uint32_t offset = address - MEM_REGIONS[i].start;
+      ssize_t n = write(fileno(out[i]), b->data + done, b->len - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+  }
+  free(b->data);
+  memset(b, 0, sizeof(*b));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : set_format                                      */
+/*                                                             */
+/* Purpose   : Parse "format[:target]" (or "format target")    */
+/*             into DUMP_FORMAT and DUMP_TARGET                */
+/*                                                             */
+/***************************************************************/
+int set_format(const char *format, const char *target)
+{
+  int f, t;
+
+  for (f = 0; f < 3; f++)
+    if (strncasecmp(format, DUMP_FORMATS[f], strlen(DUMP_FORMATS[f])) == 0 &&
+        (format[strlen(DUMP_FORMATS[f])] == '\0' || format[strlen(DUMP_FORMATS[f])] == ':'))
+      break;
+  if (f == 3)
+    return FALSE;
+  if (target == NULL && (target = strchr(format, ':')) != NULL)
+    target++;
+  t = DUMP_BOTH;
+  if (target != NULL)
+  {
+    for (t = 0; t < 3; t++)
+      if (strcasecmp(target, DUMP_TARGETS[t]) == 0)
+        break;
+    if (t == 3)
+      return FALSE;
+  }
+  DUMP_FORMAT = f;
+  DUMP_TARGET = t;
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : mdump                                           */
+/*                                                             */
+/* Purpose   : Dump a word-aligned region of memory to the     */
+/*             output file, MDUMP_CHUNK words per write so a   */
+/*             wide range never needs one huge buffer          */
+/*                                                             */
+/***************************************************************/
+#define MDUMP_CHUNK 65536
 
-      return (MEM_REGIONS[i].mem[offset + 3] << 24) |
-             (MEM_REGIONS[i].mem[offset + 2] << 16) |
-             (MEM_REGIONS[i].mem[offset + 1] << 8) |
-             (MEM_REGIONS[i].mem[offset + 0] << 0);
+void mdump(FILE *dumpsim_file, uint32_t start, uint32_t stop)
+{
+  dump_buf_t b = {NULL, 0, 0};
+  uint32_t *words, nwords, done, n, k;
+
+  nwords = stop < start ? 0 : (stop - start) / 4 + 1;
+  if ((words = malloc(MDUMP_CHUNK * sizeof(uint32_t))) == NULL)
+  {
+    printf("Error: Can't allocate the dump\n\n");
+    return;
+  }
+  armsim_timeline_span(SIM, "mdump", TRUE);
+
+  switch (DUMP_FORMAT)
+  {
+  case DUMP_TEXT:
+    buf_printf(&b, "\nMemory content [0x%08x..0x%08x] :\n", start, stop);
+    buf_printf(&b, "-------------------------------------\n");
+    break;
+  case DUMP_JSON:
+    buf_printf(&b, "{\"memory\":{\"start\":\"0x%08x\",\"stop\":\"0x%08x\",\"words\":[", start, stop);
+    break;
+  case DUMP_BINARY:
+  {
+    uint32_t header[2] = {DUMP_MEM_MAGIC, nwords};
+    uint64_t address = start;
+    buf_put(&b, header, sizeof(header));
+    buf_put(&b, &address, sizeof(address));
+    break;
+  }
+  }
+
+  for (done = 0; done < nwords; done += n)
+  {
+    uint32_t address = start + 4 * done;
+
+    n = nwords - done < MDUMP_CHUNK ? nwords - done : MDUMP_CHUNK;
+    /* one copy for the usual range inside one region */
+    if (armsim_read_mem(SIM, address, words, n * sizeof(uint32_t)) != 0)
+      for (k = 0; k < n; k++)
+        words[k] = read_word(address + 4 * k);
+
+    switch (DUMP_FORMAT)
+    {
+    case DUMP_TEXT:
+      buf_reserve(&b, (size_t)n * 44);
+      for (k = 0; k < n; k++)
+      {
+        buf_put(&b, "  0x", 4);
+        buf_hex(&b, address + 4 * k, 8);
+        buf_put(&b, " (", 2);
+        buf_dec(&b, (int32_t)(address + 4 * k));
+        buf_put(&b, ") : 0x", 6);
+        buf_hex(&b, words[k], 1);
+        buf_put(&b, "\n", 1);
+      }
+      break;
+    case DUMP_JSON:
+      buf_reserve(&b, (size_t)n * 11);
+      for (k = 0; k < n; k++)
+      {
+        if (done + k > 0)
+          buf_put(&b, ",", 1);
+        buf_dec(&b, words[k]);
+      }
+      break;
+    case DUMP_BINARY:
+      buf_put(&b, words, (size_t)n * sizeof(uint32_t));
+      break;
     }
+    if (done + n < nwords)
+      dump_flush(dumpsim_file, &b);
   }
 
-  return 0;
+  if (DUMP_FORMAT == DUMP_TEXT)
+    buf_put(&b, "\n", 1);
+  else if (DUMP_FORMAT == DUMP_JSON)
+    buf_put(&b, "]}}\n", 4);
+  free(words);
+  dump_flush(dumpsim_file, &b);
+  armsim_timeline_span(SIM, "mdump", FALSE);
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure: mem_write_32                                     */
+/* Procedure : rdump                                           */
 /*                                                             */
-/* Purpose: Write a 32-bit word to memory                      */
+/* Purpose   : Dump current register and bus values to the     */
+/*             output file.                                    */
 /*                                                             */
 /***************************************************************/
-void mem_write_32(uint64_t address, uint32_t value)
+void rdump(FILE *dumpsim_file)
 {
-  int i;
-  for (i = 0; i < MEM_NREGIONS; i++)
+  dump_buf_t b = {NULL, 0, 0};
+  int k;
+  armsim_sample_t s;
+  int flags;
+
+  armsim_timeline_span(SIM, "rdump", TRUE);
+  take_sample(&s);
+  flags = s.nzcv;
+
+  switch (DUMP_FORMAT)
+  {
+  case DUMP_TEXT:
+    buf_printf(&b, "\nCurrent register/bus values%s :\n",
+               s.running ? " (sampled while running)" : "");
+    buf_printf(&b, "-------------------------------------\n");
+    buf_printf(&b, "Instruction Count : %" PRIu64 "\n", s.instructions);
+    if (s.roi_instructions != s.instructions)
+      buf_printf(&b, "ROI Instructions  : %" PRIu64 "\n", s.roi_instructions);
+    buf_printf(&b, "PC                : 0x%" PRIx64 "\n", s.pc);
+    buf_printf(&b, "Registers:\n");
+    for (k = 0; k < ARMSIM_REGS; k++)
+      buf_printf(&b, "X%d: 0x%" PRIx64 "\n", k, s.regs[k]);
+    buf_printf(&b, "FLAG_N: %d\n", (flags & ARMSIM_FLAG_N) != 0);
+    buf_printf(&b, "FLAG_Z: %d\n", (flags & ARMSIM_FLAG_Z) != 0);
+    buf_printf(&b, "FLAG_V: %d\n", (flags & ARMSIM_FLAG_V) != 0);
+    buf_printf(&b, "FLAG_C: %d\n", (flags & ARMSIM_FLAG_C) != 0);
+    buf_printf(&b, "\n");
+    break;
+  case DUMP_JSON:
+    /* 64-bit values as hex strings: JSON numbers are doubles */
+    buf_printf(&b, "{\"registers\":{\"instructions\":%" PRIu64 ",\"roi_instructions\":%" PRIu64
+                   ",\"pc\":\"0x%" PRIx64 "\",\"running\":%s,\"x\":[",
+               s.instructions, s.roi_instructions, s.pc, s.running ? "true" : "false");
+    for (k = 0; k < ARMSIM_REGS; k++)
+      buf_printf(&b, "%s\"0x%" PRIx64 "\"", k > 0 ? "," : "", s.regs[k]);
+    buf_printf(&b, "],\"n\":%d,\"z\":%d,\"v\":%d,\"c\":%d}}\n", (flags & ARMSIM_FLAG_N) != 0,
+               (flags & ARMSIM_FLAG_Z) != 0, (flags & ARMSIM_FLAG_V) != 0,
+               (flags & ARMSIM_FLAG_C) != 0);
+    break;
+  case DUMP_BINARY:
   {
-    if (address >= MEM_REGIONS[i].start &&
-        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size))
+    uint32_t header[2] = {DUMP_REGS_MAGIC, flags};
+    uint64_t values[3] = {s.instructions, s.roi_instructions, s.pc};
+    buf_put(&b, header, sizeof(header));
+    buf_put(&b, values, sizeof(values));
+    buf_put(&b, s.regs, sizeof(s.regs));
+    break;
+  }
+  }
+  dump_flush(dumpsim_file, &b);
+  armsim_timeline_span(SIM, "rdump", FALSE);
+}
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_dump                                      */
+/*                                                             */
+/* Purpose   : Dump the cache model statistics per level and   */
+/*             per region to the output file.                  */
+/*                                                             */
+/***************************************************************/
+void cache_dump(FILE *dumpsim_file)
+{
+  static const char *levels[ARMSIM_CACHE_LEVELS] = {"L1I", "L1D", "L2"};
+  static const char *regions[ARMSIM_REGIONS] = {"text", "data", "stack", "other"};
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_cache_stats_t stats;
+  int i, level, k;
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nCache statistics :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    for (level = 0; level < ARMSIM_CACHE_LEVELS; level++)
     {
-      uint32_t offset = address - MEM_REGIONS[i].start;
+      if (armsim_cache_stats(SIM, level, &stats) != 0)
+        continue;
+      armsim_cache_counts_t *t = &stats.total;
+      uint64_t accesses = t->hits + t->misses;
+      fprintf(out[i], "%-4s hits %" PRIu64 " misses %" PRIu64 " (%.2f%%) evictions %" PRIu64
+                      " writebacks %" PRIu64 "\n",
+              levels[level], t->hits, t->misses, accesses ? 100.0 * t->misses / accesses : 0.0,
+              t->evictions, t->writebacks);
+      for (k = 0; k < ARMSIM_REGIONS; k++)
+      {
+        armsim_cache_counts_t *r = &stats.region[k];
+        if (r->hits + r->misses + r->evictions == 0)
+          continue;
+        fprintf(out[i], "  %-6s hits %" PRIu64 " misses %" PRIu64 " evictions %" PRIu64
+                        " writebacks %" PRIu64 "\n",
+                regions[k], r->hits, r->misses, r->evictions, r->writebacks);
+      }
+    }
+    fprintf(out[i], "\n");
+  }
+}
 
-      MEM_REGIONS[i].mem[offset + 3] = (value >> 24) & 0xFF;
-      MEM_REGIONS[i].mem[offset + 2] = (value >> 16) & 0xFF;
-      MEM_REGIONS[i].mem[offset + 1] = (value >> 8) & 0xFF;
-      MEM_REGIONS[i].mem[offset + 0] = (value >> 0) & 0xFF;
-      return;
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_cache                                     */
+/*                                                             */
+/* Purpose   : Parse level:size:ways:line[:lru|plru][:wb|wt],  */
+/*             e.g. l1d:32k:8:64:plru:wb, into config          */
+/*                                                             */
+/***************************************************************/
+int parse_cache(const char *spec, armsim_cache_config_t *config)
+{
+  char level[8], rest[32], *p;
+  unsigned long size, ways, line;
+  armsim_cache_config_t *c;
+  int used;
+
+  if (sscanf(spec, "%7[^:]:%lu%n", level, &size, &used) != 2)
+    return FALSE;
+  p = (char *)spec + used;
+  if (*p == 'k' || *p == 'K')
+    size <<= 10, p++;
+  else if (*p == 'm' || *p == 'M')
+    size <<= 20, p++;
+  if (sscanf(p, ":%lu:%lu%n", &ways, &line, &used) != 2)
+    return FALSE;
+  p += used;
+
+  if (strcasecmp(level, "l1i") == 0)
+    c = &config[ARMSIM_CACHE_L1I];
+  else if (strcasecmp(level, "l1d") == 0)
+    c = &config[ARMSIM_CACHE_L1D];
+  else if (strcasecmp(level, "l2") == 0)
+    c = &config[ARMSIM_CACHE_L2];
+  else
+    return FALSE;
+
+  c->size = size;
+  c->ways = ways;
+  c->line = line;
+  c->replacement = ARMSIM_REPLACE_LRU;
+  c->write_back = TRUE;
+  while (sscanf(p, ":%31[^:]%n", rest, &used) == 1)
+  {
+    if (strcasecmp(rest, "lru") == 0)
+      c->replacement = ARMSIM_REPLACE_LRU;
+    else if (strcasecmp(rest, "plru") == 0)
+      c->replacement = ARMSIM_REPLACE_PLRU;
+    else if (strcasecmp(rest, "wb") == 0)
+      c->write_back = TRUE;
+    else if (strcasecmp(rest, "wt") == 0)
+      c->write_back = FALSE;
+    else
+      return FALSE;
+    p += used;
+  }
+  return *p == '\0';
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_list                                      */
+/*                                                             */
+/* Purpose   : Parse "a,b,c" or the power-of-two range "lo-hi" */
+/*             (k/m suffixes allowed); returns the count       */
+/*                                                             */
+/***************************************************************/
+int parse_list(const char *text, uint32_t *values, int max)
+{
+  int n = 0;
+  char *end;
+
+  while (n < max)
+  {
+    unsigned long value = strtoul(text, &end, 0);
+    if (end == text)
+      return 0;
+    if (*end == 'k' || *end == 'K')
+      value <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+      value <<= 20, end++;
+    if (*end == '-' && n == 0)
+    {
+      unsigned long hi = strtoul(end + 1, &end, 0);
+      if (*end == 'k' || *end == 'K')
+        hi <<= 10, end++;
+      else if (*end == 'm' || *end == 'M')
+        hi <<= 20, end++;
+      for (; value <= hi && value != 0 && n < max; value <<= 1)
+        values[n++] = value;
+      return *end == '\0' ? n : 0;
     }
+    values[n++] = value;
+    if (*end != ',')
+      return *end == '\0' ? n : 0;
+    text = end + 1;
+  }
+  return n;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : start_sweep                                     */
+/*                                                             */
+/* Purpose   : Feed every cache configuration of spec from the */
+/*             runs that follow, until the sweep command.      */
+/*             spec is stream:sizes:ways:lines[:lru|plru]      */
+/*             [:wb|wt], e.g. data:1k-64k:1,2,4,8:32,64        */
+/*                                                             */
+/***************************************************************/
+void start_sweep(const char *spec, int threads)
+{
+  char sizes_text[64], ways_text[64], lines_text[64], policy[8];
+  uint32_t sizes[32], ways[32], lines[32];
+  int nsizes, nways, nlines, replacement = ARMSIM_REPLACE_LRU, write_back = TRUE;
+  int streams, i, j, k, used, result;
+
+  if (sscanf(spec, "%7[^:]:%63[^:]:%63[^:]:%63[^:]%n", SWEEP_STREAM, sizes_text, ways_text,
+             lines_text, &used) != 4 ||
+      (nsizes = parse_list(sizes_text, sizes, 32)) == 0 ||
+      (nways = parse_list(ways_text, ways, 32)) == 0 ||
+      (nlines = parse_list(lines_text, lines, 32)) == 0)
+  {
+    printf("Error: Bad sweep %s (want stream:sizes:ways:lines[:lru|plru][:wb|wt])\n", spec);
+    exit(1);
+  }
+  for (spec += used; sscanf(spec, ":%7[^:]%n", policy, &used) == 1; spec += used)
+  {
+    if (strcasecmp(policy, "lru") == 0)
+      replacement = ARMSIM_REPLACE_LRU;
+    else if (strcasecmp(policy, "plru") == 0)
+      replacement = ARMSIM_REPLACE_PLRU;
+    else if (strcasecmp(policy, "wb") == 0)
+      write_back = TRUE;
+    else if (strcasecmp(policy, "wt") == 0)
+      write_back = FALSE;
+    else
+      break;
+  }
+  if (*spec != '\0')
+  {
+    printf("Error: Bad sweep policy %s (want lru|plru|wb|wt)\n", spec + 1);
+    exit(1);
+  }
+  if (strcasecmp(SWEEP_STREAM, "fetch") == 0)
+    streams = ARMSIM_SWEEP_FETCH;
+  else if (strcasecmp(SWEEP_STREAM, "data") == 0)
+    streams = ARMSIM_SWEEP_DATA;
+  else if (strcasecmp(SWEEP_STREAM, "all") == 0)
+    streams = ARMSIM_SWEEP_FETCH | ARMSIM_SWEEP_DATA;
+  else
+  {
+    printf("Error: Bad sweep stream %s (want fetch|data|all)\n", SWEEP_STREAM);
+    exit(1);
   }
+
+  SWEEP_CONFIGS = calloc(nsizes * nways * nlines, sizeof(*SWEEP_CONFIGS));
+  if (SWEEP_CONFIGS == NULL)
+  {
+    printf("Error: Can't allocate sweep\n");
+    exit(-1);
+  }
+  /* geometries that don't divide into a power-of-two set count are skipped */
+  for (i = 0; i < nsizes; i++)
+    for (j = 0; j < nways; j++)
+      for (k = 0; k < nlines; k++)
+      {
+        uint64_t set_bytes = (uint64_t)ways[j] * lines[k];
+        uint64_t sets = set_bytes ? sizes[i] / set_bytes : 0;
+        if (sets == 0 || sizes[i] % set_bytes != 0 || (sets & (sets - 1)))
+          continue;
+        SWEEP_CONFIGS[NUM_SWEEP_CONFIGS].size = sizes[i];
+        SWEEP_CONFIGS[NUM_SWEEP_CONFIGS].ways = ways[j];
+        SWEEP_CONFIGS[NUM_SWEEP_CONFIGS].line = lines[k];
+        SWEEP_CONFIGS[NUM_SWEEP_CONFIGS].replacement = replacement;
+        SWEEP_CONFIGS[NUM_SWEEP_CONFIGS].write_back = write_back;
+        NUM_SWEEP_CONFIGS++;
+      }
+
+  if ((result = armsim_sweep_start(SIM, streams, SWEEP_CONFIGS, NUM_SWEEP_CONFIGS,
+                                   threads)) != 0)
+  {
+    printf("Error: Bad sweep configuration: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_dump                                      */
+/*                                                             */
+/* Purpose   : Finish the sweep and dump the miss-ratio table  */
+/*             to the output file.                             */
+/*                                                             */
+/***************************************************************/
+void sweep_dump(FILE *dumpsim_file)
+{
+  armsim_cache_counts_t *results;
+  FILE *out[2] = {stdout, dumpsim_file};
+  size_t c;
+  int i;
+
+  if (SWEEP_CONFIGS == NULL)
+  {
+    printf("No sweep running (start one with -s)\n\n");
+    return;
+  }
+  if ((results = calloc(NUM_SWEEP_CONFIGS + 1, sizeof(*results))) == NULL)
+  {
+    printf("Error: Can't allocate sweep\n");
+    exit(-1);
+  }
+  armsim_sweep_finish(SIM, results);
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nCache sweep (%s references) :\n", SWEEP_STREAM);
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "%10s %5s %5s %5s %3s %14s %14s %10s\n", "size", "ways", "line", "repl",
+            "wr", "hits", "misses", "miss ratio");
+    for (c = 0; c < NUM_SWEEP_CONFIGS; c++)
+    {
+      armsim_cache_config_t *config = &SWEEP_CONFIGS[c];
+      uint64_t accesses = results[c].hits + results[c].misses;
+      fprintf(out[i], "%10u %5u %5u %5s %3s %14" PRIu64 " %14" PRIu64 " %9.4f%%\n",
+              config->size, config->ways, config->line,
+              config->replacement == ARMSIM_REPLACE_PLRU ? "PLRU" : "LRU",
+              config->write_back ? "WB" : "WT", results[c].hits, results[c].misses,
+              accesses ? 100.0 * results[c].misses / accesses : 0.0);
+    }
+    fprintf(out[i], "\n");
+  }
+  free(results);
+  free(SWEEP_CONFIGS);
+  SWEEP_CONFIGS = NULL;
+  NUM_SWEEP_CONFIGS = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : add_predictor                                   */
+/*                                                             */
+/* Purpose   : Attach the predictor described by               */
+/*             kind[:entries[:history]], e.g. gshare:16k:14    */
+/*                                                             */
+/***************************************************************/
+int add_predictor(const char *spec)
+{
+  static const struct
+  {
+    const char *name;
+    int kind;
+    uint32_t entries, history;
+  } kinds[] = {{"bimodal", ARMSIM_BPRED_BIMODAL, 4096, 0},
+               {"gshare", ARMSIM_BPRED_GSHARE, 4096, 12},
+               {"tage", ARMSIM_BPRED_TAGE, 1024, 64},
+               {"btb", ARMSIM_BPRED_BTB, 512, 0},
+               {"ras", ARMSIM_BPRED_RAS, 16, 0}};
+  armsim_bpred_config_t config;
+  char name[16], *p, *end;
+  int used = 0, k;
+
+  if (sscanf(spec, "%15[^:]%n", name, &used) != 1)
+    return FALSE;
+  for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+    if (strcasecmp(name, kinds[k].name) == 0)
+      break;
+  if (k == sizeof(kinds) / sizeof(kinds[0]) || NUM_PREDICTORS == MAX_PREDICTORS)
+    return FALSE;
+  config.kind = kinds[k].kind;
+  config.entries = kinds[k].entries;
+  config.history = kinds[k].history;
+
+  p = (char *)spec + used;
+  if (*p == ':')
+  {
+    config.entries = strtoul(p + 1, &end, 0);
+    if (*end == 'k' || *end == 'K')
+      config.entries <<= 10, end++;
+    p = end;
+  }
+  if (*p == ':')
+  {
+    config.history = strtoul(p + 1, &end, 0);
+    p = end;
+  }
+  if (*p != '\0' || armsim_bpred_add(SIM, &config) < 0)
+    return FALSE;
+  snprintf(PREDICTOR_NAMES[NUM_PREDICTORS++], sizeof(PREDICTOR_NAMES[0]), "%s", spec);
+  return TRUE;
+}
+
+int compare_sites(const void *a, const void *b)
+{
+  uint64_t x = ((const armsim_branch_site_t *)a)->pc, y = ((const armsim_branch_site_t *)b)->pc;
+  return x < y ? -1 : x > y;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : predict_dump                                    */
+/*                                                             */
+/* Purpose   : Dump MPKI per predictor and the mispredictions  */
+/*             of every static branch to the output file.      */
+/*                                                             */
+/***************************************************************/
+void predict_dump(FILE *dumpsim_file)
+{
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_branch_site_t *sites[MAX_PREDICTORS];
+  armsim_bpred_stats_t stats;
+  int i, k, nsites, s;
+
+  if (NUM_PREDICTORS == 0)
+  {
+    printf("No branch predictors attached (add them with -p)\n\n");
+    return;
+  }
+  nsites = armsim_bpred_sites(SIM, 0, NULL, 0);
+  for (k = 0; k < NUM_PREDICTORS; k++)
+  {
+    if ((sites[k] = calloc(nsites + 1, sizeof(armsim_branch_site_t))) == NULL)
+    {
+      printf("Error: Can't allocate branch sites\n");
+      exit(-1);
+    }
+    /* every predictor lists the same branches, so sorting by PC
+       lines the arrays up */
+    armsim_bpred_sites(SIM, k, sites[k], nsites);
+    qsort(sites[k], nsites, sizeof(armsim_branch_site_t), compare_sites);
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nBranch predictors :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    for (k = 0; k < NUM_PREDICTORS; k++)
+    {
+      armsim_bpred_stats(SIM, k, &stats);
+      fprintf(out[i], "%-20s lookups %" PRIu64 " mispredicts %" PRIu64 " (%.2f%%) MPKI %.3f\n",
+              PREDICTOR_NAMES[k], stats.lookups, stats.mispredicts,
+              stats.lookups ? 100.0 * stats.mispredicts / stats.lookups : 0.0,
+              stats.instructions ? 1000.0 * stats.mispredicts / stats.instructions : 0.0);
+    }
+    fprintf(out[i], "\n%-18s %12s %12s", "branch PC", "executed", "taken");
+    for (k = 0; k < NUM_PREDICTORS; k++)
+      fprintf(out[i], " %12.12s", PREDICTOR_NAMES[k]);
+    fprintf(out[i], "\n");
+    for (s = 0; s < nsites; s++)
+    {
+      fprintf(out[i], "0x%016" PRIx64 " %12" PRIu64 " %12" PRIu64, sites[0][s].pc,
+              sites[0][s].executed, sites[0][s].taken);
+      for (k = 0; k < NUM_PREDICTORS; k++)
+        fprintf(out[i], " %12" PRIu64, sites[k][s].mispredicts);
+      fprintf(out[i], "\n");
+    }
+    fprintf(out[i], "\n");
+  }
+  for (k = 0; k < NUM_PREDICTORS; k++)
+    free(sites[k]);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_pipeline                                  */
+/*                                                             */
+/* Purpose   : Parse a comma list of forward|noforward and     */
+/*             id|ex (where branches resolve) into config      */
+/*                                                             */
+/***************************************************************/
+int parse_pipeline(const char *spec, armsim_pipeline_config_t *config)
+{
+  char option[16];
+  int used;
+
+  config->forwarding = TRUE;
+  config->branch_in_ex = FALSE;
+  while (sscanf(spec, "%15[^,]%n", option, &used) == 1)
+  {
+    if (strcasecmp(option, "forward") == 0)
+      config->forwarding = TRUE;
+    else if (strcasecmp(option, "noforward") == 0)
+      config->forwarding = FALSE;
+    else if (strcasecmp(option, "id") == 0)
+      config->branch_in_ex = FALSE;
+    else if (strcasecmp(option, "ex") == 0)
+      config->branch_in_ex = TRUE;
+    else
+      return FALSE;
+    spec += used;
+    if (*spec == ',')
+      spec++;
+  }
+  return *spec == '\0';
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : timing_dump                                     */
+/*                                                             */
+/* Purpose   : Dump the pipeline cycles, CPI and stalls by     */
+/*             cause to the output file.                       */
+/*                                                             */
+/***************************************************************/
+void timing_dump(FILE *dumpsim_file)
+{
+  static const char *causes[ARMSIM_STALL_CAUSES] = {"data", "load-use", "flags", "branch"};
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_pipeline_stats_t stats;
+  uint64_t total = 0;
+  int i, k;
+
+  if (armsim_pipeline_stats(SIM, &stats) != 0)
+  {
+    printf("No pipeline model attached (add it with -P)\n\n");
+    return;
+  }
+  for (k = 0; k < ARMSIM_STALL_CAUSES; k++)
+    total += stats.stalls[k];
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nPipeline timing :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "Instructions      : %" PRIu64 "\n", stats.instructions);
+    fprintf(out[i], "Cycles            : %" PRIu64 "\n", stats.cycles);
+    fprintf(out[i], "CPI               : %.3f\n",
+            stats.instructions ? (double)stats.cycles / stats.instructions : 0.0);
+    fprintf(out[i], "Taken branches    : %" PRIu64 "\n", stats.taken_branches);
+    fprintf(out[i], "Stall cycles      : %" PRIu64 "\n", total);
+    for (k = 0; k < ARMSIM_STALL_CAUSES; k++)
+      fprintf(out[i], "  %-15s : %" PRIu64 " (%.2f%%)\n", causes[k], stats.stalls[k],
+              stats.cycles ? 100.0 * stats.stalls[k] / stats.cycles : 0.0);
+    fprintf(out[i], "\n");
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_ooo                                       */
+/*                                                             */
+/* Purpose   : Parse a comma list of key=value, e.g.           */
+/*             width=8,rob=256,mul=4, into config. Unset keys  */
+/*             stay 0, which the library reads as its default. */
+/*                                                             */
+/***************************************************************/
+int parse_ooo(const char *spec, armsim_ooo_config_t *config)
+{
+  char key[16];
+  unsigned long value;
+  int used;
+
+  memset(config, 0, sizeof(*config));
+  while (sscanf(spec, "%15[^=,]=%lu%n", key, &value, &used) == 2)
+  {
+    if (strcasecmp(key, "width") == 0)
+      config->fetch_width = config->issue_width = config->commit_width = value;
+    else if (strcasecmp(key, "fetch") == 0)
+      config->fetch_width = value;
+    else if (strcasecmp(key, "issue") == 0)
+      config->issue_width = value;
+    else if (strcasecmp(key, "commit") == 0)
+      config->commit_width = value;
+    else if (strcasecmp(key, "rob") == 0)
+      config->rob_size = value;
+    else if (strcasecmp(key, "lsq") == 0)
+      config->lsq_size = value;
+    else if (strcasecmp(key, "frontend") == 0)
+      config->frontend_depth = value;
+    else if (strcasecmp(key, "alu") == 0)
+      config->alu_latency = value;
+    else if (strcasecmp(key, "mul") == 0)
+      config->mul_latency = value;
+    else if (strcasecmp(key, "load") == 0)
+      config->load_latency = value;
+    else if (strcasecmp(key, "alus") == 0)
+      config->alu_units = value;
+    else if (strcasecmp(key, "muls") == 0)
+      config->mul_units = value;
+    else if (strcasecmp(key, "ports") == 0)
+      config->mem_units = value;
+    else
+      return FALSE;
+    spec += used;
+    if (*spec == ',')
+      spec++;
+  }
+  return *spec == '\0';
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ooo_dump                                        */
+/*                                                             */
+/* Purpose   : Dump the out-of-order core's IPC and resource   */
+/*             stalls to the output file.                      */
+/*                                                             */
+/***************************************************************/
+void ooo_dump(FILE *dumpsim_file)
+{
+  static const char *causes[ARMSIM_OOO_STALLS] = {"ROB full", "LSQ full", "issue width",
+                                                  "unit busy", "mispredict"};
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_ooo_stats_t stats;
+  int i, k;
+
+  if (armsim_ooo_stats(SIM, &stats) != 0)
+  {
+    printf("No out-of-order model attached (add it with -O)\n\n");
+    return;
+  }
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nOut-of-order core :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "Instructions      : %" PRIu64 "\n", stats.instructions);
+    fprintf(out[i], "Cycles            : %" PRIu64 "\n", stats.cycles);
+    fprintf(out[i], "IPC               : %.3f\n",
+            stats.cycles ? (double)stats.instructions / stats.cycles : 0.0);
+    fprintf(out[i], "Mispredicts       : %" PRIu64 "\n", stats.mispredicts);
+    fprintf(out[i], "Stalls (instruction-cycles) :\n");
+    for (k = 0; k < ARMSIM_OOO_STALLS; k++)
+      fprintf(out[i], "  %-15s : %" PRIu64 "\n", causes[k], stats.stalls[k]);
+    fprintf(out[i], "\n");
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : flow_dump                                       */
+/*                                                             */
+/* Purpose   : Dump the critical path, ideal IPC and the       */
+/*             dependency-distance histogram to the output     */
+/*             file.                                           */
+/*                                                             */
+/***************************************************************/
+void flow_dump(FILE *dumpsim_file)
+{
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_dataflow_stats_t stats;
+  uint64_t dependencies = 0;
+  int i, k;
+
+  if (armsim_dataflow_stats(SIM, &stats) != 0)
+  {
+    printf("No dataflow study running (start one with -D)\n\n");
+    return;
+  }
+  for (k = 0; k < ARMSIM_DATAFLOW_BUCKETS; k++)
+    dependencies += stats.distances[k];
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nDataflow limit :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "Instructions      : %" PRIu64 "\n", stats.instructions);
+    fprintf(out[i], "Critical path     : %" PRIu64 " cycles\n", stats.critical_path);
+    fprintf(out[i], "Ideal IPC         : %.3f\n",
+            stats.critical_path ? (double)stats.instructions / stats.critical_path : 0.0);
+    fprintf(out[i], "Memory words      : %" PRIu64 "\n", stats.memory_words);
+    fprintf(out[i], "Dependency distances :\n");
+    for (k = 0; k < ARMSIM_DATAFLOW_BUCKETS; k++)
+    {
+      if (stats.distances[k] == 0)
+        continue;
+      if (k == ARMSIM_DATAFLOW_BUCKETS - 1)
+        fprintf(out[i], "  >= %-14" PRIu64, (uint64_t)1 << k);
+      else
+        fprintf(out[i], "  %7" PRIu64 "-%-9" PRIu64, (uint64_t)1 << k, ((uint64_t)2 << k) - 1);
+      fprintf(out[i], " %14" PRIu64 " (%.2f%%)\n", stats.distances[k],
+              100.0 * stats.distances[k] / dependencies);
+    }
+    fprintf(out[i], "\n");
+  }
+}
+
+int compare_accesses(const void *a, const void *b)
+{
+  uint64_t x = ((const armsim_access_site_t *)a)->accesses;
+  uint64_t y = ((const armsim_access_site_t *)b)->accesses;
+  return x > y ? -1 : x < y;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : access_dump                                     */
+/*                                                             */
+/* Purpose   : Dump the access pattern summary: reuse-distance */
+/*             histogram, per-PC strides of the busiest        */
+/*             loads/stores and working set per window.        */
+/*                                                             */
+/***************************************************************/
+void access_dump(FILE *dumpsim_file)
+{
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_access_stats_t stats;
+  armsim_access_site_t *sites;
+  uint64_t *windows, reuses = 0, max = 0, total = 0;
+  int i, k, nsites, nwindows;
+
+  if (armsim_access_stats(SIM, &stats) != 0)
+  {
+    printf("No access analyzer attached (add it with -A)\n\n");
+    return;
+  }
+  nsites = armsim_access_sites(SIM, NULL, 0);
+  nwindows = armsim_access_windows(SIM, NULL, 0);
+  sites = calloc(nsites + 1, sizeof(*sites));
+  windows = calloc(nwindows + 1, sizeof(*windows));
+  if (sites == NULL || windows == NULL)
+  {
+    printf("Error: Can't allocate access report\n");
+    exit(-1);
+  }
+  armsim_access_sites(SIM, sites, nsites);
+  armsim_access_windows(SIM, windows, nwindows);
+  qsort(sites, nsites, sizeof(*sites), compare_accesses);
+  for (k = 0; k < ARMSIM_REUSE_BUCKETS; k++)
+    reuses += stats.reuse[k];
+  for (k = 0; k < nwindows; k++)
+  {
+    total += windows[k];
+    if (windows[k] > max)
+      max = windows[k];
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nMemory access patterns :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "Accesses          : %" PRIu64 "\n", stats.accesses);
+    fprintf(out[i], "Distinct lines    : %" PRIu64 "\n", stats.lines);
+    fprintf(out[i], "Cold references   : %" PRIu64 "\n", stats.cold);
+    fprintf(out[i], "Reuse distances (distinct lines in between) :\n");
+    for (k = 0; k < ARMSIM_REUSE_BUCKETS; k++)
+    {
+      if (stats.reuse[k] == 0)
+        continue;
+      if (k == 0)
+        fprintf(out[i], "  %-17s", "0");
+      else if (k == ARMSIM_REUSE_BUCKETS - 1)
+        fprintf(out[i], "  >= %-14" PRIu64, (uint64_t)1 << (k - 1));
+      else
+        fprintf(out[i], "  %7" PRIu64 "-%-9" PRIu64, (uint64_t)1 << (k - 1), ((uint64_t)1 << k) - 1);
+      fprintf(out[i], " %14" PRIu64 " (%.2f%%)\n", stats.reuse[k], 100.0 * stats.reuse[k] / reuses);
+    }
+
+    fprintf(out[i], "\n%-18s %12s %8s %12s %9s\n", "PC", "accesses", "writes", "stride",
+            "regular");
+    for (k = 0; k < nsites && k < 32; k++)
+    {
+      armsim_access_site_t *site = &sites[k];
+      fprintf(out[i], "0x%016" PRIx64 " %12" PRIu64 " %8" PRIu64 " %12" PRId64 " %8.2f%%\n",
+              site->pc, site->accesses, site->writes, site->stride,
+              site->accesses > 1 ? 100.0 * site->stride_hits / (site->accesses - 1) : 0.0);
+    }
+    if (nsites > 32)
+      fprintf(out[i], "(%d more)\n", nsites - 32);
+
+    fprintf(out[i], "\nWorking set (lines per window) : %d windows, average %.1f, max %" PRIu64 "\n",
+            nwindows, nwindows ? (double)total / nwindows : 0.0, max);
+    for (k = 0; k < nwindows; k++)
+      fprintf(out[i], "%10" PRIu64 "%s", windows[k], k % 8 == 7 || k == nwindows - 1 ? "\n" : " ");
+    fprintf(out[i], "\n");
+  }
+  free(sites);
+  free(windows);
+}
+
+int compare_profile_sites(const void *a, const void *b)
+{
+  uint64_t x = ((const armsim_profile_site_t *)a)->count;
+  uint64_t y = ((const armsim_profile_site_t *)b)->count;
+  return x > y ? -1 : x < y;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : profile_dump                                    */
+/*                                                             */
+/* Purpose   : Dump the flat per-PC profile, exact or sampled, */
+/*             busiest PCs first                               */
+/*                                                             */
+/***************************************************************/
+void profile_dump(FILE *dumpsim_file)
+{
+  static const char *tiers[ARMSIM_TIERS] = {"idle", "scalar", "models", "lanes"};
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_profile_stats_t stats;
+  armsim_profile_site_t *sites;
+  uint64_t running;
+  double cumulative;
+  int i, k, nsites;
+
+  if (armsim_profile_stats(SIM, &stats) != 0)
+  {
+    printf("No profile (start one with -Q exact|sampled[:hz])\n\n");
+    return;
+  }
+  nsites = armsim_profile_sites(SIM, NULL, 0);
+  if ((sites = calloc(nsites + 1, sizeof(*sites))) == NULL)
+  {
+    printf("Error: Can't allocate profile report\n");
+    exit(-1);
+  }
+  armsim_profile_sites(SIM, sites, nsites);
+  qsort(sites, nsites, sizeof(*sites), compare_profile_sites);
+
+  for (i = 0; i < 2; i++)
+  {
+    if (stats.mode == ARMSIM_PROFILE_EXACT)
+      fprintf(out[i], "\nProfile (exact, instructions) :\n");
+    else
+      fprintf(out[i], "\nProfile (sampled at %u Hz, samples) :\n", stats.hz);
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "Total             : %" PRIu64 "\n", stats.total);
+    fprintf(out[i], "Outside text      : %" PRIu64 "\n", stats.other);
+    if (stats.mode == ARMSIM_PROFILE_SAMPLED)
+    {
+      running = 0;
+      for (k = 0; k < ARMSIM_TIERS; k++)
+        running += stats.tiers[k];
+      fprintf(out[i], "Outside the ROI   : %" PRIu64 "\n", stats.outside);
+      fprintf(out[i], "Engine tiers      :");
+      for (k = 0; k < ARMSIM_TIERS; k++)
+        fprintf(out[i], " %s %.2f%%", tiers[k], running ? 100.0 * stats.tiers[k] / running : 0.0);
+      fprintf(out[i], "\n");
+    }
+
+    fprintf(out[i], "\n%-18s %-8s %14s %8s %8s\n", "PC", "insn", "count", "share", "total");
+    cumulative = 0;
+    for (k = 0; k < nsites && k < 32; k++)
+    {
+      double share = stats.total ? 100.0 * sites[k].count / stats.total : 0.0;
+      cumulative += share;
+      fprintf(out[i], "0x%016" PRIx64 " %-8s %14" PRIu64 " %7.2f%% %7.2f%%\n", sites[k].pc,
+              sites[k].name, sites[k].count, share, cumulative);
+    }
+    if (nsites > 32)
+      fprintf(out[i], "(%d more)\n", nsites - 32);
+    fprintf(out[i], "\n");
+  }
+  free(sites);
+}
+
+int compare_host_costs(const void *a, const void *b)
+{
+  const armsim_host_cost_t *x = a, *y = b;
+  uint64_t tx = x->ticks[0] + x->ticks[1] + x->ticks[2];
+  uint64_t ty = y->ticks[0] + y->ticks[1] + y->ticks[2];
+  return tx > ty ? -1 : tx < ty;
+}
+
+/* Upper end of the histogram bucket holding the given fraction */
+static uint64_t host_percentile(const armsim_host_cost_t *row, double fraction)
+{
+  uint64_t seen = 0;
+  int k;
+
+  for (k = 0; k < ARMSIM_HOST_BUCKETS - 1; k++)
+    if ((seen += row->histogram[k]) >= fraction * row->count)
+      break;
+  return k == ARMSIM_HOST_BUCKETS - 1 ? (uint64_t)1 << k : ((uint64_t)2 << k) - 1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : host_dump                                       */
+/*                                                             */
+/* Purpose   : Dump what each instruction costs the host, per  */
+/*             phase, and the costliest (instruction, phase)   */
+/*             cells to work on first                          */
+/*                                                             */
+/***************************************************************/
+void host_dump(FILE *dumpsim_file)
+{
+  static const char *phases[ARMSIM_HOST_PHASES] = {"fetch", "execute", "commit"};
+  FILE *out[2] = {stdout, dumpsim_file};
+  armsim_host_cost_t *rows;
+  armsim_host_bias_t bias;
+  uint64_t totals[ARMSIM_HOST_PHASES] = {0}, flags = 0, memory = 0, total = 0;
+  int i, k, phase, nrows, top[3][2], ntop = 0;
+
+  if ((nrows = armsim_host_profile(SIM, NULL, 0, NULL)) < 0)
+  {
+    printf("No host profile (build with make PROFILE=1 and run with -X)\n\n");
+    return;
+  }
+  if ((rows = calloc(nrows + 1, sizeof(*rows))) == NULL)
+  {
+    printf("Error: Can't allocate host profile report\n");
+    exit(-1);
+  }
+  armsim_host_profile(SIM, rows, nrows, &bias);
+  qsort(rows, nrows, sizeof(*rows), compare_host_costs);
+  for (k = 0; k < nrows; k++)
+  {
+    for (phase = 0; phase < ARMSIM_HOST_PHASES; phase++)
+    {
+      totals[phase] += rows[k].ticks[phase];
+      memory += rows[k].memory_ticks[phase];
+    }
+    flags += rows[k].flags_ticks;
+  }
+  for (phase = 0; phase < ARMSIM_HOST_PHASES; phase++)
+    total += totals[phase];
+
+  /* the three costliest cells, by insertion */
+  for (k = 0; k < nrows; k++)
+    for (phase = 0; phase < ARMSIM_HOST_PHASES; phase++)
+    {
+      uint64_t ticks = rows[k].ticks[phase];
+      int j;
+      for (j = ntop; j > 0 && rows[top[j - 1][0]].ticks[top[j - 1][1]] < ticks; j--)
+        if (j < 3)
+        {
+          top[j][0] = top[j - 1][0];
+          top[j][1] = top[j - 1][1];
+        }
+      if (j < 3)
+      {
+        top[j][0] = k;
+        top[j][1] = phase;
+        if (ntop < 3)
+          ntop++;
+      }
+    }
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\nHost cost (ticks per instruction) :\n");
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "%-8s %12s %8s %8s %8s %8s %8s %8s %7s %7s %7s\n", "insn", "count", "total",
+            "fetch", "execute", "flags", "memory", "commit", "p50", "p99", "share");
+    for (k = 0; k < nrows; k++)
+    {
+      armsim_host_cost_t *row = &rows[k];
+      double n = row->count;
+      uint64_t ticks = row->ticks[0] + row->ticks[1] + row->ticks[2];
+      fprintf(out[i], "%-8s %12" PRIu64 " %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %7" PRIu64 " %7" PRIu64
+                      " %6.2f%%\n",
+              row->name, row->count, ticks / n, row->ticks[0] / n,
+              row->ticks[1] / n, row->flags_ticks / n,
+              (row->memory_ticks[0] + row->memory_ticks[1] + row->memory_ticks[2]) / n,
+              row->ticks[2] / n, host_percentile(row, 0.5), host_percentile(row, 0.99),
+              total ? 100.0 * ticks / total : 0.0);
+    }
+    fprintf(out[i], "\nPhase totals      :");
+    for (phase = 0; phase < ARMSIM_HOST_PHASES; phase++)
+      fprintf(out[i], " %s %.2f%%", phases[phase], total ? 100.0 * totals[phase] / total : 0.0);
+    fprintf(out[i], "\nNested timers     : flags %.2f%%, memory %.2f%%\n",
+            total ? 100.0 * flags / total : 0.0, total ? 100.0 * memory / total : 0.0);
+    fprintf(out[i], "Probe bias        : fetch %" PRIu64 ", execute %" PRIu64 ", commit %" PRIu64
+                    ", nested %" PRIu64 " (+%" PRIu64 " to its phase)\n",
+            bias.phase[0], bias.phase[1], bias.phase[2], bias.nested,
+            bias.nested_cost);
+    if (ntop > 0 && total > 0)
+      fprintf(out[i], "Attack next       :\n");
+    for (k = 0; k < ntop && total > 0; k++)
+    {
+      armsim_host_cost_t *row = &rows[top[k][0]];
+      phase = top[k][1];
+      fprintf(out[i], "  %-8s %-8s %6.2f%% of the host time, %.1f ticks each", row->name,
+              phases[phase], 100.0 * row->ticks[phase] / total,
+              (double)row->ticks[phase] / row->count);
+      if (phase == 1 && row->flags_ticks > 0)
+        fprintf(out[i], ", %.1f in AddWithCarry", (double)row->flags_ticks / row->count);
+      if (row->memory_ticks[phase] > 0)
+        fprintf(out[i], ", %.1f in memory lookups", (double)row->memory_ticks[phase] / row->count);
+      fprintf(out[i], "\n");
+    }
+    fprintf(out[i], "\n");
+  }
+  free(rows);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : read_inputs                                     */
+/*                                                             */
+/* Purpose   : One register file per line of filename, each    */
+/*             line holding "reg_no reg_value" pairs applied   */
+/*             on top of the loaded registers                  */
+/*                                                             */
+/***************************************************************/
+uint64_t (*read_inputs(const char *filename, size_t *count))[ARMSIM_REGS]
+{
+  FILE *file = fopen(filename, "r");
+  uint64_t(*regs)[ARMSIM_REGS] = NULL;
+  size_t n = 0, capacity = 0;
+  char line[1024];
+  int k;
+
+  if (file == NULL)
+  {
+    printf("Error: Can't open %s\n", filename);
+    exit(-1);
+  }
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    char *p = line;
+    int reg_no, used;
+    uint64_t reg_value;
+
+    if (n == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 64;
+      if ((regs = realloc(regs, capacity * sizeof(*regs))) == NULL)
+      {
+        printf("Error: Can't allocate %s\n", filename);
+        exit(-1);
+      }
+    }
+    for (k = 0; k < ARMSIM_REGS; k++)
+      regs[n][k] = armsim_get_reg(SIM, k);
+    while (sscanf(p, "%d %" SCNx64 "%n", &reg_no, &reg_value, &used) == 2)
+    {
+      if (reg_no >= 0 && reg_no < ARMSIM_REGS)
+        regs[n][reg_no] = reg_value;
+      p += used;
+    }
+    n++;
+  }
+  fclose(file);
+  *count = n;
+  return regs;
+}
+
+/* The final state of one lane or batch run, on stdout and dumpsim */
+void dump_result(FILE *dumpsim_file, const char *label, size_t n, const armsim_lane_result_t *r)
+{
+  FILE *out[2] = {stdout, dumpsim_file};
+  int i, k;
+
+  for (i = 0; i < 2; i++)
+  {
+    fprintf(out[i], "\n%s %zu : %s\n", label, n, armsim_strerror(r->status));
+    fprintf(out[i], "-------------------------------------\n");
+    fprintf(out[i], "Instruction Count : %" PRIu64 "\n", r->instructions);
+    fprintf(out[i], "PC                : 0x%" PRIx64 "\n", r->pc);
+    fprintf(out[i], "Registers:\n");
+    for (k = 0; k < ARMSIM_REGS; k++)
+      fprintf(out[i], "X%d: 0x%" PRIx64 "\n", k, r->regs[k]);
+    fprintf(out[i], "FLAG_N: %d\n", (r->nzcv & ARMSIM_FLAG_N) != 0);
+    fprintf(out[i], "FLAG_Z: %d\n", (r->nzcv & ARMSIM_FLAG_Z) != 0);
+    fprintf(out[i], "FLAG_V: %d\n", (r->nzcv & ARMSIM_FLAG_V) != 0);
+    fprintf(out[i], "FLAG_C: %d\n", (r->nzcv & ARMSIM_FLAG_C) != 0);
+    fprintf(out[i], "\n");
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_lanes                                       */
+/*                                                             */
+/* Purpose   : Run the loaded program once per line of         */
+/*             lanes_filename (see read_inputs) in lockstep,   */
+/*             and dump every lane's final state.              */
+/*                                                             */
+/***************************************************************/
+void run_lanes(FILE *dumpsim_file, const char *lanes_filename)
+{
+  uint64_t(*regs)[ARMSIM_REGS];
+  armsim_lane_result_t *results;
+  size_t nlanes, lane;
+  int result;
+
+  regs = read_inputs(lanes_filename, &nlanes);
+  if ((results = calloc(nlanes + 1, sizeof(*results))) == NULL)
+  {
+    printf("Error: Can't allocate lanes\n");
+    exit(-1);
+  }
+  printf("Simulating %zu lanes...\n\n", nlanes);
+  if ((result = armsim_run_lanes(SIM, nlanes, regs, results)) != 0)
+  {
+    printf("Error: %s\n\n", armsim_strerror(result));
+    exit(-1);
+  }
+
+  for (lane = 0; lane < nlanes; lane++)
+    dump_result(dumpsim_file, "Lane", lane, &results[lane]);
+  free(results);
+  free(regs);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_batch                                       */
+/*                                                             */
+/* Purpose   : Run the loaded program to the end once per line */
+/*             of batch_filename (see read_inputs), one run    */
+/*             after another on the scalar engine, restoring   */
+/*             the loaded image from a snapshot before each.   */
+/*                                                             */
+/***************************************************************/
+void run_batch(FILE *dumpsim_file, const char *batch_filename)
+{
+  uint64_t(*regs)[ARMSIM_REGS];
+  armsim_lane_result_t r;
+  armsim_counters_t counters;
+  size_t nruns, run;
+  int k, result;
+
+  regs = read_inputs(batch_filename, &nruns);
+  if ((result = armsim_snapshot(SIM)) != 0)
+  {
+    printf("Error: Can't snapshot the program: %s\n\n", armsim_strerror(result));
+    exit(-1);
+  }
+  printf("Simulating %zu runs...\n\n", nruns);
+  for (run = 0; run < nruns; run++)
+  {
+    armsim_restore(SIM);
+    for (k = 0; k < ARMSIM_REGS; k++)
+      armsim_set_reg(SIM, k, regs[run][k]);
+    r.status = armsim_run(SIM);
+    armsim_get_counters(SIM, &counters);
+    r.instructions = counters.instructions;
+    r.pc = armsim_get_pc(SIM);
+    r.nzcv = armsim_get_flags(SIM);
+    for (k = 0; k < ARMSIM_REGS; k++)
+      r.regs[k] = armsim_get_reg(SIM, k);
+    dump_result(dumpsim_file, "Run", run, &r);
+  }
+  free(regs);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : finish_trace                                    */
+/*                                                             */
+/* Purpose   : Close the -T trace file at exit                 */
+/*                                                             */
+/***************************************************************/
+void finish_trace()
+{
+  armsim_trace_stats_t stats;
+  int result = armsim_trace_stop(SIM, &stats);
+
+  if (result != 0)
+  {
+    printf("Error: Can't finish the trace: %s\n", armsim_strerror(result));
+    return;
+  }
+  printf("Trace: %" PRIu64 " instructions, %" PRIu64 " bytes (%.3f bytes/instruction)\n",
+         stats.instructions, stats.bytes,
+         stats.instructions ? (double)stats.bytes / stats.instructions : 0.0);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : finish_timeline                                 */
+/*                                                             */
+/* Purpose   : Close the -J timeline at exit                   */
+/*                                                             */
+/***************************************************************/
+void finish_timeline()
+{
+  armsim_timeline_stats_t stats;
+  int result = armsim_timeline_stop(SIM, &stats);
+
+  if (result != 0)
+  {
+    printf("Error: Can't finish the timeline: %s\n", armsim_strerror(result));
+    return;
+  }
+  printf("Timeline: %" PRIu64 " events, %" PRIu64 " bytes", stats.events, stats.bytes);
+  if (stats.dropped > 0)
+    printf(", %" PRIu64 " dropped", stats.dropped);
+  printf("\n");
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : finish_hash                                     */
+/*                                                             */
+/* Purpose   : Close the -K state hash file at exit            */
+/*                                                             */
+/***************************************************************/
+void finish_hash()
+{
+  int result = armsim_hash_stop(SIM);
+
+  if (result != 0)
+    printf("Error: Can't finish the state hashes: %s\n", armsim_strerror(result));
 }
+
 /***************************************************************/
 /*                                                             */
-/* Procedure : help                                            */
+/* Procedure : load_data / save_data                           */
 /*                                                             */
-/* Purpose   : Print out a list of commands                    */
+/* Purpose   : Move a host file into or out of guest memory    */
 /*                                                             */
 /***************************************************************/
-void help()
+int load_data(const char *path, uint64_t address)
 {
-  printf("----------------ARM ISIM Help-----------------------\n");
-  printf("go               -  run program to completion         \n");
-  printf("run n            -  execute program for n instructions\n");
-  printf("mdump low high   -  dump memory from low to high      \n");
-  printf("rdump            -  dump the register & bus values    \n");
-  printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
-  printf("?                -  display this help menu            \n");
-  printf("quit             -  exit the program                  \n\n");
+  uint64_t bytes;
+  int result = armsim_load_data(SIM, path, address, &bytes);
+
+  if (result != 0)
+  {
+    printf("Error: Can't load %s at 0x%" PRIx64 ": %s\n\n", path, address,
+           armsim_strerror(result));
+    return FALSE;
+  }
+  printf("Loaded %" PRIu64 " bytes from %s at 0x%" PRIx64 ".\n\n", bytes, path, address);
+  return TRUE;
+}
+
+int save_data(uint64_t address, uint64_t len, const char *path)
+{
+  int result;
+
+  armsim_timeline_span(SIM, "save_data", TRUE);
+  result = armsim_save_data(SIM, address, len, path);
+  armsim_timeline_span(SIM, "save_data", FALSE);
+  if (result != 0)
+  {
+    printf("Error: Can't save 0x%" PRIx64 "..+%" PRIu64 " to %s: %s\n\n", address, len, path,
+           armsim_strerror(result));
+    return FALSE;
+  }
+  printf("Saved %" PRIu64 " bytes at 0x%" PRIx64 " to %s.\n\n", len, address, path);
+  return TRUE;
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : cycle                                           */
+/* Procedure : finish_save                                     */
 /*                                                             */
-/* Purpose   : Execute a cycle                                 */
+/* Purpose   : Write the -o regions at exit                    */
 /*                                                             */
 /***************************************************************/
-void cycle()
+void finish_save()
 {
+  char path[1024];
+  uint64_t address, len;
+  int k;
+
+  for (k = 0; k < NUM_SAVE_SPECS; k++)
+    if (sscanf(SAVE_SPECS[k], "%" SCNi64 ":%" SCNi64 ":%1023s", &address, &len, path) == 3)
+      save_data(address, len, path);
+}
 
-  process_instruction();
-  CURRENT_STATE = NEXT_STATE;
-  INSTRUCTION_COUNT++;
+void *background_run(void *arg)
+{
+  (void)arg;
+  BG_RESULT = armsim_run(SIM);
+  RUNNING = FALSE;
+  atomic_store(&BG_STATE, BG_DONE);
+  return NULL;
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : run n                                           */
+/* Procedure : go                                              */
 /*                                                             */
-/* Purpose   : Simulate ARM for n cycles                       */
+/* Purpose   : Simulate ARM until HALTed; in the background,   */
+/*             on a thread of its own, for "go &"              */
 /*                                                             */
 /***************************************************************/
-void run(int num_cycles)
+void go(int background)
 {
-  int i;
+  armsim_counters_t counters;
+  int result;
 
-  if (RUN_BIT == FALSE)
+  if (armsim_is_halted(SIM))
   {
-    printf("Can't simulate, Simulator is halted\n\n");
+    report_stop(ARMSIM_E_HALTED);
     return;
   }
 
-  printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++)
+  if (background)
   {
-    if (RUN_BIT == FALSE)
+    printf("Simulating in the background (status, stats, rdump, stop)...\n\n");
+    armsim_get_counters(SIM, &counters);
+    BG_START_COUNT = counters.instructions;
+    clock_gettime(CLOCK_MONOTONIC, &BG_START);
+    RUNNING = TRUE;
+    atomic_store(&BG_STATE, BG_RUNNING);
+    if (pthread_create(&BG_THREAD, NULL, background_run, NULL) != 0)
     {
-      printf("Simulator halted\n\n");
-      break;
+      printf("Error: Can't start the background run\n\n");
+      RUNNING = FALSE;
+      atomic_store(&BG_STATE, BG_IDLE);
     }
-    cycle();
+    return;
   }
+  printf("Simulating...\n\n");
+  RUNNING = TRUE;
+  result = armsim_run(SIM);
+  RUNNING = FALSE;
+  report_stop(result);
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : mdump                                           */
+/* Procedure : reap                                            */
 /*                                                             */
-/* Purpose   : Dump a word-aligned region of memory to the     */
-/*             output file.                                    */
+/* Purpose   : Report a background run that has returned, or   */
+/*             with wait, wait for it first. TRUE while one is */
+/*             still in progress.                              */
 /*                                                             */
 /***************************************************************/
-void mdump(FILE *dumpsim_file, int start, int stop)
+int reap(int wait)
 {
-  int address;
-
-  printf("\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  printf("-------------------------------------\n");
-  for (address = start; address <= stop; address += 4)
-    printf("  0x%08x (%d) : 0x%x\n", address, address, mem_read_32(address));
-  printf("\n");
+  int state = atomic_load(&BG_STATE);
 
-  /* dump the memory contents into the dumpsim file */
-  fprintf(dumpsim_file, "\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  for (address = start; address <= stop; address += 4)
-    fprintf(dumpsim_file, "  0x%08x (%d) : 0x%x\n", address, address, mem_read_32(address));
-  fprintf(dumpsim_file, "\n");
+  if (state == BG_IDLE || (state == BG_RUNNING && !wait))
+    return state != BG_IDLE;
+  pthread_join(BG_THREAD, NULL);
+  atomic_store(&BG_STATE, BG_IDLE);
+  printf("Background run finished after %.3f s\n", seconds_since(&BG_START));
+  report_stop(BG_RESULT);
+  return FALSE;
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : rdump                                           */
+/* Procedure : status / stats                                  */
 /*                                                             */
-/* Purpose   : Dump current register and bus values to the     */
-/*             output file.                                    */
+/* Purpose   : One line on what the simulator is doing, and    */
+/*             its counters; live, from the monitor's latest   */
+/*             sample, during a background run                 */
 /*                                                             */
 /***************************************************************/
-void rdump(FILE *dumpsim_file)
+void status()
 {
-  int k;
+  armsim_sample_t s;
 
-  printf("\nCurrent register/bus values :\n");
-  printf("-------------------------------------\n");
-  printf("Instruction Count : %u\n", INSTRUCTION_COUNT);
-  printf("PC                : 0x%" PRIx64 "\n", CURRENT_STATE.PC);
-  printf("Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    printf("X%d: 0x%" PRIx64 "\n", k, CURRENT_STATE.REGS[k]);
-  printf("FLAG_N: %d\n", CURRENT_STATE.FLAG_N);
-  printf("FLAG_Z: %d\n", CURRENT_STATE.FLAG_Z);
-  printf("FLAG_V: %d\n", CURRENT_STATE.FLAG_V);
-  printf("FLAG_C: %d\n", CURRENT_STATE.FLAG_C);
-  printf("\n");
+  take_sample(&s);
+  if (s.running)
+    printf("Running in the background: %" PRIu64 " instructions, PC 0x%" PRIx64 "\n\n",
+           s.instructions, s.pc);
+  else
+    printf("%s: %" PRIu64 " instructions, PC 0x%" PRIx64 "\n\n",
+           armsim_is_halted(SIM) ? "Halted" : "Stopped", s.instructions, s.pc);
+}
+
+void stats()
+{
+  armsim_sample_t s;
+  double elapsed;
 
-  /* dump the state information into the dumpsim file */
-  fprintf(dumpsim_file, "\nCurrent register/bus values :\n");
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  fprintf(dumpsim_file, "Instruction Count : %u\n", INSTRUCTION_COUNT);
-  fprintf(dumpsim_file, "PC                : 0x%" PRIx64 "\n", CURRENT_STATE.PC);
-  fprintf(dumpsim_file, "Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    fprintf(dumpsim_file, "X%d: 0x%" PRIx64 "\n", k, CURRENT_STATE.REGS[k]);
-  fprintf(dumpsim_file, "FLAG_N: %d\n", CURRENT_STATE.FLAG_N);
-  fprintf(dumpsim_file, "FLAG_Z: %d\n", CURRENT_STATE.FLAG_Z);
-  fprintf(dumpsim_file, "FLAG_V: %d\n", CURRENT_STATE.FLAG_V);
-  fprintf(dumpsim_file, "FLAG_C: %d\n", CURRENT_STATE.FLAG_C);
-  fprintf(dumpsim_file, "\n");
+  take_sample(&s);
+  printf("Instructions      : %" PRIu64 "\n", s.instructions);
+  printf("ROI Instructions  : %" PRIu64 "\n", s.roi_instructions);
+  printf("Stores            : %" PRIu64 "\n", s.stores);
+  printf("PC                : 0x%" PRIx64 "\n", s.pc);
+  if (s.running && (elapsed = seconds_since(&BG_START)) > 0)
+  {
+    printf("Elapsed           : %.3f s\n", elapsed);
+    printf("Rate              : %.2f MIPS since go &\n",
+           (s.instructions - BG_START_COUNT) / elapsed / 1e6);
+  }
+  printf("\n");
 }
+
 /***************************************************************/
 /*                                                             */
-/* Procedure : go                                              */
+/* Procedure : until                                           */
 /*                                                             */
-/* Purpose   : Simulate ARM until HALTed                       */
+/* Purpose   : Simulate until pc is reached (or a stop)        */
 /*                                                             */
 /***************************************************************/
-void go(FILE *dumpsim_file)
+void until(uint64_t pc)
 {
-  if (RUN_BIT == FALSE)
-  {
-    printf("Can't simulate, Simulator is halted\n\n");
-    return;
-  }
+  /* a breakpoint that already exists is left in place */
+  int temporary = armsim_break_delete(SIM, pc) != 0;
+  int result = armsim_break_add(SIM, pc);
 
-  printf("Simulating...\n\n");
-  while (RUN_BIT)
+  if (result != 0)
   {
-    cycle();
-    // printf("Going\n");
-    // rdump(dumpsim_file);
-    // mdump(dumpsim_file, MEM_DATA_START, MEM_DATA_START+0x100);
+    printf("Error: %s\n\n", armsim_strerror(result));
+    return;
   }
-  printf("Simulator halted\n\n");
+  go(FALSE);
+  if (temporary)
+    armsim_break_delete(SIM, pc);
 }
 
 /***************************************************************/
@@ -278,27 +1960,57 @@ void go(FILE *dumpsim_file)
 void get_command(FILE *dumpsim_file)
 {
   char buffer[20];
-  int start, stop, cycles;
+  char line[128];
+  char path[1024];
+  int cycles;
   int register_no;
   int64_t register_value;
+  uint64_t address, len, limit, start, stop;
+  double seconds;
+  int result, k;
 
   printf("ARM-SIM> ");
 
-  if (scanf("%s", buffer) == EOF)
+  if (scanf("%19s", buffer) == EOF)
+  {
+    /* end of input waits for a background run */
+    reap(TRUE);
     exit(0);
+  }
 
   printf("\n");
 
+  /* the engine is busy on the background thread: only commands
+   * that read its samples or stop it */
+  if (reap(FALSE))
+  {
+    static const char *live[] = {"status", "stats", "stop", "rdump", "format", "quit", "?"};
+    for (k = 0; k < (int)(sizeof(live) / sizeof(live[0])); k++)
+      if (strcasecmp(buffer, live[k]) == 0)
+        break;
+    if (k == (int)(sizeof(live) / sizeof(live[0])))
+    {
+      printf("Error: A run is in progress in the background (status, stats, rdump, stop)\n\n");
+      /* and its arguments */
+      if (fgets(line, sizeof(line), stdin) != NULL)
+        line[0] = '\0';
+      return;
+    }
+  }
+
   switch (buffer[0])
   {
   case 'G':
   case 'g':
-    go(dumpsim_file);
+    /* "go &" runs in the background */
+    if (strchr(buffer, '&') == NULL && fgets(line, sizeof(line), stdin) == NULL)
+      line[0] = '\0';
+    go(strchr(buffer, '&') != NULL || strchr(line, '&') != NULL);
     break;
 
   case 'M':
   case 'm':
-    if (scanf("%i %i", &start, &stop) != 2)
+    if (scanf("%" SCNi64 " %" SCNi64, &start, &stop) != 2)
       break;
 
     mdump(dumpsim_file, start, stop);
@@ -308,8 +2020,65 @@ void get_command(FILE *dumpsim_file)
     help();
     break;
 
+  case 'B':
+  case 'b':
+    if (scanf("%" SCNi64, &address) != 1)
+      break;
+    if ((result = armsim_break_add(SIM, address)) != 0)
+      printf("Error: %s\n\n", armsim_strerror(result));
+    break;
+
+  case 'D':
+  case 'd':
+    if (scanf("%" SCNi64, &address) != 1)
+      break;
+    armsim_break_delete(SIM, address);
+    break;
+
+  case 'U':
+  case 'u':
+    if (scanf("%" SCNi64, &address) != 1)
+      break;
+    if (strcasecmp(buffer, "unwatch") == 0)
+      armsim_watch_delete(SIM, address);
+    else
+      until(address);
+    break;
+
+  case 'L':
+  case 'l':
+    if (strcasecmp(buffer, "load_data") == 0)
+    {
+      if (scanf("%1023s %" SCNi64, path, &address) == 2)
+        load_data(path, address);
+      break;
+    }
+    if (fgets(line, sizeof(line), stdin) == NULL)
+      break;
+    seconds = 0;
+    if (sscanf(line, "%" SCNu64 " %lf", &limit, &seconds) < 1)
+      break;
+    armsim_set_limits(SIM, limit, seconds);
+    break;
+
+  case 'W':
+  case 'w':
+    if (fgets(line, sizeof(line), stdin) == NULL)
+      break;
+    len = 4;
+    if (sscanf(line, "%" SCNi64 " %" SCNi64, &address, &len) < 1)
+      break;
+    if ((result = armsim_watch_add(SIM, address, len)) != 0)
+      printf("Error: %s\n\n", armsim_strerror(result));
+    break;
+
   case 'Q':
   case 'q':
+    if (atomic_load(&BG_STATE) != BG_IDLE)
+    {
+      armsim_interrupt(SIM);
+      reap(TRUE);
+    }
     printf("Bye.\n");
     exit(0);
 
@@ -325,12 +2094,106 @@ void get_command(FILE *dumpsim_file)
     }
     break;
 
+  case 'C':
+  case 'c':
+    cache_dump(dumpsim_file);
+    break;
+
+  case 'S':
+  case 's':
+    if (strcasecmp(buffer, "status") == 0)
+    {
+      status();
+      break;
+    }
+    if (strcasecmp(buffer, "stats") == 0)
+    {
+      stats();
+      break;
+    }
+    if (strcasecmp(buffer, "stop") == 0)
+    {
+      if (atomic_load(&BG_STATE) == BG_IDLE)
+      {
+        printf("Nothing is running\n\n");
+        break;
+      }
+      armsim_interrupt(SIM);
+      reap(TRUE);
+      break;
+    }
+    if (strcasecmp(buffer, "save_data") == 0)
+    {
+      if (scanf("%" SCNi64 " %" SCNi64 " %1023s", &address, &len, path) == 3)
+        save_data(address, len, path);
+      break;
+    }
+    if (strcasecmp(buffer, "sweep") == 0)
+    {
+      sweep_dump(dumpsim_file);
+      break;
+    }
+    printf("Invalid Command\n");
+    break;
+
+  case 'P':
+  case 'p':
+    if (strcasecmp(buffer, "profile") == 0)
+    {
+      profile_dump(dumpsim_file);
+      break;
+    }
+    predict_dump(dumpsim_file);
+    break;
+
+  case 'T':
+  case 't':
+    timing_dump(dumpsim_file);
+    break;
+
+  case 'O':
+  case 'o':
+    ooo_dump(dumpsim_file);
+    break;
+
+  case 'F':
+  case 'f':
+    if (strcasecmp(buffer, "format") == 0)
+    {
+      if (fgets(line, sizeof(line), stdin) == NULL)
+        break;
+      result = sscanf(line, "%19s %1023s", buffer, path);
+      if (result < 1 || !set_format(buffer, result == 2 ? path : NULL))
+        printf("Error: Bad format (want text|json|binary [both|console|file])\n\n");
+      break;
+    }
+    flow_dump(dumpsim_file);
+    break;
+
+  case 'A':
+  case 'a':
+    access_dump(dumpsim_file);
+    break;
+
+  case 'H':
+  case 'h':
+    if (strcasecmp(buffer, "host") == 0)
+    {
+      host_dump(dumpsim_file);
+      break;
+    }
+    if (fgets(line, sizeof(line), stdin) == NULL)
+      break;
+    cycles = 0;
+    sscanf(line, "%d", &cycles);
+    history_dump(dumpsim_file, cycles > 0 ? cycles : 0);
+    break;
+
   case 'I':
   case 'i':
     if (scanf("%i %" PRIx64, &register_no, &register_value) != 2)
       break;
-    CURRENT_STATE.REGS[register_no] = register_value;
-    NEXT_STATE.REGS[register_no] = register_value;
+    armsim_set_reg(SIM, register_no, register_value);
     break;
 
   default:
@@ -339,24 +2202,6 @@ void get_command(FILE *dumpsim_file)
   }
 }
 
-/***************************************************************/
-/*                                                             */
-/* Procedure : init_memory                                     */
-/*                                                             */
-/* Purpose   : Allocate and zero memory                        */
-/*                                                             */
-/***************************************************************/
-void init_memory()
-{
-  int i;
-  for (i = 0; i < MEM_NREGIONS; i++)
-  {
-    // Extra 3 bytes to prevent buffer overflow on unaligned access.
-    MEM_REGIONS[i].mem = malloc(MEM_REGIONS[i].size + 3);
-    memset(MEM_REGIONS[i].mem, 0, MEM_REGIONS[i].size);
-  }
-}
-
 /**************************************************************/
 /*                                                            */
 /* Procedure : load_program                                   */
@@ -366,35 +2211,21 @@ void init_memory()
 /**************************************************************/
 void load_program(char *program_filename)
 {
-  FILE *prog;
-  int ii, word;
+  size_t words;
+  int result = armsim_load_file(SIM, program_filename, &words);
 
-  /* Open program file. */
-  prog = fopen(program_filename, "r");
-  if (prog == NULL)
+  if (result == ARMSIM_E_IO)
   {
     printf("Error: Can't open program file %s\n", program_filename);
     exit(-1);
   }
-
-  /* Read in the program. */
-
-  ii = 0;
-  int bytes_read = EOF;
-  while ((bytes_read = fscanf(prog, "%x\n", &word)) > 0)
-  {
-    mem_write_32(MEM_TEXT_START + ii, word);
-    ii += 4;
-  }
-  if (bytes_read == 0)
+  if (result != 0)
   {
     printf("Error: Malformed program file %s\n", program_filename);
     exit(-1);
   }
 
-  CURRENT_STATE.PC = MEM_TEXT_START;
-
-  printf("Read %d words from program into memory.\n\n", ii / 4);
+  printf("Read %zu words from program into memory.\n\n", words);
 }
 
 /************************************************************/
@@ -409,16 +2240,32 @@ void initialize(char *program_filename, int num_prog_files)
 {
   int i;
 
-  init_memory();
+  if ((SIM = armsim_create()) == NULL)
+  {
+    printf("Error: Can't allocate simulator memory\n");
+    exit(-1);
+  }
+  if (TIMELINE_SPEC != NULL)
+  {
+    char *interval = strchr(TIMELINE_SPEC, ':');
+    int result;
+    if (interval != NULL)
+      *interval++ = '\0';
+    if ((result = armsim_timeline_start(SIM, TIMELINE_SPEC,
+                                        interval != NULL ? strtoull(interval, NULL, 0) : 0)) != 0)
+    {
+      printf("Error: Can't write the timeline to %s: %s\n", TIMELINE_SPEC,
+             armsim_strerror(result));
+      exit(1);
+    }
+    atexit(finish_timeline);
+  }
   for (i = 0; i < num_prog_files; i++)
   {
     load_program(program_filename);
     while (*program_filename++ != '\0')
       ;
   }
-  NEXT_STATE = CURRENT_STATE;
-
-  RUN_BIT = TRUE;
 }
 
 /***************************************************************/
@@ -429,18 +2276,319 @@ void initialize(char *program_filename, int num_prog_files)
 int main(int argc, char *argv[])
 {
   FILE *dumpsim_file;
+  int opt;
+  uint64_t limit = 0;
+  double seconds = 0;
+  char *lanes_filename = NULL;
+  char *batch_filename = NULL;
+  armsim_cache_config_t caches[ARMSIM_CACHE_LEVELS];
+  int use_caches = FALSE, result;
+  char *sweep_spec = NULL;
+  int threads = 1;
+  char *predictor_specs[MAX_PREDICTORS];
+  int num_predictor_specs = 0, k;
+  armsim_pipeline_config_t pipeline;
+  int use_pipeline = FALSE;
+  armsim_ooo_config_t ooo;
+  int use_ooo = FALSE;
+  int use_dataflow = FALSE;
+  int use_host_profile = FALSE;
+  int profile_mode = -1;
+  unsigned profile_hz = 0;
+  armsim_access_config_t access;
+  uint32_t access_values[2] = {0, 0};
+  int use_access = FALSE;
+  char *trace_filename = NULL;
+  char *plugin_specs[ARMSIM_MAX_PLUGINS];
+  int num_plugin_specs = 0;
+  size_t history_entries = 0;
+  char *hash_spec = NULL;
+  char *load_specs[MAX_DATA_FILES];
+  int num_load_specs = 0;
+  static struct option long_options[] = {
+      {"max-insns", required_argument, NULL, 'n'},
+      {"timeout", required_argument, NULL, 't'},
+      {"lanes", required_argument, NULL, 'l'},
+      {"batch", required_argument, NULL, 'b'},
+      {"cache", required_argument, NULL, 'c'},
+      {"sweep", required_argument, NULL, 's'},
+      {"threads", required_argument, NULL, 'j'},
+      {"predictor", required_argument, NULL, 'p'},
+      {"pipeline", required_argument, NULL, 'P'},
+      {"ooo", required_argument, NULL, 'O'},
+      {"dataflow", no_argument, NULL, 'D'},
+      {"access", required_argument, NULL, 'A'},
+      {"trace", required_argument, NULL, 'T'},
+      {"plugin", required_argument, NULL, 'L'},
+      {"history", required_argument, NULL, 'H'},
+      {"hash", required_argument, NULL, 'K'},
+      {"load-data", required_argument, NULL, 'd'},
+      {"save-data", required_argument, NULL, 'o'},
+      {"dump-format", required_argument, NULL, 'f'},
+      {"host-profile", no_argument, NULL, 'X'},
+      {"timeline", required_argument, NULL, 'J'},
+      {"profile", required_argument, NULL, 'Q'},
+      {NULL, 0, NULL, 0}};
+
+  memset(caches, 0, sizeof(caches));
+  while ((opt = getopt_long(argc, argv, "n:t:l:b:c:s:j:p:P:O:DA:T:L:H:K:d:o:f:XJ:Q:", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      limit = strtoull(optarg, NULL, 0);
+      break;
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'l':
+      lanes_filename = optarg;
+      break;
+    case 'b':
+      batch_filename = optarg;
+      break;
+    case 'c':
+      if (!parse_cache(optarg, caches))
+      {
+        printf("Error: Bad cache level %s (want level:size:ways:line[:lru|plru][:wb|wt])\n",
+               optarg);
+        exit(1);
+      }
+      use_caches = TRUE;
+      break;
+    case 's':
+      sweep_spec = optarg;
+      break;
+    case 'j':
+      threads = strtol(optarg, NULL, 0);
+      break;
+    case 'p':
+      predictor_specs[num_predictor_specs++ % MAX_PREDICTORS] = optarg;
+      break;
+    case 'P':
+      if (!parse_pipeline(optarg, &pipeline))
+      {
+        printf("Error: Bad pipeline %s (want forward|noforward,id|ex)\n", optarg);
+        exit(1);
+      }
+      use_pipeline = TRUE;
+      break;
+    case 'O':
+      if (!parse_ooo(optarg, &ooo))
+      {
+        printf("Error: Bad core %s (want key=value,... with keys width, fetch, issue, commit, "
+               "rob, lsq, frontend, alu, mul, load, alus, muls, ports)\n",
+               optarg);
+        exit(1);
+      }
+      use_ooo = TRUE;
+      break;
+    case 'D':
+      use_dataflow = TRUE;
+      break;
+    case 'A':
+      if (parse_list(optarg, access_values, 2) < 1)
+      {
+        printf("Error: Bad access analyzer %s (want line[,window])\n", optarg);
+        exit(1);
+      }
+      access.line = access_values[0];
+      access.window = access_values[1] ? access_values[1] : 1 << 20;
+      use_access = TRUE;
+      break;
+    case 'T':
+      trace_filename = optarg;
+      break;
+    case 'L':
+      plugin_specs[num_plugin_specs++ % ARMSIM_MAX_PLUGINS] = optarg;
+      break;
+    case 'H':
+      history_entries = strtoull(optarg, NULL, 0);
+      break;
+    case 'K':
+      hash_spec = optarg;
+      break;
+    case 'd':
+      load_specs[num_load_specs++ % MAX_DATA_FILES] = optarg;
+      break;
+    case 'o':
+      SAVE_SPECS[NUM_SAVE_SPECS++ % MAX_DATA_FILES] = optarg;
+      break;
+    case 'f':
+      if (!set_format(optarg, NULL))
+      {
+        printf("Error: Bad dump format %s (want text|json|binary[:both|console|file])\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'X':
+      use_host_profile = TRUE;
+      break;
+    case 'J':
+      TIMELINE_SPEC = optarg;
+      break;
+    case 'Q':
+      if (strncmp(optarg, "exact", 5) == 0 && optarg[5] == '\0')
+        profile_mode = ARMSIM_PROFILE_EXACT;
+      else if (strncmp(optarg, "sampled", 7) == 0 && (optarg[7] == '\0' || optarg[7] == ':'))
+      {
+        profile_mode = ARMSIM_PROFILE_SAMPLED;
+        profile_hz = optarg[7] == ':' ? strtoul(optarg + 8, NULL, 0) : 0;
+      }
+      else
+      {
+        printf("Error: Bad profile %s (want exact or sampled[:hz])\n", optarg);
+        exit(1);
+      }
+      break;
+    default:
+      exit(1);
+    }
+  }
 
   /* Error Checking */
-  if (argc < 2)
+  if (argc - optind < 1)
   {
-    printf("Error: usage: %s <program_file_1> <program_file_2> ...\n",
+    printf("Error: usage: %s [-n max_insns] [-t seconds] [-l lanes_file] [-b batch_file] [-c cache_level]... [-s sweep [-j threads]] [-p predictor]... [-P pipeline] [-O core] [-D] [-A line[,window]] [-T trace_file] [-L plugin.so[:args]]... [-H history_entries] [-K hash_file:interval[:from]] [-d data_file:addr]... [-o addr:len:data_file]... [-f format[:target]] [-X] [-J timeline_file[:interval]] [-Q exact|sampled[:hz]] <program_file_1> <program_file_2> ...\n",
            argv[0]);
     exit(1);
   }
 
   printf("ARM Simulator\n\n");
 
-  initialize(argv[1], argc - 1);
+  initialize(argv[optind], argc - optind);
+  if (armsim_monitor_start(SIM) != 0)
+  {
+    printf("Error: Can't allocate the run monitor\n");
+    exit(1);
+  }
+  signal(SIGINT, interrupt_handler);
+  armsim_set_limits(SIM, limit, seconds);
+  if (profile_mode >= 0 && (result = armsim_profile_start(SIM, profile_mode, profile_hz)) != 0)
+  {
+    printf("Error: Can't start the profile: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+  if (use_host_profile && (result = armsim_host_profile_start(SIM)) != 0)
+  {
+    printf("Error: Can't profile the host: %s%s\n", armsim_strerror(result),
+           result == ARMSIM_E_NOSYS ? " (build with make PROFILE=1)" : "");
+    exit(1);
+  }
+  if (history_entries > 0 && (result = armsim_history_configure(SIM, history_entries)) != 0)
+  {
+    printf("Error: Bad history size %zu (want a power of two)\n", history_entries);
+    exit(1);
+  }
+  if (use_caches && (result = armsim_cache_configure(SIM, caches)) != 0)
+  {
+    printf("Error: Bad cache configuration: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+  if (use_pipeline && (result = armsim_pipeline_configure(SIM, &pipeline)) != 0)
+  {
+    printf("Error: Can't attach the pipeline model: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+  if (use_ooo && (result = armsim_ooo_configure(SIM, &ooo)) != 0)
+  {
+    printf("Error: Can't attach the out-of-order model: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+  if (use_dataflow && (result = armsim_dataflow_enable(SIM, TRUE)) != 0)
+  {
+    printf("Error: Can't start the dataflow study: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+  if (use_access && (result = armsim_access_configure(SIM, &access)) != 0)
+  {
+    printf("Error: Bad access analyzer: %s\n", armsim_strerror(result));
+    exit(1);
+  }
+  if (trace_filename != NULL)
+  {
+    if ((result = armsim_trace_start(SIM, trace_filename)) != 0)
+    {
+      printf("Error: Can't record the trace to %s: %s\n", trace_filename, armsim_strerror(result));
+      exit(1);
+    }
+    atexit(finish_trace);
+  }
+  if (hash_spec != NULL && lanes_filename != NULL)
+  {
+    printf("Error: -K can't hash lockstep lanes (-l); -b runs the same inputs on the scalar engine\n");
+    exit(1);
+  }
+  if (hash_spec != NULL)
+  {
+    char *interval = strchr(hash_spec, ':'), *from = NULL;
+    if (interval != NULL)
+    {
+      *interval++ = '\0';
+      if ((from = strchr(interval, ':')) != NULL)
+        *from++ = '\0';
+    }
+    if (interval == NULL ||
+        (result = armsim_hash_start(SIM, hash_spec, strtoull(interval, NULL, 0),
+                                    from != NULL ? strtoull(from, NULL, 0) : 0)) != 0)
+    {
+      printf("Error: Can't hash the state to %s: %s\n", hash_spec,
+             interval == NULL ? "want hash_file:interval[:from]" : armsim_strerror(result));
+      exit(1);
+    }
+    atexit(finish_hash);
+  }
+  if (num_plugin_specs > ARMSIM_MAX_PLUGINS)
+  {
+    printf("Error: At most %d plugins\n", ARMSIM_MAX_PLUGINS);
+    exit(1);
+  }
+  for (k = 0; k < num_plugin_specs; k++)
+  {
+    char *args = strchr(plugin_specs[k], ':');
+    if (args != NULL)
+      *args++ = '\0';
+    if ((result = armsim_plugin_load(SIM, plugin_specs[k], args)) != 0)
+    {
+      printf("Error: Can't load plugin %s: %s (%s)\n", plugin_specs[k], armsim_strerror(result),
+             result == ARMSIM_E_IO ? dlerror() : "armsim_plugin_init failed");
+      exit(1);
+    }
+  }
+  if (num_predictor_specs > MAX_PREDICTORS)
+  {
+    printf("Error: At most %d predictors\n", MAX_PREDICTORS);
+    exit(1);
+  }
+  for (k = 0; k < num_predictor_specs; k++)
+  {
+    if (!add_predictor(predictor_specs[k]))
+    {
+      printf("Error: Bad predictor %s (want bimodal|gshare|tage|btb|ras[:entries[:history]])\n",
+             predictor_specs[k]);
+      exit(1);
+    }
+  }
+
+  if (num_load_specs > MAX_DATA_FILES || NUM_SAVE_SPECS > MAX_DATA_FILES)
+  {
+    printf("Error: At most %d data files each way\n", MAX_DATA_FILES);
+    exit(1);
+  }
+  for (k = 0; k < num_load_specs; k++)
+  {
+    char *address = strrchr(load_specs[k], ':');
+    if (address == NULL)
+    {
+      printf("Error: Bad data file %s (want data_file:addr)\n", load_specs[k]);
+      exit(1);
+    }
+    *address++ = '\0';
+    if (!load_data(load_specs[k], strtoull(address, NULL, 0)))
+      exit(1);
+  }
+  if (NUM_SAVE_SPECS > 0)
+    atexit(finish_save);
 
   if ((dumpsim_file = fopen("dumpsim", "w")) == NULL)
   {
@@ -448,6 +2596,25 @@ int main(int argc, char *argv[])
     exit(-1);
   }
 
+  if (sweep_spec != NULL)
+    start_sweep(sweep_spec, threads);
+  if (lanes_filename != NULL)
+  {
+    run_lanes(dumpsim_file, lanes_filename);
+    if (profile_mode >= 0)
+      profile_dump(dumpsim_file);
+    fclose(dumpsim_file);
+    exit(0);
+  }
+  if (batch_filename != NULL)
+  {
+    run_batch(dumpsim_file, batch_filename);
+    if (profile_mode >= 0)
+      profile_dump(dumpsim_file);
+    fclose(dumpsim_file);
+    exit(0);
+  }
+
   while (1)
     get_command(dumpsim_file);
 }
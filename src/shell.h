@@ -2,25 +2,44 @@
 /*                                                             */
 /*   ARM Instruction Level Simulator                           */
 /*                                                             */
-/*   CMSC-22200 Computer Architecture                          */
-/*   University of Chicago                                     */
+/*   libarmsim internals                                       */
 /*                                                             */
 /***************************************************************/
 
-/* !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
-/*          DO NOT MODIFY THIS FILE!                            */
-/*          You should only change sim.c!                       */
-/* !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
+/* Shared by the engine (sim.c) and the library modules, never
+ * installed: struct armsim, the per-instance engine state; the
+ * CURRENT_STATE, NEXT_STATE, RUN_BIT, ... bindings that reach it
+ * through the thread's current instance ARMSIM; and the inline
+ * fetch, data and branch taps process_instruction() feeds the
+ * attached models through. */
 
 #ifndef _SIM_SHELL_H_
 #define _SIM_SHELL_H_
 
 #include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include "armsim.h"
+
 #define FALSE 0
 #define TRUE 1
 
 #define ARM_REGS 32
 
+/* Guest memory map */
+#define MEM_DATA_START 0x10000000
+#define MEM_DATA_SIZE 0x00100000
+#define MEM_TEXT_START 0x00400000
+#define MEM_TEXT_SIZE 0x00100000
+#define MEM_STACK_START 0xfffffffc
+#define MEM_STACK_SIZE 0x00100000
+#define MEM_NREGIONS 3
+#define MEM_DATA_LIMIT 0x80000000 /* armsim_load_data can grow data this far */
+
+/* Written-page bitmap, see snapshot.c */
+#define MEM_PAGE 4096
+#define DIRTY_WORDS(size) (((size) + 3) / MEM_PAGE / 64 + 1)
+
 typedef struct CPU_State_Struct
 {
   uint64_t PC;            /* program counter */
@@ -31,16 +50,321 @@ typedef struct CPU_State_Struct
   int FLAG_C;
 } CPU_State;
 
-/* Data Structure for Latch */
+/* Why the last run stopped; these mirror armsim_status_t */
+typedef enum
+{
+  STOP_NONE = ARMSIM_RUNNING,
+  STOP_HALT = ARMSIM_HALTED,
+  STOP_BREAKPOINT = ARMSIM_BREAKPOINT,
+  STOP_WATCHPOINT = ARMSIM_WATCHPOINT,
+  STOP_BUDGET = ARMSIM_BUDGET,
+  STOP_TIMEOUT = ARMSIM_TIMEOUT,
+  STOP_IDLE_LOOP = ARMSIM_IDLE_LOOP,
+  STOP_INVALID = ARMSIM_INVALID,
+  STOP_CHECKPOINT = ARMSIM_CHECKPOINT,
+  STOP_INTERRUPT = ARMSIM_INTERRUPTED,
+  STOP_WATCH_PENDING /* internal: a watched page was written */
+} Stop_Reason;
+
+typedef struct
+{
+  uint64_t start, size;
+  uint8_t *mem;
+  uint64_t limit;  /* size + 3 bytes are mapped for this much */
+  int file_backed; /* armsim_load_data mapped a host file in */
+} mem_region_t;
+
+/* One flight recorder entry, see history.c */
+typedef struct
+{
+  uint64_t pc;
+  uint64_t value; /* register in the Rd/Rt field after the instruction */
+  uint32_t word;
+} history_t;
+
+#define HISTORY_ENTRIES 256 /* flight recorder default, a power of two */
+
+#define MAX_BREAKPOINTS 64
+#define MAX_WATCHPOINTS 16
+#define MAX_UNPROTECTED 8
+
+typedef struct
+{
+  uint64_t start, end; /* guest range [start, end) */
+  uint8_t *shadow;     /* contents when last armed */
+} watch_t;
+
+/* Everything one simulator instance owns */
+struct armsim
+{
+  CPU_State current, next; /* Data Structure for Latch */
+  int run_bit;
+  Stop_Reason stop_reason;
+  uint64_t instruction_count;
+  uint64_t mem_writes;
+  history_t *history;     /* flight recorder ring, indexed by instruction_count */
+  uint64_t history_mask;  /* entries - 1 */
+  uint64_t history_start; /* instruction_count when the ring was empty */
+
+  mem_region_t regions[MEM_NREGIONS];
+  uint64_t *dirty[MEM_NREGIONS]; /* pages written since the snapshot or reset */
+  int8_t predecoded[MEM_TEXT_SIZE / 4]; /* see sim.c */
+  uint64_t decoded;                     /* slots filled so far, for the timeline */
 
-extern CPU_State CURRENT_STATE, NEXT_STATE;
+  uint64_t breakpoints[MAX_BREAKPOINTS];
+  int num_breakpoints;
+  uint64_t break_skip_pc; /* breakpoint to step over on resume */
 
-extern int RUN_BIT; /* run bit */
+  watch_t watchpoints[MAX_WATCHPOINTS];
+  int num_watchpoints;
+  uint8_t *unprotected_pages[MAX_UNPROTECTED];
+  volatile sig_atomic_t num_unprotected;
+  uint64_t watch_hit_addr, watch_hit_pc;
+  uintptr_t page_size; /* host pages, as watchpoints protect them */
+
+  /* watchdog for armsim_run */
+  uint64_t instruction_limit; /* 0 = unlimited */
+  double time_limit;          /* seconds, 0 = unlimited */
+  uint64_t check_at;          /* next INSTRUCTION_COUNT with work due */
+  uint64_t budget_at, clock_at, probe_at;
+  struct timespec deadline;
+  struct
+  {
+    uint64_t target;
+    uint64_t mem_writes;
+    int boundaries_left;
+    CPU_State state;
+  } probe; /* state seen at a block entry, compared when it recurs */
+
+  /* timing models fed by trace_fetch/trace_data/trace_branch */
+  int tracing;               /* any of the below attached */
+  struct cache_model *cache; /* NULL unless configured, see cache.c */
+  struct sweep *sweep;       /* see sweep.c */
+  struct bpred_model *bpred; /* branch predictors, see bpred.c */
+  struct access_model *access; /* access patterns, see access.c */
+  uint64_t *pc_counts;         /* exact per-PC profile, see pcprof.c */
+  int recording;             /* fed by trace_retire, see timing.h */
+  struct pipeline *pipeline; /* in-order pipeline, see pipeline.c */
+  struct ooo *ooo;           /* out-of-order core, see ooo.c */
+  struct dataflow *dataflow; /* limit study, see dataflow.c */
+  struct recorder *recorder; /* trace file writer, see tracefile.c */
+
+  struct snapshot *snapshot; /* restore point for reruns, see snapshot.c */
+  struct state_hash *hash; /* periodic state hashing, see hash.c */
+  uint64_t hash_at;        /* next INSTRUCTION_COUNT hashed, UINT64_MAX if none */
+
+  struct host_profile *host_profile; /* make PROFILE=1 only, see hostprof.c */
+
+  struct pcprof *pcprof; /* per-PC profile, exact or sampled, see pcprof.c */
+
+  struct timeline *timeline; /* trace-event timeline, see timeline.c */
+  uint64_t timeline_at;      /* next INSTRUCTION_COUNT sampled, UINT64_MAX if none */
+
+  struct monitor *monitor; /* live samples for other threads, see monitor.c */
+  uint64_t monitor_at;     /* next INSTRUCTION_COUNT sampled, UINT64_MAX if none */
+
+  struct plugins *plugins; /* see plugin.c */
+  int plugin_blocks;       /* block events subscribed: CHECK_AT stays 0 */
+  int plugin_memory;       /* memory events subscribed: sets tracing */
+
+  /* region of interest, see roi_marker() */
+  int roi_active;        /* models, plugins and the ROI count see this */
+  uint64_t roi_offset;   /* while active: INSTRUCTION_COUNT - ROI count */
+  uint64_t roi_count;    /* while not: the ROI count */
+};
+
+/* The instance the calling thread is simulating; every library
+ * entry point binds it before touching guest state. */
+extern __thread struct armsim *ARMSIM __attribute__((tls_model("initial-exec")));
+
+#define CURRENT_STATE (ARMSIM->current)
+#define NEXT_STATE (ARMSIM->next)
+#define RUN_BIT (ARMSIM->run_bit) /* run bit */
+#define STOP_REASON (ARMSIM->stop_reason)
+#define INSTRUCTION_COUNT (ARMSIM->instruction_count)
+#define MEM_WRITES (ARMSIM->mem_writes)
+#define MEM_REGIONS (ARMSIM->regions)
+#define PREDECODED (ARMSIM->predecoded)
+#define BREAK_SKIP_PC (ARMSIM->break_skip_pc)
+#define CHECK_AT (ARMSIM->check_at) /* watchdog work is due here */
+
+#define CLOCK_CHECK_INTERVAL (1 << 20) /* instructions between clock reads */
+#define PROBE_INTERVAL (1 << 16)       /* instructions between loop probes */
+#define PROBE_BOUNDARIES 64            /* blocks a probe waits to recur */
+#define MONITOR_INTERVAL (1 << 16)     /* instructions between live samples */
+
+void boundary_checks(uint64_t target);
+void roi_marker(uint32_t instruction);
+void roi_restart(int active);
+void schedule_checks();
+void disarm_watchdog();
+int simulate(uint64_t max_cycles);
+uint8_t *host_address(uint64_t address, uint64_t *avail);
+
+/* Called by every taken branch with the new PC, i.e. once per block */
+static inline void block_boundary(uint64_t target, uint64_t pc)
+{
+  if (target == pc)
+  {
+    /* a branch to itself never changes state again */
+    RUN_BIT = FALSE;
+    STOP_REASON = STOP_IDLE_LOOP;
+  }
+  else if (INSTRUCTION_COUNT >= CHECK_AT)
+  {
+    boundary_checks(target);
+  }
+}
+
+/* Instructions retired inside the region of interest */
+static inline uint64_t roi_instructions()
+{
+  return ARMSIM->roi_active ? INSTRUCTION_COUNT - ARMSIM->roi_offset : ARMSIM->roi_count;
+}
+
+/* Plugins (plugin.c) */
+void plugin_block(uint64_t target);
+void plugin_data(uint64_t address, int size, int write);
+void plugin_run_start();
+void plugin_run_end();
+void plugin_roi(int marker);
+void plugin_invalidate();
+void plugin_flush();
+void plugin_free();
+
+/* Cache model (cache.c) and design-space sweep (sweep.c) */
+void cache_fetch(uint64_t pc);
+void cache_data(uint64_t address, int size, int write);
+void cache_flush();
+void cache_clear_stats();
+void cache_free();
+void sweep_fetch(uint64_t pc);
+void sweep_data(uint64_t address, int size, int write);
+void sweep_free();
+
+/* Memory access analyzer (access.c) */
+void access_data(uint64_t address, int size, int write);
+void access_flush();
+void access_free();
+
+/* Branch predictors (bpred.c) */
+#define BRANCH_CONDITIONAL 0 /* B.cond, CBZ, CBNZ */
+#define BRANCH_INDIRECT 1    /* BR */
+#define BRANCH_RETURN 2      /* BR X30 */
+#define BRANCH_DIRECT 3      /* B */
+
+void bpred_fetch(uint64_t pc);
+void bpred_branch(uint64_t pc, uint64_t next_pc, int taken, int kind);
+void bpred_flush();
+void bpred_clear_stats();
+void bpred_free();
+
+/* Reference stream taps for the timing models; one well-predicted
+ * branch each while no model is attached */
+void trace_update();
+void trace_fetch_models(uint64_t pc);
+void trace_data_models(uint64_t address, int size, int write);
+
+static inline void trace_fetch(uint64_t pc)
+{
+  if (ARMSIM->tracing)
+    trace_fetch_models(pc);
+}
+
+static inline void trace_data(uint64_t address, int size, int write)
+{
+  if (ARMSIM->tracing)
+    trace_data_models(address, size, write);
+}
+
+/* Called by every branch before it moves the PC to next_pc */
+static inline void trace_branch(uint64_t pc, uint64_t next_pc, int taken, int kind)
+{
+  if (ARMSIM->tracing && ARMSIM->bpred != NULL)
+    bpred_branch(pc, next_pc, taken, kind);
+}
 
 uint32_t mem_read_32(uint64_t address);
 void mem_write_32(uint64_t address, uint32_t value);
 
 /* YOU IMPLEMENT THIS FUNCTION */
-void process_instruction();
+uint32_t process_instruction();
+
+/* State hashing (hash.c) */
+void hash_store(uint64_t address, const uint8_t *old, const uint8_t *new, size_t len);
+void hash_schedule();
+void hash_emit();
+void hash_rewind();
+void hash_rescan();
+void hash_flush();
+void hash_free();
+
+/* Host cost profile (hostprof.c): with make PROFILE=1 cycle() and
+ * the handlers it reaches time themselves, otherwise the hooks
+ * compile to nothing */
+enum { HOST_FETCH, HOST_EXECUTE, HOST_COMMIT };
+#define HOST_PHASES ARMSIM_HOST_PHASES
+enum { HOST_FLAGS, HOST_MEMORY };
+
+#ifdef ARMSIM_HOST_PROFILE
+#define HOST_PROFILE(call)              \
+  do                                    \
+  {                                     \
+    if (ARMSIM->host_profile != NULL)   \
+      call;                             \
+  } while (0)
+#else
+#define HOST_PROFILE(call) \
+  do                       \
+  {                        \
+  } while (0)
+#endif
+
+void host_begin();
+void host_mark(int inst);
+void host_end();
+void host_enter();
+void host_leave(int what);
+void host_flush();
+void host_free();
+
+/* Per-PC profiles (pcprof.c) */
+void pcprof_fetch(uint64_t pc);
+void pcprof_run(int running);
+void pcprof_source(struct armsim *owner, const uint64_t *pc, int tier);
+void pcprof_flush();
+void pcprof_free();
+
+/* Trace-event timeline (timeline.c) */
+void timeline_tick(uint64_t target);
+void timeline_run(int running);
+void timeline_roi(int marker);
+void timeline_span(const char *name, int begin);
+void timeline_free();
+
+/* Live sampling (monitor.c) */
+void monitor_tick(uint64_t target);
+void monitor_run(int running);
+void monitor_free();
+
+/* Snapshots (snapshot.c) */
+void snapshot_clear();
+void snapshot_free();
+
+/* len bytes at offset into region i are about to be written */
+static inline void mark_dirty(int i, uint64_t offset, uint64_t len)
+{
+  uint64_t page;
+  for (page = offset / MEM_PAGE; page <= (offset + len - 1) / MEM_PAGE; page++)
+    ARMSIM->dirty[i][page / 64] |= 1ULL << (page % 64);
+}
+
+/* Flight recorder (history.c) */
+int history_init(size_t entries);
+
+/* Pre-decoded text stream (sim.c) */
+void predecode_reset();
+void predecode_invalidate(uint64_t address);
+void predecode_set_breakpoint(uint64_t pc, int enable);
 
 #endif
@@ -1,4 +1,6 @@
 #include "shell.h"
+#include "sim.h"
+#include "timing.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,46 +10,12 @@ const char *instruction_names[] = {
     "HLT", "ADDSer", "ADDSim", "SUBSer", "SUBSim", "CMPer", "CMPim",
     "ANDS", "EOR", "ORR", "BR", "LSL", "LSR", "STUR",
     "STURB", "STURH", "LDUR", "LDURB", "LDURH", "MOVZ", "ISNOT",
-    "ADDim", "ADDer", "MUL", "CBZ", "CBNZ", "ADCS"};
-
-typedef enum
-{
-    B = 0,
-    BEQ = 1,
-    BNE = 2,
-    BGT = 3,
-    BLT = 4,
-    BGE = 5,
-    BLE = 6,
-    HLT = 7,
-    ADDSer = 8,
-    ADDSim = 9,
-    SUBSer = 10,
-    SUBSim = 11,
-    CMPer = 12,
-    CMPim = 13,
-    ANDS = 14,
-    EOR = 15,
-    ORR = 16,
-    BR = 17,
-    LSL = 18,
-    LSR = 19,
-    STUR = 20,
-    STURB = 21,
-    STURH = 22,
-    LDUR = 23,
-    LDURB = 24,
-    LDURH = 25,
-    MOVZ = 26,
-    ISNOT = 27,
-    ADDim = 28,
-    ADDer = 29,
-    MUL = 30,
-    CBZ = 31,
-    CBNZ = 32,
-    ADCS = 33,
-    INVALID_INSTRUCTION = -1 // To handle invalid cases
-} Instruction;
+    "ADDim", "ADDer", "MUL", "CBZ", "CBNZ", "ADCS", "BRK", "MRS",
+    "MAGIC"};
+
+/* PREDECODED holds one decoded Instruction per text word, filled
+ * lazily on first fetch */
+#define PREDECODE_EMPTY -2
 
 typedef struct
 {
@@ -72,6 +40,11 @@ Instruction detectHLT(uint32_t instruction)
         uint32_t halt = extract_bits(instruction, 0, 4);
         if (halt == 0x0)
         {
+            uint32_t imm16 = extract_bits(instruction, 5, 20);
+            if (imm16 >= ARMSIM_ROI_RESET && imm16 <= ARMSIM_ROI_CHECKPOINT)
+            {
+                return MAGIC;
+            }
             return HLT;
         }
     }
@@ -106,6 +79,19 @@ Instruction LvsR(uint32_t instruction)
     return ISNOT;
 }
 
+Instruction detectMRS(uint32_t instruction)
+{
+    switch (instruction & ~0x1fu)
+    {
+    case MRS_CNTVCT_EL0:
+    case MRS_PMCCNTR_EL0:
+    case MRS_PMEVCNTR0_EL0:
+        return MRS;
+    default:
+        return INVALID_INSTRUCTION;
+    }
+}
+
 Instruction bcond(uint32_t instruction)
 {
     int b = extract_bits(instruction, 26, 31);
@@ -161,6 +147,7 @@ Instruction SUBSvsCMP(uint32_t instruction)
 AddWithCarryResult AddWithCarry(uint64_t x, uint64_t y, bool carry_in)
 {
     AddWithCarryResult result;
+    HOST_PROFILE(host_enter());
 
     // Suma sin signo
     uint64_t unsigned_sum = x + y + carry_in;
@@ -184,6 +171,7 @@ AddWithCarryResult AddWithCarry(uint64_t x, uint64_t y, bool carry_in)
     result.flagV = (both_positive && !result_positive) ||
                    (both_negative && result_positive);
 
+    HOST_PROFILE(host_leave(HOST_FLAGS));
     return result;
 }
 
@@ -351,6 +339,8 @@ CPU_State b()
     int64_t imm26 = extract_bits(instruction, 0, 25);
     int32_t value = imm26 << 2;
     int64_t offset = SignExtend(value, (int)28);
+    trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + offset, TRUE, BRANCH_DIRECT);
+    block_boundary(NEXT_STATE.PC + offset, NEXT_STATE.PC);
     NEXT_STATE.PC = NEXT_STATE.PC + offset;
 }
 
@@ -358,6 +348,8 @@ CPU_State br()
 {
     uint32_t instruction = mem_read_32(NEXT_STATE.PC);
     size_t n = extract_bits(instruction, 5, 9);
+    trace_branch(NEXT_STATE.PC, NEXT_STATE.REGS[n], TRUE, n == 30 ? BRANCH_RETURN : BRANCH_INDIRECT);
+    block_boundary(NEXT_STATE.REGS[n], NEXT_STATE.PC);
     NEXT_STATE.PC = NEXT_STATE.REGS[n];
 }
 
@@ -369,10 +361,13 @@ CPU_State bconditional()
         int64_t imm19 = extract_bits(instruction, 5, 23);
         int32_t value = imm19 << 2;
         int64_t offset = SignExtend(value, 21);
+        trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + offset, TRUE, BRANCH_CONDITIONAL);
+        block_boundary(NEXT_STATE.PC + offset, NEXT_STATE.PC);
         NEXT_STATE.PC = NEXT_STATE.PC + offset;
     }
     else
     {
+        trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + 4, FALSE, BRANCH_CONDITIONAL);
         NEXT_STATE.PC += 4;
     }
 }
@@ -405,6 +400,28 @@ CPU_State movz()
     NEXT_STATE.REGS[d] = imm16;
 }
 
+/* Cycles so far: from the timing model if one is attached */
+uint64_t modelled_cycles()
+{
+#ifndef ARMSIM_NO_TIMING
+    if (ARMSIM->pipeline != NULL)
+        return pipeline_cycles();
+    if (ARMSIM->ooo != NULL)
+        return ooo_cycles();
+#endif
+    return roi_instructions();
+}
+
+void mrs()
+{
+    uint32_t instruction = mem_read_32(NEXT_STATE.PC);
+    uint64_t t = extract_bits(instruction, 0, 4);
+    if ((instruction & ~0x1fu) == MRS_PMEVCNTR0_EL0)
+        NEXT_STATE.REGS[t] = roi_instructions();
+    else
+        NEXT_STATE.REGS[t] = modelled_cycles();
+}
+
 CPU_State stur()
 {
     uint32_t instruction = mem_read_32(NEXT_STATE.PC);
@@ -416,6 +433,7 @@ CPU_State stur()
     uint64_t data = NEXT_STATE.REGS[t];
     uint32_t data1 = data;
     uint32_t data2 = data >> 32;
+    trace_data(address, 8, 1);
     mem_write_32(address, data1);
     mem_write_32(address + 4, data2);
     mem_write_32(address, data);
@@ -430,6 +448,7 @@ CPU_State sturb()
     uint64_t address = NEXT_STATE.REGS[n];
     address += offset;
     uint32_t data = extract_bits(NEXT_STATE.REGS[t], 0, 7);
+    trace_data(address, 4, 1);
     mem_write_32(address, data);
 }
 
@@ -442,6 +461,7 @@ CPU_State sturh()
     uint64_t address = NEXT_STATE.REGS[n];
     address += offset;
     uint32_t data = extract_bits(NEXT_STATE.REGS[t], 0, 16);
+    trace_data(address, 4, 1);
     mem_write_32(address, data);
 }
 
@@ -453,6 +473,7 @@ CPU_State ldur()
     uint64_t t = extract_bits(instruction, 0, 4);
     uint64_t address = NEXT_STATE.REGS[n];
     address += offset;
+    trace_data(address, 8, 0);
     uint32_t data1 = mem_read_32(address);
     uint32_t data2 = mem_read_32(address + 4);
     uint64_t data = data2;
@@ -468,6 +489,7 @@ CPU_State ldurb()
     uint64_t t = extract_bits(instruction, 0, 4);
     uint64_t address = NEXT_STATE.REGS[n];
     address += offset;
+    trace_data(address, 4, 0);
     uint32_t data = extract_bits(mem_read_32(address), 0, 7);
     NEXT_STATE.REGS[t] = data;
 }
@@ -480,6 +502,7 @@ CPU_State ldurh()
     uint64_t t = extract_bits(instruction, 0, 4);
     uint64_t address = NEXT_STATE.REGS[n];
     address += offset;
+    trace_data(address, 4, 0);
     uint32_t data = extract_bits(mem_read_32(address), 0, 16);
     NEXT_STATE.REGS[t] = data;
 }
@@ -528,10 +551,13 @@ void cbz()
     int64_t offset = SignExtend(value, 21);
     if (NEXT_STATE.REGS[t] == 0)
     {
+        trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + offset, TRUE, BRANCH_CONDITIONAL);
+        block_boundary(NEXT_STATE.PC + offset, NEXT_STATE.PC);
         NEXT_STATE.PC = NEXT_STATE.PC + offset;
     }
     else
     {
+        trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + 4, FALSE, BRANCH_CONDITIONAL);
         NEXT_STATE.PC += 4;
     }
 }
@@ -545,10 +571,13 @@ void cbnz()
     int64_t offset = SignExtend(value, 21);
     if (NEXT_STATE.REGS[t] != 0)
     {
+        trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + offset, TRUE, BRANCH_CONDITIONAL);
+        block_boundary(NEXT_STATE.PC + offset, NEXT_STATE.PC);
         NEXT_STATE.PC = NEXT_STATE.PC + offset;
     }
     else
     {
+        trace_branch(NEXT_STATE.PC, NEXT_STATE.PC + 4, FALSE, BRANCH_CONDITIONAL);
         NEXT_STATE.PC += 4;
     }
 }
@@ -569,9 +598,10 @@ void adcs()
 
 Instruction decode(uint32_t instruction)
 {
-    if (detectHLT(instruction) == HLT)
+    Instruction h = detectHLT(instruction);
+    if (h != ISNOT)
     {
-        return HLT;
+        return h;
     }
     Instruction b = bcond(instruction);
     if (b != ISNOT)
@@ -658,124 +688,393 @@ Instruction decode(uint32_t instruction)
         return CBNZ;
     case 0xba:
         return ADCS;
+    case 0xd5:
+        return detectMRS(instruction);
     default:
         return INVALID_INSTRUCTION;
     }
     return INVALID_INSTRUCTION;
 }
 
-void process_instruction()
+void predecode_reset()
+{
+    memset(PREDECODED, PREDECODE_EMPTY, sizeof(PREDECODED));
+}
+
+void predecode_invalidate(uint64_t address)
+{
+    uint64_t offset = address - MEM_TEXT_START;
+    if (offset >= MEM_TEXT_SIZE)
+    {
+        return;
+    }
+    // A 32-bit store can straddle two text words
+    for (uint64_t i = offset >> 2; i <= (offset + 3) >> 2 && i < MEM_TEXT_SIZE / 4; i++)
+    {
+        if (PREDECODED[i] != BRK)
+        {
+            PREDECODED[i] = PREDECODE_EMPTY;
+        }
+    }
+}
+
+void predecode_set_breakpoint(uint64_t pc, int enable)
+{
+    uint64_t offset = pc - MEM_TEXT_START;
+    if (offset >= MEM_TEXT_SIZE || (offset & 3))
+    {
+        return;
+    }
+    PREDECODED[offset >> 2] = enable ? BRK : PREDECODE_EMPTY;
+}
+
+// The word comes back in *word too: in the text segment it is a
+// plain load from region 0, no walk over the regions
+Instruction fetch_decoded(uint64_t pc, uint32_t *word)
+{
+    uint64_t offset = pc - MEM_TEXT_START;
+    if (offset < MEM_TEXT_SIZE && !(offset & 3))
+    {
+        const uint8_t *text = MEM_REGIONS[0].mem + offset;
+        int8_t *slot = &PREDECODED[offset >> 2];
+        *word = text[0] | text[1] << 8 | text[2] << 16 | (uint32_t)text[3] << 24;
+        if (*slot == PREDECODE_EMPTY)
+        {
+            *slot = decode(*word);
+            ARMSIM->decoded++;
+        }
+        return *slot;
+    }
+    *word = mem_read_32(pc);
+    return decode(*word);
+}
+
+/* Whether inst writes the register in its Rd/Rt field */
+int writes_register(Instruction inst)
 {
-    Instruction inst = decode(mem_read_32(NEXT_STATE.PC));
     switch (inst)
     {
+    case ADDSer:
+    case ADDSim:
+    case SUBSer:
+    case SUBSim:
+    case ANDS:
+    case EOR:
+    case ORR:
+    case LSL:
+    case LSR:
+    case LDUR:
+    case LDURB:
+    case LDURH:
+    case MOVZ:
+    case ADDim:
+    case ADDer:
+    case MUL:
+    case ADCS:
+    case MRS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+#ifndef ARMSIM_NO_TIMING
+/***************************************************************/
+/*                                                             */
+/* Procedure : record_instruction                              */
+/*                                                             */
+/* Purpose   : Describe the instruction just executed for the  */
+/*             timing models. CURRENT_STATE still holds the    */
+/*             registers it read.                              */
+/*                                                             */
+/***************************************************************/
+void record_instruction(insn_record_t *record, Instruction inst)
+{
+    uint32_t instruction = mem_read_32(CURRENT_STATE.PC);
+    uint8_t d = extract_bits(instruction, 0, 4);
+    uint8_t n = extract_bits(instruction, 5, 9);
+    uint8_t m = extract_bits(instruction, 16, 20);
+
+    record->pc = CURRENT_STATE.PC;
+    record->address = 0;
+    record->word = instruction;
+    record->inst = inst;
+    record->dest = REG_NONE;
+    record->src[0] = record->src[1] = record->src[2] = REG_NONE;
+    record->flags = 0;
+
+    switch (inst)
+    {
+    case ADDSer:
+    case SUBSer:
+    case ANDS:
+        record->flags = RECORD_SETS_FLAGS;
+        /* fall through */
+    case EOR:
+    case ORR:
+    case ADDer:
+    case MUL:
+        record->dest = d;
+        record->src[0] = n;
+        record->src[1] = m;
+        break;
+    case ADCS:
+        record->flags = RECORD_SETS_FLAGS;
+        record->dest = d;
+        record->src[0] = n;
+        record->src[1] = m;
+        record->src[2] = REG_FLAGS;
+        break;
+    case ADDSim:
+    case SUBSim:
+        record->flags = RECORD_SETS_FLAGS;
+        /* fall through */
+    case ADDim:
+    case LSL:
+    case LSR:
+        record->dest = d;
+        record->src[0] = n;
+        break;
+    case CMPer:
+        record->flags = RECORD_SETS_FLAGS;
+        record->src[0] = n;
+        record->src[1] = m;
+        break;
+    case CMPim:
+        record->flags = RECORD_SETS_FLAGS;
+        record->src[0] = n;
+        break;
+    case MOVZ:
+    case MRS:
+        record->dest = d;
+        break;
+    case LDUR:
+    case LDURB:
+    case LDURH:
+        record->flags = RECORD_LOAD;
+        record->dest = d;
+        record->src[0] = n;
+        record->address = CURRENT_STATE.REGS[n] + extract_bits(instruction, 12, 20);
+        break;
+    case STUR:
+    case STURB:
+    case STURH:
+        record->flags = RECORD_STORE;
+        record->src[0] = n;
+        record->src[1] = d;
+        record->address = CURRENT_STATE.REGS[n] + extract_bits(instruction, 12, 20);
+        break;
+    case B:
+        record->flags = RECORD_BRANCH | RECORD_TAKEN;
+        break;
+    case BR:
+        record->flags = RECORD_BRANCH | RECORD_TAKEN;
+        record->src[0] = n;
+        break;
+    case BEQ:
+    case BNE:
+    case BGT:
+    case BLT:
+    case BGE:
+    case BLE:
+        record->flags = RECORD_BRANCH;
+        record->src[0] = REG_FLAGS;
+        break;
+    case CBZ:
+    case CBNZ:
+        record->flags = RECORD_BRANCH;
+        record->src[0] = d;
+        break;
+    default:
+        break;
+    }
+    if ((record->flags & RECORD_BRANCH) && NEXT_STATE.PC != CURRENT_STATE.PC + 4)
+        record->flags |= RECORD_TAKEN;
+}
+#endif
+
+/* Fetch taps of an instruction that is about to execute; BRK and
+ * MAGIC stay out of them */
+static inline void fetched(Instruction inst)
+{
+    (void)inst; // only PROFILE=1 builds mark it
+    trace_fetch(NEXT_STATE.PC);
+    HOST_PROFILE(host_mark(inst));
+}
+
+uint32_t process_instruction()
+{
+    uint32_t word;
+    Instruction inst = fetch_decoded(NEXT_STATE.PC, &word);
+dispatch:
+    switch (inst)
+    {
+    case BRK:
+        if (NEXT_STATE.PC != BREAK_SKIP_PC)
+        {
+            // Trap before executing; the shell makes us resumable again
+            RUN_BIT = 0;
+            STOP_REASON = STOP_BREAKPOINT;
+            return word;
+        }
+        BREAK_SKIP_PC = 0;
+        inst = decode(word);
+        goto dispatch;
+    case MAGIC:
+        // ROI markers stay out of the fetch stream too
+        roi_marker(word);
+        return word;
     case HLT:
+        fetched(inst);
         RUN_BIT = 0;
+        STOP_REASON = STOP_HALT;
         break;
     case ADDSer:
+        fetched(inst);
         addser();
         break;
     case ADDSim:
+        fetched(inst);
         addsim();
         break;
     case SUBSer:
+        fetched(inst);
         subser();
         break;
     case SUBSim:
+        fetched(inst);
         subsim();
         break;
     case CMPer:
+        fetched(inst);
         cmper();
         break;
     case CMPim:
+        fetched(inst);
         cmpim();
         break;
     case ANDS:
+        fetched(inst);
         ands();
         break;
     case EOR:
+        fetched(inst);
         eor();
         break;
     case ORR:
+        fetched(inst);
         orr();
         break;
     case B:
+        fetched(inst);
         b();
         break;
     case BR:
+        fetched(inst);
         br();
         break;
     case BEQ:
+        fetched(inst);
         bconditional();
         break;
     case BNE:
+        fetched(inst);
         bconditional();
         break;
     case BGT:
+        fetched(inst);
         bconditional();
         break;
     case BGE:
+        fetched(inst);
         bconditional();
         break;
     case BLE:
+        fetched(inst);
         bconditional();
         break;
     case BLT:
+        fetched(inst);
         bconditional();
         break;
     case LSL:
+        fetched(inst);
         lsl();
         break;
     case LSR:
+        fetched(inst);
         lsr();
         break;
     case MOVZ:
+        fetched(inst);
         movz();
         break;
     case STUR:
+        fetched(inst);
         stur();
         break;
     case STURB:
+        fetched(inst);
         sturb();
         break;
     case STURH:
+        fetched(inst);
         sturh();
         break;
     case LDUR:
+        fetched(inst);
         ldur();
         break;
     case LDURB:
+        fetched(inst);
         ldurb();
         break;
     case LDURH:
+        fetched(inst);
         ldurh();
         break;
     case ADDim:
+        fetched(inst);
         addim();
         break;
     case ADDer:
+        fetched(inst);
         addreg();
         break;
     case MUL:
+        fetched(inst);
         mul();
         break;
     case CBZ:
+        fetched(inst);
         cbz();
         break;
     case CBNZ:
+        fetched(inst);
         cbnz();
         break;
     case ADCS:
+        fetched(inst);
         adcs();
         break;
-    default:
+    case MRS:
+        fetched(inst);
+        mrs();
         break;
+    default:
+        fetched(inst);
+        // Unimplemented: stop here rather than slide through memory
+        RUN_BIT = 0;
+        STOP_REASON = STOP_INVALID;
+        return word;
     }
+    HOST_PROFILE(host_mark(inst));
     if (inst != B && inst != BR && inst != CBZ && inst != CBNZ &&
         !(inst >= BEQ && inst <= BLE))
     {
         NEXT_STATE.PC += 4;
     }
+    trace_retire(inst);
     /* execute one instruction here. You should use CURRENT_STATE and modify
      * values in NEXT_STATE. You can call mem_read_32() and mem_write_32() to
      * access memory.
@@ -784,4 +1083,5 @@ void process_instruction()
      *             y otra para execute()
      *
      * */
+    return word;
 }
\ No newline at end of file
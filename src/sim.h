@@ -0,0 +1,70 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <inttypes.h>
+
+/* Decoder interface of sim.c */
+
+typedef enum
+{
+    B = 0,
+    BEQ = 1,
+    BNE = 2,
+    BGT = 3,
+    BLT = 4,
+    BGE = 5,
+    BLE = 6,
+    HLT = 7,
+    ADDSer = 8,
+    ADDSim = 9,
+    SUBSer = 10,
+    SUBSim = 11,
+    CMPer = 12,
+    CMPim = 13,
+    ANDS = 14,
+    EOR = 15,
+    ORR = 16,
+    BR = 17,
+    LSL = 18,
+    LSR = 19,
+    STUR = 20,
+    STURB = 21,
+    STURH = 22,
+    LDUR = 23,
+    LDURB = 24,
+    LDURH = 25,
+    MOVZ = 26,
+    ISNOT = 27,
+    ADDim = 28,
+    ADDer = 29,
+    MUL = 30,
+    CBZ = 31,
+    CBNZ = 32,
+    ADCS = 33,
+    BRK = 34,                // Breakpoint patched into the pre-decoded stream
+    MRS = 35,
+    MAGIC = 36,              // HLT with an ARMSIM_ROI_* immediate
+    INVALID_INSTRUCTION = -1 // To handle invalid cases
+} Instruction;
+
+extern const char *instruction_names[];
+
+/* MRS Xt, <register>: the system registers it reads, with Rt = 0.
+ * The cycle counters hold modelled cycles while the pipeline or
+ * out-of-order model is attached, retired instructions otherwise;
+ * PMEVCNTR0_EL0 counts retired instructions (INST_RETIRED). All
+ * three exclude the MRS itself and count the region of interest
+ * only. */
+#define MRS_CNTVCT_EL0 0xd53be040
+#define MRS_PMCCNTR_EL0 0xd53b9d00
+#define MRS_PMEVCNTR0_EL0 0xd53be800
+
+/* HLT #imm */
+#define HLT_WORD(imm) (0xd4400000u | (uint32_t)(imm) << 5)
+
+uint32_t extract_bits(uint32_t instruction, int start, int end);
+Instruction decode(uint32_t instruction);
+Instruction fetch_decoded(uint64_t pc, uint32_t *word);
+int writes_register(Instruction inst);
+
+#endif
@@ -0,0 +1,393 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   simd: batch simulation server on a Unix domain socket     */
+/*                                                             */
+/***************************************************************/
+
+/* Wire format, all integers little-endian.
+ *
+ * Request:   u32 magic SIMD_REQUEST_MAGIC, u32 njobs, then per job
+ *              u64 max_instructions   (0 = server default)
+ *              u32 nwords             (program size in words, at most
+ *                                      ARMSIM_TEXT_WORDS)
+ *              u32 reg_mask           (bit k set: X<k> is given)
+ *              u64 value[popcount(reg_mask)], lowest register first
+ *              u32 word[nwords]
+ *
+ * Response:  u32 magic SIMD_REPLY_MAGIC, u32 njobs, then per job
+ *              i32 status             (armsim_status_t or ARMSIM_E*)
+ *              u32 nzcv               (ARMSIM_FLAG_* bits)
+ *              u64 instructions
+ *              u64 pc
+ *              u64 regs[32]
+ *
+ * A connection may send any number of requests; each gets one
+ * response. Jobs of a batch run in parallel on the worker pool, each
+ * worker reusing one warm, pre-allocated simulator instance. A worker
+ * keeps a snapshot of the last program it loaded: a job with the same
+ * words restores it, rewriting only the pages the previous run
+ * stored to, instead of resetting and loading again.
+ *
+ * Batches run one at a time, so a job that never halts would hold up
+ * every connection: unless -n or -t say otherwise (0 for unlimited),
+ * each job stops after SIMD_DEFAULT_LIMIT instructions or
+ * SIMD_DEFAULT_SECONDS seconds, whichever comes first. The time
+ * limit applies even to jobs that set max_instructions. A request
+ * with an oversized job, or more than SIMD_MAX_WORDS words in all,
+ * is malformed and closes the connection. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "armsim.h"
+
+#define SIMD_REQUEST_MAGIC 0x514d5341 /* "ASMQ" */
+#define SIMD_REPLY_MAGIC 0x524d5341   /* "ASMR" */
+#define SIMD_MAX_JOBS 65536
+#define SIMD_MAX_WORDS (64 * ARMSIM_TEXT_WORDS) /* per request, 16M words (64 MB) */
+#define SIMD_DEFAULT_LIMIT 1000000000ULL
+#define SIMD_DEFAULT_SECONDS 10.0
+
+typedef struct
+{
+  uint64_t max_instructions;
+  uint32_t nwords;
+  uint32_t reg_mask;
+  uint64_t regs[ARMSIM_REGS];
+  uint32_t *words;
+} job_t;
+
+typedef struct
+{
+  int32_t status;
+  uint32_t nzcv;
+  uint64_t instructions;
+  uint64_t pc;
+  uint64_t regs[ARMSIM_REGS];
+} __attribute__((packed)) result_t;
+
+typedef struct
+{
+  armsim_t *sim;
+  uint32_t *words; /* program in the snapshot, NULL if none */
+  uint32_t nwords;
+} worker_t;
+
+typedef struct
+{
+  job_t *jobs;
+  result_t *results;
+  uint32_t njobs;
+  uint32_t next; /* next job to hand out */
+  uint32_t done;
+} batch_t;
+
+/* one batch in flight at a time; connections queue on BATCH_LOCK */
+pthread_mutex_t BATCH_LOCK = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t POOL_LOCK = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t WORK_READY = PTHREAD_COND_INITIALIZER;
+pthread_cond_t WORK_DONE = PTHREAD_COND_INITIALIZER;
+batch_t *BATCH;
+
+uint64_t DEFAULT_LIMIT = SIMD_DEFAULT_LIMIT;
+double TIME_LIMIT = SIMD_DEFAULT_SECONDS;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : read_full / write_full                          */
+/*                                                             */
+/***************************************************************/
+int read_full(int fd, void *buf, size_t len)
+{
+  uint8_t *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int write_full(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_job                                         */
+/*                                                             */
+/* Purpose   : Run one job on a worker's warm instance         */
+/*                                                             */
+/***************************************************************/
+void run_job(worker_t *w, const job_t *job, result_t *result)
+{
+  armsim_t *sim = w->sim;
+  size_t bytes = (size_t)job->nwords * sizeof(uint32_t);
+  int k, status = 0;
+
+  memset(result, 0, sizeof(*result));
+  if (w->words == NULL || w->nwords != job->nwords || memcmp(w->words, job->words, bytes) != 0)
+  {
+    free(w->words);
+    w->words = NULL;
+    armsim_reset(sim);
+    status = armsim_load_image(sim, job->words, job->nwords);
+    /* without a snapshot the next job just loads again */
+    if (status == 0 && armsim_snapshot(sim) == 0 && (w->words = malloc(bytes + 1)) != NULL)
+    {
+      memcpy(w->words, job->words, bytes);
+      w->nwords = job->nwords;
+    }
+  }
+  else
+  {
+    armsim_restore(sim);
+  }
+  if (status == 0)
+  {
+    for (k = 0; k < ARMSIM_REGS; k++)
+      if (job->reg_mask & (1u << k))
+        armsim_set_reg(sim, k, job->regs[k]);
+    armsim_set_limits(sim, job->max_instructions ? job->max_instructions : DEFAULT_LIMIT,
+                      TIME_LIMIT);
+    status = armsim_run(sim);
+  }
+
+  armsim_counters_t counters;
+  armsim_get_counters(sim, &counters);
+  result->status = status;
+  result->nzcv = armsim_get_flags(sim);
+  result->instructions = counters.instructions;
+  result->pc = armsim_get_pc(sim);
+  for (k = 0; k < ARMSIM_REGS; k++)
+    result->regs[k] = armsim_get_reg(sim, k);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : worker                                          */
+/*                                                             */
+/* Purpose   : Pool thread: take jobs from the current batch   */
+/*                                                             */
+/***************************************************************/
+void *worker(void *arg)
+{
+  worker_t *w = arg;
+
+  pthread_mutex_lock(&POOL_LOCK);
+  for (;;)
+  {
+    while (BATCH == NULL || BATCH->next == BATCH->njobs)
+      pthread_cond_wait(&WORK_READY, &POOL_LOCK);
+
+    batch_t *batch = BATCH;
+    uint32_t i = batch->next++;
+    pthread_mutex_unlock(&POOL_LOCK);
+
+    run_job(w, &batch->jobs[i], &batch->results[i]);
+
+    pthread_mutex_lock(&POOL_LOCK);
+    if (++batch->done == batch->njobs)
+      pthread_cond_broadcast(&WORK_DONE);
+  }
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : read_batch                                      */
+/*                                                             */
+/* Purpose   : Parse one request; returns -1 on EOF or error   */
+/*                                                             */
+/***************************************************************/
+int read_batch(int fd, batch_t *batch)
+{
+  uint32_t header[2];
+  uint32_t i;
+  uint64_t total = 0;
+  int k;
+
+  memset(batch, 0, sizeof(*batch));
+  if (read_full(fd, header, sizeof(header)) != 0 ||
+      header[0] != SIMD_REQUEST_MAGIC || header[1] > SIMD_MAX_JOBS)
+    return -1;
+
+  batch->njobs = header[1];
+  batch->jobs = calloc(batch->njobs + 1, sizeof(job_t));
+  batch->results = calloc(batch->njobs + 1, sizeof(result_t));
+  if (batch->jobs == NULL || batch->results == NULL)
+    return -1;
+
+  for (i = 0; i < batch->njobs; i++)
+  {
+    job_t *job = &batch->jobs[i];
+    if (read_full(fd, &job->max_instructions, sizeof(job->max_instructions)) != 0 ||
+        read_full(fd, &job->nwords, sizeof(job->nwords)) != 0 ||
+        read_full(fd, &job->reg_mask, sizeof(job->reg_mask)) != 0 ||
+        job->nwords > ARMSIM_TEXT_WORDS || (total += job->nwords) > SIMD_MAX_WORDS)
+      return -1;
+    for (k = 0; k < ARMSIM_REGS; k++)
+      if ((job->reg_mask & (1u << k)) &&
+          read_full(fd, &job->regs[k], sizeof(uint64_t)) != 0)
+        return -1;
+    job->words = malloc((size_t)job->nwords * sizeof(uint32_t) + 1);
+    if (job->words == NULL ||
+        read_full(fd, job->words, (size_t)job->nwords * sizeof(uint32_t)) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+void free_batch(batch_t *batch)
+{
+  uint32_t i;
+  if (batch->jobs != NULL)
+    for (i = 0; i < batch->njobs; i++)
+      free(batch->jobs[i].words);
+  free(batch->jobs);
+  free(batch->results);
+  memset(batch, 0, sizeof(*batch));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : serve                                           */
+/*                                                             */
+/* Purpose   : Answer every request on one connection          */
+/*                                                             */
+/***************************************************************/
+void *serve(void *arg)
+{
+  int fd = (int)(intptr_t)arg;
+  batch_t batch;
+
+  while (read_batch(fd, &batch) == 0)
+  {
+    pthread_mutex_lock(&BATCH_LOCK);
+    pthread_mutex_lock(&POOL_LOCK);
+    BATCH = &batch;
+    pthread_cond_broadcast(&WORK_READY);
+    while (batch.done < batch.njobs)
+      pthread_cond_wait(&WORK_DONE, &POOL_LOCK);
+    BATCH = NULL;
+    pthread_mutex_unlock(&POOL_LOCK);
+    pthread_mutex_unlock(&BATCH_LOCK);
+
+    uint32_t header[2] = {SIMD_REPLY_MAGIC, batch.njobs};
+    int failed = write_full(fd, header, sizeof(header)) != 0 ||
+                 write_full(fd, batch.results, batch.njobs * sizeof(result_t)) != 0;
+    free_batch(&batch);
+    if (failed)
+      break;
+  }
+  free_batch(&batch);
+  close(fd);
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : main                                            */
+/*                                                             */
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  const char *path = "simd.sock";
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  struct sockaddr_un addr;
+  int opt, listener;
+  long k;
+
+  while ((opt = getopt(argc, argv, "s:j:n:t:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      path = optarg;
+      break;
+    case 'j':
+      workers = strtol(optarg, NULL, 0);
+      break;
+    case 'n':
+      DEFAULT_LIMIT = strtoull(optarg, NULL, 0);
+      break;
+    case 't':
+      TIME_LIMIT = strtod(optarg, NULL);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s socket] [-j workers] [-n max_insns] [-t seconds]\n",
+              argv[0]);
+      exit(1);
+    }
+  }
+  if (workers < 1)
+    workers = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  /* warm pool: every worker owns a ready instance for its lifetime */
+  for (k = 0; k < workers; k++)
+  {
+    pthread_t thread;
+    worker_t *w = calloc(1, sizeof(*w));
+    if (w == NULL || (w->sim = armsim_create()) == NULL ||
+        pthread_create(&thread, NULL, worker, w) != 0)
+    {
+      fprintf(stderr, "Error: Can't start worker %ld\n", k);
+      exit(-1);
+    }
+    pthread_detach(thread);
+  }
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 16) != 0)
+  {
+    fprintf(stderr, "Error: Can't listen on %s: %s\n", path, strerror(errno));
+    exit(-1);
+  }
+  fprintf(stderr, "simd: %ld workers listening on %s\n", workers, path);
+
+  for (;;)
+  {
+    pthread_t thread;
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0)
+      continue;
+    if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) != 0)
+      close(fd);
+    else
+      pthread_detach(thread);
+  }
+}
@@ -0,0 +1,181 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: snapshots for repeated runs                    */
+/*                                                             */
+/***************************************************************/
+
+/* mem_write_32(), armsim_write_mem() and armsim_load_data() mark
+ * every 4 KB page they store to in ARMSIM->dirty, two ORs per store.
+ * A snapshot keeps a copy of guest memory in private anonymous
+ * mappings, and a page differs from its copy only while its bit is
+ * set: taking a snapshot copies the marked pages in, restoring copies
+ * them back out, and both clear the bits. Reset drops the snapshot
+ * and the bits, since every page is zero again, and empties the
+ * copies without unmapping them, so a snapshot taken right after
+ * loading copies just the program. Decoded text survives a restore,
+ * except on text pages that were written. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "shell.h"
+
+struct snapshot
+{
+  CPU_State current, next;
+  int run_bit;
+  Stop_Reason stop_reason;
+  uint64_t instruction_count, mem_writes;
+  uint64_t break_skip_pc;
+  int roi_active;
+  uint64_t roi_offset, roi_count;
+
+  uint8_t *copy[MEM_NREGIONS]; /* limit + 3 bytes, like the region */
+  int taken;                   /* FALSE after a reset */
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sync_pages                                      */
+/*                                                             */
+/* Purpose   : Copy every dirty page into the snapshot, or     */
+/*             back out of it, and clear the marks             */
+/*                                                             */
+/***************************************************************/
+static void sync_pages(struct snapshot *s, int restore)
+{
+  uint64_t w, offset, len, a;
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+    for (w = 0; w < DIRTY_WORDS(MEM_REGIONS[i].size); w++)
+      for (; ARMSIM->dirty[i][w] != 0; ARMSIM->dirty[i][w] &= ARMSIM->dirty[i][w] - 1)
+      {
+        uint8_t *mem, *copy;
+        offset = (64 * w + __builtin_ctzll(ARMSIM->dirty[i][w])) * MEM_PAGE;
+        len = MEM_REGIONS[i].size + 3 - offset;
+        if (len > MEM_PAGE)
+          len = MEM_PAGE;
+        mem = MEM_REGIONS[i].mem + offset;
+        copy = s->copy[i] + offset;
+        if (!restore)
+        {
+          memcpy(copy, mem, len);
+          continue;
+        }
+        if (ARMSIM->hash != NULL)
+          hash_store(MEM_REGIONS[i].start + offset, mem, copy, len);
+        memcpy(mem, copy, len);
+        if (i == 0)
+        {
+          for (a = 0; a < len; a += 4)
+            predecode_invalidate(MEM_REGIONS[i].start + offset + a);
+          if (ARMSIM->plugins != NULL)
+            plugin_invalidate();
+        }
+      }
+}
+
+/* From armsim_reset(), once guest memory is zero and unmarked again */
+void snapshot_clear()
+{
+  struct snapshot *s = ARMSIM->snapshot;
+  int i;
+
+  if (s == NULL || !s->taken)
+    return;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    madvise(s->copy[i], MEM_REGIONS[i].limit + 3, MADV_DONTNEED);
+  s->taken = FALSE;
+}
+
+void snapshot_free()
+{
+  struct snapshot *s = ARMSIM->snapshot;
+  int i;
+
+  if (s == NULL)
+    return;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    if (s->copy[i] != NULL)
+      munmap(s->copy[i], MEM_REGIONS[i].limit + 3);
+  free(s);
+  ARMSIM->snapshot = NULL;
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_snapshot(armsim_t *sim)
+{
+  struct snapshot *s;
+  int i;
+
+  if (sim == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if (sim->snapshot == NULL)
+  {
+    /* the copies start out zero, like memory after a reset: only
+     * pages written since then differ */
+    if ((s = calloc(1, sizeof(*s))) == NULL)
+      return ARMSIM_E_NOMEM;
+    sim->snapshot = s;
+    for (i = 0; i < MEM_NREGIONS; i++)
+    {
+      s->copy[i] = mmap(NULL, MEM_REGIONS[i].limit + 3, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (s->copy[i] == MAP_FAILED)
+      {
+        s->copy[i] = NULL;
+        snapshot_free();
+        return ARMSIM_E_NOMEM;
+      }
+    }
+  }
+  s = sim->snapshot;
+  sync_pages(s, FALSE);
+
+  s->current = sim->current;
+  s->next = sim->next;
+  s->run_bit = sim->run_bit;
+  s->stop_reason = sim->stop_reason;
+  s->instruction_count = sim->instruction_count;
+  s->mem_writes = sim->mem_writes;
+  s->break_skip_pc = sim->break_skip_pc;
+  s->roi_active = sim->roi_active;
+  s->roi_offset = sim->roi_offset;
+  s->roi_count = sim->roi_count;
+  s->taken = TRUE;
+  return 0;
+}
+
+int armsim_restore(armsim_t *sim)
+{
+  struct snapshot *s;
+
+  if (sim == NULL || sim->snapshot == NULL || !sim->snapshot->taken)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  s = sim->snapshot;
+  sync_pages(s, TRUE);
+
+  sim->current = s->current;
+  sim->next = s->next;
+  sim->run_bit = s->run_bit;
+  sim->stop_reason = s->stop_reason;
+  sim->instruction_count = s->instruction_count;
+  sim->mem_writes = s->mem_writes;
+  sim->history_start = s->instruction_count;
+  sim->break_skip_pc = s->break_skip_pc;
+  sim->roi_active = s->roi_active;
+  sim->roi_offset = s->roi_offset;
+  sim->roi_count = s->roi_count;
+  trace_update();
+  hash_rewind();
+  disarm_watchdog();
+  return 0;
+}
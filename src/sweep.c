@@ -0,0 +1,512 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: single-pass cache design-space sweep           */
+/*                                                             */
+/***************************************************************/
+
+/* One functional run feeds its reference stream to every
+ * configuration of a sweep. LRU configurations with write
+ * allocation that share a line size and a set count are answered
+ * together by one LRU stack per set (Mattson's stack distance: a
+ * reference hits in every cache of that geometry with more ways than
+ * its depth in the stack). Everything else -- pseudo-LRU,
+ * write-through -- is simulated directly with the cache.c levels.
+ *
+ * The simulating thread only appends references to a local batch.
+ * Full batches are copied into one single-producer single-consumer
+ * ring per worker thread; workers own disjoint sets of stack groups
+ * and direct caches, so they never share mutable state. */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "cache.h"
+
+#define SWEEP_RING (1 << 16) /* references per worker ring */
+#define SWEEP_BATCH 1024     /* references per producer batch */
+#define SWEEP_MAX_THREADS 64
+
+/* A reference is address << 5 | write << 4 | size */
+#define REF(address, size, write) ((address) << 5 | (uint64_t)(write) << 4 | (size))
+#define REF_ADDRESS(ref) ((ref) >> 5)
+#define REF_WRITE(ref) (((ref) >> 4) & 1)
+#define REF_SIZE(ref) ((ref) & 0xf)
+
+typedef struct
+{
+  _Atomic uint64_t head __attribute__((aligned(64))); /* written by the producer */
+  _Atomic uint64_t tail __attribute__((aligned(64))); /* written by the consumer */
+  _Atomic int done;
+  uint64_t slots[SWEEP_RING];
+} ring_t;
+
+typedef struct
+{
+  unsigned line_shift;
+  uint64_t set_mask;
+  uint32_t depth;      /* largest associativity asked for */
+  uint64_t *stacks;    /* sets * depth line entries, MRU first */
+  uint64_t *histogram; /* hits at each depth, [depth] = misses */
+} stack_group_t;
+
+typedef struct
+{
+  pthread_t thread;
+  armsim_t *sim; /* for region_of() in the direct caches */
+  ring_t *ring;
+  stack_group_t *groups;
+  int ngroups;
+  cache_level_t *direct;
+  int ndirect;
+} sweep_worker_t;
+
+/* Where each configuration's answer lives */
+typedef struct
+{
+  int worker, index, direct;
+  uint32_t ways;
+} sweep_slot_t;
+
+struct sweep
+{
+  int streams;
+  size_t nconfigs;
+  sweep_slot_t *slots;
+  sweep_worker_t workers[SWEEP_MAX_THREADS];
+  int nworkers, started;
+  uint64_t batch[SWEEP_BATCH];
+  int nbatch;
+  /* repeated fetches from one line of the smallest line size are
+   * counted here instead of queued, see sweep_fetch() */
+  unsigned min_shift;
+  uint64_t last_fetch;
+  uint64_t repeats;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : stack_access                                    */
+/*                                                             */
+/* Purpose   : Move a line to the top of its set's LRU stack,  */
+/*             recording the depth it was found at             */
+/*                                                             */
+/***************************************************************/
+void stack_access(stack_group_t *g, uint64_t line)
+{
+  uint64_t *stack = g->stacks + (line & g->set_mask) * g->depth;
+  uint64_t want = line + 1;
+  uint32_t depth;
+
+  for (depth = 0; depth < g->depth; depth++)
+    if (stack[depth] == want)
+      break;
+  g->histogram[depth]++;
+  if (depth == g->depth)
+    depth = g->depth - 1; /* a miss pushes the bottom entry out */
+  memmove(stack + 1, stack, depth * sizeof(*stack));
+  stack[0] = want;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : worker_reference                                */
+/*                                                             */
+/* Purpose   : Apply one reference to everything a worker owns */
+/*                                                             */
+/***************************************************************/
+void worker_reference(sweep_worker_t *w, uint64_t ref)
+{
+  uint64_t address = REF_ADDRESS(ref);
+  uint64_t end = address + REF_SIZE(ref) - 1;
+  int write = REF_WRITE(ref);
+  int k;
+
+  for (k = 0; k < w->ngroups; k++)
+  {
+    stack_group_t *g = &w->groups[k];
+    uint64_t line;
+    for (line = address >> g->line_shift; line <= end >> g->line_shift; line++)
+      stack_access(g, line);
+  }
+
+  for (k = 0; k < w->ndirect; k++)
+  {
+    cache_level_t *c = &w->direct[k];
+    uint64_t line, victim, *slot;
+    for (line = address >> c->line_shift; line <= end >> c->line_shift; line++)
+    {
+      level_access(c, line, ARMSIM_REGION_NONE, !write || c->config.write_back, &victim, &slot);
+      if (write && slot != NULL && c->config.write_back)
+        *slot |= DIRTY;
+    }
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_worker                                    */
+/*                                                             */
+/* Purpose   : Consume one ring until the sweep is finished    */
+/*                                                             */
+/***************************************************************/
+void *sweep_worker(void *arg)
+{
+  sweep_worker_t *w = arg;
+  ring_t *ring = w->ring;
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  ARMSIM = w->sim;
+  for (;;)
+  {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+    {
+      if (atomic_load_explicit(&ring->done, memory_order_acquire) &&
+          atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+        break;
+      sched_yield();
+      continue;
+    }
+    for (; tail != head; tail++)
+      worker_reference(w, ring->slots[tail & (SWEEP_RING - 1)]);
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_flush                                     */
+/*                                                             */
+/* Purpose   : Copy the producer batch into every ring         */
+/*                                                             */
+/***************************************************************/
+void sweep_flush(struct sweep *sweep)
+{
+  int k, i;
+
+  for (k = 0; k < sweep->nworkers; k++)
+  {
+    ring_t *ring = sweep->workers[k].ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    while (head + sweep->nbatch - atomic_load_explicit(&ring->tail, memory_order_acquire) >
+           SWEEP_RING)
+      sched_yield();
+    for (i = 0; i < sweep->nbatch; i++)
+      ring->slots[(head + i) & (SWEEP_RING - 1)] = sweep->batch[i];
+    atomic_store_explicit(&ring->head, head + sweep->nbatch, memory_order_release);
+  }
+  sweep->nbatch = 0;
+}
+
+static inline void sweep_push(struct sweep *sweep, uint64_t ref)
+{
+  sweep->batch[sweep->nbatch++] = ref;
+  if (sweep->nbatch == SWEEP_BATCH)
+    sweep_flush(sweep);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_fetch / sweep_data                        */
+/*                                                             */
+/* Purpose   : Reference stream taps (see trace_fetch)         */
+/*                                                             */
+/***************************************************************/
+void sweep_fetch(uint64_t pc)
+{
+  struct sweep *sweep = ARMSIM->sweep;
+
+  if (!(sweep->streams & ARMSIM_SWEEP_FETCH))
+    return;
+  /* another fetch from the MRU line hits everywhere and changes no
+   * replacement state, as long as no data reference came between */
+  if ((pc >> sweep->min_shift) + 1 == sweep->last_fetch)
+  {
+    sweep->repeats++;
+    return;
+  }
+  sweep->last_fetch = (pc >> sweep->min_shift) + 1;
+  sweep_push(sweep, REF(pc, 4, FALSE));
+}
+
+void sweep_data(uint64_t address, int size, int write)
+{
+  struct sweep *sweep = ARMSIM->sweep;
+
+  if (!(sweep->streams & ARMSIM_SWEEP_DATA))
+    return;
+  sweep->last_fetch = 0;
+  sweep_push(sweep, REF(address, size, write));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_stop                                      */
+/*                                                             */
+/* Purpose   : Drain the rings and join the running workers    */
+/*                                                             */
+/***************************************************************/
+void sweep_stop(struct sweep *sweep)
+{
+  int k;
+
+  if (sweep->nbatch > 0)
+    sweep_flush(sweep);
+  for (k = 0; k < sweep->started; k++)
+  {
+    atomic_store_explicit(&sweep->workers[k].ring->done, TRUE, memory_order_release);
+    pthread_join(sweep->workers[k].thread, NULL);
+  }
+  sweep->started = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_release                                   */
+/*                                                             */
+/***************************************************************/
+void sweep_release(struct sweep *sweep)
+{
+  int k, i;
+
+  for (k = 0; k < sweep->nworkers; k++)
+  {
+    sweep_worker_t *w = &sweep->workers[k];
+    for (i = 0; i < w->ngroups; i++)
+    {
+      free(w->groups[i].stacks);
+      free(w->groups[i].histogram);
+    }
+    for (i = 0; i < w->ndirect; i++)
+      level_free(&w->direct[i]);
+    free(w->groups);
+    free(w->direct);
+    free(w->ring);
+  }
+  free(sweep->slots);
+  free(sweep);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_free                                      */
+/*                                                             */
+/* Purpose   : Abandon the instance's sweep, if any            */
+/*                                                             */
+/***************************************************************/
+void sweep_free()
+{
+  if (ARMSIM->sweep == NULL)
+    return;
+  sweep_stop(ARMSIM->sweep);
+  sweep_release(ARMSIM->sweep);
+  ARMSIM->sweep = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sweep_place                                     */
+/*                                                             */
+/* Purpose   : Give configuration i to a worker: join the      */
+/*             stack group of its geometry, or a direct cache  */
+/*                                                             */
+/***************************************************************/
+int sweep_place(struct sweep *sweep, const armsim_cache_config_t *configs, size_t i, int *next)
+{
+  const armsim_cache_config_t *c = &configs[i];
+  sweep_slot_t *slot = &sweep->slots[i];
+  uint64_t sets = c->size / ((uint64_t)c->ways * c->line);
+  sweep_worker_t *w;
+  int k;
+
+  slot->ways = c->ways;
+  if (c->replacement == ARMSIM_REPLACE_LRU && c->write_back)
+  {
+    /* same geometry: share the group, wherever it lives */
+    for (k = 0; k < sweep->nworkers; k++)
+    {
+      int j;
+      w = &sweep->workers[k];
+      for (j = 0; j < w->ngroups; j++)
+      {
+        stack_group_t *g = &w->groups[j];
+        if (g->line_shift == (unsigned)__builtin_ctz(c->line) && g->set_mask == sets - 1)
+        {
+          if (c->ways > g->depth)
+            g->depth = c->ways;
+          slot->worker = k;
+          slot->index = j;
+          slot->direct = FALSE;
+          return 0;
+        }
+      }
+    }
+    w = &sweep->workers[*next];
+    stack_group_t *groups = realloc(w->groups, (w->ngroups + 1) * sizeof(*groups));
+    if (groups == NULL)
+      return ARMSIM_E_NOMEM;
+    w->groups = groups;
+    memset(&groups[w->ngroups], 0, sizeof(*groups));
+    groups[w->ngroups].line_shift = __builtin_ctz(c->line);
+    groups[w->ngroups].set_mask = sets - 1;
+    groups[w->ngroups].depth = c->ways;
+    slot->worker = *next;
+    slot->index = w->ngroups++;
+    slot->direct = FALSE;
+  }
+  else
+  {
+    w = &sweep->workers[*next];
+    cache_level_t *direct = realloc(w->direct, (w->ndirect + 1) * sizeof(*direct));
+    if (direct == NULL)
+      return ARMSIM_E_NOMEM;
+    w->direct = direct;
+    if (level_init(&direct[w->ndirect], c) != 0)
+    {
+      level_free(&direct[w->ndirect]);
+      return ARMSIM_E_NOMEM;
+    }
+    slot->worker = *next;
+    slot->index = w->ndirect++;
+    slot->direct = TRUE;
+  }
+  *next = (*next + 1) % sweep->nworkers;
+  return 0;
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_sweep_start(armsim_t *sim, int streams, const armsim_cache_config_t *configs,
+                       size_t nconfigs, int threads)
+{
+  struct sweep *sweep;
+  size_t i;
+  int k, j, next = 0, result = 0;
+
+  if (sim == NULL || sim->sweep != NULL || configs == NULL || nconfigs == 0 ||
+      (streams & ~(ARMSIM_SWEEP_FETCH | ARMSIM_SWEEP_DATA)) || streams == 0)
+    return ARMSIM_E_INVAL;
+  for (i = 0; i < nconfigs; i++)
+    if (configs[i].size == 0 || !level_valid(&configs[i]))
+      return ARMSIM_E_INVAL;
+  if (threads < 1)
+    threads = 1;
+  if (threads > SWEEP_MAX_THREADS)
+    threads = SWEEP_MAX_THREADS;
+  if ((size_t)threads > nconfigs)
+    threads = nconfigs;
+
+  ARMSIM = sim;
+  if ((sweep = calloc(1, sizeof(*sweep))) == NULL)
+    return ARMSIM_E_NOMEM;
+  sweep->streams = streams;
+  sweep->nconfigs = nconfigs;
+  sweep->nworkers = threads;
+  sweep->min_shift = 63;
+  sweep->slots = calloc(nconfigs, sizeof(*sweep->slots));
+  if (sweep->slots == NULL)
+    result = ARMSIM_E_NOMEM;
+  for (k = 0; k < threads && result == 0; k++)
+  {
+    sweep->workers[k].sim = sim;
+    sweep->workers[k].ring = aligned_alloc(64, sizeof(ring_t));
+    if (sweep->workers[k].ring == NULL)
+      result = ARMSIM_E_NOMEM;
+    else
+      memset(sweep->workers[k].ring, 0, sizeof(ring_t));
+  }
+  for (i = 0; i < nconfigs && result == 0; i++)
+  {
+    result = sweep_place(sweep, configs, i, &next);
+    if ((unsigned)__builtin_ctz(configs[i].line) < sweep->min_shift)
+      sweep->min_shift = __builtin_ctz(configs[i].line);
+  }
+  for (k = 0; k < threads && result == 0; k++)
+  {
+    sweep_worker_t *w = &sweep->workers[k];
+    for (j = 0; j < w->ngroups && result == 0; j++)
+    {
+      stack_group_t *g = &w->groups[j];
+      g->stacks = calloc((g->set_mask + 1) * g->depth, sizeof(*g->stacks));
+      g->histogram = calloc(g->depth + 1, sizeof(*g->histogram));
+      if (g->stacks == NULL || g->histogram == NULL)
+        result = ARMSIM_E_NOMEM;
+    }
+  }
+
+  for (k = 0; k < threads && result == 0; k++)
+  {
+    if (pthread_create(&sweep->workers[k].thread, NULL, sweep_worker, &sweep->workers[k]) != 0)
+      result = ARMSIM_E_NOMEM;
+    else
+      sweep->started++;
+  }
+  if (result != 0)
+  {
+    sweep_stop(sweep);
+    sweep_release(sweep);
+    return result;
+  }
+  sim->sweep = sweep;
+  trace_update();
+  return 0;
+}
+
+int armsim_sweep_finish(armsim_t *sim, armsim_cache_counts_t *results)
+{
+  struct sweep *sweep;
+  size_t i;
+  uint32_t d;
+
+  if (sim == NULL || sim->sweep == NULL || results == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  sweep = sim->sweep;
+
+  sweep_stop(sweep);
+
+  for (i = 0; i < sweep->nconfigs; i++)
+  {
+    sweep_slot_t *slot = &sweep->slots[i];
+    sweep_worker_t *w = &sweep->workers[slot->worker];
+    memset(&results[i], 0, sizeof(results[i]));
+    if (slot->direct)
+    {
+      int k;
+      for (k = 0; k < ARMSIM_REGIONS; k++)
+      {
+        results[i].hits += w->direct[slot->index].counts[k].hits;
+        results[i].misses += w->direct[slot->index].counts[k].misses;
+        results[i].evictions += w->direct[slot->index].counts[k].evictions;
+        results[i].writebacks += w->direct[slot->index].counts[k].writebacks;
+      }
+    }
+    else
+    {
+      stack_group_t *g = &w->groups[slot->index];
+      for (d = 0; d <= g->depth; d++)
+      {
+        if (d < slot->ways)
+          results[i].hits += g->histogram[d];
+        else
+          results[i].misses += g->histogram[d];
+      }
+    }
+    results[i].hits += sweep->repeats;
+  }
+
+  sweep_release(sweep);
+  sim->sweep = NULL;
+  trace_update();
+  return 0;
+}
@@ -0,0 +1,464 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: Chrome trace-event timeline                    */
+/*                                                             */
+/***************************************************************/
+
+/* A timeline file is Chrome trace-event JSON, which chrome://tracing
+ * and ui.perfetto.dev both open, with host timestamps in microseconds
+ * since armsim_timeline_start() on four tracks:
+ *
+ *   engine      spans for loading (program and data files) and every
+ *               run, its stop reason as an instant event, and
+ *               counters of MIPS and text slots decoded
+ *   guest       a span from each ROI begin marker to its end, and
+ *               instants for ROI resets and checkpoints
+ *   hot blocks  one span per window of TIMELINE_WINDOW samples,
+ *               named after the block most of them hit
+ *   host        whatever the embedder marks with armsim_timeline_span
+ *               (the shell marks its dumps)
+ *
+ * Decoding has no span of its own: text is pre-decoded one slot at a
+ * time as it is first fetched, so it shows as the decoded counter.
+ *
+ * Every `interval` instructions, at the next block boundary, the
+ * branch target is sampled into a small direct-mapped table. Events
+ * go into a ring under a mutex, since the shell marks spans from its
+ * own thread while a background run goes on, and a writer thread
+ * formats and writes them. The engine never waits on the writer: if
+ * the ring is full the event is dropped and counted. */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "shell.h"
+
+#define TIMELINE_RING 4096    /* events between engine and writer */
+#define TIMELINE_WINDOW 64    /* samples per hot block span */
+#define TIMELINE_SITES 256    /* sampled block table */
+#define TIMELINE_INTERVAL (1 << 16) /* default instructions per sample */
+
+enum
+{
+  TRACK_ENGINE = 1,
+  TRACK_GUEST,
+  TRACK_BLOCKS,
+  TRACK_HOST,
+  TRACKS
+};
+
+enum
+{
+  EVENT_BEGIN,   /* value: instructions, pc (none on the host track) */
+  EVENT_END,     /* value: instructions; name: status, or "" */
+  EVENT_INSTANT, /* value: instructions, pc */
+  EVENT_BLOCK,   /* value: samples of the block, samples, instructions */
+  EVENT_COUNTER  /* value: instructions, slots decoded, over dur */
+};
+
+typedef struct
+{
+  uint64_t ts, dur; /* ns since the timeline started */
+  uint64_t value[3];
+  char name[32];
+  uint8_t kind, track;
+} event_t;
+
+struct timeline
+{
+  _Atomic uint64_t head, tail;
+  _Atomic int done;
+  event_t *ring;
+  pthread_mutex_t lock; /* producers: the engine and the embedder */
+  pthread_t thread;
+  struct timespec start;
+  uint64_t events, dropped;
+
+  /* engine only */
+  uint64_t interval;
+  struct
+  {
+    uint64_t pc;
+    uint32_t count;
+  } sites[TIMELINE_SITES];
+  int samples;
+  uint64_t window_ts, window_count, window_decoded;
+
+  /* writer thread only */
+  FILE *file;
+  int error;
+  uint64_t bytes;
+};
+
+static const char *track_names[TRACKS] = {NULL, "engine", "guest", "hot blocks", "host"};
+
+static uint64_t elapsed(const struct timeline *t)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - t->start.tv_sec) * 1000000000 + now.tv_nsec - t->start.tv_nsec;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : push                                            */
+/*                                                             */
+/* Purpose   : Queue one event for the writer, or drop it if   */
+/*             the ring is full                                */
+/*                                                             */
+/***************************************************************/
+static void push(struct timeline *t, int kind, int track, const char *name, uint64_t ts,
+                 uint64_t dur, uint64_t a, uint64_t b, uint64_t c)
+{
+  uint64_t head;
+  event_t *e;
+
+  pthread_mutex_lock(&t->lock);
+  head = atomic_load_explicit(&t->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&t->tail, memory_order_acquire) >= TIMELINE_RING)
+  {
+    t->dropped++;
+    pthread_mutex_unlock(&t->lock);
+    return;
+  }
+  e = &t->ring[head & (TIMELINE_RING - 1)];
+  e->kind = kind;
+  e->track = track;
+  snprintf(e->name, sizeof(e->name), "%s", name);
+  e->ts = ts;
+  e->dur = dur;
+  e->value[0] = a;
+  e->value[1] = b;
+  e->value[2] = c;
+  t->events++;
+  atomic_store_explicit(&t->head, head + 1, memory_order_release);
+  pthread_mutex_unlock(&t->lock);
+}
+
+/* Timestamps as microseconds, to the nanosecond */
+static void write_event(struct timeline *t, const event_t *e)
+{
+  char ts[32], dur[32];
+  int n = 0;
+
+  snprintf(ts, sizeof(ts), "%" PRIu64 ".%03u", e->ts / 1000, (unsigned)(e->ts % 1000));
+  switch (e->kind)
+  {
+  case EVENT_BEGIN:
+  case EVENT_INSTANT:
+    /* the embedder's spans may come while another thread runs */
+    if (e->track == TRACK_HOST)
+    {
+      n = fprintf(t->file, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%s,\"pid\":1,\"tid\":%d}",
+                  e->name, ts, e->track);
+      break;
+    }
+    n = fprintf(t->file,
+                ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%s,\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"instructions\":%" PRIu64 ",\"pc\":\"0x%" PRIx64 "\"}}",
+                e->name, e->kind == EVENT_BEGIN ? "B" : "i\",\"s\":\"t", ts, e->track, e->value[0],
+                e->value[1]);
+    break;
+  case EVENT_END:
+    if (e->track == TRACK_HOST)
+    {
+      n = fprintf(t->file, ",\n{\"ph\":\"E\",\"ts\":%s,\"pid\":1,\"tid\":%d}", ts, e->track);
+      break;
+    }
+    n = fprintf(t->file,
+                ",\n{\"ph\":\"E\",\"ts\":%s,\"pid\":1,\"tid\":%d,\"args\":{\"instructions\":%" PRIu64
+                "%s%s%s}}",
+                ts, e->track, e->value[0], e->name[0] ? ",\"status\":\"" : "", e->name,
+                e->name[0] ? "\"" : "");
+    break;
+  case EVENT_BLOCK:
+    snprintf(dur, sizeof(dur), "%" PRIu64 ".%03u", e->dur / 1000, (unsigned)(e->dur % 1000));
+    n = fprintf(t->file,
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%s,\"dur\":%s,\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"share\":%.3f,\"samples\":%" PRIu64 ",\"instructions\":%" PRIu64 "}}",
+                e->name, ts, dur, e->track, (double)e->value[0] / e->value[1], e->value[1],
+                e->value[2]);
+    break;
+  case EVENT_COUNTER:
+    n = fprintf(t->file,
+                ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%s,\"pid\":1,"
+                "\"args\":{\"MIPS\":%.2f,\"decoded\":%" PRIu64 "}}",
+                e->name, ts, e->dur ? 1000.0 * e->value[0] / e->dur : 0.0, e->value[1]);
+    break;
+  }
+  if (n < 0 && t->error == 0)
+    t->error = ARMSIM_E_IO;
+  else if (n > 0)
+    t->bytes += n;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : writer_main                                     */
+/*                                                             */
+/* Purpose   : Write queued events until the timeline stops.   */
+/*             Events are rare, so an empty ring sleeps.       */
+/*                                                             */
+/***************************************************************/
+static void *writer_main(void *arg)
+{
+  struct timeline *t = arg;
+  struct timespec nap = {0, 1000000};
+  uint64_t tail = 0, head;
+
+  for (;;)
+  {
+    head = atomic_load_explicit(&t->head, memory_order_acquire);
+    if (head == tail)
+    {
+      if (atomic_load_explicit(&t->done, memory_order_acquire) &&
+          atomic_load_explicit(&t->head, memory_order_acquire) == tail)
+        break;
+      nanosleep(&nap, NULL);
+      continue;
+    }
+    for (; tail != head; tail++)
+      write_event(t, &t->ring[tail & (TIMELINE_RING - 1)]);
+    atomic_store_explicit(&t->tail, tail, memory_order_release);
+  }
+  return NULL;
+}
+
+/* Close the sample window: its hottest block, and the counters */
+static void close_window(struct timeline *t)
+{
+  uint64_t now = elapsed(t), hottest = 0;
+  uint32_t count = 0;
+  char name[32];
+  int k;
+
+  if (t->samples == 0)
+    return;
+  for (k = 0; k < TIMELINE_SITES; k++)
+    if (t->sites[k].count > count)
+    {
+      count = t->sites[k].count;
+      hottest = t->sites[k].pc;
+    }
+  snprintf(name, sizeof(name), "0x%" PRIx64, hottest);
+  push(t, EVENT_BLOCK, TRACK_BLOCKS, name, t->window_ts, now - t->window_ts, count, t->samples,
+       INSTRUCTION_COUNT);
+  push(t, EVENT_COUNTER, TRACK_ENGINE, "engine", t->window_ts, now - t->window_ts,
+       INSTRUCTION_COUNT - t->window_count, ARMSIM->decoded - t->window_decoded, 0);
+  memset(t->sites, 0, sizeof(t->sites));
+  t->samples = 0;
+  t->window_ts = now;
+  t->window_count = INSTRUCTION_COUNT;
+  t->window_decoded = ARMSIM->decoded;
+}
+
+/* From boundary_checks(), while the branch to target retires */
+void timeline_tick(uint64_t target)
+{
+  struct timeline *t = ARMSIM->timeline;
+  int slot = (target >> 2) & (TIMELINE_SITES - 1);
+
+  if (t->sites[slot].pc != target)
+  {
+    t->sites[slot].pc = target;
+    t->sites[slot].count = 0;
+  }
+  t->sites[slot].count++;
+  if (++t->samples == TIMELINE_WINDOW)
+    close_window(t);
+  ARMSIM->timeline_at = INSTRUCTION_COUNT + t->interval;
+  schedule_checks();
+}
+
+/* From simulate(), as a run starts and once it has settled */
+void timeline_run(int running)
+{
+  struct timeline *t = ARMSIM->timeline;
+  uint64_t now = elapsed(t);
+
+  if (running)
+  {
+    push(t, EVENT_BEGIN, TRACK_ENGINE, "execute", now, 0, INSTRUCTION_COUNT, CURRENT_STATE.PC, 0);
+    memset(t->sites, 0, sizeof(t->sites));
+    t->samples = 0;
+    t->window_ts = now;
+    t->window_count = INSTRUCTION_COUNT;
+    t->window_decoded = ARMSIM->decoded;
+    ARMSIM->timeline_at = INSTRUCTION_COUNT + t->interval;
+  }
+  else
+  {
+    close_window(t);
+    now = elapsed(t);
+    push(t, EVENT_END, TRACK_ENGINE, armsim_strerror(STOP_REASON), now, 0, INSTRUCTION_COUNT, 0,
+         0);
+    if (STOP_REASON != STOP_NONE)
+      push(t, EVENT_INSTANT, TRACK_ENGINE, armsim_strerror(STOP_REASON), now, 0,
+           INSTRUCTION_COUNT, CURRENT_STATE.PC, 0);
+    ARMSIM->timeline_at = UINT64_MAX;
+  }
+  schedule_checks();
+}
+
+/* From roi_marker(), with the PC already past the marker */
+void timeline_roi(int marker)
+{
+  struct timeline *t = ARMSIM->timeline;
+  uint64_t now = elapsed(t);
+
+  switch (marker)
+  {
+  case ARMSIM_ROI_RESET:
+    push(t, EVENT_INSTANT, TRACK_GUEST, "roi reset", now, 0, INSTRUCTION_COUNT, NEXT_STATE.PC, 0);
+    break;
+  case ARMSIM_ROI_BEGIN:
+    if (!ARMSIM->roi_active)
+      push(t, EVENT_BEGIN, TRACK_GUEST, "roi", now, 0, INSTRUCTION_COUNT, NEXT_STATE.PC, 0);
+    break;
+  case ARMSIM_ROI_END:
+    if (ARMSIM->roi_active)
+      push(t, EVENT_END, TRACK_GUEST, "", now, 0, INSTRUCTION_COUNT, 0, 0);
+    break;
+  case ARMSIM_ROI_CHECKPOINT:
+    push(t, EVENT_INSTANT, TRACK_GUEST, "checkpoint", now, 0, INSTRUCTION_COUNT, NEXT_STATE.PC,
+         0);
+    break;
+  }
+}
+
+/* Library phases outside runs: loading */
+void timeline_span(const char *name, int begin)
+{
+  struct timeline *t = ARMSIM->timeline;
+
+  push(t, begin ? EVENT_BEGIN : EVENT_END, TRACK_ENGINE, begin ? name : "", elapsed(t), 0,
+       INSTRUCTION_COUNT, CURRENT_STATE.PC, 0);
+}
+
+static void timeline_release(struct timeline *t)
+{
+  if (t->file != NULL)
+    fclose(t->file);
+  pthread_mutex_destroy(&t->lock);
+  free(t->ring);
+  free(t);
+}
+
+/* Drain and join the writer, close the file; the first error wins */
+static int timeline_stop(struct timeline *t, armsim_timeline_stats_t *stats)
+{
+  int result;
+
+  atomic_store_explicit(&t->done, TRUE, memory_order_release);
+  pthread_join(t->thread, NULL);
+  result = t->error;
+  if (fputs("\n]}\n", t->file) == EOF && result == 0)
+    result = ARMSIM_E_IO;
+  if (fclose(t->file) != 0 && result == 0)
+    result = ARMSIM_E_IO;
+  t->file = NULL;
+  if (stats != NULL)
+  {
+    stats->events = t->events;
+    stats->dropped = t->dropped;
+    stats->bytes = t->bytes;
+  }
+  timeline_release(t);
+  return result;
+}
+
+void timeline_free()
+{
+  if (ARMSIM->timeline == NULL)
+    return;
+  timeline_stop(ARMSIM->timeline, NULL);
+  ARMSIM->timeline = NULL;
+  ARMSIM->timeline_at = UINT64_MAX;
+  schedule_checks();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_timeline_start(armsim_t *sim, const char *path, uint64_t interval)
+{
+  struct timeline *t;
+  int k, n;
+
+  if (sim == NULL || path == NULL || sim->timeline != NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if ((t = calloc(1, sizeof(*t))) == NULL)
+    return ARMSIM_E_NOMEM;
+  pthread_mutex_init(&t->lock, NULL);
+  atomic_init(&t->head, 0);
+  atomic_init(&t->tail, 0);
+  atomic_init(&t->done, FALSE);
+  t->interval = interval ? interval : TIMELINE_INTERVAL;
+  if ((t->ring = malloc(TIMELINE_RING * sizeof(event_t))) == NULL)
+  {
+    timeline_release(t);
+    return ARMSIM_E_NOMEM;
+  }
+  if ((t->file = fopen(path, "w")) == NULL)
+  {
+    timeline_release(t);
+    return ARMSIM_E_IO;
+  }
+  /* the header and track names, so every event after is ",\n{...}" */
+  n = fprintf(t->file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"armsim\"}}");
+  for (k = TRACK_ENGINE; k < TRACKS && n > 0; k++)
+    n = fprintf(t->file,
+                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}",
+                k, track_names[k]);
+  if (n < 0)
+  {
+    timeline_release(t);
+    return ARMSIM_E_IO;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t->start);
+  if (pthread_create(&t->thread, NULL, writer_main, t) != 0)
+  {
+    timeline_release(t);
+    return ARMSIM_E_NOMEM;
+  }
+  sim->timeline = t;
+  return 0;
+}
+
+/* Any thread: the caller's own phases, on the host track */
+int armsim_timeline_span(armsim_t *sim, const char *name, int begin)
+{
+  struct timeline *t;
+
+  if (sim == NULL || (begin && name == NULL))
+    return ARMSIM_E_INVAL;
+  if ((t = sim->timeline) == NULL)
+    return 0;
+  push(t, begin ? EVENT_BEGIN : EVENT_END, TRACK_HOST, begin ? name : "", elapsed(t), 0, 0, 0, 0);
+  return 0;
+}
+
+int armsim_timeline_stop(armsim_t *sim, armsim_timeline_stats_t *stats)
+{
+  struct timeline *t;
+
+  if (sim == NULL || sim->timeline == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  t = sim->timeline;
+  sim->timeline = NULL;
+  sim->timeline_at = UINT64_MAX;
+  schedule_checks();
+  return timeline_stop(t, stats);
+}
@@ -0,0 +1,82 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: retired-instruction records for timing models  */
+/*                                                             */
+/***************************************************************/
+
+/* process_instruction() describes every retired instruction in one
+ * insn_record_t, built only while a timing model or the trace recorder
+ * is attached. Building with -DARMSIM_NO_TIMING (make TIMING=0) removes
+ * the tap and its consumers; their API entry points then return
+ * ARMSIM_E_NOSYS. */
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include "shell.h"
+#include "sim.h"
+
+#define REG_FLAGS 32    /* NZCV, as a source or in ready tables */
+#define REG_NONE 0xff
+
+/* insn_record_t.flags */
+#define RECORD_LOAD 0x01
+#define RECORD_STORE 0x02       /* src[1] holds the data register */
+#define RECORD_BRANCH 0x04
+#define RECORD_TAKEN 0x08
+#define RECORD_SETS_FLAGS 0x10
+
+typedef struct
+{
+  uint64_t pc;
+  uint64_t address; /* loads and stores */
+  uint32_t word;    /* raw encoding */
+  int8_t inst;      /* Instruction */
+  uint8_t dest;     /* REG_NONE if no register is written */
+  uint8_t src[3];   /* REG_NONE padded */
+  uint8_t flags;    /* RECORD_* */
+} insn_record_t;
+
+void record_instruction(insn_record_t *record, Instruction inst);
+
+/* In-order pipeline (pipeline.c) */
+void pipeline_retire(const insn_record_t *record);
+void pipeline_flush();
+void pipeline_free();
+uint64_t pipeline_cycles();
+
+/* Out-of-order core (ooo.c) */
+void ooo_retire(const insn_record_t *record);
+void ooo_flush();
+void ooo_free();
+uint64_t ooo_cycles();
+
+/* Dataflow limit study (dataflow.c) */
+void dataflow_retire(const insn_record_t *record);
+void dataflow_flush();
+void dataflow_free();
+
+/* Execution trace recorder (tracefile.c) */
+void recorder_retire(const insn_record_t *record);
+void recorder_sync();
+void recorder_publish();
+void recorder_free();
+
+#ifdef ARMSIM_NO_TIMING
+static inline void trace_retire(Instruction inst)
+{
+}
+#else
+void trace_retire_models(Instruction inst);
+
+/* Called once per retired instruction, after NEXT_STATE is final */
+static inline void trace_retire(Instruction inst)
+{
+  if (ARMSIM->recording)
+    trace_retire_models(inst);
+}
+#endif
+
+#endif
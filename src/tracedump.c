@@ -0,0 +1,105 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   tracedump: pretty-printer for execution trace files       */
+/*                                                             */
+/***************************************************************/
+
+/* One line per instruction: sequence number, pc, raw word, mnemonic,
+ * NZCV after it (upper case set, lower case clear), the register it
+ * wrote and the memory it read or wrote:
+ *
+ *        12  0x0000000000400010: f8400022  LDUR    nzcv  X2 = 0x2a  load [0x10000000] 0x2a
+ *
+ * -s skips instructions, -n stops after printing that many and -q
+ * prints only the totals. */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "armsim.h"
+
+void print_entry(uint64_t sequence, const armsim_trace_entry_t *e)
+{
+  printf("%10" PRIu64 "  0x%016" PRIx64 ": %08x  %-7s %c%c%c%c", sequence, e->pc, e->word,
+         e->name, e->nzcv & ARMSIM_FLAG_N ? 'N' : 'n', e->nzcv & ARMSIM_FLAG_Z ? 'Z' : 'z',
+         e->nzcv & ARMSIM_FLAG_C ? 'C' : 'c', e->nzcv & ARMSIM_FLAG_V ? 'V' : 'v');
+  if (e->dest >= 0)
+    printf("  X%d = 0x%" PRIx64, e->dest, e->value);
+  if (e->access != 0)
+    printf("  %s [0x%" PRIx64 "] 0x%" PRIx64, e->access == ARMSIM_TRACE_LOAD ? "load" : "store",
+           e->address, e->data);
+  printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+  armsim_trace_t *trace;
+  armsim_trace_entry_t entry;
+  uint64_t skip = 0, count = UINT64_MAX, sequence = 0, printed = 0;
+  uint64_t loads = 0, stores = 0;
+  int opt, quiet = 0, result;
+  struct stat st;
+
+  while ((opt = getopt(argc, argv, "s:n:q")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      skip = strtoull(optarg, NULL, 0);
+      break;
+    case 'n':
+      count = strtoull(optarg, NULL, 0);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s skip] [-n count] [-q] <trace_file>\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (argc - optind != 1)
+  {
+    fprintf(stderr, "usage: %s [-s skip] [-n count] [-q] <trace_file>\n", argv[0]);
+    exit(1);
+  }
+  if ((result = armsim_trace_open(argv[optind], &trace)) != 0)
+  {
+    fprintf(stderr, "Error: Can't open %s: %s\n", argv[optind], armsim_strerror(result));
+    exit(1);
+  }
+
+  while ((quiet || printed < count) && (result = armsim_trace_next(trace, &entry)) > 0)
+  {
+    loads += entry.access == ARMSIM_TRACE_LOAD;
+    stores += entry.access == ARMSIM_TRACE_STORE;
+    if (!quiet && sequence >= skip)
+    {
+      print_entry(sequence, &entry);
+      printed++;
+    }
+    sequence++;
+  }
+  armsim_trace_close(trace);
+  if (result < 0)
+  {
+    fprintf(stderr, "Error: %s: %s after %" PRIu64 " instructions\n", argv[optind],
+            armsim_strerror(result), sequence);
+    exit(1);
+  }
+
+  if (quiet)
+  {
+    printf("Instructions : %" PRIu64 "\n", sequence);
+    printf("Loads        : %" PRIu64 "\n", loads);
+    printf("Stores       : %" PRIu64 "\n", stores);
+    if (stat(argv[optind], &st) == 0 && sequence > 0)
+      printf("File size    : %lld bytes (%.3f bytes/instruction)\n", (long long)st.st_size,
+             (double)st.st_size / sequence);
+  }
+  return 0;
+}
@@ -0,0 +1,853 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: compressed execution trace files               */
+/*                                                             */
+/***************************************************************/
+
+/* The recorder turns every instruction scalar runs retire into an
+ * entry on a single-producer ring; a background thread drains it,
+ * delta-encodes the entries and writes LZ-compressed blocks. All
+ * integers are little-endian.
+ *
+ * File:    "ARMTRACE", u32 TRACE_VERSION, u32 0, then blocks
+ * Block:   u32 raw size, u32 stored size (equal: stored raw),
+ *          u32 instructions, stored bytes
+ * Raw:     u64 pc, u32 nzcv, u64 regs[32] before the first
+ *          instruction, then per instruction
+ *            u8      NZCV after it in bits 4-7, RAW_* in bits 0-3
+ *            varint  zigzag(pc - predicted pc)        RAW_JUMP
+ *            u32     instruction word                 RAW_WORD
+ *            varint  zigzag(value - previous value)   RAW_DEST
+ *            varint  zigzag(address - predicted)      RAW_MEMORY
+ * The predictions come from a direct-mapped table of static
+ * instructions, cleared at every block so blocks decode on their
+ * own: the last successor of the previous instruction, the last word
+ * at the pc and the last address plus the last stride. RAW_DEST
+ * writes register bits 0-4 of the word. Memory data are not stored:
+ * the reader tracks the register file, so it knows what each load
+ * returned and each store wrote.
+ *
+ * Compressed blocks are a series of varint literal count, literals,
+ * varint match length - 3 (0 ends the block), varint distance. */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "timing.h"
+
+#define TRACE_MAGIC "ARMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_RING (1 << 16)                  /* entries between engine and writer */
+#define TRACE_BATCH 256                       /* entries the engine publishes at once */
+#define TRACE_BLOCK (1 << 18)                 /* raw bytes per block */
+#define TRACE_RECORD_MAX 40                   /* longest encoded instruction */
+#define TRACE_STATE (8 + 4 + 8 * ARMSIM_REGS) /* block start state */
+#define TRACE_PACKED_MAX (TRACE_BLOCK + TRACE_BLOCK / 2 + 64)
+#define SITE_BITS 12
+#define LZ_BITS 14
+#define LZ_MIN 4
+
+/* Raw record header */
+#define RAW_JUMP 0x1
+#define RAW_WORD 0x2
+#define RAW_DEST 0x4
+#define RAW_MEMORY 0x8
+
+/* entry_t.kind */
+#define ENTRY_DEST 0x1
+#define ENTRY_MEMORY 0x2
+#define ENTRY_SYNC 0x4 /* state at a run start; ARMSIM_REGS ENTRY_REG follow */
+#define ENTRY_REG 0x8
+
+typedef struct
+{
+  uint64_t pc, value, address;
+  uint32_t word;
+  uint8_t nzcv, kind;
+} entry_t;
+
+typedef struct
+{
+  uint64_t tag; /* pc + 1, 0 = empty */
+  uint64_t next, address;
+  int64_t stride;
+  uint32_t word;
+} site_t;
+
+/* Prediction state, kept identically by the writer and the reader */
+typedef struct
+{
+  uint64_t expect; /* predicted pc of the next instruction */
+  site_t *last;    /* site of the previous instruction */
+  uint64_t regs[ARMSIM_REGS];
+  uint32_t nzcv;
+  site_t sites[1 << SITE_BITS];
+} coder_t;
+
+/***************************************************************/
+/* Encoding helpers shared by the writer and the reader.       */
+/***************************************************************/
+
+static inline uint64_t zigzag(uint64_t delta)
+{
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t value)
+{
+  return (value >> 1) ^ -(value & 1);
+}
+
+static inline size_t put_varint(uint8_t *p, uint64_t value)
+{
+  size_t n = 0;
+
+  while (value >= 0x80)
+  {
+    p[n++] = value | 0x80;
+    value >>= 7;
+  }
+  p[n++] = value;
+  return n;
+}
+
+/* FALSE if the varint runs past end */
+static inline int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value)
+{
+  int shift;
+
+  *value = 0;
+  for (shift = 0; *p < end && shift < 64; shift += 7)
+  {
+    uint8_t byte = *(*p)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static void coder_reset(coder_t *c, const uint8_t *state)
+{
+  memcpy(&c->expect, state, 8);
+  memcpy(&c->nzcv, state + 8, 4);
+  memcpy(c->regs, state + 12, sizeof(c->regs));
+  c->last = NULL;
+  memset(c->sites, 0, sizeof(c->sites));
+}
+
+static void coder_state(const coder_t *c, uint8_t *state)
+{
+  memcpy(state, &c->expect, 8);
+  memcpy(state + 8, &c->nzcv, 4);
+  memcpy(state + 12, c->regs, sizeof(c->regs));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : coder_site                                      */
+/*                                                             */
+/* Purpose   : Move to the instruction at pc: teach the        */
+/*             previous one its successor and return this one's */
+/*             site, emptied if it held another pc             */
+/*                                                             */
+/***************************************************************/
+static site_t *coder_site(coder_t *c, uint64_t pc, int *fresh)
+{
+  site_t *s = &c->sites[(pc >> 2) & ((1 << SITE_BITS) - 1)];
+
+  if (c->last != NULL)
+    c->last->next = pc;
+  *fresh = s->tag != pc + 1;
+  if (*fresh)
+  {
+    memset(s, 0, sizeof(*s));
+    s->tag = pc + 1;
+    s->next = pc + 4;
+  }
+  c->last = s;
+  c->expect = s->next;
+  return s;
+}
+
+/* Address prediction, updated with the actual address */
+static uint64_t coder_address(site_t *s, uint64_t address)
+{
+  uint64_t predicted = s->address + s->stride;
+
+  s->stride = s->address != 0 ? address - s->address : 0;
+  s->address = address;
+  return predicted;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lz_compress                                     */
+/*                                                             */
+/* Purpose   : Greedy LZ77 over one block with a hash of the   */
+/*             last position of every 4-byte sequence. Returns */
+/*             the packed size, at most n + n / 2 + 32.        */
+/*                                                             */
+/***************************************************************/
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, uint32_t *table)
+{
+  size_t i = 0, anchor = 0, out = 0;
+
+  memset(table, 0, sizeof(uint32_t) << LZ_BITS);
+  while (i + LZ_MIN <= n)
+  {
+    uint32_t sequence, candidate, h;
+    size_t length;
+
+    memcpy(&sequence, src + i, 4);
+    h = (sequence * 2654435761u) >> (32 - LZ_BITS);
+    candidate = table[h];
+    table[h] = i + 1;
+    if (candidate == 0 || memcmp(src + candidate - 1, src + i, LZ_MIN) != 0)
+    {
+      i++;
+      continue;
+    }
+    candidate--;
+    for (length = LZ_MIN; i + length < n && src[candidate + length] == src[i + length]; length++)
+      ;
+    out += put_varint(dst + out, i - anchor);
+    memcpy(dst + out, src + anchor, i - anchor);
+    out += i - anchor;
+    out += put_varint(dst + out, length - LZ_MIN + 1);
+    out += put_varint(dst + out, i - candidate);
+    i += length;
+    anchor = i;
+  }
+  out += put_varint(dst + out, n - anchor);
+  memcpy(dst + out, src + anchor, n - anchor);
+  out += n - anchor;
+  out += put_varint(dst + out, 0);
+  return out;
+}
+
+/* FALSE unless src unpacks to exactly size bytes */
+static int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size)
+{
+  const uint8_t *end = src + n;
+  size_t out = 0;
+  uint64_t literals, length, distance;
+
+  for (;;)
+  {
+    if (!get_varint(&src, end, &literals) || literals > (size_t)(end - src) ||
+        literals > size - out)
+      return FALSE;
+    memcpy(dst + out, src, literals);
+    src += literals;
+    out += literals;
+    if (!get_varint(&src, end, &length))
+      return FALSE;
+    if (length == 0)
+      return out == size;
+    length += LZ_MIN - 1;
+    if (!get_varint(&src, end, &distance) || distance == 0 || distance > out ||
+        length > size - out)
+      return FALSE;
+    /* overlapping copies repeat the last distance bytes */
+    for (; length > 0; length--, out++)
+      dst[out] = dst[out - distance];
+  }
+}
+
+/***************************************************************/
+/* Recorder: the engine thread produces, the writer consumes.  */
+/***************************************************************/
+
+#ifndef ARMSIM_NO_TIMING
+
+struct recorder
+{
+  _Atomic uint64_t head __attribute__((aligned(64))); /* written by the engine */
+  uint64_t next;                                       /* engine's unpublished head */
+  uint64_t tail_seen;                                  /* engine's copy of tail */
+  _Atomic uint64_t tail __attribute__((aligned(64))); /* written by the writer */
+  _Atomic int done;
+  entry_t *ring;
+  pthread_t thread;
+
+  /* writer thread only */
+  FILE *file;
+  int error; /* first write failure, reported by armsim_trace_stop */
+  coder_t coder;
+  uint8_t *raw, *packed;
+  size_t raw_size;
+  uint32_t *lz_table;
+  uint32_t block_instructions;
+  uint64_t sync[ARMSIM_REGS];
+  uint64_t sync_pc;
+  uint32_t sync_nzcv;
+  int sync_left;
+  armsim_trace_stats_t stats;
+};
+
+/* Entries are published in batches, so the writer does not chase
+ * the engine through cache lines it is still filling */
+static inline entry_t *ring_slot(struct recorder *rec)
+{
+  while (rec->next - rec->tail_seen >= TRACE_RING)
+  {
+    rec->tail_seen = atomic_load_explicit(&rec->tail, memory_order_acquire);
+    if (rec->next - rec->tail_seen >= TRACE_RING)
+      sched_yield();
+  }
+  return &rec->ring[rec->next & (TRACE_RING - 1)];
+}
+
+static inline void ring_push(struct recorder *rec)
+{
+  if ((++rec->next & (TRACE_BATCH - 1)) == 0)
+    atomic_store_explicit(&rec->head, rec->next, memory_order_release);
+}
+
+/* Hand everything queued to the writer; at the end of every run */
+void recorder_publish()
+{
+  struct recorder *rec = ARMSIM->recorder;
+  atomic_store_explicit(&rec->head, rec->next, memory_order_release);
+}
+
+static inline uint8_t current_nzcv(const CPU_State *state)
+{
+  return (state->FLAG_N ? ARMSIM_FLAG_N : 0) | (state->FLAG_Z ? ARMSIM_FLAG_Z : 0) |
+         (state->FLAG_C ? ARMSIM_FLAG_C : 0) | (state->FLAG_V ? ARMSIM_FLAG_V : 0);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : recorder_retire                                 */
+/*                                                             */
+/* Purpose   : Queue one retired instruction                   */
+/*                                                             */
+/***************************************************************/
+void recorder_retire(const insn_record_t *r)
+{
+  struct recorder *rec = ARMSIM->recorder;
+  entry_t *e = ring_slot(rec);
+
+  e->pc = r->pc;
+  e->word = r->word;
+  e->nzcv = current_nzcv(&NEXT_STATE);
+  e->kind = 0;
+  if (r->dest != REG_NONE)
+  {
+    e->kind = ENTRY_DEST;
+    e->value = NEXT_STATE.REGS[r->dest];
+  }
+  if (r->flags & (RECORD_LOAD | RECORD_STORE))
+  {
+    e->kind |= ENTRY_MEMORY;
+    e->address = r->address;
+  }
+  ring_push(rec);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : recorder_sync                                   */
+/*                                                             */
+/* Purpose   : Queue the architectural state at a run start,   */
+/*             which the writer compares with the one it       */
+/*             tracks to catch registers set between runs      */
+/*                                                             */
+/***************************************************************/
+void recorder_sync()
+{
+  struct recorder *rec = ARMSIM->recorder;
+  entry_t *e = ring_slot(rec);
+  int k;
+
+  e->kind = ENTRY_SYNC;
+  e->pc = CURRENT_STATE.PC;
+  e->nzcv = current_nzcv(&CURRENT_STATE);
+  ring_push(rec);
+  for (k = 0; k < ARMSIM_REGS; k++)
+  {
+    e = ring_slot(rec);
+    e->kind = ENTRY_REG;
+    e->value = CURRENT_STATE.REGS[k];
+    ring_push(rec);
+  }
+  recorder_publish();
+}
+
+static void writer_begin(struct recorder *rec, uint64_t pc, uint32_t nzcv, const uint64_t *regs)
+{
+  coder_t *c = &rec->coder;
+
+  c->expect = pc;
+  c->nzcv = nzcv;
+  memcpy(c->regs, regs, sizeof(c->regs));
+  coder_state(c, rec->raw);
+  coder_reset(c, rec->raw);
+  rec->raw_size = TRACE_STATE;
+}
+
+static void writer_block(struct recorder *rec)
+{
+  uint32_t header[3];
+  size_t size = lz_compress(rec->raw, rec->raw_size, rec->packed, rec->lz_table);
+  const uint8_t *data = rec->packed;
+
+  if (size >= rec->raw_size)
+  {
+    size = rec->raw_size;
+    data = rec->raw;
+  }
+  header[0] = rec->raw_size;
+  header[1] = size;
+  header[2] = rec->block_instructions;
+  if (fwrite(header, sizeof(header), 1, rec->file) != 1 ||
+      fwrite(data, 1, size, rec->file) != size)
+    rec->error = ARMSIM_E_IO;
+  rec->stats.bytes += sizeof(header) + size;
+  rec->block_instructions = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : writer_record                                   */
+/*                                                             */
+/* Purpose   : Encode one instruction into the current block,  */
+/*             starting the next block when it is full         */
+/*                                                             */
+/***************************************************************/
+static void writer_record(struct recorder *rec, const entry_t *e)
+{
+  coder_t *c = &rec->coder;
+  uint8_t *p = rec->raw + rec->raw_size, *header = p++;
+  uint64_t expect = c->expect;
+  site_t *s;
+  int fresh;
+
+  *header = e->nzcv << 4;
+  if (e->pc != expect)
+  {
+    *header |= RAW_JUMP;
+    p += put_varint(p, zigzag(e->pc - expect));
+  }
+  s = coder_site(c, e->pc, &fresh);
+  if (fresh || s->word != e->word)
+  {
+    *header |= RAW_WORD;
+    memcpy(p, &e->word, 4);
+    p += 4;
+    s->word = e->word;
+  }
+  if (e->kind & ENTRY_DEST)
+  {
+    int reg = e->word & (ARMSIM_REGS - 1);
+    *header |= RAW_DEST;
+    p += put_varint(p, zigzag(e->value - c->regs[reg]));
+    c->regs[reg] = e->value;
+  }
+  if (e->kind & ENTRY_MEMORY)
+  {
+    *header |= RAW_MEMORY;
+    p += put_varint(p, zigzag(e->address - coder_address(s, e->address)));
+  }
+  c->nzcv = e->nzcv;
+  rec->raw_size = p - rec->raw;
+  rec->block_instructions++;
+  rec->stats.instructions++;
+
+  if (rec->raw_size >= TRACE_BLOCK)
+  {
+    uint64_t regs[ARMSIM_REGS];
+    memcpy(regs, c->regs, sizeof(regs));
+    writer_block(rec);
+    writer_begin(rec, c->expect, c->nzcv, regs);
+  }
+}
+
+static void writer_entry(struct recorder *rec, const entry_t *e)
+{
+  if (e->kind == ENTRY_SYNC)
+  {
+    rec->sync_pc = e->pc;
+    rec->sync_nzcv = e->nzcv;
+    rec->sync_left = ARMSIM_REGS;
+    return;
+  }
+  if (e->kind != ENTRY_REG)
+  {
+    writer_record(rec, e);
+    return;
+  }
+
+  rec->sync[ARMSIM_REGS - rec->sync_left--] = e->value;
+  if (rec->sync_left > 0)
+    return;
+  if (rec->block_instructions == 0)
+    writer_begin(rec, rec->sync_pc, rec->sync_nzcv, rec->sync);
+  else if (memcmp(rec->sync, rec->coder.regs, sizeof(rec->sync)) != 0)
+  {
+    /* registers changed outside the trace: restart from the new state */
+    writer_block(rec);
+    writer_begin(rec, rec->sync_pc, rec->sync_nzcv, rec->sync);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : writer_main                                     */
+/*                                                             */
+/* Purpose   : Drain the ring until the recorder is stopped.   */
+/*             Polls, backing off to short sleeps while the    */
+/*             engine is idle.                                 */
+/*                                                             */
+/***************************************************************/
+static void *writer_main(void *arg)
+{
+  struct recorder *rec = arg;
+  struct timespec nap = {0, 200000};
+  uint64_t tail = 0, head;
+  int idle = 0;
+
+  for (;;)
+  {
+    head = atomic_load_explicit(&rec->head, memory_order_acquire);
+    if (head == tail)
+    {
+      if (atomic_load_explicit(&rec->done, memory_order_acquire) &&
+          atomic_load_explicit(&rec->head, memory_order_acquire) == tail)
+        break;
+      if (++idle < 64)
+        sched_yield();
+      else
+        nanosleep(&nap, NULL);
+      continue;
+    }
+    idle = 0;
+    while (tail != head)
+    {
+      writer_entry(rec, &rec->ring[tail & (TRACE_RING - 1)]);
+      if ((++tail & 4095) == 0)
+        atomic_store_explicit(&rec->tail, tail, memory_order_release);
+    }
+    atomic_store_explicit(&rec->tail, tail, memory_order_release);
+  }
+  if (rec->block_instructions > 0)
+    writer_block(rec);
+  return NULL;
+}
+
+static void recorder_release(struct recorder *rec)
+{
+  if (rec->file != NULL)
+    fclose(rec->file);
+  free(rec->ring);
+  free(rec->raw);
+  free(rec->packed);
+  free(rec->lz_table);
+  free(rec);
+}
+
+/* Drain and join the writer, close the file; the first error wins */
+static int recorder_stop(struct recorder *rec, armsim_trace_stats_t *stats)
+{
+  int result;
+
+  atomic_store_explicit(&rec->head, rec->next, memory_order_release);
+  atomic_store_explicit(&rec->done, TRUE, memory_order_release);
+  pthread_join(rec->thread, NULL);
+  result = rec->error;
+  if (fclose(rec->file) != 0 && result == 0)
+    result = ARMSIM_E_IO;
+  rec->file = NULL;
+  if (stats != NULL)
+  {
+    *stats = rec->stats;
+    stats->bytes += 16; /* file header */
+  }
+  recorder_release(rec);
+  return result;
+}
+
+void recorder_free()
+{
+  if (ARMSIM->recorder == NULL)
+    return;
+  recorder_stop(ARMSIM->recorder, NULL);
+  ARMSIM->recorder = NULL;
+  trace_update();
+}
+
+/***************************************************************/
+/* Public API.                                                 */
+/***************************************************************/
+
+int armsim_trace_start(armsim_t *sim, const char *path)
+{
+  struct recorder *rec;
+  uint32_t version[2] = {TRACE_VERSION, 0};
+
+  if (sim == NULL || path == NULL || sim->recorder != NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  if ((rec = aligned_alloc(64, sizeof(*rec))) == NULL)
+    return ARMSIM_E_NOMEM;
+  memset(rec, 0, sizeof(*rec));
+  rec->ring = malloc(TRACE_RING * sizeof(entry_t));
+  rec->raw = malloc(TRACE_BLOCK + TRACE_RECORD_MAX);
+  rec->packed = malloc(TRACE_PACKED_MAX);
+  rec->lz_table = malloc(sizeof(uint32_t) << LZ_BITS);
+  if (rec->ring == NULL || rec->raw == NULL || rec->packed == NULL || rec->lz_table == NULL)
+  {
+    recorder_release(rec);
+    return ARMSIM_E_NOMEM;
+  }
+  if ((rec->file = fopen(path, "wb")) == NULL)
+  {
+    recorder_release(rec);
+    return ARMSIM_E_IO;
+  }
+  if (fwrite(TRACE_MAGIC, 8, 1, rec->file) != 1 ||
+      fwrite(version, sizeof(version), 1, rec->file) != 1)
+  {
+    recorder_release(rec);
+    return ARMSIM_E_IO;
+  }
+  if (pthread_create(&rec->thread, NULL, writer_main, rec) != 0)
+  {
+    recorder_release(rec);
+    return ARMSIM_E_NOMEM;
+  }
+  sim->recorder = rec;
+  recorder_sync();
+  trace_update();
+  return 0;
+}
+
+int armsim_trace_stop(armsim_t *sim, armsim_trace_stats_t *stats)
+{
+  struct recorder *rec;
+
+  if (sim == NULL || sim->recorder == NULL)
+    return ARMSIM_E_INVAL;
+  ARMSIM = sim;
+  rec = sim->recorder;
+  sim->recorder = NULL;
+  trace_update();
+  return recorder_stop(rec, stats);
+}
+
+#else
+
+void recorder_retire(const insn_record_t *record)
+{
+}
+
+void recorder_sync()
+{
+}
+
+void recorder_publish()
+{
+}
+
+void recorder_free()
+{
+}
+
+int armsim_trace_start(armsim_t *sim, const char *path)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+int armsim_trace_stop(armsim_t *sim, armsim_trace_stats_t *stats)
+{
+  return ARMSIM_E_NOSYS;
+}
+
+#endif
+
+/***************************************************************/
+/* Reader: available in every build.                           */
+/***************************************************************/
+
+struct armsim_trace
+{
+  FILE *file;
+  coder_t coder;
+  uint8_t *raw, *packed;
+  const uint8_t *cursor, *end;
+  uint32_t left; /* instructions left in the block */
+};
+
+/* Read the next block; 0 at a clean end of file */
+static int reader_block(armsim_trace_t *trace)
+{
+  uint32_t header[3];
+  size_t got = fread(header, 1, sizeof(header), trace->file);
+
+  if (got == 0 && feof(trace->file))
+    return 0;
+  if (got != sizeof(header))
+    return ferror(trace->file) ? ARMSIM_E_IO : ARMSIM_E_FORMAT;
+  if (header[0] < TRACE_STATE || header[0] > TRACE_BLOCK + TRACE_RECORD_MAX ||
+      header[1] > TRACE_PACKED_MAX || header[1] > header[0] + header[0] / 2 + 32)
+    return ARMSIM_E_FORMAT;
+  if (fread(header[1] == header[0] ? trace->raw : trace->packed, 1, header[1], trace->file) !=
+      header[1])
+    return ferror(trace->file) ? ARMSIM_E_IO : ARMSIM_E_FORMAT;
+  if (header[1] != header[0] && !lz_decompress(trace->packed, header[1], trace->raw, header[0]))
+    return ARMSIM_E_FORMAT;
+  coder_reset(&trace->coder, trace->raw);
+  trace->cursor = trace->raw + TRACE_STATE;
+  trace->end = trace->raw + header[0];
+  trace->left = header[2];
+  return 1;
+}
+
+int armsim_trace_open(const char *path, armsim_trace_t **result)
+{
+  armsim_trace_t *trace;
+  char magic[8];
+  uint32_t version[2];
+
+  if (path == NULL || result == NULL)
+    return ARMSIM_E_INVAL;
+  if ((trace = calloc(1, sizeof(*trace))) == NULL ||
+      (trace->raw = malloc(TRACE_BLOCK + TRACE_RECORD_MAX)) == NULL ||
+      (trace->packed = malloc(TRACE_PACKED_MAX)) == NULL)
+  {
+    armsim_trace_close(trace);
+    return ARMSIM_E_NOMEM;
+  }
+  if ((trace->file = fopen(path, "rb")) == NULL)
+  {
+    armsim_trace_close(trace);
+    return ARMSIM_E_IO;
+  }
+  if (fread(magic, sizeof(magic), 1, trace->file) != 1 ||
+      fread(version, sizeof(version), 1, trace->file) != 1 ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 || version[0] != TRACE_VERSION)
+  {
+    armsim_trace_close(trace);
+    return ARMSIM_E_FORMAT;
+  }
+  *result = trace;
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_trace_next                               */
+/*                                                             */
+/* Purpose   : Decode the next instruction: 1, 0 at the end of */
+/*             the trace or a negative error                   */
+/*                                                             */
+/***************************************************************/
+int armsim_trace_next(armsim_trace_t *trace, armsim_trace_entry_t *entry)
+{
+  coder_t *c;
+  site_t *s;
+  uint64_t value, pc;
+  uint8_t header;
+  int fresh, result, reg;
+  Instruction inst;
+
+  if (trace == NULL || entry == NULL)
+    return ARMSIM_E_INVAL;
+  while (trace->left == 0)
+    if ((result = reader_block(trace)) <= 0)
+      return result;
+  c = &trace->coder;
+  if (trace->cursor >= trace->end)
+    return ARMSIM_E_FORMAT;
+
+  header = *trace->cursor++;
+  pc = c->expect;
+  if (header & RAW_JUMP)
+  {
+    if (!get_varint(&trace->cursor, trace->end, &value))
+      return ARMSIM_E_FORMAT;
+    pc += unzigzag(value);
+  }
+  s = coder_site(c, pc, &fresh);
+  if (header & RAW_WORD)
+  {
+    if (trace->end - trace->cursor < 4)
+      return ARMSIM_E_FORMAT;
+    memcpy(&s->word, trace->cursor, 4);
+    trace->cursor += 4;
+  }
+  else if (fresh)
+    return ARMSIM_E_FORMAT;
+
+  memset(entry, 0, sizeof(*entry));
+  entry->pc = pc;
+  entry->word = s->word;
+  entry->nzcv = header >> 4;
+  entry->dest = -1;
+  reg = s->word & (ARMSIM_REGS - 1);
+  inst = decode(s->word);
+  /* only retired instructions are recorded */
+  if (inst < 0)
+    return ARMSIM_E_FORMAT;
+  entry->name = instruction_names[inst];
+  if (header & RAW_DEST)
+  {
+    if (!get_varint(&trace->cursor, trace->end, &value))
+      return ARMSIM_E_FORMAT;
+    c->regs[reg] += unzigzag(value);
+    entry->dest = reg;
+    entry->value = c->regs[reg];
+  }
+  if (header & RAW_MEMORY)
+  {
+    if (!get_varint(&trace->cursor, trace->end, &value))
+      return ARMSIM_E_FORMAT;
+    entry->address = s->address + s->stride + unzigzag(value);
+    coder_address(s, entry->address);
+    /* sizes and data as sim.c accesses memory */
+    entry->size = (inst == LDUR || inst == STUR) ? 8 : 4;
+    switch (inst)
+    {
+    case LDUR:
+    case LDURB:
+    case LDURH:
+      entry->access = ARMSIM_TRACE_LOAD;
+      entry->data = entry->value;
+      break;
+    case STURB:
+      entry->access = ARMSIM_TRACE_STORE;
+      entry->data = c->regs[reg] & 0xff;
+      break;
+    case STURH:
+      entry->access = ARMSIM_TRACE_STORE;
+      entry->data = c->regs[reg] & 0x1ffff;
+      break;
+    default:
+      entry->access = ARMSIM_TRACE_STORE;
+      entry->data = c->regs[reg];
+      break;
+    }
+  }
+  c->nzcv = entry->nzcv;
+  trace->left--;
+  return 1;
+}
+
+void armsim_trace_close(armsim_trace_t *trace)
+{
+  if (trace == NULL)
+    return;
+  if (trace->file != NULL)
+    fclose(trace->file);
+  free(trace->raw);
+  free(trace->packed);
+  free(trace);
+}